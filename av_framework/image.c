@@ -1,14 +1,16 @@
 #include "image.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "../common/common.h"
-
-static const int MAX_SIZE = 1024 * 1024;
+#include "pixel_convert.h"
 
 void Image_free(Image* img) {
   free(img->data);
@@ -16,6 +18,28 @@ void Image_free(Image* img) {
   free(img);
 }
 
+int Image_bytesPerPixel(PixelType type) {
+  switch (type) {
+    case MONO8:
+      return 1;
+    case MONO16:
+      return 2;
+    case RGB8:
+      return 3;
+    case RGB16:
+      return 6;
+    case FLOATMONO:
+      return sizeof(float);
+    case FLOATRGB:
+      return sizeof(float) * 3;
+  }
+  return 1;
+}
+
+int Image_dataSize(const Image* img) {
+  return img->rows * img->cols * Image_bytesPerPixel(img->type);
+}
+
 Image* Image_alloc(int rows, int cols, PixelType type) {
   int bpp = 1;
   int channels = 1;
@@ -50,6 +74,7 @@ Image* Image_alloc(int rows, int cols, PixelType type) {
   img->rows = rows;
   img->cols = cols;
   img->channels = channels;
+  img->type = type;
   img->data = (unsigned char*)malloc(rows * cols * bpp);
   img->row_data = (unsigned char**)malloc(sizeof(unsigned char*) * rows);
   unsigned char* base_data = img->data;
@@ -60,54 +85,57 @@ Image* Image_alloc(int rows, int cols, PixelType type) {
   return img;
 }
 
-int getLine(char* dest, const char* src, size_t src_size) {
+// copies a line of src in dest, returns the bytes consumed or 0 if src is
+// over or the line doesn't fit, the header may come from an untrusted file
+static int getLine(char* dest, int dest_size, const char* src, int src_size) {
   int k = 0;
-  char* dest_end = dest;
-  while (k < src_size && (*src != '\n' || *src == EOF || *src == 0)) {
-    *dest_end = *src;
-    ++dest_end;
-    ++src;
+  while (k < src_size && src[k] != '\n') {
+    if (k + 1 >= dest_size) return 0;
+    dest[k] = src[k];
     ++k;
   }
-  ++k;
-  *dest_end = '\n';
-  return k;
+  if (k >= src_size) return 0;
+  dest[k] = 0;
+  return k + 1;
 }
 
-int Image_serialize(const Image* img, char* buffer, int size) {
+// writes the PNM header of img, returns its length or 0 if the type can't be
+// stored
+static int Image_header(const Image* img, char* buffer, int size) {
   char* magic_number = 0;
-  int bpp;
   int maxval = 0;
   switch (img->type) {
     case MONO8:
       magic_number = "P5";
-      bpp = 1;
       maxval = 255;
       break;
     case MONO16:
       magic_number = "P5";
-      bpp = 2;
       maxval = 65535;
       break;
     case RGB8:
       magic_number = "P6";
-      bpp = 3;
       maxval = 255;
       break;
     case RGB16:
       magic_number = "P6";
-      bpp = 6;
       maxval = 65535;
       break;
     default:
       return 0;
   }
-  char* buffer_end = buffer;
-  buffer_end += sprintf(buffer_end, "%s\n", magic_number);
-  buffer_end += sprintf(buffer_end, "%d %d\n", img->rows, img->cols);
-  buffer_end += sprintf(buffer_end, "%d\n", maxval);
-  int remaining_size = size - (buffer_end - buffer);
-  int bytes_to_write = bpp * img->rows * img->cols;
+  // PNM stores the width first, as Image_deserialize expects
+  int len = snprintf(buffer, size, "%s\n%d %d\n%d\n", magic_number, img->cols,
+                     img->rows, maxval);
+  return len < size ? len : 0;
+}
+
+int Image_serialize(const Image* img, char* buffer, int size) {
+  int header_len = Image_header(img, buffer, size);
+  if (!header_len) return 0;
+  char* buffer_end = buffer + header_len;
+  int remaining_size = size - header_len;
+  int bytes_to_write = Image_dataSize(img);
   if (bytes_to_write > remaining_size) return 0;
   memcpy(buffer_end, img->data, bytes_to_write);
   buffer_end += bytes_to_write;
@@ -115,18 +143,18 @@ int Image_serialize(const Image* img, char* buffer, int size) {
 }
 
 Image* Image_deserialize(const char* buffer, int size) {
-  char magic_number[100];
-  int rows, cols;
+  char magic_number[100] = "";
+  int rows = 0, cols = 0;
   int bpp = 1;
   char line[1024];
-  int char_read = getLine(line, buffer, size);
+  int char_read = getLine(line, sizeof(line), buffer, size);
   if (!char_read) return 0;
   buffer += char_read;
   size -= char_read;
 
-  sscanf(line, "%s", magic_number);
+  sscanf(line, "%99s", magic_number);
   do {
-    char_read = getLine(line, buffer, size);
+    char_read = getLine(line, sizeof(line), buffer, size);
     if (!char_read) return 0;
     buffer += char_read;
     size -= char_read;
@@ -137,8 +165,8 @@ Image* Image_deserialize(const char* buffer, int size) {
   debug_print("rows:%d, cols: %d\n", rows, cols);
   debug_print("magic number: [%s]\n", magic_number);
 
-  int maxval;
-  char_read = getLine(line, buffer, size);
+  int maxval = 0;
+  char_read = getLine(line, sizeof(line), buffer, size);
   if (!char_read) return 0;
   buffer += char_read;
   size -= char_read;
@@ -160,8 +188,10 @@ Image* Image_deserialize(const char* buffer, int size) {
     }
   } else
     return 0;
+  if (rows <= 0 || cols <= 0 || (long)rows * cols > INT_MAX / bpp) return 0;
   int bytes_to_read = bpp * rows * cols;
-  if (bytes_to_read < size) return 0;
+  // a truncated buffer would be read past its end
+  if (bytes_to_read > size) return 0;
   Image* img = Image_alloc(rows, cols, type);
   memcpy(img->data, buffer, bytes_to_read);
   img->type = type;
@@ -169,62 +199,100 @@ Image* Image_deserialize(const char* buffer, int size) {
 }
 
 Image* Image_load(const char* filename) {
-  char buffer[MAX_SIZE];
   int fd = open(filename, O_RDONLY);
   if (fd < 0) return 0;
-  int size = read(fd, buffer, MAX_SIZE);
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0 || st.st_size > INT_MAX) {
+    close(fd);
+    return 0;
+  }
+  // the header is parsed in place, the pixels are copied once
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
   close(fd);
-  return Image_deserialize(buffer, size);
+  if (data == MAP_FAILED) return 0;
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  Image* img = Image_deserialize((const char*)data, st.st_size);
+  munmap(data, st.st_size);
+  return img;
+}
+
+// writes the whole buffer, returns 0 on error
+static int Image_write(int fd, const void* buffer, size_t size) {
+  const char* ptr = (const char*)buffer;
+  while (size > 0) {
+    ssize_t ret = write(fd, ptr, size);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0) return 0;
+    ptr += ret;
+    size -= ret;
+  }
+  return 1;
 }
 
-int Image_save(Image* img, const char* filename) {
-  char buffer[MAX_SIZE];
-  int fd = open(filename, O_RDWR | O_CREAT, 0666);
+int Image_save(const Image* img, const char* filename) {
+  char header[64];
+  int header_len = Image_header(img, header, sizeof(header));
+  if (!header_len) return 0;
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
   if (fd < 0) {
     debug_print("save error, cant open file\n");
     return 0;
   }
-  int size = Image_serialize(img, buffer, MAX_SIZE);
-  write(fd, buffer, size);
-  close(fd);
-  return 1;
+  // the pixels go straight from the image to the file
+  int ret = Image_write(fd, header, header_len) &&
+            Image_write(fd, img->data, Image_dataSize(img));
+  if (close(fd) == -1) ret = 0;
+  return ret;
+}
+
+// full scale value of each integer type, MONO16 holds elevations
+static float Image_fullScale(PixelType type) {
+  switch (type) {
+    case MONO16:
+      return 6000;
+    case RGB16:
+      return 65535;
+    default:
+      return 255;
+  }
 }
 
 Image* Image_convert(Image* src, PixelType type) {
-  float scale;
-  if (src->type == MONO8 && type == FLOATMONO) {
-    scale = 1. / 255;
-  } else if (src->type == MONO16 && type == FLOATMONO) {
-    scale = 1. / 6000;
-  } else if (src->type == RGB8 && type == FLOATRGB) {
-    scale = 1. / 255;
-  } else if (src->type == RGB16 && type == FLOATRGB) {
-    scale = 1. / 65535;
-  } else
+  const PixelConverter* converter = PixelConvert_best();
+  PixelToFloatFn to_float = 0;
+  PixelFromFloatFn from_float = 0;
+  if ((src->type == MONO8 && type == FLOATMONO) ||
+      (src->type == RGB8 && type == FLOATRGB))
+    to_float = converter->u8ToFloat;
+  else if ((src->type == MONO16 && type == FLOATMONO) ||
+           (src->type == RGB16 && type == FLOATRGB))
+    to_float = converter->u16ToFloat;
+  else if ((src->type == FLOATMONO && type == MONO8) ||
+           (src->type == FLOATRGB && type == RGB8))
+    from_float = converter->floatToU8;
+  else if ((src->type == FLOATMONO && type == MONO16) ||
+           (src->type == FLOATRGB && type == RGB16))
+    from_float = converter->floatToU16;
+  else
     return 0;
 
   Image* img = Image_alloc(src->rows, src->cols, type);
+  // the rows are contiguous, the whole image is converted in one call
+  int n = src->rows * src->cols * src->channels;
+  if (to_float)
+    to_float(src->data, (float*)img->data, n, 1. / Image_fullScale(src->type));
+  else
+    from_float((const float*)src->data, img->data, n, Image_fullScale(type));
+  return img;
+}
 
-  for (int r = 0; r < src->rows; r++) {
-    float* destptr = (float*)img->row_data[r];
-    unsigned char* srcptr = src->row_data[r];
-    for (int c = 0; c < src->cols; c++) {
-      for (int i = 0; i < src->channels; i++) {
-        if (src->type == MONO16 || src->type == RGB16) {
-          unsigned int c_up = *srcptr;
-          srcptr++;
-          unsigned int c_low = *srcptr;
-          srcptr++;
-          int v = (c_up << 8) + c_low;
-          *destptr = scale * v;
-          destptr++;
-        } else {
-          *destptr = scale * (*srcptr);
-          srcptr++;
-          destptr++;
-        }
-      }
-    }
-  }
+Image* Image_crop(const Image* src, int row, int col, int rows, int cols) {
+  if (row < 0 || col < 0 || rows <= 0 || cols <= 0 ||
+      row + rows > src->rows || col + cols > src->cols)
+    return 0;
+  Image* img = Image_alloc(rows, cols, src->type);
+  int bpp = Image_bytesPerPixel(src->type);
+  for (int r = 0; r < rows; r++)
+    memcpy(img->row_data[r], src->row_data[row + r] + col * bpp, cols * bpp);
   return img;
 }
@@ -21,14 +21,24 @@ Image* Image_alloc(int rows, int cols, PixelType type);
 
 void Image_free(Image* img);
 
+// bytes of pixel data
+int Image_dataSize(const Image* img);
+
+// bytes of a pixel of type
+int Image_bytesPerPixel(PixelType type);
+
+// integer to float pixels in [0, 1] and back, same number of channels
 Image* Image_convert(Image* src, PixelType type);
 
+// copy of the rows x cols region of src starting at (row, col)
+Image* Image_crop(const Image* src, int row, int col, int rows, int cols);
+
 int Image_serialize(const Image* img, char* buffer, int size);
 
 Image* Image_deserialize(const char* buffer, int size);
 
 Image* Image_load(const char* filename);
 
-int Image_save(Image* img, const char* filename);
+int Image_save(const Image* img, const char* filename);
 
 #endif
@@ -0,0 +1,312 @@
+#include "image_codec.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/common.h"
+
+typedef struct ImageCodecHeader {
+  int rows, cols;
+  PixelType type;
+  ImageEncoding encoding;
+  int payload_size;
+} ImageCodecHeader;
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5  // the tail is always sent as literals
+#define LZ_HASH_BITS 14
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN 130
+#define RLE_MAX_LITERALS 128
+// bytes a payload byte can expand to at most: a 2-byte run, an LZ length
+// extension byte. LZ_MAX_SEQUENCE covers the token of a final sequence
+#define RLE_MAX_EXPANSION (RLE_MAX_RUN / 2)
+#define LZ_MAX_EXPANSION 255
+#define LZ_MAX_SEQUENCE (15 + LZ_MIN_MATCH + 15)
+
+static int ImageCodec_bytesPerPixel(const Image* img) {
+  return Image_dataSize(img) / (img->rows * img->cols);
+}
+
+int ImageCodec_maxEncodedSize(const Image* img) {
+  int n = Image_dataSize(img);
+  // worst case of both codecs: one extra byte every 128 literals
+  return sizeof(ImageCodecHeader) + n + n / 128 + 16;
+}
+
+/* RLE + delta */
+
+static int ImageCodec_encodeRleDelta(const unsigned char* src, int n,
+                                     int stride, unsigned char* dest,
+                                     int capacity) {
+  unsigned char* delta = (unsigned char*)malloc(n);
+  if (delta == NULL) return -1;
+  for (int k = 0; k < n; k++)
+    delta[k] = k < stride ? src[k] : src[k] - src[k - stride];
+  int out = 0, p = 0, literals = 0;
+  while (p < n) {
+    int run = 1;
+    while (p + run < n && run < RLE_MAX_RUN && delta[p + run] == delta[p])
+      run++;
+    if (run >= RLE_MIN_RUN || literals == RLE_MAX_LITERALS || p + 1 == n) {
+      if (run < RLE_MIN_RUN) {
+        // the last bytes or a full literal block
+        literals += (p + 1 == n);
+        p += (p + 1 == n);
+      }
+      if (literals > 0) {
+        if (out + 1 + literals > capacity) goto FULL;
+        dest[out++] = literals - 1;
+        memcpy(dest + out, delta + p - literals, literals);
+        out += literals;
+        literals = 0;
+      }
+      if (run >= RLE_MIN_RUN) {
+        if (out + 2 > capacity) goto FULL;
+        dest[out++] = run - RLE_MIN_RUN + 128;
+        dest[out++] = delta[p];
+        p += run;
+      }
+      continue;
+    }
+    literals++;
+    p++;
+  }
+  free(delta);
+  return out;
+FULL:
+  free(delta);
+  return -1;
+}
+
+static int ImageCodec_decodeRleDelta(const unsigned char* src, int size,
+                                     unsigned char* dest, int n, int stride) {
+  int in = 0, out = 0;
+  while (in < size) {
+    int control = src[in++];
+    if (control < 128) {
+      int literals = control + 1;
+      if (in + literals > size || out + literals > n) return -1;
+      memcpy(dest + out, src + in, literals);
+      in += literals;
+      out += literals;
+    } else {
+      int run = control - 128 + RLE_MIN_RUN;
+      if (in >= size || out + run > n) return -1;
+      memset(dest + out, src[in++], run);
+      out += run;
+    }
+  }
+  if (out != n) return -1;
+  for (int k = stride; k < n; k++) dest[k] += dest[k - stride];
+  return 0;
+}
+
+/* LZ */
+
+static inline uint32_t ImageCodec_read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// writes the 15+255+...+remainder length extension
+static inline int ImageCodec_writeLength(unsigned char* dest, int out,
+                                         int capacity, int len) {
+  for (; len >= 255; len -= 255) {
+    if (out >= capacity) return -1;
+    dest[out++] = 255;
+  }
+  if (out >= capacity) return -1;
+  dest[out++] = len;
+  return out;
+}
+
+static int ImageCodec_emitSequence(unsigned char* dest, int out, int capacity,
+                                   const unsigned char* literals,
+                                   int literal_len, int offset,
+                                   int match_len) {
+  if (out >= capacity) return -1;
+  int token = out++;
+  dest[token] = (literal_len >= 15 ? 15 : literal_len) << 4;
+  if (literal_len >= 15) {
+    out = ImageCodec_writeLength(dest, out, capacity, literal_len - 15);
+    if (out == -1) return -1;
+  }
+  if (out + literal_len > capacity) return -1;
+  memcpy(dest + out, literals, literal_len);
+  out += literal_len;
+  if (match_len == 0) return out;  // last sequence
+  if (out + 2 > capacity) return -1;
+  dest[out++] = offset & 0xff;
+  dest[out++] = offset >> 8;
+  int extra = match_len - LZ_MIN_MATCH;
+  dest[token] |= extra >= 15 ? 15 : extra;
+  if (extra >= 15)
+    out = ImageCodec_writeLength(dest, out, capacity, extra - 15);
+  return out;
+}
+
+static int ImageCodec_encodeLz(const unsigned char* src, int n,
+                               unsigned char* dest, int capacity) {
+  int* table = (int*)malloc(sizeof(int) << LZ_HASH_BITS);
+  if (table == NULL) return -1;
+  for (int i = 0; i < 1 << LZ_HASH_BITS; i++) table[i] = -1;
+  int out = 0, anchor = 0, i = 0;
+  while (i + LZ_MIN_MATCH <= n - LZ_LAST_LITERALS) {
+    uint32_t sequence = ImageCodec_read32(src + i);
+    uint32_t h = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+    int ref = table[h];
+    table[h] = i;
+    if (ref < 0 || i - ref > 0xffff ||
+        ImageCodec_read32(src + ref) != sequence) {
+      i++;
+      continue;
+    }
+    int len = LZ_MIN_MATCH;
+    while (i + len < n - LZ_LAST_LITERALS && src[ref + len] == src[i + len])
+      len++;
+    out = ImageCodec_emitSequence(dest, out, capacity, src + anchor,
+                                  i - anchor, i - ref, len);
+    if (out == -1) break;
+    i += len;
+    anchor = i;
+  }
+  if (out != -1)
+    out = ImageCodec_emitSequence(dest, out, capacity, src + anchor,
+                                  n - anchor, 0, 0);
+  free(table);
+  return out;
+}
+
+static inline int ImageCodec_readLength(const unsigned char* src, int* in,
+                                        int size, int len) {
+  if (len != 15) return len;
+  int byte;
+  do {
+    if (*in >= size) return -1;
+    byte = src[(*in)++];
+    len += byte;
+  } while (byte == 255);
+  return len;
+}
+
+static int ImageCodec_decodeLz(const unsigned char* src, int size,
+                               unsigned char* dest, int n) {
+  int in = 0, out = 0;
+  while (in < size) {
+    int token = src[in++];
+    int literal_len = ImageCodec_readLength(src, &in, size, token >> 4);
+    if (literal_len < 0 || in + literal_len > size || out + literal_len > n)
+      return -1;
+    memcpy(dest + out, src + in, literal_len);
+    in += literal_len;
+    out += literal_len;
+    if (in == size) break;  // the last sequence has no match
+    if (in + 2 > size) return -1;
+    int offset = src[in] | src[in + 1] << 8;
+    in += 2;
+    int match_len = ImageCodec_readLength(src, &in, size, token & 15);
+    if (match_len < 0) return -1;
+    match_len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > out || out + match_len > n) return -1;
+    // the match may overlap the bytes it produces
+    const unsigned char* ref = dest + out - offset;
+    if (offset >= match_len) {
+      memcpy(dest + out, ref, match_len);
+    } else {
+      for (int k = 0; k < match_len; k++) dest[out + k] = ref[k];
+    }
+    out += match_len;
+  }
+  return out == n ? 0 : -1;
+}
+
+int ImageCodec_encode(const Image* img, ImageEncoding encoding, char* dest,
+                      int capacity) {
+  int header_len = sizeof(ImageCodecHeader);
+  int n = Image_dataSize(img);
+  if (capacity < header_len) return -1;
+  // an encoding that doesn't save anything is not worth decoding
+  int payload_capacity = capacity - header_len;
+  if (payload_capacity > n - 1) payload_capacity = n - 1;
+  unsigned char* payload = (unsigned char*)dest + header_len;
+  int payload_size;
+  switch (encoding) {
+    case EncodingRleDelta:
+      payload_size =
+          ImageCodec_encodeRleDelta(img->data, n, ImageCodec_bytesPerPixel(img),
+                                    payload, payload_capacity);
+      break;
+    case EncodingLz:
+      payload_size = ImageCodec_encodeLz(img->data, n, payload,
+                                         payload_capacity);
+      break;
+    default:
+      return -1;
+  }
+  if (payload_size < 0) return -1;
+  ImageCodecHeader header;
+  header.rows = img->rows;
+  header.cols = img->cols;
+  header.type = img->type;
+  header.encoding = encoding;
+  header.payload_size = payload_size;
+  memcpy(dest, &header, header_len);
+  return header_len + payload_size;
+}
+
+Image* ImageCodec_decode(const char* src, int size) {
+  ImageCodecHeader header;
+  if (size < (int)sizeof(ImageCodecHeader)) return NULL;
+  memcpy(&header, src, sizeof(ImageCodecHeader));
+  src += sizeof(ImageCodecHeader);
+  size -= sizeof(ImageCodecHeader);
+  if (header.rows <= 0 || header.cols <= 0 ||
+      header.rows > IMAGE_MAX_SIDE || header.cols > IMAGE_MAX_SIDE ||
+      header.payload_size < 0 || header.payload_size > size ||
+      header.type < RGB8 || header.type > MONO16)
+    return NULL;
+  // the header comes from the peer: the payload must be able to fill it
+  long long bytes = (long long)header.rows * header.cols *
+                    Image_bytesPerPixel(header.type);
+  long long max_bytes = 0;
+  if (header.encoding == EncodingRleDelta)
+    max_bytes = (long long)header.payload_size * RLE_MAX_EXPANSION;
+  else if (header.encoding == EncodingLz)
+    max_bytes =
+        (long long)header.payload_size * LZ_MAX_EXPANSION + LZ_MAX_SEQUENCE;
+  if (bytes > INT_MAX || bytes > max_bytes) return NULL;
+  Image* img = Image_alloc(header.rows, header.cols, header.type);
+  int n = Image_dataSize(img);
+  int ret = -1;
+  if (header.encoding == EncodingRleDelta)
+    ret = ImageCodec_decodeRleDelta((const unsigned char*)src,
+                                    header.payload_size, img->data, n,
+                                    ImageCodec_bytesPerPixel(img));
+  else if (header.encoding == EncodingLz)
+    ret = ImageCodec_decodeLz((const unsigned char*)src, header.payload_size,
+                              img->data, n);
+  if (ret == -1) {
+    Image_free(img);
+    return NULL;
+  }
+  return img;
+}
+
+ImageEncoding ImageCodec_choose(const Image* img) {
+  int capacity = ImageCodec_maxEncodedSize(img);
+  char* buffer = (char*)malloc(capacity);
+  if (buffer == NULL) return EncodingRaw;
+  ImageEncoding best = EncodingRaw;
+  int best_size = capacity;
+  for (int encoding = EncodingRleDelta; encoding < ImageEncodings;
+       encoding++) {
+    int size = ImageCodec_encode(img, encoding, buffer, best_size);
+    if (size == -1) continue;
+    best = encoding;
+    best_size = size;
+  }
+  free(buffer);
+  return best;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "image.h"
+
+// Encodings of the pixel data of an ImagePacket
+typedef enum ImageEncoding {
+  EncodingRaw = 0x0,       // PNM, as produced by Image_serialize
+  EncodingRleDelta = 0x1,  // per-channel delta, then run-length encoded
+  EncodingLz = 0x2,        // LZ77 with 64KB window, LZ4-like sequences
+  ImageEncodings = 0x3
+} ImageEncoding;
+
+// bitmask of the encodings this build can decode, exchanged in the handshake
+#define IMAGE_CODECS ((1 << EncodingRaw) | (1 << EncodingRleDelta) | \
+                      (1 << EncodingLz))
+
+// the encoding giving the smallest output for img, EncodingRaw if none makes
+// it smaller. Every codec is tried, images are encoded once per upload
+ImageEncoding ImageCodec_choose(const Image* img);
+
+// upper bound of the size produced by ImageCodec_encode
+int ImageCodec_maxEncodedSize(const Image* img);
+
+// encodes img (header included) into dest, returns the written bytes or -1
+// if dest is too small or the encoding doesn't make the image smaller
+int ImageCodec_encode(const Image* img, ImageEncoding encoding, char* dest,
+                      int capacity);
+
+// decodes straight into a new image, returns NULL on a malformed buffer
+Image* ImageCodec_decode(const char* src, int size);
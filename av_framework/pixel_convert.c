@@ -0,0 +1,137 @@
+#include "pixel_convert.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86 1
+#endif
+
+/* scalar */
+
+static void PixelConvert_u8ToFloat(const unsigned char* src, float* dest,
+                                   int n, float scale) {
+  for (int k = 0; k < n; k++) dest[k] = scale * src[k];
+}
+
+static void PixelConvert_u16ToFloat(const unsigned char* src, float* dest,
+                                    int n, float scale) {
+  for (int k = 0; k < n; k++)
+    dest[k] = scale * (src[2 * k] << 8 | src[2 * k + 1]);
+}
+
+static inline int PixelConvert_round(float v, float scale, int max) {
+  v *= scale;
+  // same clamping and rounding (to nearest even) as the vector kernels
+  if (!(v > 0)) return 0;
+  if (v > max) return max;
+  return (int)nearbyintf(v);
+}
+
+static void PixelConvert_floatToU8(const float* src, unsigned char* dest,
+                                   int n, float scale) {
+  for (int k = 0; k < n; k++) dest[k] = PixelConvert_round(src[k], scale, 255);
+}
+
+static void PixelConvert_floatToU16(const float* src, unsigned char* dest,
+                                    int n, float scale) {
+  for (int k = 0; k < n; k++) {
+    int v = PixelConvert_round(src[k], scale, 65535);
+    dest[2 * k] = v >> 8;
+    dest[2 * k + 1] = v & 0xff;
+  }
+}
+
+const PixelConverter PixelConvert_scalar = {
+    "scalar", PixelConvert_u8ToFloat, PixelConvert_u16ToFloat,
+    PixelConvert_floatToU8, PixelConvert_floatToU16};
+
+/* AVX2, 8 samples per iteration and the scalar kernels for the tail */
+
+#ifdef PIXEL_CONVERT_X86
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void PixelConvert_u8ToFloatAvx2(const unsigned char* src,
+                                            float* dest, int n, float scale) {
+  __m256 s = _mm256_set1_ps(scale);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m128i v = _mm_loadl_epi64((const __m128i*)(src + k));
+    __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+    _mm256_storeu_ps(dest + k, _mm256_mul_ps(s, f));
+  }
+  PixelConvert_u8ToFloat(src + k, dest + k, n - k, scale);
+}
+
+AVX2 static void PixelConvert_u16ToFloatAvx2(const unsigned char* src,
+                                             float* dest, int n, float scale) {
+  const __m128i swap =
+      _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  __m256 s = _mm256_set1_ps(scale);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + 2 * k));
+    v = _mm_shuffle_epi8(v, swap);
+    __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v));
+    _mm256_storeu_ps(dest + k, _mm256_mul_ps(s, f));
+  }
+  PixelConvert_u16ToFloat(src + 2 * k, dest + k, n - k, scale);
+}
+
+// 8 scaled and clamped samples packed to unsigned 16 bit
+AVX2 static inline __m128i PixelConvert_pack16(const float* src, __m256 scale,
+                                               __m256 max) {
+  __m256 f = _mm256_mul_ps(_mm256_loadu_ps(src), scale);
+  // max_ps returns the second operand on NaN, like the scalar kernel
+  f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), max);
+  __m256i v = _mm256_cvtps_epi32(f);
+  return _mm_packus_epi32(_mm256_castsi256_si128(v),
+                          _mm256_extracti128_si256(v, 1));
+}
+
+AVX2 static void PixelConvert_floatToU8Avx2(const float* src,
+                                            unsigned char* dest, int n,
+                                            float scale) {
+  __m256 s = _mm256_set1_ps(scale);
+  __m256 max = _mm256_set1_ps(255);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m128i v = PixelConvert_pack16(src + k, s, max);
+    _mm_storel_epi64((__m128i*)(dest + k), _mm_packus_epi16(v, v));
+  }
+  PixelConvert_floatToU8(src + k, dest + k, n - k, scale);
+}
+
+AVX2 static void PixelConvert_floatToU16Avx2(const float* src,
+                                             unsigned char* dest, int n,
+                                             float scale) {
+  const __m128i swap =
+      _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  __m256 s = _mm256_set1_ps(scale);
+  __m256 max = _mm256_set1_ps(65535);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m128i v = PixelConvert_pack16(src + k, s, max);
+    _mm_storeu_si128((__m128i*)(dest + 2 * k), _mm_shuffle_epi8(v, swap));
+  }
+  PixelConvert_floatToU16(src + k, dest + 2 * k, n - k, scale);
+}
+
+static const PixelConverter PixelConvert_avx2Kernels = {
+    "avx2", PixelConvert_u8ToFloatAvx2, PixelConvert_u16ToFloatAvx2,
+    PixelConvert_floatToU8Avx2, PixelConvert_floatToU16Avx2};
+
+#endif
+
+const PixelConverter* PixelConvert_avx2(void) {
+#ifdef PIXEL_CONVERT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return &PixelConvert_avx2Kernels;
+#endif
+  return NULL;
+}
+
+const PixelConverter* PixelConvert_best(void) {
+  const PixelConverter* converter = PixelConvert_avx2();
+  return converter ? converter : &PixelConvert_scalar;
+}
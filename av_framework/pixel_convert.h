@@ -0,0 +1,26 @@
+#pragma once
+
+// Kernels converting n samples between integer and float pixels, 16 bit
+// samples are big endian as in PNM files. Integer results are rounded to
+// the nearest value and clamped to the range of the type.
+typedef void (*PixelToFloatFn)(const unsigned char* src, float* dest, int n,
+                               float scale);
+typedef void (*PixelFromFloatFn)(const float* src, unsigned char* dest, int n,
+                                 float scale);
+
+typedef struct PixelConverter {
+  const char* name;
+  PixelToFloatFn u8ToFloat;
+  PixelToFloatFn u16ToFloat;
+  PixelFromFloatFn floatToU8;
+  PixelFromFloatFn floatToU16;
+} PixelConverter;
+
+// portable kernels, always available
+extern const PixelConverter PixelConvert_scalar;
+
+// vector kernels, NULL if the CPU doesn't support them
+const PixelConverter* PixelConvert_avx2(void);
+
+// fastest kernels supported by the CPU
+const PixelConverter* PixelConvert_best(void);
@@ -1,20 +1,38 @@
 #include "surface.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../common/common.h"
 
-void Surface_init(Surface* s, int rows, int cols, float row_scale,
-                  float col_scale) {
+#define SURFACE_CACHE_MAGIC 0x46534750  // "PGSF"
+#define SURFACE_CACHE_VERSION 1
+
+// the points and then the normals follow the header
+typedef struct SurfaceCacheHeader {
+  int magic, version;
+  int rows, cols;
+  float row_scale, col_scale;
+  unsigned char key[SURFACE_KEY_LEN];
+} SurfaceCacheHeader;
+
+// fills everything but the points and the normals
+static void Surface_setup(Surface* s, int rows, int cols, float row_scale,
+                          float col_scale) {
   s->rows = rows;
   s->cols = cols;
   s->row_scale = row_scale;
   s->col_scale = col_scale;
   s->n_points = rows * cols;
-  s->points = (Vec3*)malloc(sizeof(Vec3) * s->n_points);
-  s->normals = (Vec3*)malloc(sizeof(Vec3) * s->n_points);
-  memset(s->points, 0, (sizeof(Vec3) * s->n_points));
-  memset(s->normals, 0, (sizeof(Vec3) * s->n_points));
+  s->mapping = 0;
+  s->mapping_size = 0;
   s->point_rows = (Vec3**)malloc(sizeof(Vec3*) * rows);
   s->normal_rows = (Vec3**)malloc(sizeof(Vec3*) * rows);
   for (int i = 0; i < rows; i++) {
@@ -23,18 +41,153 @@ void Surface_init(Surface* s, int rows, int cols, float row_scale,
   }
   s->gl_list = -1;
   s->gl_texture = -1;
+  s->texture = 0;
+  s->tile_size = 0;
+  s->tile_rows = s->tile_cols = 0;
+  s->tile_resident = 0;
+  s->tile_dirty = 0;
+  s->tile_textures = 0;
+  s->tile_gl_lists = 0;
+  s->tile_gl_textures = 0;
   s->_destructor = 0;
 }
 
+void Surface_init(Surface* s, int rows, int cols, float row_scale,
+                  float col_scale) {
+  s->points = (Vec3*)calloc(rows * cols, sizeof(Vec3));
+  s->normals = (Vec3*)calloc(rows * cols, sizeof(Vec3));
+  Surface_setup(s, rows, cols, row_scale, col_scale);
+}
+
+void Surface_initTiled(Surface* s, int rows, int cols, float row_scale,
+                       float col_scale, int tile_size) {
+  Surface_init(s, rows, cols, row_scale, col_scale);
+  s->tile_size = tile_size;
+  s->tile_rows = (rows + tile_size - 1) / tile_size;
+  s->tile_cols = (cols + tile_size - 1) / tile_size;
+  int n_tiles = s->tile_rows * s->tile_cols;
+  s->tile_resident = (char*)calloc(n_tiles, sizeof(char));
+  s->tile_dirty = (char*)calloc(n_tiles, sizeof(char));
+  s->tile_textures = (Image**)calloc(n_tiles, sizeof(Image*));
+  s->tile_gl_lists = (int*)malloc(n_tiles * sizeof(int));
+  s->tile_gl_textures = (int*)malloc(n_tiles * sizeof(int));
+  for (int i = 0; i < n_tiles; i++) {
+    s->tile_gl_lists[i] = -1;
+    s->tile_gl_textures[i] = -1;
+  }
+}
+
+int Surface_isResident(Surface* s, int r, int c) {
+  if (r < 0 || r >= s->rows || c < 0 || c >= s->cols) return 0;
+  if (!s->tile_size) return 1;
+  int tile = (r / s->tile_size) * s->tile_cols + c / s->tile_size;
+  return __atomic_load_n(&s->tile_resident[tile], __ATOMIC_ACQUIRE);
+}
+
+// normals of the points in [r0,r1)x[c0,c1), the border of the surface has none
+static void Surface_computeNormals(Surface* s, int r0, int r1, int c0,
+                                   int c1) {
+  if (r0 < 1) r0 = 1;
+  if (c0 < 1) c0 = 1;
+  if (r1 > s->rows - 1) r1 = s->rows - 1;
+  if (c1 > s->cols - 1) c1 = s->cols - 1;
+  for (int r = r0; r < r1; r++) {
+    Vec3* normals_row_ptr = s->normal_rows[r] + c0;
+    Vec3* points_row_ptr = s->point_rows[r] + c0;
+    Vec3* points_row_prev = s->point_rows[r - 1] + c0;
+    Vec3* points_row_next = s->point_rows[r + 1] + c0;
+    for (int c = c0; c < c1; c++) {
+      // v3compose, v3cross and v3normalize inlined, same operations
+      const float* n = points_row_next->values;
+      const float* p = points_row_prev->values;
+      const float* e = points_row_ptr[1].values;
+      const float* w = points_row_ptr[-1].values;
+      float dx0 = n[0] - p[0], dx1 = n[1] - p[1], dx2 = n[2] - p[2];
+      float dy0 = e[0] - w[0], dy1 = e[1] - w[1], dy2 = e[2] - w[2];
+      float x = dx1 * dy2 - dx2 * dy1;
+      float y = dx2 * dy0 - dx0 * dy2;
+      float z = dx0 * dy1 - dx1 * dy0;
+      float norm = 1. / sqrt(x * x + y * y + z * z);
+      normals_row_ptr->values[0] = x * norm;
+      normals_row_ptr->values[1] = y * norm;
+      normals_row_ptr->values[2] = z * norm;
+      points_row_ptr++;
+      points_row_next++;
+      points_row_prev++;
+      normals_row_ptr++;
+    }
+  }
+}
+
+static void Surface_markDirty(Surface* s, int tile_row, int tile_col) {
+  if (tile_row < 0 || tile_col < 0) return;
+  __atomic_store_n(&s->tile_dirty[tile_row * s->tile_cols + tile_col], 1,
+                   __ATOMIC_RELEASE);
+}
+
+int Surface_setTile(Surface* s, int tile_row, int tile_col, float** m,
+                    int rows, int cols, float z_scale) {
+  if (!s->tile_size || tile_row < 0 || tile_row >= s->tile_rows ||
+      tile_col < 0 || tile_col >= s->tile_cols)
+    return 0;
+  int r0 = tile_row * s->tile_size, c0 = tile_col * s->tile_size;
+  int r1 = r0 + s->tile_size, c1 = c0 + s->tile_size;
+  if (r1 > s->rows) r1 = s->rows;
+  if (c1 > s->cols) c1 = s->cols;
+  if (rows != r1 - r0 || cols != c1 - c0) return 0;
+  for (int r = r0; r < r1; r++) {
+    Vec3* points_row_ptr = s->point_rows[r] + c0;
+    for (int c = c0; c < c1; c++) {
+      points_row_ptr->values[0] = s->row_scale * r;
+      points_row_ptr->values[1] = s->col_scale * c;
+      points_row_ptr->values[2] = z_scale * m[r - r0][c - c0];
+      points_row_ptr++;
+    }
+  }
+  // the neighbors' normals on the shared borders change too
+  Surface_computeNormals(s, r0 - 1, r1 + 1, c0 - 1, c1 + 1);
+  __atomic_store_n(&s->tile_resident[tile_row * s->tile_cols + tile_col], 1,
+                   __ATOMIC_RELEASE);
+  // the tiles above and on the left draw up to the first row and column
+  // of this one
+  Surface_markDirty(s, tile_row, tile_col);
+  Surface_markDirty(s, tile_row - 1, tile_col);
+  Surface_markDirty(s, tile_row, tile_col - 1);
+  Surface_markDirty(s, tile_row - 1, tile_col - 1);
+  return 1;
+}
+
+void Surface_setTileTexture(Surface* s, int tile_row, int tile_col,
+                            Image* img) {
+  if (!s->tile_size || tile_row < 0 || tile_row >= s->tile_rows ||
+      tile_col < 0 || tile_col >= s->tile_cols) {
+    Image_free(img);
+    return;
+  }
+  Image* old = __atomic_exchange_n(
+      &s->tile_textures[tile_row * s->tile_cols + tile_col], img,
+      __ATOMIC_ACQ_REL);
+  // the GL texture is uploaded by the drawing thread
+  if (old) Image_free(old);
+  Surface_markDirty(s, tile_row, tile_col);
+}
+
 void Surface_destroy(Surface* s) {
-  if (s->points) {
-    free(s->points);
+  if (s->mapping) {
+    munmap(s->mapping, s->mapping_size);
     free(s->point_rows);
-  }
-  if (s->normals) {
-    free(s->normals);
     free(s->normal_rows);
+  } else {
+    if (s->points) {
+      free(s->points);
+      free(s->point_rows);
+    }
+    if (s->normals) {
+      free(s->normals);
+      free(s->normal_rows);
+    }
   }
+  s->mapping = 0;
   s->points = 0;
   s->normals = 0;
   s->n_points = 0;
@@ -42,38 +195,157 @@ void Surface_destroy(Surface* s) {
   s->cols = 0;
   s->gl_texture = -1;
   if (s->_destructor) (*s->_destructor)(s);
+  if (s->tile_size) {
+    for (int i = 0; i < s->tile_rows * s->tile_cols; i++)
+      if (s->tile_textures[i]) Image_free(s->tile_textures[i]);
+    free(s->tile_resident);
+    free(s->tile_dirty);
+    free(s->tile_textures);
+    free(s->tile_gl_lists);
+    free(s->tile_gl_textures);
+    s->tile_size = 0;
+  }
 }
 
-void Surface_fromMatrix(Surface* s, float** m, int rows, int cols,
-                        float row_scale, float col_scale, float z_scale) {
-  Surface_init(s, rows, cols, row_scale, col_scale);
-  // compute the points
-  for (int r = 0; r < rows; r++) {
+// band of rows built by a thread
+typedef struct SurfaceJob {
+  Surface* s;
+  float** m;
+  float z_scale;
+  int r0, r1;
+  pthread_t thread;
+  char running;
+} SurfaceJob;
+
+static void* Surface_pointsJob(void* arg) {
+  SurfaceJob* job = (SurfaceJob*)arg;
+  Surface* s = job->s;
+  for (int r = job->r0; r < job->r1; r++) {
     Vec3* points_row_ptr = s->point_rows[r];
-    for (int c = 0; c < cols; c++) {
-      points_row_ptr->values[0] = row_scale * r;
-      points_row_ptr->values[1] = col_scale * c;
-      points_row_ptr->values[2] = z_scale * m[r][c];
+    for (int c = 0; c < s->cols; c++) {
+      points_row_ptr->values[0] = s->row_scale * r;
+      points_row_ptr->values[1] = s->col_scale * c;
+      points_row_ptr->values[2] = job->z_scale * job->m[r][c];
       points_row_ptr++;
     }
   }
-  for (int r = 1; r < rows - 1; r++) {
-    Vec3* normals_row_ptr = s->normal_rows[r];
-    Vec3* points_row_ptr = s->point_rows[r];
-    Vec3* points_row_prev = s->point_rows[r - 1];
-    Vec3* points_row_next = s->point_rows[r + 1];
-    for (int c = 1; c < cols - 1; c++) {
-      Vec3 delta_px, delta_py;
-      v3compose(&delta_px, points_row_next, points_row_prev, 1, -1);
-      v3compose(&delta_py, points_row_ptr + 1, points_row_ptr - 1, 1, -1);
-      v3cross(normals_row_ptr, &delta_px, &delta_py);
-      v3normalize(normals_row_ptr);
-      points_row_ptr++;
-      points_row_next++;
-      points_row_prev++;
-      normals_row_ptr++;
+  return NULL;
+}
+
+static void* Surface_normalsJob(void* arg) {
+  SurfaceJob* job = (SurfaceJob*)arg;
+  Surface_computeNormals(job->s, job->r0, job->r1, 1, job->s->cols - 1);
+  return NULL;
+}
+
+// runs fn on every band, the calling thread takes the first one
+static void Surface_runJobs(SurfaceJob* jobs, int n_jobs,
+                            void* (*fn)(void*)) {
+  for (int i = 1; i < n_jobs; i++) {
+    jobs[i].running = !pthread_create(&jobs[i].thread, NULL, fn, &jobs[i]);
+    // no more threads, build the band here
+    if (!jobs[i].running) fn(&jobs[i]);
+  }
+  fn(&jobs[0]);
+  for (int i = 1; i < n_jobs; i++)
+    if (jobs[i].running) pthread_join(jobs[i].thread, NULL);
+}
+
+void Surface_fromMatrix(Surface* s, float** m, int rows, int cols,
+                        float row_scale, float col_scale, float z_scale) {
+  Surface_init(s, rows, cols, row_scale, col_scale);
+  int n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_jobs > SURFACE_MAX_THREADS) n_jobs = SURFACE_MAX_THREADS;
+  // small surfaces aren't worth the threads
+  if (n_jobs > rows / SURFACE_MIN_ROWS) n_jobs = rows / SURFACE_MIN_ROWS;
+  if (n_jobs < 1) n_jobs = 1;
+  SurfaceJob jobs[SURFACE_MAX_THREADS];
+  for (int i = 0; i < n_jobs; i++) {
+    jobs[i].s = s;
+    jobs[i].m = m;
+    jobs[i].z_scale = z_scale;
+    jobs[i].r0 = (long)rows * i / n_jobs;
+    jobs[i].r1 = (long)rows * (i + 1) / n_jobs;
+  }
+  // the normals need the points of the rows around them
+  Surface_runJobs(jobs, n_jobs, Surface_pointsJob);
+  Surface_runJobs(jobs, n_jobs, Surface_normalsJob);
+}
+
+int Surface_save(const Surface* s, const char* filename,
+                 const unsigned char key[SURFACE_KEY_LEN]) {
+  if (s->tile_size) return -1;
+  SurfaceCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SURFACE_CACHE_MAGIC;
+  header.version = SURFACE_CACHE_VERSION;
+  header.rows = s->rows;
+  header.cols = s->cols;
+  header.row_scale = s->row_scale;
+  header.col_scale = s->col_scale;
+  memcpy(header.key, key, SURFACE_KEY_LEN);
+  char tmp_filename[PATH_MAX];
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.%d", filename, getpid());
+  int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) return -1;
+  const char* chunks[] = {(const char*)&header, (const char*)s->points,
+                          (const char*)s->normals};
+  size_t sizes[] = {sizeof(header), sizeof(Vec3) * s->n_points,
+                    sizeof(Vec3) * s->n_points};
+  int ret = 0;
+  for (int i = 0; i < 3 && ret == 0; i++) {
+    size_t written = 0;
+    while (written < sizes[i]) {
+      ssize_t n = write(fd, chunks[i] + written, sizes[i] - written);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) {
+        ret = -1;
+        break;
+      }
+      written += n;
     }
   }
+  if (close(fd) == -1) ret = -1;
+  // another process may be building the same surface, rename is atomic
+  if (ret == -1 || rename(tmp_filename, filename) == -1) {
+    unlink(tmp_filename);
+    return -1;
+  }
+  return 0;
+}
+
+int Surface_load(Surface* s, const char* filename,
+                 const unsigned char key[SURFACE_KEY_LEN]) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(SurfaceCacheHeader)) {
+    close(fd);
+    return -1;
+  }
+  // private and writable, the surface may still be modified in memory
+  void* mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return -1;
+  SurfaceCacheHeader header;
+  memcpy(&header, mapping, sizeof(header));
+  long n_points = (long)header.rows * header.cols;
+  if (header.magic != SURFACE_CACHE_MAGIC ||
+      header.version != SURFACE_CACHE_VERSION || header.rows <= 0 ||
+      header.cols <= 0 || n_points > INT_MAX ||
+      st.st_size != sizeof(header) + 2 * sizeof(Vec3) * n_points ||
+      memcmp(header.key, key, SURFACE_KEY_LEN)) {
+    munmap(mapping, st.st_size);
+    return -1;
+  }
+  s->points = (Vec3*)((char*)mapping + sizeof(header));
+  s->normals = s->points + n_points;
+  Surface_setup(s, header.rows, header.cols, header.row_scale,
+                header.col_scale);
+  s->mapping = mapping;
+  s->mapping_size = st.st_size;
+  return 0;
 }
 
 int Surface_getTransform(float transform[16], Surface* s, float x, float y,
@@ -84,6 +356,16 @@ int Surface_getTransform(float transform[16], Surface* s, float x, float y,
   int r = floor(x / s->row_scale);
   int c = floor(y / s->col_scale);
   if (r < 1 || r > s->rows - 2 || c < 1 || c > s->cols - 2) return 0;
+  // the normals of the neighbors depend on the points around them
+  if (s->tile_size) {
+    int r_next = r + 2 < s->rows ? r + 2 : r + 1;
+    int c_next = c + 2 < s->cols ? c + 2 : c + 1;
+    if (!Surface_isResident(s, r - 1, c - 1) ||
+        !Surface_isResident(s, r - 1, c_next) ||
+        !Surface_isResident(s, r_next, c - 1) ||
+        !Surface_isResident(s, r_next, c_next))
+      return 0;
+  }
 
   // coefficients for interpolation
   float dx = (x - r * s->row_scale) / s->row_scale;
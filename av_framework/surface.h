@@ -1,7 +1,11 @@
 #pragma once
 #include "image.h"
+#include <stddef.h>
 #include "vec3.h"
 
+//! bytes of the key identifying a cached surface
+#define SURFACE_KEY_LEN 32
+
 struct Surface;
 typedef void (*SurfaceDtor)(struct Surface* self);
 
@@ -32,6 +36,26 @@ typedef struct Surface {
   int gl_texture;
 
   Image* texture;
+
+  //! terrain streamed in tiles of tile_size x tile_size points, 0 if the
+  //! whole surface is resident
+  int tile_size, tile_rows, tile_cols;
+
+  //! per tile: points received
+  char* tile_resident;
+
+  //! per tile: the display list must be rebuilt
+  char* tile_dirty;
+
+  //! per tile: texture (owned by the surface), display list and GL texture
+  Image** tile_textures;
+  int* tile_gl_lists;
+  int* tile_gl_textures;
+
+  //! file the points and normals are mapped from, see Surface_load
+  void* mapping;
+  size_t mapping_size;
+
   SurfaceDtor _destructor;
 } Surface;
 
@@ -56,5 +80,33 @@ void Surface_destroy(Surface* s);
 void Surface_fromMatrix(Surface* s, float** m, int rows, int cols,
                         float row_scale, float col_scale, float z_scale);
 
+//! writes the points and normals of a surface built by Surface_fromMatrix
+//! in filename, tagged with key. Returns -1 on error
+int Surface_save(const Surface* s, const char* filename,
+                 const unsigned char key[SURFACE_KEY_LEN]);
+
+//! maps a surface written by Surface_save, instead of Surface_fromMatrix.
+//! Returns -1 if the file is missing, corrupted or has a different key
+int Surface_load(Surface* s, const char* filename,
+                 const unsigned char key[SURFACE_KEY_LEN]);
+
+//! allocates a surface whose points arrive in tiles, nothing is resident
+//! until Surface_setTile is called
+void Surface_initTiled(Surface* s, int rows, int cols, float row_scale,
+                       float col_scale, int tile_size);
+
+//! fills the points of a tile out of its grid representation and recomputes
+//! the normals around it. Returns 0 if the tile or its size is wrong
+int Surface_setTile(Surface* s, int tile_row, int tile_col, float** m,
+                    int rows, int cols, float z_scale);
+
+//! sets the texture of a tile, the surface takes the ownership of img
+void Surface_setTileTexture(Surface* s, int tile_row, int tile_col,
+                            Image* img);
+
+//! 1 if the point r,c can be used
+int Surface_isResident(Surface* s, int r, int c);
+
+//! fails (returns 0) where the surface isn't resident yet, as on its edges
 int Surface_getTransform(float transform[16], Surface* s, float x, float y,
                          float z, float alpha, int inverse);
@@ -134,6 +134,11 @@ void Surface_destructor(Surface *s) {
   if (s->gl_list > -1) glDeleteLists(s->gl_list, 1);
   s->gl_list = -1;
   if (s->gl_texture > -1) glDeleteTextures(1, (unsigned int *)&s->gl_texture);
+  for (int i = 0; i < s->tile_rows * s->tile_cols; i++) {
+    if (s->tile_gl_lists[i] > -1) glDeleteLists(s->tile_gl_lists[i], 1);
+    if (s->tile_gl_textures[i] > -1)
+      glDeleteTextures(1, (unsigned int *)&s->tile_gl_textures[i]);
+  }
 }
 
 void Vehicle_destructor(Vehicle *v) {
@@ -202,7 +207,9 @@ int Image_toTexture(Image *src) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, src->rows, src->cols, 0, GL_RGB,
+  // rows of the image are the rows of the texture, tiles may not be square
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, src->cols, src->rows, 0, GL_RGB,
                GL_UNSIGNED_BYTE, src->data);
   return surface_texture;
 }
@@ -218,7 +225,75 @@ void Surface_applyTexture(Surface *s, Image *img) {
   if (img) s->gl_texture = Image_toTexture(img);
 }
 
+// display list of a tile, up to the first row and column of the next tiles
+// if they are resident so that there are no gaps between tiles
+static void Surface_compileTile(Surface *s, int tile_row, int tile_col) {
+  int tile = tile_row * s->tile_cols + tile_col;
+  int r0 = tile_row * s->tile_size, c0 = tile_col * s->tile_size;
+  int r1 = r0 + s->tile_size, c1 = c0 + s->tile_size;
+  if (r1 > s->rows - 1) r1 = s->rows - 1;
+  if (c1 > s->cols - 1) c1 = s->cols - 1;
+  Image *texture =
+      __atomic_load_n(&s->tile_textures[tile], __ATOMIC_ACQUIRE);
+  if (texture && s->tile_gl_textures[tile] < 0) {
+    s->tile_gl_textures[tile] = Image_toTexture(texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  if (s->tile_gl_lists[tile] > -1) glDeleteLists(s->tile_gl_lists[tile], 1);
+  s->tile_gl_lists[tile] = glGenLists(1);
+  glNewList(s->tile_gl_lists[tile], GL_COMPILE);
+  int gl_texture = s->tile_gl_textures[tile];
+  if (gl_texture > -1) {
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glBindTexture(GL_TEXTURE_2D, gl_texture);
+  }
+  // points of this tile, the last tiles may be smaller
+  float tile_rows = r0 + s->tile_size > s->rows ? s->rows - r0 : s->tile_size;
+  float tile_cols = c0 + s->tile_size > s->cols ? s->cols - c0 : s->tile_size;
+  for (int r = r0; r < r1; r++) {
+    glBegin(GL_TRIANGLE_STRIP);
+    for (int c = c0; c <= c1; c++) {
+      if (!Surface_isResident(s, r + 1, c)) break;
+      glNormal3fv(s->normal_rows[r][c].values);
+      glTexCoord2f((c - c0) / tile_cols, (r - r0) / tile_rows);
+      glVertex3fv(s->point_rows[r][c].values);
+      glNormal3fv(s->normal_rows[r + 1][c].values);
+      glTexCoord2f((c - c0) / tile_cols, (r + 1 - r0) / tile_rows);
+      glVertex3fv(s->point_rows[r + 1][c].values);
+      if (!Surface_isResident(s, r, c + 1)) break;
+    }
+    glEnd();
+  }
+  if (gl_texture > -1) glDisable(GL_TEXTURE_2D);
+  glEndList();
+}
+
+// draws the resident tiles, rebuilding the ones that changed
+static void Surface_drawTiles(Surface *s) {
+  for (int tile_row = 0; tile_row < s->tile_rows; tile_row++) {
+    for (int tile_col = 0; tile_col < s->tile_cols; tile_col++) {
+      int tile = tile_row * s->tile_cols + tile_col;
+      if (!__atomic_load_n(&s->tile_resident[tile], __ATOMIC_ACQUIRE))
+        continue;
+      if (__atomic_exchange_n(&s->tile_dirty[tile], 0, __ATOMIC_ACQ_REL)) {
+        // a new texture replaces the uploaded one
+        if (s->tile_gl_textures[tile] > -1)
+          glDeleteTextures(1, (unsigned int *)&s->tile_gl_textures[tile]);
+        s->tile_gl_textures[tile] = -1;
+        Surface_compileTile(s, tile_row, tile_col);
+      }
+      glCallList(s->tile_gl_lists[tile]);
+    }
+  }
+}
+
 void Surface_draw(Surface *s) {
+  if (s->tile_size) {
+    Surface_drawTiles(s);
+    return;
+  }
   if (s->gl_list > -1) {
     glCallList(s->gl_list);
     return;
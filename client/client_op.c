@@ -12,10 +12,14 @@
 #include "../av_framework/surface.h"
 #include "../av_framework/world_viewer.h"
 #include "../common/common.h"
+#include "../game_framework/asset_cache.h"
 #include "../game_framework/protogame_protocol.h"
+#include "../game_framework/texture_store.h"
 #include "../game_framework/vehicle.h"
 #include "../game_framework/world.h"
 int sent_goodbye = 0;
+// encodings the server decodes, raw until exchangeCodecs
+int server_codecs = 1 << EncodingRaw;
 // Used to get ID from server
 int getID(int socket_desc) {
   char buf_send[BUFFERSIZE];
@@ -168,6 +172,9 @@ int sendVehicleTexture(int socket, Image* texture, int id) {
   request->header = ph;
   request->id = id;
   request->image = texture;
+  ImageEncoding encoding = ImageCodec_choose(texture);
+  request->encoding =
+      server_codecs & (1 << encoding) ? encoding : EncodingRaw;
 
   int size = Packet_serialize(buf_send, &(request->header));
   if (size == -1) return -1;
@@ -238,6 +245,161 @@ Image* getVehicleTexture(int socket, int id) {
   return im;
 }
 
+// sends a fixed size request and reads the whole answer into buf_rcv,
+// returns its size
+static int requestPacket(int socket, PacketHeader* request, char* buf_rcv) {
+  char buf_send[256];
+  int size = Packet_serialize(buf_send, request);
+  int bytes_sent = 0;
+  while (bytes_sent < size) {
+    int ret = send(socket, buf_send + bytes_sent, size - bytes_sent, 0);
+    if (ret == -1 && errno == EINTR) continue;
+    ERROR_HELPER(ret, "Can't send a texture request");
+    bytes_sent += ret;
+  }
+  int ph_len = sizeof(PacketHeader);
+  int msg_len = 0;
+  while (msg_len < ph_len) {
+    int ret = recv(socket, buf_rcv + msg_len, ph_len - msg_len, 0);
+    if (ret == -1 && errno == EINTR) continue;
+    ERROR_HELPER(ret, "Cannot read from socket");
+    if (ret == 0) return -1;
+    msg_len += ret;
+  }
+  int total = ((PacketHeader*)buf_rcv)->size;
+  if (total < ph_len || total > BUFFERSIZE) return -1;
+  while (msg_len < total) {
+    int ret = recv(socket, buf_rcv + msg_len, total - msg_len, 0);
+    if (ret == -1 && errno == EINTR) continue;
+    ERROR_HELPER(ret, "Cannot read from socket");
+    if (ret == 0) return -1;
+    msg_len += ret;
+  }
+  return total;
+}
+
+int exchangeCodecs(int socket) {
+  char buf_rcv[BUFFERSIZE];
+  CodecsPacket request;
+  request.header.type = GetCodecs;
+  request.codecs = IMAGE_CODECS;
+  int size = requestPacket(socket, &request.header, buf_rcv);
+  if (size == -1) return -1;
+  PacketHeader* header = (PacketHeader*)buf_rcv;
+  if (header->type != PostCodecs) return -1;
+  server_codecs = ((CodecsPacket*)buf_rcv)->codecs | (1 << EncodingRaw);
+  debug_print("[Codecs] Server decodes 0x%x \n", server_codecs);
+  return 0;
+}
+
+int getVehicleTextureHash(int socket, int id, TextureHash* hash) {
+  char buf_rcv[BUFFERSIZE];
+  TextureHashPacket request = {0};
+  request.header.type = GetTextureHash;
+  request.id = id;
+  int size = requestPacket(socket, &request.header, buf_rcv);
+  if (size == -1) return -1;
+  PacketHeader* header = (PacketHeader*)buf_rcv;
+  if (header->type != PostTextureHash) return -1;
+  memcpy(hash->bytes, ((TextureHashPacket*)buf_rcv)->hash, SHA256_DIGEST_LEN);
+  return 0;
+}
+
+Image* getTextureByHash(int socket, int id, const TextureHash* hash) {
+  char buf_rcv[BUFFERSIZE];
+  TextureHashPacket request = {0};
+  request.header.type = GetTextureByHash;
+  request.id = id;
+  memcpy(request.hash, hash->bytes, SHA256_DIGEST_LEN);
+  int size = requestPacket(socket, &request.header, buf_rcv);
+  if (size == -1) return NULL;
+  PacketHeader* header = (PacketHeader*)buf_rcv;
+  if (header->type != PostTexture) return NULL;
+  ImagePacket* deserialized_packet =
+      (ImagePacket*)Packet_deserialize(buf_rcv, size);
+  if (deserialized_packet == NULL) return NULL;
+  debug_print("[Get Texture By Hash] Received %d bytes \n", size);
+  Image* im = deserialized_packet->image;
+  free(deserialized_packet);
+  return im;
+}
+
+TextureStoreItem* getVehicleTextureItem(int socket, TextureStore* store,
+                                        AssetCache* cache, int id) {
+  TextureHash hash;
+  if (getVehicleTextureHash(socket, id, &hash) == -1) return NULL;
+  TextureStoreItem* item = TextureStore_find(store, &hash);
+  if (item != NULL) return item;
+  Image* im = cache ? AssetCache_load(cache, &hash) : NULL;
+  if (im == NULL) {
+    im = getTextureByHash(socket, id, &hash);
+    if (im == NULL) return NULL;
+    if (cache) AssetCache_store(cache, &hash, im);
+  }
+  return TextureStore_insert(store, im, NULL);
+}
+
+Image* loadCachedMap(int socket, AssetCache* cache, int map_id,
+                     TextureHash* hash) {
+  TextureHash advertised;
+  // servers without the hash request answer PostDisconnect too
+  if (getVehicleTextureHash(socket, map_id, &advertised) == -1) return NULL;
+  Image* im = AssetCache_load(cache, &advertised);
+  if (im != NULL) {
+    debug_print("[Map request] Loaded map %d from the disk cache \n", map_id);
+    if (hash) *hash = advertised;
+  }
+  return im;
+}
+
+Image* getCachedMap(int socket, AssetCache* cache, int map_id,
+                    TextureHash* hash) {
+  Image* im = loadCachedMap(socket, cache, map_id, hash);
+  if (im != NULL) return im;
+  im = map_id == MAP_TEXTURE_ID ? getTextureMap(socket)
+                                       : getElevationMap(socket);
+  if (im == NULL) return NULL;
+  // stored under the hash of what was received, the next request will match
+  // only if the server still has the same map
+  TextureHash received;
+  TextureHash_compute(im, &received);
+  AssetCache_store(cache, &received, im);
+  if (hash) *hash = received;
+  return im;
+}
+
+int getMapInfo(int socket, MapInfoPacket* info) {
+  char buf_rcv[BUFFERSIZE];
+  MapInfoPacket request = {0};
+  request.header.type = GetMapInfo;
+  int size = requestPacket(socket, &request.header, buf_rcv);
+  if (size < (int)sizeof(MapInfoPacket)) return -1;
+  PacketHeader* header = (PacketHeader*)buf_rcv;
+  if (header->type != PostMapInfo) return -1;
+  memcpy(info, buf_rcv, sizeof(MapInfoPacket));
+  return 0;
+}
+
+Image* getTile(int socket, MapLayer layer, int tile_row, int tile_col) {
+  char* buf_rcv = (char*)malloc(BUFFERSIZE);
+  TilePacket request = {0};
+  request.header.type = GetTile;
+  request.layer = layer;
+  request.tile_row = tile_row;
+  request.tile_col = tile_col;
+  int size = requestPacket(socket, &request.header, buf_rcv);
+  Image* im = NULL;
+  if (size != -1 && ((PacketHeader*)buf_rcv)->type == PostTile) {
+    TilePacket* tile = (TilePacket*)Packet_deserialize(buf_rcv, size);
+    if (tile != NULL) {
+      im = tile->image;
+      free(tile);
+    }
+  }
+  free(buf_rcv);
+  return im;
+}
+
 AudioContext* getAudioContext(int socket_desc) {
   char buf_send[BUFFERSIZE];
   char buf_rcv[BUFFERSIZE];
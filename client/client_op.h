@@ -1,14 +1,39 @@
 #pragma once
 #include "../av_framework/audio_context.h"
+#include "../game_framework/asset_cache.h"
 #include "../game_framework/protogame_protocol.h"
+#include "../game_framework/texture_store.h"
 // converts a well formed packet into a string in dest.
 // returns the written bytes
 // h is the packet to write
 int getID(int socket);
+// tells the server which image encodings this client decodes and stores the
+// ones the server decodes, used by sendVehicleTexture. Returns -1 on error
+int exchangeCodecs(int socket);
 Image *getElevationMap(int socket);
 Image *getTextureMap(int socket);
 int sendVehicleTexture(int socket, Image *texture, int id);
 int sendGoodbye(int socket, int id);
 Image *getVehicleTexture(int socket, int id);
+// content hash of the texture of vehicle id, -1 if the server doesn't know it
+int getVehicleTextureHash(int socket, int id, TextureHash *hash);
+Image *getTextureByHash(int socket, int id, const TextureHash *hash);
+// texture of vehicle id, looked up by hash in the store and then in the disk
+// cache (if not NULL) before downloading it. The caller owns a reference to
+// the returned item
+TextureStoreItem *getVehicleTextureItem(int socket, TextureStore *store,
+                                        AssetCache *cache, int id);
+// map texture (MAP_TEXTURE_ID) or elevation (MAP_ELEVATION_ID), downloaded
+// only if the disk cache doesn't have the hash advertised by the server. The
+// hash of the returned map is written in hash, if not NULL
+Image *getCachedMap(int socket, AssetCache *cache, int map_id,
+                    TextureHash *hash);
+// same as getCachedMap without the download, NULL on a cache miss
+Image *loadCachedMap(int socket, AssetCache *cache, int map_id,
+                     TextureHash *hash);
+// size of the map and of its tiles, -1 if the server can't stream it
+int getMapInfo(int socket, MapInfoPacket *info);
+// a layer of a map tile, NULL on error
+Image *getTile(int socket, MapLayer layer, int tile_row, int tile_col);
 AudioContext *getAudioContext(int socket);
 int joinChat(int socket_desc, int id, char *username);
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "map_stream.h"
+#include <stdlib.h>
+#include "../common/common.h"
+#include "client_op.h"
+
+void MapStream_init(MapStream* stream, World* world, int socket,
+                    pthread_mutex_t* socket_mutex, const MapInfoPacket* info) {
+  stream->world = world;
+  stream->socket = socket;
+  stream->socket_mutex = socket_mutex;
+  stream->info = *info;
+  stream->remaining = info->tile_rows * info->tile_cols;
+  stream->loaded = (char*)calloc(stream->remaining, sizeof(char));
+  World_initTiled(world, info->rows, info->cols, info->tile_size);
+}
+
+// the tile not loaded yet closest to the point r,c, -1 if there is none
+// within radius
+static int MapStream_nearest(MapStream* stream, float r, float c,
+                             int radius) {
+  float tile_size = stream->info.tile_size;
+  int best = -1;
+  float best_distance = 0;
+  for (int tr = 0; tr < stream->info.tile_rows; tr++) {
+    for (int tc = 0; tc < stream->info.tile_cols; tc++) {
+      int tile = tr * stream->info.tile_cols + tc;
+      if (stream->loaded[tile]) continue;
+      // distance in tiles from the tile center
+      float dr = (tr + .5) - r / tile_size;
+      float dc = (tc + .5) - c / tile_size;
+      float distance = dr * dr + dc * dc;
+      if (distance > (radius + .5) * (radius + .5)) continue;
+      if (best == -1 || distance < best_distance) {
+        best = tile;
+        best_distance = distance;
+      }
+    }
+  }
+  return best;
+}
+
+int MapStream_fetch(MapStream* stream, float x, float y, int radius,
+                    int max_tiles) {
+  Surface* ground = &stream->world->ground;
+  float r = x / ground->row_scale, c = y / ground->col_scale;
+  int loaded = 0;
+  while (loaded < max_tiles && stream->remaining > 0) {
+    int tile = MapStream_nearest(stream, r, c, radius);
+    if (tile == -1) break;
+    int tile_row = tile / stream->info.tile_cols;
+    int tile_col = tile % stream->info.tile_cols;
+    pthread_mutex_lock(stream->socket_mutex);
+    Image* elevation =
+        getTile(stream->socket, LayerElevation, tile_row, tile_col);
+    Image* texture =
+        elevation ? getTile(stream->socket, LayerTexture, tile_row, tile_col)
+                  : NULL;
+    pthread_mutex_unlock(stream->socket_mutex);
+    if (elevation == NULL || texture == NULL) {
+      if (elevation) Image_free(elevation);
+      return -1;
+    }
+    // the texture first, the tile is drawn as soon as it is resident
+    World_setTile(stream->world, tile_row, tile_col, NULL, texture);
+    int ret = World_setTile(stream->world, tile_row, tile_col, elevation, NULL);
+    Image_free(elevation);
+    if (!ret) return -1;
+    stream->loaded[tile] = 1;
+    stream->remaining--;
+    loaded++;
+  }
+  return loaded;
+}
+
+void MapStream_destroy(MapStream* stream) {
+  free(stream->loaded);
+  stream->loaded = NULL;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <pthread.h>
+#include "../game_framework/protogame_protocol.h"
+#include "../game_framework/world.h"
+
+// Downloads the tiles of the map into a tiled World, nearest to the vehicle
+// first. The TCP socket is shared with the other requests of the client,
+// every download holds socket_mutex
+typedef struct MapStream {
+  World* world;
+  int socket;
+  pthread_mutex_t* socket_mutex;
+  MapInfoPacket info;
+  char* loaded;  // per tile
+  int remaining;
+} MapStream;
+
+// initializes the world with a tiled ground of the size in info
+void MapStream_init(MapStream* stream, World* world, int socket,
+                    pthread_mutex_t* socket_mutex, const MapInfoPacket* info);
+
+// downloads up to max_tiles tiles within radius tiles of the world point
+// x,y, the nearest first. Returns the tiles loaded or -1 on error
+int MapStream_fetch(MapStream* stream, float x, float y, int radius,
+                    int max_tiles);
+
+void MapStream_destroy(MapStream* stream);
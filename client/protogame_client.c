@@ -1,6 +1,7 @@
 #include <GL/glut.h>
 #include <arpa/inet.h>  // htons() and inet_addr()
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <netinet/in.h>  // struct sockaddr_in
 #include <pthread.h>
@@ -15,16 +16,27 @@
 #include "../av_framework/surface.h"
 #include "../av_framework/world_viewer.h"
 #include "../common/common.h"
+#include "../game_framework/chat_channel.h"
+#include "../game_framework/clock_sync.h"
+#include "../game_framework/dead_reckoning.h"
+#include "../game_framework/latency.h"
+#include "../game_framework/link_stats.h"
+#include "../game_framework/logger.h"
+#include "../game_framework/prediction.h"
+#include "../game_framework/roster.h"
+#include "../game_framework/snapshot_buffer.h"
 #include "../game_framework/protogame_protocol.h"
 #include "../game_framework/vehicle.h"
 #include "../game_framework/world.h"
 #include "client_op.h"
+#include "map_stream.h"
 
 #define UNTOUCHED 0
 #define TOUCHED 1
-#define SENDER_SLEEP 200 * 1000
 #define RECEIVER_SLEEP 50 * 100
 #define MAX_FAILED_ATTEMPTS 20
+#define STREAMER_SLEEP 20 * 1000
+#define STREAMER_BATCH 4  // tiles downloaded before looking at the vehicle
 #if CACHE_TEXTURE == 1
 #define _USE_CACHED_TEXTURE_
 #endif
@@ -46,11 +58,36 @@ uint16_t port_number_no;
 int socket_desc = -1;  // socket tcp
 int socket_udp = -1;   // socket udp
 struct sockaddr_in udp_server = {0};
-struct timeval last_world_update_time;
+unsigned int last_world_update_time;  // of the last snapshot, 0 if none
 struct timeval last_update_time;
 struct timeval start_time;
 char kicked = 0;
+volatile sig_atomic_t dump_latency = 0;
 pthread_mutex_t time_lock = PTHREAD_MUTEX_INITIALIZER;
+ClockSync clock_sync;  // of the server timeline
+// quality of the UDP link to the server, the vehicles seen in the last
+// WorldUpdatePacket set how often the poses are sent
+LinkStats server_link;
+int visible_vehicles = 0;
+unsigned int roster_ack = 0;  // acked to the server along the link feedback
+pthread_mutex_t link_mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifdef _USE_SERVER_SIDE_FOG_
+Roster roster;  // of the server, replicated by the UDPReceiver
+#endif
+ChatReceiver chat_receiver;  // puts the chat records back in order
+VehicleForces input = {0};  // the last input frames sent, newest first
+DeadReckoning uplink;       // the pose of the last VehicleUpdatePacket
+Prediction prediction;      // of the own vehicle, reconciled with the server
+// textures of the other vehicles, by content
+TextureStore texture_store;
+// textures and maps received in the previous sessions
+AssetCache asset_cache;
+// held by the threads that send a request and wait for its answer on the TCP
+// socket, so that the answers don't get mixed
+pthread_mutex_t tcp_mutex = PTHREAD_MUTEX_INITIALIZER;
+// tiles of the map still to download, if the map is streamed
+MapStream map_stream;
+char map_streaming = 0;
 
 typedef struct localWorld {
   World world;
@@ -58,8 +95,12 @@ typedef struct localWorld {
   int users_online;
   char has_vehicle[WORLDSIZE];
   char is_disabled[WORLDSIZE];
-  struct timeval vehicle_login_time[WORLDSIZE];
+  unsigned int vehicle_login_time[WORLDSIZE];  // on the server timeline
+  unsigned int last_input_time[WORLDSIZE];
+  TextureStoreItem* textures[WORLDSIZE];  // shared with same-skin vehicles
   Vehicle** vehicles;
+  SnapshotBuffer snapshots[WORLDSIZE];  // of the vehicles, when interpolated
+  DeadReckoning replicas[WORLDSIZE];    // last state received of the vehicles
 } localWorld;
 
 typedef struct listenArgs {
@@ -69,6 +110,103 @@ typedef struct listenArgs {
   int socket_tcp;
 } udpArgs;
 
+// Moves a remote vehicle (already locked) to the pose sent by the server.
+// With SNAPSHOT_INTERPOLATION the pose is queued and World_update draws the
+// vehicle a bit late, between the last snapshots. reset drops the old ones
+void placeRemoteVehicle(localWorld* lw, int index, ClientUpdate* cup,
+                        unsigned int server_time, char reset) {
+  Vehicle* v = lw->vehicles[index];
+  DeadReckoning_set(&lw->replicas[index], cup, server_time);
+#if SNAPSHOT_INTERPOLATION == 1
+  if (reset || v->snapshots == NULL) {
+    SnapshotBuffer_init(&lw->snapshots[index]);
+    Vehicle_place(v, cup->x, cup->y, cup->theta);
+    v->snapshots = &lw->snapshots[index];
+  }
+  SnapshotBuffer_push(v->snapshots, cup, server_time);
+#else
+  Vehicle_setXYTheta(v, cup->x, cup->y, cup->theta);
+  Vehicle_setForcesUpdate(v, cup->translational_force, cup->rotational_force);
+  World_manualUpdate(&lw->world, v,
+                     (int)(ClockSync_now(&clock_sync) - server_time) / 1000.0);
+#endif
+}
+
+// Moves a remote vehicle (already locked) left out of a snapshot as
+// Predicted along the extrapolation of the last state received, which the
+// server keeps within DR_POSITION_ERROR of the true one. A state lost on
+// the way is sent again once the loss is reported, about a round trip
+// later. Without interpolation the local simulation already moves it on
+// its last velocities
+void predictRemoteVehicle(localWorld* lw, int index,
+                          unsigned int server_time) {
+#if SNAPSHOT_INTERPOLATION == 1
+  Vehicle* v = lw->vehicles[index];
+  if (!lw->replicas[index].valid || v->snapshots == NULL) return;
+  ClientUpdate predicted;
+  DeadReckoning_predict(&lw->replicas[index], server_time, &predicted);
+  SnapshotBuffer_push(v->snapshots, &predicted, server_time);
+#endif
+}
+
+#ifdef _USE_SERVER_SIDE_FOG_
+// the next packets to the server ack the last presence event applied
+void ackRoster(void) {
+  pthread_mutex_lock(&link_mutex);
+  roster_ack = roster.sequence;
+  pthread_mutex_unlock(&link_mutex);
+}
+#endif
+
+// tells the server which chat records arrived, so it sends only the others
+void ackChat(int socket_udp, struct sockaddr_in server_addr) {
+  ChatAckPacket ack;
+  ack.header.type = ChatAck;
+  ack.id = id;
+  ChatReceiver_ack(&chat_receiver, &ack.ack, &ack.selective);
+  char buf_send[sizeof(ChatAckPacket)];
+  int size = Packet_serialize(buf_send, &ack.header);
+  if (sendto(socket_udp, buf_send, size, 0,
+             (const struct sockaddr*)&server_addr,
+             (socklen_t)sizeof(server_addr)) < 0)
+    debug_print("[UDP_Receiver] Can't send the ChatAckPacket \n");
+}
+
+void printChatRecord(MessageBroadcast* m) {
+  struct tm* info = localtime(&m->time);
+  m->text[strcspn(m->text, "\n")] = 0;
+  switch (m->type) {
+    case (Text): {
+      printf("%s (id %d): %s (%d:%d)\n", m->sender, m->id, m->text,
+             info->tm_hour, info->tm_min);
+      break;
+    }
+    case (Hello): {
+      printf("[INFO] %s (id %d) joined the chat! (%d:%d)\n", m->sender, m->id,
+             info->tm_hour, info->tm_min);
+      break;
+    }
+    case (Goodbye): {
+      printf("[INFO] %s (id %d) left the chat! (%d:%d)\n", m->sender, m->id,
+             info->tm_hour, info->tm_min);
+      break;
+    }
+  }
+  fflush(stdout);
+}
+
+// Accounts the end-to-end latency of a remote vehicle the first time a new
+// input of its owner shows up in a WorldUpdatePacket
+void trackInputLatency(localWorld* lw, int index, ClientUpdate* cup,
+                       unsigned int receive_time) {
+  if (cup->input_time == 0 ||
+      (lw->last_input_time[index] != 0 &&
+       (int)(cup->input_time - lw->last_input_time[index]) <= 0))
+    return;
+  lw->last_input_time[index] = cup->input_time;
+  Latency_recordMs(LatEndToEnd, cup->input_time, receive_time);
+}
+
 int hasUser(int ids[], int size, int id) {
   for (int i = 0; i < size; i++) {
     if (ids[i] == id) {
@@ -83,11 +221,14 @@ void handleSignal(int signal) {
   switch (signal) {
     case SIGHUP:
       break;
+    case SIGUSR1:
+      dump_latency = 1;
+      break;
     case SIGINT:
       connectivity = 0;
       exchange_update = 0;
       pthread_mutex_lock(&time_lock);
-      if (last_world_update_time.tv_sec != 1 && !kicked)
+      if (!kicked)
         sendGoodbye(socket_desc, id);
       pthread_mutex_unlock(&time_lock);
       WorldViewer_exit(0);
@@ -140,7 +281,9 @@ USERNAME:
          username, TEXT_LEN);
 
   // send hello message
+  pthread_mutex_lock(&tcp_mutex);
   int ret = joinChat(socket_desc, id, username);
+  pthread_mutex_unlock(&tcp_mutex);
   ERROR_HELPER(ret, "Invalid join chat request");
   // Get user messages
   while (connectivity) {
@@ -170,28 +313,8 @@ USERNAME:
   pthread_exit(NULL);
 }
 
-int sendUpdates(int socket_udp, struct sockaddr_in server_addr, int serverlen) {
-  char buf_send[BUFFERSIZE];
-  PacketHeader ph;
-  ph.type = VehicleUpdate;
-  VehicleUpdatePacket* vup =
-      (VehicleUpdatePacket*)malloc(sizeof(VehicleUpdatePacket));
-  vup->header = ph;
-  gettimeofday(&vup->time, NULL);
-  pthread_mutex_lock(&vehicle->mutex);
-  Vehicle_getForcesUpdate(vehicle, &(vup->translational_force),
-                          &(vup->rotational_force));
-  Vehicle_getXYTheta(vehicle, &(vup->x), &(vup->y), &(vup->theta));
-  pthread_mutex_unlock(&vehicle->mutex);
-  vup->id = id;
-  int size = Packet_serialize(buf_send, &vup->header);
-  int bytes_sent =
-      sendto(socket_udp, buf_send, size, 0,
-             (const struct sockaddr*)&server_addr, (socklen_t)serverlen);
-  debug_print(
-      "[UDP_Sender] Sent a VehicleUpdatePacket of %d bytes with tf:%f rf:%f \n",
-      bytes_sent, vup->translational_force, vup->rotational_force);
-  Packet_free(&(vup->header));
+// terminates the client if the server stopped sending updates
+void checkServer(void) {
   struct timeval current_time;
   gettimeofday(&current_time, NULL);
   pthread_mutex_lock(&time_lock);
@@ -214,10 +337,128 @@ int sendUpdates(int socket_udp, struct sockaddr_in server_addr, int serverlen) {
     WorldViewer_exit(0);
   }
   pthread_mutex_unlock(&time_lock);
+}
+
+// asks the server for its clock, the reply is handled by the receiver
+int sendTimeSync(int socket_udp, struct sockaddr_in server_addr,
+                 int serverlen) {
+  char buf_send[sizeof(TimeSyncPacket)];
+  TimeSyncPacket ping = {0};
+  ping.header.type = TimeSync;
+  ping.client_send = Clock_now();
+  int size = Packet_serialize(buf_send, &ping.header);
+  int bytes_sent =
+      sendto(socket_udp, buf_send, size, 0,
+             (const struct sockaddr*)&server_addr, (socklen_t)serverlen);
+  return bytes_sent == size ? 0 : -1;
+}
+
+int sendUpdates(int socket_udp, struct sockaddr_in server_addr, int serverlen) {
+  // the poses are stamped on the server timeline
+  if (!ClockSync_ready(&clock_sync)) {
+    checkServer();
+    return 0;
+  }
+  char buf_send[BUFFERSIZE];
+  PacketHeader ph;
+  ph.type = VehicleUpdate;
+  VehicleUpdatePacket* vup =
+      (VehicleUpdatePacket*)malloc(sizeof(VehicleUpdatePacket));
+  vup->header = ph;
+  vup->time = ClockSync_now(&clock_sync);
+  pthread_mutex_lock(&vehicle->mutex);
+  Vehicle_getForcesUpdate(vehicle, &(vup->translational_force),
+                          &(vup->rotational_force));
+  Vehicle_getXYTheta(vehicle, &(vup->x), &(vup->y), &(vup->theta));
+  pthread_mutex_unlock(&vehicle->mutex);
+  vup->id = id;
+#if DEAD_RECKONING == 1
+  // the server holds the last pose it got: a parked vehicle is sent again
+  // only to keep it alive
+  ClientUpdate pose = {0};
+  pose.x = vup->x;
+  pose.y = vup->y;
+  pose.theta = vup->theta;
+  if (!DeadReckoning_diverged(&uplink, &pose, vup->time)) {
+    Packet_free(&(vup->header));
+    checkServer();
+    return 0;
+  }
+  DeadReckoning_set(&uplink, &pose, vup->time);
+#endif
+  pthread_mutex_lock(&link_mutex);
+  LinkStats_stamp(&server_link, &vup->link, Clock_now());
+  vup->roster_ack = roster_ack;
+  pthread_mutex_unlock(&link_mutex);
+  int size = Packet_serialize(buf_send, &vup->header);
+  int bytes_sent =
+      sendto(socket_udp, buf_send, size, 0,
+             (const struct sockaddr*)&server_addr, (socklen_t)serverlen);
+  debug_print(
+      "[UDP_Sender] Sent a VehicleUpdatePacket of %d bytes with tf:%f rf:%f \n",
+      bytes_sent, vup->translational_force, vup->rotational_force);
+  Packet_free(&(vup->header));
+  checkServer();
   if (bytes_sent < 0) return -1;
   return 0;
 }
 
+// quantizes the current forces in a new input frame, simulates it and sends
+// it to the server with the last ones it may have lost
+int sendInputs(int socket_udp, struct sockaddr_in server_addr, int serverlen) {
+  char buf_send[BUFFERSIZE];
+  float tf, rf;
+  pthread_mutex_lock(&vehicle->mutex);
+  Vehicle_getForcesUpdate(vehicle, &tf, &rf);
+  float limit = SHRT_MAX / INPUT_FORCE_SCALE;
+  InputFrame frame = {
+      (short)lrintf(fmaxf(-limit, fminf(tf, limit)) * INPUT_FORCE_SCALE),
+      (short)lrintf(fmaxf(-limit, fminf(rf, limit)) * INPUT_FORCE_SCALE)};
+  input.sequence = Prediction_apply(&prediction, vehicle, frame);
+  pthread_mutex_unlock(&vehicle->mutex);
+
+  memmove(&input.frames[1], &input.frames[0],
+          sizeof(InputFrame) * (INPUT_REDUNDANCY - 1));
+  input.frames[0] = frame;
+  input.header.type = VehicleInput;
+  input.id = id;
+  if (input.num_frames < INPUT_REDUNDANCY) input.num_frames++;
+  pthread_mutex_lock(&link_mutex);
+  LinkStats_stamp(&server_link, &input.link, Clock_now());
+  input.roster_ack = roster_ack;
+  pthread_mutex_unlock(&link_mutex);
+  // the local clock means nothing to the server
+  input.time =
+      ClockSync_ready(&clock_sync) ? ClockSync_now(&clock_sync) : 0;
+  int size = Packet_serialize(buf_send, &input.header);
+  int bytes_sent =
+      sendto(socket_udp, buf_send, size, 0,
+             (const struct sockaddr*)&server_addr, (socklen_t)serverlen);
+  debug_print("[UDP_Sender] Sent input %u of %d bytes with tf:%f rf:%f \n",
+              input.sequence, bytes_sent, tf, rf);
+  checkServer();
+  if (bytes_sent < 0) return -1;
+  return 0;
+}
+
+// Downloads the rest of the map around the vehicle while playing
+void* mapStreamer(void* args) {
+  while (connectivity && map_stream.remaining > 0) {
+    float x, y, theta;
+    pthread_mutex_lock(&vehicle->mutex);
+    Vehicle_getXYTheta(vehicle, &x, &y, &theta);
+    pthread_mutex_unlock(&vehicle->mutex);
+    int ret = MapStream_fetch(&map_stream, x, y, MAP_STREAM_RADIUS,
+                              STREAMER_BATCH);
+    if (ret == -1) {
+      LOG_WARNING("[Map streamer] Can't download a tile, giving up");
+      break;
+    }
+    if (ret == 0) usleep(STREAMER_SLEEP);
+  }
+  pthread_exit(NULL);
+}
+
 // Send vehicleUpdatePacket to server
 void* UDPSender(void* args) {
   udpArgs udp_args = *(udpArgs*)args;
@@ -225,10 +466,40 @@ void* UDPSender(void* args) {
   int socket_udp = udp_args.socket_udp;
   int serverlen = sizeof(server_addr);
   while (connectivity && exchange_update) {
+    if (ClockSync_shouldPing(&clock_sync, Clock_now()) &&
+        sendTimeSync(socket_udp, server_addr, serverlen) == -1)
+      debug_print("[UDP_Sender] Cannot send TimeSyncPacket \n");
+#if INPUT_UPLINK == 1
+    int ret = sendInputs(socket_udp, server_addr, serverlen);
+#else
     int ret = sendUpdates(socket_udp, server_addr, serverlen);
+#endif
     if (ret == -1)
       debug_print("[UDP_Sender] Cannot send VehicleUpdatePacket \n");
-    usleep(SENDER_SLEEP);
+    if (dump_latency) {
+      dump_latency = 0;
+      Latency_print(stderr);
+      pthread_mutex_lock(&link_mutex);
+      fprintf(stderr,
+              "[Link] rtt %.0fms jitter %.0fms loss up %.1f%% down %.1f%%\n",
+              server_link.srtt, server_link.jitter,
+              server_link.send_loss * 100, server_link.receive_loss * 100);
+      pthread_mutex_unlock(&link_mutex);
+    }
+#if INPUT_UPLINK == 1
+    // the inputs are simulation steps, their rate is fixed
+    usleep(1000000 / INPUT_RATE);
+#else
+    float tv, rv;
+    pthread_mutex_lock(&vehicle->mutex);
+    Vehicle_getVelocities(vehicle, &tv, &rv);
+    pthread_mutex_unlock(&vehicle->mutex);
+    pthread_mutex_lock(&link_mutex);
+    unsigned int interval = LinkStats_adapt(
+        &server_link, LinkStats_need(tv, visible_vehicles));
+    pthread_mutex_unlock(&link_mutex);
+    usleep(interval * 1000);
+#endif
   }
   pthread_exit(NULL);
 }
@@ -241,6 +512,18 @@ void* UDPReceiver(void* args) {
   socklen_t addrlen = sizeof(server_addr);
   localWorld* lw = udp_args.lw;
   int socket_tcp = udp_args.socket_tcp;
+  // the snapshot being received, its datagrams fill the masks
+  unsigned int snapshot = 0;
+  unsigned long long fragments_received = 0;  // bit i: fragment i arrived
+  int others = 0;
+  char mask[WORLDSIZE], updated[WORLDSIZE];
+  // in range but left out of this snapshot, they keep moving on the last ones
+  char deferred[WORLDSIZE];
+#ifdef _USE_SERVER_SIDE_FOG_
+  // the whole roster, if the snapshot carries it
+  ClientStatusUpdate members[WORLDSIZE];
+  int num_members = 0;
+#endif
   while (connectivity && exchange_update) {
     char buf_rcv[BUFFERSIZE];
     int bytes_read = recvfrom(socket_udp, buf_rcv, BUFFERSIZE, 0,
@@ -257,7 +540,11 @@ void* UDPReceiver(void* args) {
 
     debug_print("[UDP_Receiver] Received %d bytes over UDP\n", bytes_read);
     PacketHeader* ph = (PacketHeader*)buf_rcv;
-    if (ph->size != bytes_read) ERROR_HELPER(-1, "Partial UDP READ!");
+    if (bytes_read < sizeof(PacketHeader) || ph->size != bytes_read) {
+      debug_print("[UDP_Receiver] Dropping a partial datagram \n");
+      usleep(RECEIVER_SLEEP);
+      continue;
+    }
     switch (ph->type) {
       case (PostDisconnect): {
         fprintf(
@@ -273,46 +560,58 @@ void* UDPReceiver(void* args) {
       case (ChatHistory): {
         MessageHistoryPacket* mh =
             (MessageHistoryPacket*)Packet_deserialize(buf_rcv, bytes_read);
-        for (int i = 0; i < mh->num_messages; i++) {
-          struct tm* info;
-          info = localtime(&mh->messages[i].time);
-          if (mh->messages[i].id == id) continue;
-          mh->messages[i].text[strcspn(mh->messages[i].text, "\n")] = 0;
-          switch (mh->messages[i].type) {
-            case (Text): {
-              printf("%s (id %d): %s (%d:%d)\n", mh->messages[i].sender,
-                     mh->messages[i].id, mh->messages[i].text, info->tm_hour,
-                     info->tm_min);
-              fflush(stdout);
-              break;
-            }
-            case (Hello): {
-              printf("[INFO] %s (id %d) joined the chat! (%d:%d)\n",
-                     mh->messages[i].sender, mh->messages[i].id, info->tm_hour,
-                     info->tm_min);
-              fflush(stdout);
-              break;
-            }
-            case (Goodbye): {
-              printf("[INFO] %s (id %d) left the chat! (%d:%d)\n",
-                     mh->messages[i].sender, mh->messages[i].id, info->tm_hour,
-                     info->tm_min);
-              fflush(stdout);
-              break;
-            }
-          }
-        }
+        if (mh == NULL) break;
+        // the records are printed once and in order, the ack is sent even
+        // for the duplicates: the previous one may have been lost
+        ChatReceiver_skipTo(&chat_receiver, mh->first);
+        for (int i = 0; i < mh->num_messages; i++)
+          ChatReceiver_receive(&chat_receiver, &mh->messages[i]);
         Packet_free(&mh->header);
+        MessageBroadcast record;
+        while (ChatReceiver_pop(&chat_receiver, &record))
+          if (record.id != id) printChatRecord(&record);
+        ackChat(socket_udp, server_addr);
+        break;
+      }
+      case (TimeSync): {
+        unsigned int receive = Clock_now();
+        TimeSyncPacket* pong =
+            (TimeSyncPacket*)Packet_deserialize(buf_rcv, bytes_read);
+        if (pong == NULL) break;
+        if (!ClockSync_update(&clock_sync, pong->client_send,
+                              pong->server_receive, pong->server_send,
+                              receive))
+          debug_print("[UDP_Receiver] Inconsistent TimeSyncPacket \n");
+        Packet_free(&pong->header);
         break;
       }
       case (WorldUpdate): {
         WorldUpdatePacket* wup =
             (WorldUpdatePacket*)Packet_deserialize(buf_rcv, bytes_read);
-        debug_print("WorldUpdatePacket contains %d vehicles besides mine \n",
-                    wup->num_update_vehicles - 1);
+        if (wup == NULL) {
+          debug_print("[UDP_Receiver] Malformed WorldUpdatePacket \n");
+          break;
+        }
+        pthread_mutex_lock(&link_mutex);
+        int in_order =
+            LinkStats_receive(&server_link, &wup->link, Clock_now());
+        pthread_mutex_unlock(&link_mutex);
+        debug_print("WorldUpdatePacket %u contains %d vehicles (part %d/%d)\n",
+                    wup->snapshot, wup->num_update_vehicles,
+                    wup->fragment + 1, wup->num_fragments);
+        unsigned int receive_clock = ClockSync_now(&clock_sync);
         pthread_mutex_lock(&time_lock);
-        if (last_world_update_time.tv_sec != -1 &&
-            timercmp(&last_world_update_time, &wup->time, >=)) {
+        // the other datagrams of the current snapshot carry its same time
+        int same_snapshot = fragments_received != 0 &&
+                            wup->snapshot == snapshot &&
+                            wup->time == last_world_update_time;
+        unsigned long long fragment = 1ull << wup->fragment;
+        // a datagram overtaken by a later one is only used if it's a
+        // missing fragment of the current snapshot
+        if ((same_snapshot && (fragments_received & fragment)) ||
+            (!same_snapshot && !in_order) ||
+            (!same_snapshot && last_world_update_time != 0 &&
+             (int)(wup->time - last_world_update_time) <= 0)) {
           pthread_mutex_unlock(&time_lock);
           debug_print("[INFO] Ignoring a WorldUpdatePacket... \n");
           Packet_free(&wup->header);
@@ -322,29 +621,67 @@ void* UDPReceiver(void* args) {
         last_world_update_time = wup->time;
         gettimeofday(&last_update_time, NULL);
         pthread_mutex_unlock(&time_lock);
-        char mask[WORLDSIZE];
-        for (int k = 0; k < WORLDSIZE; k++) mask[k] = UNTOUCHED;
+        Latency_recordMs(LatDownlink, wup->time, receive_clock);
+        if (!same_snapshot) {
+          snapshot = wup->snapshot;
+          fragments_received = 0;
+          others = 0;
+          for (int k = 0; k < WORLDSIZE; k++) {
+            mask[k] = UNTOUCHED;
+            updated[k] = UNTOUCHED;
+            deferred[k] = 0;
+          }
+#ifdef _USE_SERVER_SIDE_FOG_
+          num_members = 0;
+#endif
+        }
+        fragments_received |= fragment;
+        for (int i = 0; i < wup->num_update_vehicles; i++)
+          if (wup->updates[i].id != id) others++;
+        pthread_mutex_lock(&link_mutex);
+        visible_vehicles = others;
+        pthread_mutex_unlock(&link_mutex);
         float x, y, theta;
         pthread_mutex_lock(&vehicle->mutex);
         Vehicle_getXYTheta(vehicle, &x, &y, &theta);
         pthread_mutex_unlock(&vehicle->mutex);
         int ignored = 0;
-        char updated[WORLDSIZE];
-        for (int k = 0; k < WORLDSIZE; k++) updated[k] = UNTOUCHED;
 
 #ifdef _USE_SERVER_SIDE_FOG_
         for (int i = 0; i < wup->num_status_vehicles; i++) {
-          int ret = hasUser(lw->ids, WORLDSIZE, wup->status_updates[i].id);
+          ClientStatusUpdate* csu = &wup->status_updates[i];
+          if (csu->status != Deferred && csu->status != Predicted) {
+            // the roster is replaced once the whole snapshot is here
+            if (!wup->roster_full)
+              Roster_apply(&roster, csu);
+            else if (num_members < WORLDSIZE)
+              members[num_members++] = *csu;
+            continue;
+          }
+          int ret = hasUser(lw->ids, WORLDSIZE, csu->id);
           if (ret == -1) continue;
-          if (wup->status_updates[i].status == Online && CACHE_TEXTURE)
-            mask[ret] = TOUCHED;
+          if (CACHE_TEXTURE) mask[ret] = TOUCHED;
+          deferred[ret] = 1;
+          if (csu->status != Predicted || !lw->has_vehicle[ret] ||
+              lw->is_disabled[ret])
+            continue;
+          pthread_mutex_lock(&lw->vehicles[ret]->mutex);
+          predictRemoteVehicle(lw, ret, wup->time);
+          pthread_mutex_unlock(&lw->vehicles[ret]->mutex);
         }
 #endif
 
         for (int i = 0; i < wup->num_update_vehicles; i++) {
-          if (wup->updates[i].id == id)
+          if (wup->updates[i].id == id) {
+#if INPUT_UPLINK == 1
+            pthread_mutex_lock(&vehicle->mutex);
+            if (Prediction_reconcile(&prediction, vehicle, &wup->updates[i]))
+              debug_print("[UDP_Receiver] Corrected the own vehicle at %u\n",
+                          wup->updates[i].input_sequence);
+            pthread_mutex_unlock(&vehicle->mutex);
+#endif
             continue;
-          else if (SERVER_SIDE_POSITION_CHECK ||
+          } else if (SERVER_SIDE_POSITION_CHECK ||
                    !(abs((int)x - (int)wup->updates[i].x) > HIDE_RANGE ||
                      abs((int)y - (int)wup->updates[i].y) > HIDE_RANGE)) {
             int new_position = -1;
@@ -356,27 +693,31 @@ void* UDPReceiver(void* args) {
                   "[INFO] New Vehicle with id %d and x: %f y: %f z: %f \n",
                   wup->updates[i].id, wup->updates[i].x, wup->updates[i].y,
                   wup->updates[i].theta);
-              Image* img = getVehicleTexture(socket_tcp, wup->updates[i].id);
-              if (img == NULL) {
+              pthread_mutex_lock(&tcp_mutex);
+              TextureStoreItem* item =
+                  getVehicleTextureItem(socket_tcp, &texture_store,
+                                        &asset_cache, wup->updates[i].id);
+              pthread_mutex_unlock(&tcp_mutex);
+              if (item == NULL) {
                 lw->ids[new_position] = -1;
                 continue;
               }
+              lw->textures[new_position] = item;
+              Image* img = item->image;
               // Update masks
               mask[new_position] = TOUCHED;
               updated[new_position] = TOUCHED;
+              lw->last_input_time[new_position] = 0;
+              trackInputLatency(lw, new_position, &wup->updates[i],
+                                receive_clock);
 
               Vehicle* new_vehicle = (Vehicle*)malloc(sizeof(Vehicle));
               Vehicle_init(new_vehicle, &lw->world, wup->updates[i].id, img);
               lw->vehicles[new_position] = new_vehicle;
               pthread_mutex_lock(&lw->vehicles[new_position]->mutex);
-              Vehicle_setXYTheta(lw->vehicles[new_position], wup->updates[i].x,
-                                 wup->updates[i].y, wup->updates[i].theta);
-              Vehicle_setForcesUpdate(lw->vehicles[new_position],
-                                      wup->updates[i].translational_force,
-                                      wup->updates[i].rotational_force);
+              placeRemoteVehicle(lw, new_position, &wup->updates[i],
+                                 wup->time, 1);
               World_addVehicle(&lw->world, new_vehicle);
-              World_manualUpdate(&lw->world, lw->vehicles[new_position],
-                                 wup->updates[i].client_update_time);
               pthread_mutex_unlock(&lw->vehicles[new_position]->mutex);
               lw->is_disabled[new_position] = 0;  // Just to play safe
               lw->has_vehicle[new_position] = 1;
@@ -385,23 +726,29 @@ void* UDPReceiver(void* args) {
             } else {
               mask[id_struct] = TOUCHED;
               updated[id_struct] = TOUCHED;
-              if (timercmp(&wup->updates[i].client_creation_time,
-                           &lw->vehicle_login_time[id_struct], !=)) {
+              trackInputLatency(lw, id_struct, &wup->updates[i],
+                                receive_clock);
+              if (wup->updates[i].client_creation_time !=
+                  lw->vehicle_login_time[id_struct]) {
                 debug_print("[WARNING] Forcing refresh for client with id %d",
                             wup->updates[i].id);
                 debug_print("Vehicle with id %d and x: %f y: %f z: %f \n",
                             wup->updates[i].id, wup->updates[i].x,
                             wup->updates[i].y, wup->updates[i].theta);
                 if (lw->has_vehicle[id_struct]) {
-                  Image* im = lw->vehicles[id_struct]->texture;
                   if (!lw->is_disabled[id_struct])
                     World_detachVehicle(&lw->world, lw->vehicles[id_struct]);
                   Vehicle_destroy(lw->vehicles[id_struct]);
-                  if (im != NULL) Image_free(im);
+                  TextureStore_release(&texture_store, lw->textures[id_struct]);
+                  lw->textures[id_struct] = NULL;
                   free(lw->vehicles[id_struct]);
                 }
-                Image* img = getVehicleTexture(socket_tcp, wup->updates[i].id);
-                if (img == NULL) {
+                pthread_mutex_lock(&tcp_mutex);
+                TextureStoreItem* item =
+                    getVehicleTextureItem(socket_tcp, &texture_store,
+                                          &asset_cache, wup->updates[i].id);
+                pthread_mutex_unlock(&tcp_mutex);
+                if (item == NULL) {
                   // Remove vehicle if server cannot provide a texture
                   lw->ids[id_struct] = -1;
                   lw->has_vehicle[id_struct] = 0;
@@ -410,18 +757,15 @@ void* UDPReceiver(void* args) {
                   mask[id_struct] = UNTOUCHED;
                   continue;
                 }
+                lw->textures[id_struct] = item;
+                Image* img = item->image;
                 Vehicle* new_vehicle = (Vehicle*)malloc(sizeof(Vehicle));
                 Vehicle_init(new_vehicle, &lw->world, wup->updates[i].id, img);
                 lw->vehicles[id_struct] = new_vehicle;
                 pthread_mutex_lock(&lw->vehicles[id_struct]->mutex);
-                Vehicle_setXYTheta(lw->vehicles[id_struct], wup->updates[i].x,
-                                   wup->updates[i].y, wup->updates[i].theta);
-                Vehicle_setForcesUpdate(lw->vehicles[id_struct],
-                                        wup->updates[i].translational_force,
-                                        wup->updates[i].rotational_force);
+                placeRemoteVehicle(lw, id_struct, &wup->updates[i],
+                                   wup->time, 1);
                 World_addVehicle(&lw->world, new_vehicle);
-                World_manualUpdate(&lw->world, lw->vehicles[id_struct],
-                                   wup->updates[i].client_update_time);
                 pthread_mutex_unlock(&lw->vehicles[id_struct]->mutex);
                 lw->vehicle_login_time[id_struct] =
                     wup->updates[i].client_creation_time;
@@ -436,35 +780,26 @@ void* UDPReceiver(void* args) {
                               wup->updates[i].y, wup->updates[i].theta);
                   Vehicle* old_vehicle = lw->vehicles[id_struct];
                   pthread_mutex_lock(&lw->vehicles[id_struct]->mutex);
-                  Vehicle_setXYTheta(lw->vehicles[id_struct], wup->updates[i].x,
-                                     wup->updates[i].y, wup->updates[i].theta);
-                  Vehicle_setForcesUpdate(lw->vehicles[id_struct],
-                                          wup->updates[i].translational_force,
-                                          wup->updates[i].rotational_force);
+                  // it was hidden, the old snapshots are stale
+                  placeRemoteVehicle(lw, id_struct, &wup->updates[i],
+                                     wup->time, 1);
                   World_addVehicle(&lw->world, old_vehicle);
-                  World_manualUpdate(&lw->world, lw->vehicles[id_struct],
-                                     wup->updates[i].client_update_time);
                   pthread_mutex_unlock(&lw->vehicles[id_struct]->mutex);
                   lw->is_disabled[id_struct] = 0;
                   // lw->has_vehicle[id_struct]=1;
                 } else {
                   debug_print(
-                      "[INFO] Updating vehicle with crt_time:%ld "
-                      "login_time:%ld "
+                      "[INFO] Updating vehicle with crt_time:%u "
+                      "login_time:%u "
                       "\n",
-                      lw->vehicle_login_time[id_struct].tv_sec,
-                      wup->updates[i].client_creation_time.tv_sec);
+                      lw->vehicle_login_time[id_struct],
+                      wup->updates[i].client_creation_time);
                   debug_print("Vehicle with id %d and x: %f y: %f z: %f \n",
                               wup->updates[i].id, wup->updates[i].x,
                               wup->updates[i].y, wup->updates[i].theta);
                   pthread_mutex_lock(&lw->vehicles[id_struct]->mutex);
-                  Vehicle_setXYTheta(lw->vehicles[id_struct], wup->updates[i].x,
-                                     wup->updates[i].y, wup->updates[i].theta);
-                  Vehicle_setForcesUpdate(lw->vehicles[id_struct],
-                                          wup->updates[i].translational_force,
-                                          wup->updates[i].rotational_force);
-                  World_manualUpdate(&lw->world, lw->vehicles[id_struct],
-                                     wup->updates[i].client_update_time);
+                  placeRemoteVehicle(lw, id_struct, &wup->updates[i],
+                                     wup->time, 0);
                   pthread_mutex_unlock(&lw->vehicles[id_struct]->mutex);
                   // lw->is_disabled[id_struct]=0;
                   // lw->has_vehicle[id_struct]=1;
@@ -487,6 +822,35 @@ void* UDPReceiver(void* args) {
         if (ignored > 0)
           debug_print("[INFO] Ignored %d vehicles based on position \n",
                       ignored);
+        // a vehicle missing from a datagram may be in one that was lost:
+        // only a whole snapshot tells who left
+        unsigned long long all = wup->num_fragments == SNAPSHOT_MAX_FRAGMENTS
+                                     ? ~0ull
+                                     : (1ull << wup->num_fragments) - 1;
+        if (fragments_received != all) {
+#ifdef _USE_SERVER_SIDE_FOG_
+          ackRoster();
+#endif
+          Packet_free(&wup->header);
+          break;
+        }
+#ifdef _USE_SERVER_SIDE_FOG_
+        if (wup->roster_full)
+          Roster_reset(&roster, members, num_members, wup->roster_sequence);
+        else if (roster.sequence == wup->roster_sequence &&
+                 roster.hash != wup->roster_hash)
+          // out of sync, acking nothing asks for the whole roster
+          Roster_init(&roster);
+        ackRoster();
+        // the members online keep their vehicles while they're out of the
+        // snapshots, everyone does until the roster is known
+        for (int i = 1; i < WORLDSIZE; i++) {
+          if (lw->ids[i] != -1 && CACHE_TEXTURE &&
+              (roster.sequence == 0 ||
+               Roster_status(&roster, lw->ids[i]) == Online))
+            mask[i] = TOUCHED;
+        }
+#endif
         for (int i = 0; i < WORLDSIZE; i++) {
           if (i == 0) continue;
           if (mask[i] == UNTOUCHED && lw->ids[i] != -1) {
@@ -494,18 +858,19 @@ void* UDPReceiver(void* args) {
                         lw->ids[i]);
             lw->users_online = lw->users_online - 1;
             if (!lw->has_vehicle[i]) goto END;
-            Image* im = lw->vehicles[i]->texture;
             if (!lw->is_disabled[i])
               World_detachVehicle(&lw->world, lw->vehicles[i]);
             Vehicle_destroy(lw->vehicles[i]);
-            if (im != NULL) Image_free(im);
+            TextureStore_release(&texture_store, lw->textures[i]);
+            lw->textures[i] = NULL;
             free(lw->vehicles[i]);
           END:
             lw->ids[i] = -1;
             lw->has_vehicle[i] = 0;
             lw->is_disabled[i] = 0;
           } else if (mask[i] != UNTOUCHED && lw->ids[i] != -1 &&
-                     updated[i] == UNTOUCHED && !lw->is_disabled[i]) {
+                     updated[i] == UNTOUCHED && !lw->is_disabled[i] &&
+                     !deferred[i]) {
             debug_print("[INFO] Temporary disabling a vehicle %d \n",
                         lw->ids[i]);
             lw->is_disabled[i] = 1;
@@ -551,8 +916,13 @@ int main(int argc, char** argv) {
     exit(EXIT_FAILURE);
   }
   fprintf(stdout, "[Main] Starting... \n");
+  // debug messages must not stall the UDP threads on stderr
+  Logger_init(stderr);
   last_update_time.tv_sec = -1;
-  last_world_update_time.tv_sec = -1;
+  last_world_update_time = 0;
+  ClockSync_init(&clock_sync);
+  LinkStats_init(&server_link);
+  ChatReceiver_init(&chat_receiver);
 
 #ifdef _USE_CACHED_TEXTURE_
   debug_print("[INFO] CACHE_TEXTURE option is enabled \n");
@@ -593,6 +963,8 @@ int main(int argc, char** argv) {
   ERROR_HELPER(ret, "Error: cannot handle SIGHUP");
   ret = sigaction(SIGINT, &sa, NULL);
   ERROR_HELPER(ret, "Error: cannot handle SIGINT");
+  ret = sigaction(SIGUSR1, &sa, NULL);
+  ERROR_HELPER(ret, "Error: cannot handle SIGUSR1");
 
   // setting up localWorld
   localWorld* local_world = (localWorld*)malloc(sizeof(localWorld));
@@ -601,17 +973,59 @@ int main(int argc, char** argv) {
     local_world->ids[i] = -1;
     local_world->has_vehicle[i] = 0;
     local_world->is_disabled[i] = 0;
+    local_world->last_input_time[i] = 0;
+    local_world->textures[i] = NULL;
   }
+  TextureStore_init(&texture_store, 0);
 
   // Talk with server
   fprintf(stdout, "[Main] Starting ID,map_elevation,map_texture requests \n");
   id = getID(socket_desc);
   local_world->ids[0] = id;
   fprintf(stdout, "[Main] ID number %d received \n", id);
-  Image* surface_elevation = getElevationMap(socket_desc);
-  fprintf(stdout, "[Main] Map elevation received \n");
-  Image* surface_texture = getTextureMap(socket_desc);
-  fprintf(stdout, "[Main] Map texture received \n");
+  if (exchangeCodecs(socket_desc) == -1)
+    fprintf(stderr, "[Main] Codecs negotiation failed, using raw images\n");
+  if (ASSET_CACHE && AssetCache_init(&asset_cache) == -1)
+    fprintf(stderr, "[Main] Can't use the disk cache, downloading the maps\n");
+  Image* surface_elevation = NULL;
+  Image* surface_texture = NULL;
+  TextureHash elevation_hash;
+  MapInfoPacket map_info;
+  if (MAP_STREAMING) {
+    // a map in the disk cache is still faster than streaming it
+    surface_elevation =
+        loadCachedMap(socket_desc, &asset_cache, MAP_ELEVATION_ID,
+                      &elevation_hash);
+    if (surface_elevation)
+      surface_texture =
+          loadCachedMap(socket_desc, &asset_cache, MAP_TEXTURE_ID, NULL);
+    if (surface_texture == NULL && getMapInfo(socket_desc, &map_info) == 0)
+      map_streaming = 1;
+  }
+  if (map_streaming) {
+    if (surface_elevation) Image_free(surface_elevation);
+    surface_elevation = NULL;
+    MapStream_init(&map_stream, &local_world->world, socket_desc, &tcp_mutex,
+                   &map_info);
+    // the tiles around the spawn point, the rest is streamed while playing
+    Surface* ground = &local_world->world.ground;
+    ret = MapStream_fetch(&map_stream, ground->rows / 2 * ground->row_scale,
+                          ground->cols / 2 * ground->col_scale,
+                          MAP_PRELOAD_RADIUS, map_stream.remaining);
+    ERROR_HELPER(ret, "[Main] Can't download the map tiles");
+    fprintf(stdout, "[Main] %d of %d map tiles received \n", ret,
+            map_info.tile_rows * map_info.tile_cols);
+  } else {
+    if (surface_elevation == NULL)
+      surface_elevation =
+          getCachedMap(socket_desc, &asset_cache, MAP_ELEVATION_ID,
+                       &elevation_hash);
+    fprintf(stdout, "[Main] Map elevation received \n");
+    if (surface_texture == NULL)
+      surface_texture =
+          getCachedMap(socket_desc, &asset_cache, MAP_TEXTURE_ID, NULL);
+    fprintf(stdout, "[Main] Map texture received \n");
+  }
   debug_print("[Main] Sending vehicle texture");
   sendVehicleTexture(socket_desc, my_texture, id);
   fprintf(stdout, "[Main] Client Vehicle texture sent \n");
@@ -621,14 +1035,25 @@ int main(int argc, char** argv) {
   }
 
   // create Vehicle
-  World_init(&local_world->world, surface_elevation, surface_texture, 0.5, 0.5,
-             0.5);
+  if (!map_streaming)
+    World_initCached(&local_world->world, surface_elevation, surface_texture,
+                     0.5, 0.5, 0.5,
+                     SURFACE_CACHE && asset_cache.enabled ? asset_cache.path
+                                                          : NULL,
+                     &elevation_hash);
 
   vehicle = (Vehicle*)malloc(sizeof(Vehicle));
+  local_world->world.clock = &clock_sync;
   Vehicle_init(vehicle, &local_world->world, id, my_texture);
+  Prediction_init(&prediction);
   World_addVehicle(&local_world->world, vehicle);
   local_world->vehicles[0] = vehicle;
   local_world->has_vehicle[0] = 1;
+  pthread_t map_streamer;
+  if (map_streaming) {
+    ret = pthread_create(&map_streamer, NULL, mapStreamer, NULL);
+    PTHREAD_ERROR_HELPER(ret, "[MAIN] pthread_create on thread map_streamer");
+  }
   if (SINGLEPLAYER) goto SKIP;
 
   // UDP Init
@@ -676,8 +1101,15 @@ SKIP:
     ret = pthread_join(message_sender, NULL);
     PTHREAD_ERROR_HELPER(ret, "pthread_join on thread message_sender failed");
   }
+  if (map_streaming) {
+    ret = pthread_join(map_streamer, NULL);
+    PTHREAD_ERROR_HELPER(ret, "pthread_join on thread map_streamer failed");
+    MapStream_destroy(&map_stream);
+  }
 
   fprintf(stdout, "[Main] Cleaning up... \n");
+  Logger_shutdown();
+  Latency_print(stdout);
   sendGoodbye(socket_desc, id);
   // Clean resources
   pthread_mutex_destroy(&time_lock);
@@ -685,14 +1117,14 @@ SKIP:
     if (local_world->ids[i] == -1) continue;
     if (i == 0) continue;
     local_world->users_online--;
-    Image* im = local_world->vehicles[i]->texture;
     World_detachVehicle(&local_world->world, local_world->vehicles[i]);
-    if (im != NULL) Image_free(im);
+    TextureStore_release(&texture_store, local_world->textures[i]);
     Vehicle_destroy(local_world->vehicles[i]);
     free(local_world->vehicles[i]);
   }
 
   free(local_world->vehicles);
+  TextureStore_destroy(&texture_store);
   World_destroy(&local_world->world);
   free(local_world);
   ret = close(socket_desc);
@@ -702,8 +1134,8 @@ SKIP:
     ERROR_HELPER(ret, "Failed to close UDP socket");
   }
   // images cleanup
-  Image_free(surface_elevation);
-  Image_free(surface_texture);
+  if (surface_elevation) Image_free(surface_elevation);
+  if (surface_texture) Image_free(surface_texture);
   Image_free(my_texture);
   return 0;
 }
@@ -21,10 +21,8 @@
            do { if (DEBUG) fprintf(stderr, fmt, __VA_ARGS__); } while (0)
 **/
 
-#define debug_print(fmt, ...)                       \
-  do {                                              \
-    if (DEBUG) fprintf(stderr, fmt, ##__VA_ARGS__); \
-  } while (0)
+// goes through the asynchronous logger, compiled out unless DEBUG is set
+#define debug_print(fmt, ...) LOG_DEBUG(fmt, ##__VA_ARGS__)
 
 /* Configuration parameters */
 #define SERVER_ADDRESS "127.0.0.1"
@@ -42,8 +40,81 @@
 #define AFK_RANGE 1
 #define MAX_AFK_COUNTER 20
 #define CACHE_TEXTURE 1
+#define TEXTURE_STORE_BUCKETS 64
+#define IMAGE_MAX_SIDE 4096  // pixels, an uploaded image can't be larger
+#define ASSET_CACHE 1  // keep the received textures on disk between sessions
+#define ASSET_CACHE_DIR "protogame"
+#define MAP_STREAMING 1  // download the map in tiles, around the vehicle first
+#define MAP_TILE_SIZE 64  // elevation points on each side of a tile
+#define MAP_PRELOAD_RADIUS 1  // tiles around the spawn loaded before playing
+#define MAP_STREAM_RADIUS 8   // tiles around the vehicle kept streaming
+#define SURFACE_CACHE 1  // keep the ground built from the maps on disk
+#define SURFACE_MAX_THREADS 8  // threads building the ground
+#define SURFACE_MIN_ROWS 64    // rows built by each of them at least
+#define WALL_THRESHOLD 0.5  // elevation of the walls, in [0, 1]
+#define MOVE_BATCH_SIZE 64  // vehicle updates validated together
+#define MOVE_MAX_SPEED 150  // world units per second a vehicle can drive
+#define MOVE_MAX_TURN 10    // radians per second a vehicle can turn
+#define MOVE_MAX_DT 0.5     // seconds of movement allowed after a silence
+#define MOVE_TOLERANCE 1    // slack for the clocks and the simulation steps
+#define MOVE_TELEPORT_FACTOR 4  // jumps past this many envelopes are rejected
+#define MOVE_VEHICLE_RADIUS 0.25
+#define INPUT_UPLINK 1  // send the inputs only, the server simulates the pose
+#define INPUT_RATE 30   // input frames per second, each one a simulation step
+#define WORLD_TIME_SCALE 10  // simulated seconds in a second of play
+#define INPUT_REDUNDANCY 4  // frames repeated in every packet against loss
+#define INPUT_FORCE_SCALE 1000  // forces are sent as multiples of 1/scale
+#define INPUT_MAX_BURST 8  // frames a client can catch up on after a stall
+#define PREDICTION_FRAMES 64  // input frames kept until the server acks them
+#define PREDICTION_TOLERANCE 0.01  // prediction error that isn't corrected
+#define SNAPSHOT_INTERPOLATION 1  // draw the other vehicles between snapshots
+#define SNAPSHOT_BUFFER_SIZE 8     // server snapshots kept for each vehicle
+#define INTERPOLATION_DELAY 0.45   // seconds the other vehicles are drawn late
+#define MAX_EXTRAPOLATION 0.25     // seconds of motion guessed after a loss
+#define CLOCK_SYNC_SAMPLES 8     // pings the server clock is estimated from
+#define CLOCK_SYNC_INTERVAL 1000  // ms between two pings, once synchronized
+#define LINK_HISTORY 64  // packets whose send time is kept for the round trip
+#define LINK_MIN_INTERVAL 50    // ms between two updates, for the busiest peer
+#define LINK_MAX_INTERVAL 500   // and for an idle or congested one
+#define LINK_START_INTERVAL 300
+#define LINK_RATE_STEP 1        // updates per second gained at each send
+#define LINK_QUEUE_DELAY 100    // ms of round trip over the minimum: congested
+#define LINK_LOSS_THRESHOLD 0.1  // packets lost over this share: congested
+#define LINK_LOSS_GAIN 0.03125   // weight of a packet in the loss averages
+#define LINK_FAST_SPEED 3  // vehicle speed that needs the most updates
+#define LINK_CROWD 3       // vehicles around one that need the most updates
+#define PACKET_MTU 1200  // bytes of a datagram, larger snapshots are split
+#define SNAPSHOT_MAX_FRAGMENTS 64  // datagrams of a snapshot, bits of a mask
+#define SNAPSHOT_BUDGET 3600  // bytes of a snapshot, statuses included
+#define PRIORITY_MAX_ENTITIES WORLDSIZE  // vehicles competing for a snapshot
+#define PRIORITY_DISTANCE 1  // distance that halves the priority of a vehicle
+#define PRIORITY_SPEED 3     // speed that doubles it
+#define DEAD_RECKONING 1  // send a vehicle only when its extrapolation strays
+#define DR_POSITION_ERROR 0.1  // world units the extrapolation can be off
+#define DR_HEADING_ERROR 0.1   // radians
+#define DR_KEEPALIVE 1000      // ms a vehicle can go without being sent
+#define ROSTER_LOG 64  // presence events kept to catch up the clients
+#define ROSTER_SYNC_INTERVAL 1000  // ms between two whole rosters to a client
+#define CHAT_LOG 64     // chat records kept to deliver and retransmit
+#define CHAT_WINDOW 32  // records in flight to a client, at most 32
+#define CHAT_MIN_RTO 200  // ms before a record is sent again, at least
+#define MESSAGE_RING_SIZE 256  // chat messages waiting, the next are dropped
 #define SERVER_SIDE_POSITION_CHECK 1
 #define COLLISION_RANGE 0.5
 #define MAX_TIME_WITHOUT_VEHICLEUPDATE 10
 #define MAX_TIME_WITHOUT_WORLDUPDATE 10
+#define METRICS_SOCKET_PATH "/tmp/protogame_server.sock"
+#define METRICS_DUMP_FILE ""  // empty string disables the periodic dump
+#define METRICS_INTERVAL 1
+#define METRICS_MAX_THREADS 64
+#define TRACING 1
+#define TRACE_BUFFER_SIZE 4096  // events kept for each thread
+#define TRACE_MAX_THREADS 64
+#define TRACE_FILE "protogame_trace.json"
+#define LOG_LEVEL (DEBUG ? 0 : 1)  // 0 debug, 1 info, 2 warning, 3 error
+#define LOG_QUEUE_SIZE 256         // messages buffered for each thread
+#define LOG_LINE_LEN 256
+#define LOG_MAX_THREADS 64
+#define LOG_FLUSH_INTERVAL 10  // ms the writer sleeps when the queues are empty
+#include "../game_framework/logger.h"
 #endif
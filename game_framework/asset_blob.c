@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include "asset_blob.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int AssetBlob_openFile(void) {
+  int fd = memfd_create("protogame_asset", MFD_CLOEXEC);
+  if (fd >= 0 || errno != ENOSYS) return fd;
+  // kernels without memfd, an unlinked temporary file works the same way
+  char template[] = "/tmp/protogame_assetXXXXXX";
+  fd = mkstemp(template);
+  if (fd >= 0) unlink(template);
+  return fd;
+}
+
+AssetBlob* AssetBlob_create(const Image* img, PacketType type,
+                            ImageEncoding encoding) {
+  if (img == NULL) return NULL;
+  // PNM header plus the pixels, 6 bytes per pixel at most (RGB16)
+  int capacity = img->rows * img->cols * 6 + 64;
+  char* buffer = (char*)malloc(capacity);
+  if (buffer == NULL) return NULL;
+  int size = encoding == EncodingRaw
+                 ? Image_serialize(img, buffer, capacity)
+                 : ImageCodec_encode(img, encoding, buffer, capacity);
+  int fd = size > 0 ? AssetBlob_openFile() : -1;
+  if (fd < 0) {
+    free(buffer);
+    return NULL;
+  }
+  int written = 0;
+  while (written < size) {
+    int ret = write(fd, buffer + written, size - written);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0) {
+      close(fd);
+      free(buffer);
+      return NULL;
+    }
+    written += ret;
+  }
+  free(buffer);
+  AssetBlob* blob = (AssetBlob*)malloc(sizeof(AssetBlob));
+  blob->fd = fd;
+  blob->size = size;
+  blob->type = type;
+  blob->encoding = encoding;
+  blob->refcount = 1;
+  return blob;
+}
+
+AssetBlob* AssetBlob_createCompressed(const Image* img, PacketType type) {
+  if (img == NULL) return NULL;
+  ImageEncoding encoding = ImageCodec_choose(img);
+  if (encoding == EncodingRaw) return NULL;
+  return AssetBlob_create(img, type, encoding);
+}
+
+AssetBlob* AssetBlob_retain(AssetBlob* blob) {
+  if (blob != NULL) __atomic_add_fetch(&blob->refcount, 1, __ATOMIC_RELAXED);
+  return blob;
+}
+
+void AssetBlob_release(AssetBlob* blob) {
+  if (blob == NULL) return;
+  if (__atomic_sub_fetch(&blob->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+  close(blob->fd);
+  free(blob);
+}
+
+int AssetBlob_send(AssetBlob* blob, int socket, int id) {
+  // same layout produced by Packet_serialize, the image pointer is
+  // meaningless on the other side
+  ImagePacket packet;
+  memset(&packet, 0, sizeof(ImagePacket));
+  packet.header.type = blob->type;
+  packet.header.size = sizeof(ImagePacket) + blob->size;
+  packet.id = id;
+  packet.encoding = blob->encoding;
+  packet.image = NULL;
+  int bytes_sent = 0;
+  while (bytes_sent < (int)sizeof(ImagePacket)) {
+    int ret = send(socket, (char*)&packet + bytes_sent,
+                   sizeof(ImagePacket) - bytes_sent, MSG_MORE);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0) return -1;
+    bytes_sent += ret;
+  }
+  // the offset is private to this call, concurrent senders don't interfere
+  off_t offset = 0;
+  while (offset < blob->size) {
+    ssize_t ret = sendfile(socket, blob->fd, &offset, blob->size - offset);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0) return -1;
+  }
+  return bytes_sent + blob->size;
+}
+
+AssetBlob* AssetBlob_pick(AssetBlob* raw, AssetBlob* compressed, int codecs) {
+  if (compressed != NULL && (codecs & (1 << compressed->encoding)))
+    return AssetBlob_retain(compressed);
+  return AssetBlob_retain(raw);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "../av_framework/image.h"
+#include "../av_framework/image_codec.h"
+#include "protogame_protocol.h"
+
+// Immutable serialized image kept in a memfd, sent with sendfile so serving a
+// map or a vehicle texture doesn't copy it through user space.
+// Blobs are refcounted: a sender keeps its reference while the blob is being
+// transmitted even if the owner replaces it in the meantime.
+typedef struct AssetBlob {
+  int fd;
+  int size;  // bytes of the serialized image, the packet header excluded
+  PacketType type;
+  ImageEncoding encoding;
+  int refcount;
+} AssetBlob;
+
+// serializes the image once with the given encoding, returns NULL on error or
+// if the encoding doesn't make the image smaller. The blob starts with a
+// reference owned by the caller
+AssetBlob* AssetBlob_create(const Image* img, PacketType type,
+                            ImageEncoding encoding);
+// the image encoded with the codec that suits it best, NULL if none makes it
+// smaller
+AssetBlob* AssetBlob_createCompressed(const Image* img, PacketType type);
+AssetBlob* AssetBlob_retain(AssetBlob* blob);
+// drops a reference, the blob is destroyed with the last one
+void AssetBlob_release(AssetBlob* blob);
+
+// sends the blob as an ImagePacket with the given id, returns the number of
+// bytes sent or -1 on error
+int AssetBlob_send(AssetBlob* blob, int socket, int id);
+
+// the compressed blob if not NULL and the peer can decode it, else raw.
+// Returns a new reference
+AssetBlob* AssetBlob_pick(AssetBlob* raw, AssetBlob* compressed, int codecs);
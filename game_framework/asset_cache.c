@@ -0,0 +1,77 @@
+#include "asset_cache.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// mkdir -p
+static int AssetCache_makePath(char* path) {
+  for (char* p = path + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    int ret = mkdir(path, 0700);
+    *p = '/';
+    if (ret == -1 && errno != EEXIST) return -1;
+  }
+  if (mkdir(path, 0700) == -1 && errno != EEXIST) return -1;
+  return 0;
+}
+
+int AssetCache_init(AssetCache* cache) {
+  cache->enabled = 0;
+  const char* base = getenv("XDG_CACHE_HOME");
+  int ret;
+  if (base != NULL && base[0] == '/') {
+    ret = snprintf(cache->path, sizeof(cache->path), "%s/%s", base,
+                   ASSET_CACHE_DIR);
+  } else {
+    const char* home = getenv("HOME");
+    if (home == NULL) return -1;
+    ret = snprintf(cache->path, sizeof(cache->path), "%s/.cache/%s", home,
+                   ASSET_CACHE_DIR);
+  }
+  if (ret >= sizeof(cache->path) || AssetCache_makePath(cache->path) == -1)
+    return -1;
+  cache->enabled = 1;
+  return 0;
+}
+
+static void AssetCache_filename(const AssetCache* cache,
+                                const TextureHash* hash, char* dest) {
+  char hex[SHA256_DIGEST_LEN * 2 + 1];
+  TextureHash_toString(hash, hex, sizeof(hex));
+  snprintf(dest, PATH_MAX, "%s/%s.pnm", cache->path, hex);
+}
+
+Image* AssetCache_load(const AssetCache* cache, const TextureHash* hash) {
+  if (!cache->enabled) return NULL;
+  char filename[PATH_MAX];
+  AssetCache_filename(cache, hash, filename);
+  if (access(filename, F_OK) == -1) return NULL;
+  Image* img = Image_load(filename);
+  TextureHash loaded;
+  if (img != NULL) TextureHash_compute(img, &loaded);
+  if (img == NULL || !TextureHash_equals(&loaded, hash)) {
+    // truncated or tampered with, it will be downloaded again
+    if (img != NULL) Image_free(img);
+    unlink(filename);
+    return NULL;
+  }
+  return img;
+}
+
+int AssetCache_store(const AssetCache* cache, const TextureHash* hash,
+                     const Image* img) {
+  if (!cache->enabled) return -1;
+  char filename[PATH_MAX], tmp_filename[PATH_MAX + 16];
+  AssetCache_filename(cache, hash, filename);
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.%d", filename, getpid());
+  // another client may be storing the same texture, rename is atomic
+  if (!Image_save(img, tmp_filename) || rename(tmp_filename, filename) == -1) {
+    unlink(tmp_filename);
+    return -1;
+  }
+  return 0;
+}
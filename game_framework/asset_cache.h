@@ -0,0 +1,25 @@
+#pragma once
+#include <limits.h>
+#include "../av_framework/image.h"
+#include "texture_store.h"
+
+// On-disk cache of the maps and vehicle textures received from the server,
+// one PNM file per texture named after its content hash. It survives the
+// client restarts, a texture is downloaded again only if its hash changes.
+// The server keeps the ground it builds out of the map in the same place
+typedef struct AssetCache {
+  char path[PATH_MAX - 80];  // room for the file names
+  char enabled;
+} AssetCache;
+
+// uses $XDG_CACHE_HOME/ASSET_CACHE_DIR, or ~/.cache/ASSET_CACHE_DIR, creating
+// it if needed. Returns -1 and disables the cache if no directory is usable
+int AssetCache_init(AssetCache* cache);
+
+// returns the cached texture or NULL on a miss. The file is mapped and
+// checked against the hash, a corrupted entry is deleted
+Image* AssetCache_load(const AssetCache* cache, const TextureHash* hash);
+
+// stores img under its hash, returns -1 on error
+int AssetCache_store(const AssetCache* cache, const TextureHash* hash,
+                     const Image* img);
@@ -0,0 +1,102 @@
+#include "chat_channel.h"
+#include <string.h>
+
+void ChatLog_init(ChatLog* log) { memset(log, 0, sizeof(ChatLog)); }
+
+void ChatLog_append(ChatLog* log, const MessageBroadcast* m) {
+  MessageBroadcast* record = &log->records[++log->sequence % CHAT_LOG];
+  *record = *m;
+  record->sequence = log->sequence;
+  if (log->size < CHAT_LOG) log->size++;
+}
+
+unsigned int ChatLog_first(const ChatLog* log) {
+  return log->sequence - log->size + 1;
+}
+
+void ChatSender_init(ChatSender* s) { memset(s, 0, sizeof(ChatSender)); }
+
+int ChatSender_collect(ChatSender* s, const ChatLog* log, unsigned int now,
+                       unsigned int rto, int max_bytes,
+                       MessageBroadcast* out) {
+  // the records the client is missing aren't kept anymore
+  unsigned int first = ChatLog_first(log);
+  if ((int)(first - (s->ack + 1)) > 0) {
+    s->ack = first - 1;
+    s->selective = 0;
+  }
+  int n = 0;
+  for (unsigned int sequence = s->ack + 1;
+       (int)(sequence - s->ack) <= CHAT_WINDOW &&
+       (int)(sequence - log->sequence) <= 0;
+       sequence++) {
+    int distance = sequence - s->ack;
+    if (distance >= 2 && (s->selective >> (distance - 2) & 1)) continue;
+    int slot = sequence % CHAT_WINDOW;
+    if (s->sent_sequence[slot] == sequence &&
+        (int)(now - s->sent_time[slot]) < (int)rto)
+      continue;
+    const MessageBroadcast* record = &log->records[sequence % CHAT_LOG];
+    int size = MessageBroadcast_size(record);
+    // the next datagram takes the rest, in order
+    if (size > max_bytes) break;
+    max_bytes -= size;
+    out[n++] = *record;
+    if (s->sent_sequence[slot] == sequence) s->retransmits++;
+    s->sent_sequence[slot] = sequence;
+    s->sent_time[slot] = now;
+  }
+  return n;
+}
+
+void ChatSender_ack(ChatSender* s, unsigned int ack, unsigned int selective) {
+  int ahead = (int)(ack - s->ack);
+  if (ahead < 0) return;
+  if (ahead > 0) {
+    s->ack = ack;
+    s->selective = selective;
+  } else {
+    s->selective |= selective;
+  }
+}
+
+void ChatReceiver_init(ChatReceiver* r) {
+  memset(r, 0, sizeof(ChatReceiver));
+}
+
+void ChatReceiver_skipTo(ChatReceiver* r, unsigned int first) {
+  if (r->next == 0 || (int)(first - r->next) > 0) r->next = first;
+}
+
+int ChatReceiver_receive(ChatReceiver* r, const MessageBroadcast* m) {
+  int distance = (int)(m->sequence - r->next);
+  if (r->next == 0 || distance < 0 || distance >= CHAT_WINDOW) return 0;
+  int slot = m->sequence % CHAT_WINDOW;
+  if (r->received[slot] && r->window[slot].sequence == m->sequence) return 0;
+  r->window[slot] = *m;
+  r->received[slot] = 1;
+  return 1;
+}
+
+int ChatReceiver_pop(ChatReceiver* r, MessageBroadcast* m) {
+  int slot = r->next % CHAT_WINDOW;
+  if (r->next == 0 || !r->received[slot] ||
+      r->window[slot].sequence != r->next)
+    return 0;
+  *m = r->window[slot];
+  r->received[slot] = 0;
+  r->next++;
+  return 1;
+}
+
+void ChatReceiver_ack(const ChatReceiver* r, unsigned int* ack,
+                      unsigned int* selective) {
+  *ack = r->next - 1;
+  *selective = 0;
+  for (int i = 0; i + 2 <= CHAT_WINDOW; i++) {
+    unsigned int sequence = r->next + 1 + i;
+    int slot = sequence % CHAT_WINDOW;
+    if (r->received[slot] && r->window[slot].sequence == sequence)
+      *selective |= 1u << i;
+  }
+}
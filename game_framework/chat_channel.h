@@ -0,0 +1,66 @@
+#pragma once
+#include "../common/common.h"
+#include "protogame_protocol.h"
+
+// Reliable ordered chat over the UDP socket. The server numbers every chat
+// record and keeps the last CHAT_LOG ones; each client acks what it got,
+// cumulatively and selectively, and is sent only the records it didn't ack,
+// again after a timeout driven by its round trip. A client that falls
+// behind the log skips the records that aren't kept anymore
+typedef struct ChatLog {
+  MessageBroadcast records[CHAT_LOG];  // ring, by sequence % CHAT_LOG
+  unsigned int sequence;  // of the last record, 0 if none
+  int size;
+} ChatLog;
+
+void ChatLog_init(ChatLog* log);
+
+// numbers a copy of m as the next record
+void ChatLog_append(ChatLog* log, const MessageBroadcast* m);
+
+// sequence of the oldest record kept, sequence + 1 if none
+unsigned int ChatLog_first(const ChatLog* log);
+
+// server side, the delivery of the log to a client
+typedef struct ChatSender {
+  unsigned int ack;        // the client has every record up to this one
+  unsigned int selective;  // bit i: it has ack + 2 + i too
+  // the records in flight, by sequence % CHAT_WINDOW
+  unsigned int sent_sequence[CHAT_WINDOW];
+  unsigned int sent_time[CHAT_WINDOW];
+  unsigned int retransmits;  // records sent again, in total
+} ChatSender;
+
+// the client gets the records kept when it's first sent something
+void ChatSender_init(ChatSender* s);
+
+// copies in out the records to send at now, oldest first: the ones never
+// sent or sent at least rto ms ago, in the window after the ack, that fit
+// in max_bytes. Returns how many
+int ChatSender_collect(ChatSender* s, const ChatLog* log, unsigned int now,
+                       unsigned int rto, int max_bytes, MessageBroadcast* out);
+
+// an ack of the client, the older ones are ignored
+void ChatSender_ack(ChatSender* s, unsigned int ack, unsigned int selective);
+
+// client side, puts the records back in order
+typedef struct ChatReceiver {
+  unsigned int next;  // sequence of the next record to deliver, 0 at first
+  MessageBroadcast window[CHAT_WINDOW];  // by sequence % CHAT_WINDOW
+  char received[CHAT_WINDOW];
+} ChatReceiver;
+
+void ChatReceiver_init(ChatReceiver* r);
+
+// the records before first won't come, stops waiting for them
+void ChatReceiver_skipTo(ChatReceiver* r, unsigned int first);
+
+// stores a record, returns 0 if already seen or out of the window
+int ChatReceiver_receive(ChatReceiver* r, const MessageBroadcast* m);
+
+// takes the next record in order, returns 0 if it didn't come yet
+int ChatReceiver_pop(ChatReceiver* r, MessageBroadcast* m);
+
+// the ack to send back, see ChatAckPacket
+void ChatReceiver_ack(const ChatReceiver* r, unsigned int* ack,
+                      unsigned int* selective);
@@ -3,21 +3,46 @@
 #include <time.h>
 #include "../av_framework/image.h"
 #include "../common/common.h"
+#include "chat_channel.h"
+#include "dead_reckoning.h"
+#include "link_stats.h"
+#include "priority_accumulator.h"
+#include "texture_store.h"
 #include "vehicle.h"
 typedef struct ClientListItem {
   struct ClientListItem* next;
   int id;
   float x, y, theta, prev_x, prev_y, x_shift, y_shift;
   struct sockaddr_in user_addr_tcp, user_addr_udp;
-  struct timeval last_update_time, creation_time, world_update_time;
+  struct timeval last_update_time, creation_time;
+  // login and send time of the last input applied, on the shared timeline
+  unsigned int creation_clock, input_clock;
+  struct timeval ingest_time, apply_time;  // latency accounting
+  char snapshot_pending;
+  // input uplink: last frame applied, frames that can still be applied
+  unsigned int input_sequence;
+  float input_budget;
+  struct timeval input_time;
+  // quality of the UDP link, the next WorldUpdatePacket is due at next_send
+  LinkStats link;
+  unsigned int next_send;
+  // of the other vehicles, to fit them in its snapshots
+  PriorityAccumulator priorities;
+  // last presence event it applied, when it was last sent the whole roster
+  unsigned int roster_ack, roster_sync_time;
+  // the state of the other vehicles it was last sent, by id % WORLDSIZE
+  DeadReckoning replicas[WORLDSIZE];
   char is_udp_addr_ready;
   int afk_counter;
   char inside_world;
   char inside_chat;
+  ChatSender chat;  // delivery of the chat records, once inside_chat
   char username[USERNAME_LEN];
   Vehicle* vehicle;
-  Image* v_texture;
+  Image* v_texture;  // shared, owned by v_texture_item
+  TextureStoreItem* v_texture_item;
   float rotational_force, translational_force;
+  float translational_velocity, rotational_velocity;
 } ClientListItem;
 
 typedef struct ClientListHead {
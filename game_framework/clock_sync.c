@@ -0,0 +1,57 @@
+#include "clock_sync.h"
+#include <string.h>
+#include <time.h>
+
+unsigned int Clock_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned int)(now.tv_sec * 1000ULL + now.tv_nsec / 1000000);
+}
+
+void ClockSync_init(ClockSync* s) { memset(s, 0, sizeof(ClockSync)); }
+
+int ClockSync_shouldPing(ClockSync* s, unsigned int now) {
+  int interval = s->count < CLOCK_SYNC_SAMPLES ? CLOCK_SYNC_INTERVAL / 10
+                                                : CLOCK_SYNC_INTERVAL;
+  if (s->last_ping != 0 && (int)(now - s->last_ping) < interval) return 0;
+  s->last_ping = now;
+  return 1;
+}
+
+int ClockSync_update(ClockSync* s, unsigned int client_send,
+                     unsigned int server_receive, unsigned int server_send,
+                     unsigned int receive) {
+  int rtt = (int)(receive - client_send) - (int)(server_send - server_receive);
+  if (rtt < 0 || (int)(server_send - server_receive) < 0) return 0;
+  ClockSyncSample* sample = &s->samples[s->next];
+  // same as ((server_receive - client_send) + (server_send - receive)) / 2
+  // without overflowing
+  sample->offset = (int)(server_receive - client_send) - rtt / 2;
+  sample->rtt = rtt;
+  s->next = (s->next + 1) % CLOCK_SYNC_SAMPLES;
+  if (s->count < CLOCK_SYNC_SAMPLES)
+    __atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELAXED);
+  const ClockSyncSample* best = &s->samples[0];
+  for (int i = 1; i < s->count; i++)
+    if (s->samples[i].rtt < best->rtt) best = &s->samples[i];
+  __atomic_store_n(&s->offset, best->offset, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->rtt, best->rtt, __ATOMIC_RELAXED);
+  return 1;
+}
+
+unsigned int ClockSync_toServer(const ClockSync* s, unsigned int local) {
+  return local + __atomic_load_n(&s->offset, __ATOMIC_RELAXED);
+}
+
+unsigned int ClockSync_now(ClockSync* s) {
+  unsigned int now = ClockSync_toServer(s, Clock_now());
+  // before the first sample it's just the local clock
+  if (!ClockSync_ready(s)) return now;
+  unsigned int last = __atomic_load_n(&s->last_now, __ATOMIC_RELAXED);
+  do {
+    // a smaller offset would move it back, it waits for the clock instead
+    if (last != 0 && (int)(now - last) < 0) return last;
+  } while (!__atomic_compare_exchange_n(&s->last_now, &last, now, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return now;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "../common/common.h"
+
+// Shared timeline: milliseconds of the server monotonic clock. Timestamps
+// on it wrap every ~49 days, compare them with (int)(a - b)
+unsigned int Clock_now(void);
+
+typedef struct ClockSyncSample {
+  int offset;  // server clock minus local clock, ms
+  int rtt;     // ms, without the time spent on the server
+} ClockSyncSample;
+
+// NTP-like estimate of the server clock on a client. The offset comes from
+// the sample with the lowest round trip among the last CLOCK_SYNC_SAMPLES,
+// the one with the least queueing delay
+typedef struct ClockSync {
+  ClockSyncSample samples[CLOCK_SYNC_SAMPLES];
+  int next, count;
+  int offset, rtt;
+  unsigned int last_ping;
+  unsigned int last_now;  // the timeline never goes back
+} ClockSync;
+
+void ClockSync_init(ClockSync* s);
+
+// returns 1 if a ping is due at local time now (Clock_now), often until
+// there are enough samples and every CLOCK_SYNC_INTERVAL ms afterwards
+int ClockSync_shouldPing(ClockSync* s, unsigned int now);
+
+// adds the sample of a ping sent at client_send (local), received by the
+// server at server_receive and answered at server_send (timeline), whose
+// reply got back at receive (local). Returns 0 if it's not consistent
+int ClockSync_update(ClockSync* s, unsigned int client_send,
+                     unsigned int server_receive, unsigned int server_send,
+                     unsigned int receive);
+
+// 1 once the server clock is known
+static inline int ClockSync_ready(const ClockSync* s) {
+  return __atomic_load_n(&s->count, __ATOMIC_RELAXED) > 0;
+}
+
+// local time on the timeline
+unsigned int ClockSync_toServer(const ClockSync* s, unsigned int local);
+
+// current time on the timeline, never smaller than the last one returned
+unsigned int ClockSync_now(ClockSync* s);
@@ -0,0 +1,59 @@
+#include "dead_reckoning.h"
+#include <math.h>
+#include <string.h>
+
+// below this turn in a frame the vehicle goes straight
+#define DR_MIN_TURN 1e-4
+
+// shortest turn from a to b
+static float DeadReckoning_turn(float a, float b) {
+  float d = fmodf(b - a, 2 * M_PI);
+  if (d > M_PI) d -= 2 * M_PI;
+  if (d < -M_PI) d += 2 * M_PI;
+  return d;
+}
+
+void DeadReckoning_init(DeadReckoning* d) {
+  memset(d, 0, sizeof(DeadReckoning));
+}
+
+void DeadReckoning_set(DeadReckoning* d, const ClientUpdate* state,
+                       unsigned int time) {
+  d->state = *state;
+  d->time = time;
+  d->valid = 1;
+}
+
+void DeadReckoning_predict(const DeadReckoning* d, unsigned int time,
+                           ClientUpdate* predicted) {
+  *predicted = d->state;
+  float frames = (int)(time - d->time) * INPUT_RATE / 1000.0;
+  if (frames <= 0) return;
+  // World_applyInput on flat ground with constant velocities: every input
+  // frame the vehicle drives WORLD_TIME_SCALE / INPUT_RATE simulated
+  // seconds along its heading, then turns. The steps add up to a chord of
+  // the arc, whose length is a sum of cosines
+  float step = (float)WORLD_TIME_SCALE / INPUT_RATE;
+  float v = d->state.translational_velocity * step;
+  float w = d->state.rotational_velocity * step;
+  float along = frames;
+  float heading = d->state.theta;
+  if (fabsf(w) >= DR_MIN_TURN) {
+    along = sinf(frames * w / 2) / sinf(w / 2);
+    heading += (frames - 1) * w / 2;
+  }
+  predicted->x += v * along * cosf(heading);
+  predicted->y += v * along * sinf(heading);
+  predicted->theta = d->state.theta + w * frames;
+}
+
+int DeadReckoning_diverged(const DeadReckoning* d, const ClientUpdate* state,
+                           unsigned int time) {
+  if (!d->valid || (int)(time - d->time) >= DR_KEEPALIVE) return 1;
+  ClientUpdate predicted;
+  DeadReckoning_predict(d, time, &predicted);
+  return hypotf(state->x - predicted.x, state->y - predicted.y) >
+             DR_POSITION_ERROR ||
+         fabsf(DeadReckoning_turn(predicted.theta, state->theta)) >
+             DR_HEADING_ERROR;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "../common/common.h"
+#include "protogame_protocol.h"
+
+// What a peer was last sent of a vehicle. Both ends extrapolate it the same
+// way, keeping its velocities, so the sender knows what the peer is drawing
+// and sends the vehicle again only when the true state strays from it
+typedef struct DeadReckoning {
+  ClientUpdate state;
+  unsigned int time;  // ms on the server timeline the state was taken
+  char valid;
+} DeadReckoning;
+
+void DeadReckoning_init(DeadReckoning* d);
+
+// state is the one sent to the peer, taken at time
+void DeadReckoning_set(DeadReckoning* d, const ClientUpdate* state,
+                       unsigned int time);
+
+// fills the pose of predicted with the one extrapolated at time, the rest
+// is copied from the last state
+void DeadReckoning_predict(const DeadReckoning* d, unsigned int time,
+                           ClientUpdate* predicted);
+
+// the state at time is farther than DR_POSITION_ERROR or DR_HEADING_ERROR
+// from the prediction, or DR_KEEPALIVE ms have passed since the last one:
+// it must be sent. Always true if nothing was sent yet
+int DeadReckoning_diverged(const DeadReckoning* d, const ClientUpdate* state,
+                           unsigned int time);
@@ -0,0 +1,139 @@
+#include "distance_field.h"
+#include <math.h>
+#include <stdlib.h>
+
+// steps shorter than this fraction of a cell count as a contact
+#define SWEEP_MIN_STEP 1e-3f
+
+// squared distance transform of n samples spaced s apart (Felzenszwalb and
+// Huttenlocher): d[p] = min_q ((p - q) * s)^2 + f[q]. v and z are scratch
+// arrays of n and n + 1 elements
+static void DistanceField_transform(const double* f, double* d, int n,
+                                    double s, int* v, double* z) {
+  int k = -1;
+  for (int q = 0; q < n; q++) {
+    if (f[q] == INFINITY) continue;
+    double pq = q * s;
+    double sq = -INFINITY;
+    // drop the parabolas hidden by the one of q
+    while (k >= 0) {
+      double pv = v[k] * s;
+      sq = ((f[q] + pq * pq) - (f[v[k]] + pv * pv)) / (2 * (pq - pv));
+      if (sq > z[k]) break;
+      k--;
+      sq = -INFINITY;
+    }
+    k++;
+    v[k] = q;
+    z[k] = sq;
+  }
+  if (k < 0) {
+    // no walls on this line
+    for (int q = 0; q < n; q++) d[q] = INFINITY;
+    return;
+  }
+  z[k + 1] = INFINITY;
+  int j = 0;
+  for (int q = 0; q < n; q++) {
+    double p = q * s;
+    while (z[j + 1] < p) j++;
+    double delta = p - v[j] * s;
+    d[q] = delta * delta + f[v[j]];
+  }
+}
+
+int DistanceField_init(DistanceField* f, Image* elevation, float threshold,
+                       float row_scale, float col_scale) {
+  Image* float_image = Image_convert(elevation, FLOATMONO);
+  if (!float_image) return -1;
+  int rows = elevation->rows, cols = elevation->cols;
+  // along the columns the nearest wall is the first one above or below,
+  // both scans go row by row. steps > rows means no wall in the column
+  int* steps = (int*)malloc(sizeof(int) * rows * cols);
+  for (int r = 0; r < rows; r++) {
+    float* heights = (float*)float_image->row_data[r];
+    int* row = steps + r * cols;
+    int* above = row - cols;
+    for (int c = 0; c < cols; c++)
+      row[c] = heights[c] >= threshold ? 0 : r ? above[c] + 1 : rows + 1;
+  }
+  Image_free(float_image);
+  for (int r = rows - 2; r >= 0; r--) {
+    int* row = steps + r * cols;
+    int* below = row + cols;
+    for (int c = 0; c < cols; c++)
+      if (below[c] + 1 < row[c]) row[c] = below[c] + 1;
+  }
+  // then along the rows, on the squared distances
+  double* line = (double*)malloc(sizeof(double) * cols);
+  double* out = (double*)malloc(sizeof(double) * cols);
+  double* z = (double*)malloc(sizeof(double) * (cols + 1));
+  int* v = (int*)malloc(sizeof(int) * cols);
+  f->distances = (float*)malloc(sizeof(float) * rows * cols);
+  for (int r = 0; r < rows; r++) {
+    int* row = steps + r * cols;
+    for (int c = 0; c < cols; c++) {
+      double d = row_scale * row[c];
+      line[c] = row[c] > rows ? INFINITY : d * d;
+    }
+    DistanceField_transform(line, out, cols, col_scale, v, z);
+    // the nearest edge is one step past the first and the last point
+    float edge_r = row_scale * (r + 1 < rows - r ? r + 1 : rows - r);
+    for (int c = 0; c < cols; c++) {
+      float edge_c = col_scale * (c + 1 < cols - c ? c + 1 : cols - c);
+      float d = sqrt(out[c]);
+      if (d > edge_r) d = edge_r;
+      if (d > edge_c) d = edge_c;
+      f->distances[r * cols + c] = d;
+    }
+  }
+  free(steps);
+  free(line);
+  free(out);
+  free(z);
+  free(v);
+  f->rows = rows;
+  f->cols = cols;
+  f->row_scale = row_scale;
+  f->col_scale = col_scale;
+  f->error = .5f * sqrtf(row_scale * row_scale + col_scale * col_scale);
+  return 0;
+}
+
+void DistanceField_initEmpty(DistanceField* f) {
+  f->rows = f->cols = 0;
+  f->row_scale = f->col_scale = 1;
+  f->error = 0;
+  f->distances = 0;
+}
+
+void DistanceField_destroy(DistanceField* f) {
+  free(f->distances);
+  f->distances = 0;
+}
+
+int DistanceField_sweep(const DistanceField* f, float x0, float y0, float x1,
+                        float y1, float radius, float* fraction) {
+  float dx = x1 - x0, dy = y1 - y0;
+  float length = sqrtf(dx * dx + dy * dy);
+  float min_step = SWEEP_MIN_STEP * (f->row_scale < f->col_scale
+                                         ? f->row_scale
+                                         : f->col_scale);
+  // sphere tracing: no wall is nearer than the clearance, the circle can
+  // move that far along the segment
+  float t = 0, safe = 0;
+  for (;;) {
+    float s = length > 0 ? t / length : 0;
+    float room = DistanceField_clearance(f, x0 + dx * s, y0 + dy * s) - radius;
+    if (room < min_step) {
+      *fraction = length > 0 ? safe / length : 0;
+      return 0;
+    }
+    safe = t;
+    if (t >= length) break;
+    t += room;
+    if (t > length) t = length;
+  }
+  *fraction = 1;
+  return 1;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "../av_framework/image.h"
+
+// Distance from every point of the map to the nearest wall, where the
+// elevation is at least a threshold. The edges of the map count as walls.
+// Distances are in world units, points are row_scale x col_scale apart as
+// in the Surface built out of the same elevation
+typedef struct DistanceField {
+  int rows, cols;
+  float row_scale, col_scale;
+  float error;       // half diagonal of a cell, the error of a lookup
+  float* distances;  // rows x cols, row major, NULL if the field is empty
+} DistanceField;
+
+// threshold is in [0, 1], as the elevation converted to FLOATMONO.
+// Returns -1 if the elevation can't be converted
+int DistanceField_init(DistanceField* f, Image* elevation, float threshold,
+                       float row_scale, float col_scale);
+
+// a field without walls, for worlds whose elevation isn't known
+void DistanceField_initEmpty(DistanceField* f);
+
+void DistanceField_destroy(DistanceField* f);
+
+// lower bound of the distance between x, y and the nearest wall, 0 on the
+// walls and off the map
+static inline float DistanceField_clearance(const DistanceField* f, float x,
+                                            float y) {
+  if (f->distances == 0) return 3.4e38f;
+  int r = (int)(x / f->row_scale + .5f);
+  int c = (int)(y / f->col_scale + .5f);
+  if (x < 0 || y < 0 || r >= f->rows || c >= f->cols) return 0;
+  float d = f->distances[r * f->cols + c] - f->error;
+  return d > 0 ? d : 0;
+}
+
+// moves a circle of the given radius from x0, y0 to x1, y1. Returns 1 if it
+// never touches a wall, otherwise 0 and in fraction the part of the way it
+// can safely cover
+int DistanceField_sweep(const DistanceField* f, float x0, float y0, float x1,
+                        float y1, float radius, float* fraction);
@@ -0,0 +1,117 @@
+#include "latency.h"
+#include <stdio.h>
+#include <string.h>
+
+static LatencyHistogram hops[LatHops];
+
+static const char* hop_names[LatHops] = {
+    "uplink", "apply", "snapshot", "send", "downlink", "end_to_end"};
+
+void LatencyHistogram_init(LatencyHistogram* h) {
+  memset(h, 0, sizeof(LatencyHistogram));
+}
+
+void LatencyHistogram_record(LatencyHistogram* h, long usec) {
+  // samples coming from different machines can be negative if the clocks are
+  // not aligned, they are accounted in the first bucket
+  if (usec < 0) usec = 0;
+  int bucket = 0;
+  unsigned long v = (unsigned long)usec;
+  while (v > 1 && bucket < LATENCY_BUCKETS - 1) {
+    v >>= 1;
+    bucket++;
+  }
+  __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum_us, (unsigned long)usec, __ATOMIC_RELAXED);
+  unsigned long max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+  while ((unsigned long)usec > max &&
+         !__atomic_compare_exchange_n(&h->max_us, &max, (unsigned long)usec, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+void LatencyHistogram_merge(LatencyHistogram* dest,
+                            const LatencyHistogram* src) {
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    __atomic_fetch_add(&dest->buckets[i],
+                       __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+  __atomic_fetch_add(&dest->count,
+                     __atomic_load_n(&src->count, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&dest->sum_us,
+                     __atomic_load_n(&src->sum_us, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+  unsigned long src_max = __atomic_load_n(&src->max_us, __ATOMIC_RELAXED);
+  unsigned long max = __atomic_load_n(&dest->max_us, __ATOMIC_RELAXED);
+  while (src_max > max &&
+         !__atomic_compare_exchange_n(&dest->max_us, &max, src_max, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+long LatencyHistogram_percentile(const LatencyHistogram* h, float p) {
+  unsigned long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  if (count == 0) return 0;
+  unsigned long target = (unsigned long)(p * count);
+  if (target >= count) target = count - 1;
+  // the bucket bound can't be larger than the worst sample
+  long max = (long)__atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+  unsigned long seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    if (seen > target) return (2L << i) < max ? (2L << i) : max;
+  }
+  return max;
+}
+
+void Latency_record(LatencyHop hop, const struct timeval* start,
+                    const struct timeval* end) {
+  if (hop < 0 || hop >= LatHops || start->tv_sec <= 0) return;
+  long usec = (end->tv_sec - start->tv_sec) * 1000000L +
+              (end->tv_usec - start->tv_usec);
+  LatencyHistogram_record(&hops[hop], usec);
+}
+
+void Latency_recordSince(LatencyHop hop, const struct timeval* start) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  Latency_record(hop, start, &now);
+}
+
+void Latency_recordMs(LatencyHop hop, unsigned int start, unsigned int end) {
+  if (hop < 0 || hop >= LatHops || start == 0) return;
+  LatencyHistogram_record(&hops[hop], (int)(end - start) * 1000L);
+}
+
+const LatencyHistogram* Latency_getHistogram(LatencyHop hop) {
+  if (hop < 0 || hop >= LatHops) return NULL;
+  return &hops[hop];
+}
+
+const char* Latency_hopName(LatencyHop hop) {
+  if (hop < 0 || hop >= LatHops) return "unknown";
+  return hop_names[hop];
+}
+
+void Latency_reset(void) {
+  for (int i = 0; i < LatHops; i++) LatencyHistogram_init(&hops[i]);
+}
+
+void Latency_print(FILE* out) {
+  fprintf(out, "[Latency] %-10s %8s %10s %10s %10s %10s\n", "hop", "count",
+          "avg_us", "p50_us", "p99_us", "max_us");
+  for (int i = 0; i < LatHops; i++) {
+    const LatencyHistogram* h = &hops[i];
+    unsigned long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    unsigned long sum = __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+    if (count == 0) continue;
+    fprintf(out, "[Latency] %-10s %8lu %10lu %10ld %10ld %10lu\n",
+            hop_names[i], count, count ? sum / count : 0,
+            LatencyHistogram_percentile(h, 0.5),
+            LatencyHistogram_percentile(h, 0.99),
+            __atomic_load_n(&h->max_us, __ATOMIC_RELAXED));
+  }
+  fflush(out);
+}
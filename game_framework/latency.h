@@ -0,0 +1,47 @@
+#pragma once
+#include <stdio.h>
+#include <sys/time.h>
+
+// number of log2 buckets: bucket i holds samples in [2^i, 2^(i+1)) usec,
+// the last one also collects everything above ~16s
+#define LATENCY_BUCKETS 24
+
+// Hops of the path that goes from a key press to the replicated state seen by
+// the other players. Every hop is measured between two consecutive stages.
+typedef enum {
+  LatUplink = 0x0,      // client send -> server ingest
+  LatApply = 0x1,       // server ingest -> update applied to the world
+  LatSnapshot = 0x2,    // update applied -> packed in a WorldUpdatePacket
+  LatSend = 0x3,        // WorldUpdatePacket built -> handed to the socket
+  LatDownlink = 0x4,    // server send -> remote receive
+  LatEndToEnd = 0x5,    // client send -> remote receive
+  LatHops = 0x6
+} LatencyHop;
+
+// fixed-bucket histogram, every field is updated with atomic operations so
+// that it can be shared between threads without locks
+typedef struct LatencyHistogram {
+  unsigned long count;
+  unsigned long sum_us;
+  unsigned long max_us;
+  unsigned long buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+void LatencyHistogram_init(LatencyHistogram* h);
+void LatencyHistogram_record(LatencyHistogram* h, long usec);
+// accumulates the samples of src into dest
+void LatencyHistogram_merge(LatencyHistogram* dest,
+                            const LatencyHistogram* src);
+// returns the upper bound (usec) of the bucket holding the p-th percentile
+long LatencyHistogram_percentile(const LatencyHistogram* h, float p);
+
+// process-wide histograms, one for each hop
+void Latency_record(LatencyHop hop, const struct timeval* start,
+                    const struct timeval* end);
+void Latency_recordSince(LatencyHop hop, const struct timeval* start);
+// between two ms of the shared timeline (see ClockSync), start 0 is unknown
+void Latency_recordMs(LatencyHop hop, unsigned int start, unsigned int end);
+const LatencyHistogram* Latency_getHistogram(LatencyHop hop);
+const char* Latency_hopName(LatencyHop hop);
+void Latency_reset(void);
+void Latency_print(FILE* out);
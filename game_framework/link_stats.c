@@ -0,0 +1,103 @@
+#include "link_stats.h"
+#include <math.h>
+#include <string.h>
+
+void LinkStats_init(LinkStats* s) {
+  memset(s, 0, sizeof(LinkStats));
+  s->interval = LINK_START_INTERVAL;
+}
+
+void LinkStats_stamp(LinkStats* s, LinkFeedback* f, unsigned int now) {
+  s->sequence++;
+  s->send_time[s->sequence % LINK_HISTORY] = now;
+  f->sequence = s->sequence;
+  f->ack = s->peer_sequence;
+  f->received = s->received;
+  f->ack_delay = s->peer_sequence != 0 ? now - s->receive_time : 0;
+}
+
+// moving average, each of the packets accounted weights LINK_LOSS_GAIN
+static void LinkStats_average(float* value, float sample,
+                              unsigned int packets) {
+  *value += (sample - *value) * fminf(1, packets * LINK_LOSS_GAIN);
+}
+
+static void LinkStats_sampleRtt(LinkStats* s, float rtt) {
+  if (s->rtt_samples == 0) {
+    s->srtt = rtt;
+    s->rttvar = rtt / 2;
+    s->min_rtt = rtt;
+  } else {
+    s->rttvar = 0.75 * s->rttvar + 0.25 * fabsf(s->srtt - rtt);
+    s->srtt = 0.875 * s->srtt + 0.125 * rtt;
+    s->jitter += (fabsf(rtt - s->last_rtt) - s->jitter) / 16;
+    if (rtt < s->min_rtt) s->min_rtt = rtt;
+  }
+  s->last_rtt = rtt;
+  s->rtt_samples++;
+}
+
+int LinkStats_receive(LinkStats* s, const LinkFeedback* f, unsigned int now) {
+  if (s->peer_sequence != 0) {
+    int gap = (int)(f->sequence - s->peer_sequence);
+    if (gap <= 0) return 0;
+    LinkStats_average(&s->receive_loss, (float)(gap - 1) / gap, gap);
+  }
+  // the stale and duplicate packets don't count, or the peer would see
+  // fewer losses than there are
+  s->received++;
+  s->peer_sequence = f->sequence;
+  s->receive_time = now;
+  // only the first packet carrying an ack is sampled, the later ones
+  // have a longer ack_delay to subtract
+  if (f->ack == 0 || (s->acked != 0 && (int)(f->ack - s->acked) <= 0) ||
+      (int)(s->sequence - f->ack) < 0)
+    return 1;
+  if ((int)(s->sequence - f->ack) < LINK_HISTORY) {
+    int rtt = (int)(now - s->send_time[f->ack % LINK_HISTORY]) -
+              (int)f->ack_delay;
+    LinkStats_sampleRtt(s, rtt > 0 ? rtt : 0);
+  }
+  if (s->acked != 0) {
+    unsigned int sent = f->ack - s->acked;
+    unsigned int got = f->received - s->acked_received;
+    LinkStats_average(&s->send_loss,
+                      got >= sent ? 0 : (float)(sent - got) / sent, sent);
+    if (got < sent) s->lost += sent - got;
+  }
+  s->acked = f->ack;
+  s->acked_received = f->received;
+  return 1;
+}
+
+int LinkStats_congested(const LinkStats* s) {
+  if (s->rtt_samples == 0) return 0;
+  return s->srtt > s->min_rtt + LINK_QUEUE_DELAY ||
+         s->send_loss > LINK_LOSS_THRESHOLD;
+}
+
+float LinkStats_need(float speed, int neighbours) {
+  float moving = fminf(fabsf(speed) / LINK_FAST_SPEED, 1);
+  float crowd = fminf((float)neighbours / LINK_CROWD, 1);
+  return fmaxf(moving, crowd);
+}
+
+unsigned int LinkStats_adapt(LinkStats* s, float need) {
+  need = fmaxf(0, fminf(need, 1));
+  unsigned int target =
+      LINK_MAX_INTERVAL - (LINK_MAX_INTERVAL - LINK_MIN_INTERVAL) * need;
+  if (LinkStats_congested(s)) {
+    // the peer must have acked a packet sent after the last back off
+    if ((int)(s->acked - s->backoff_sequence) > 0) {
+      s->interval = s->interval * 2 < LINK_MAX_INTERVAL ? s->interval * 2
+                                                         : LINK_MAX_INTERVAL;
+      s->backoff_sequence = s->sequence;
+    }
+  } else if (s->interval > target) {
+    // additive increase of the rate
+    unsigned int interval = 1000 / (1000.0 / s->interval + LINK_RATE_STEP);
+    s->interval = interval > target ? interval : target;
+  }
+  if (s->interval < target) s->interval = target;
+  return s->interval;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "../common/common.h"
+
+// Piggybacked on the UDP packets in both directions: every packet is
+// numbered, and acknowledges the last one received from the peer
+typedef struct LinkFeedback {
+  unsigned int sequence;   // of this packet, counted by its sender
+  unsigned int ack;        // highest sequence received from the peer, 0 none
+  unsigned int received;   // packets accepted from the peer so far
+  unsigned int ack_delay;  // ms between receiving ack and sending this
+} LinkFeedback;
+
+// Link quality as seen by one endpoint, times are ms on the local clock
+// (Clock_now). The round trip is smoothed as in TCP (RFC 6298), the jitter
+// is the mean deviation of consecutive round trips (RFC 3550 estimator),
+// the losses are moving averages of the missing sequence numbers
+typedef struct LinkStats {
+  // packets sent to the peer
+  unsigned int sequence;
+  unsigned int send_time[LINK_HISTORY];
+  unsigned int acked, acked_received;  // of the last new ack
+  unsigned int lost;  // packets the peer reported missing, in total
+  // packets received from the peer
+  unsigned int peer_sequence;  // highest, 0 if none
+  unsigned int received;
+  unsigned int receive_time;  // of peer_sequence
+  // estimates, 0 until the first sample
+  int rtt_samples;
+  float srtt, rttvar, min_rtt, last_rtt, jitter;
+  float send_loss;     // of the packets sent, reported by the peer
+  float receive_loss;  // of the packets of the peer
+  // rate control
+  unsigned int interval;  // ms between two packets to the peer
+  unsigned int backoff_sequence;  // last packet sent when it backed off
+} LinkStats;
+
+void LinkStats_init(LinkStats* s);
+
+// numbers a packet sent at now and fills its feedback
+void LinkStats_stamp(LinkStats* s, LinkFeedback* f, unsigned int now);
+
+// accounts the feedback of a packet received at now. Returns 0 if the
+// packet is older than one already received
+int LinkStats_receive(LinkStats* s, const LinkFeedback* f, unsigned int now);
+
+// the round trip grows past the queueing allowance or too many packets are
+// lost: the peer should get less traffic
+int LinkStats_congested(const LinkStats* s);
+
+// how much a peer needs updates, in [0, 1]: a fast vehicle or one with
+// others around needs them the most
+float LinkStats_need(float speed, int neighbours);
+
+// picks the interval before the next packet. It closes in on the one
+// asked by need while the link is healthy and doubles, at most once per
+// round trip, when it's congested
+unsigned int LinkStats_adapt(LinkStats* s, float need);
@@ -0,0 +1,227 @@
+#include "logger.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct LogRecord {
+  struct timeval time;
+  LogLevel level;
+  char text[LOG_LINE_LEN];
+} LogRecord;
+
+// Single-producer single-consumer queue: the owner thread advances head, the
+// writer thread advances tail
+typedef struct LogQueue {
+  LogRecord records[LOG_QUEUE_SIZE];
+  unsigned long head;
+  unsigned long tail;
+  int closing;  // owner exited, the writer releases the queue once empty
+} LogQueue;
+
+static LogQueue* queues[LOG_MAX_THREADS];
+static int claimed[LOG_MAX_THREADS];
+static __thread LogQueue* local_queue = NULL;
+static __thread char local_queue_exhausted = 0;
+static pthread_key_t queue_key;
+static pthread_once_t queue_key_once = PTHREAD_ONCE_INIT;
+
+static FILE* log_out = NULL;
+static int runtime_level = LOG_LEVEL;
+static int writer_running = 0;
+static pthread_t writer;
+static unsigned long dropped = 0;
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* level_names[] = {"DEBUG", "INFO", "WARNING", "ERROR",
+                                    "OFF"};
+
+static void Logger_releaseQueue(void* arg) {
+  LogQueue* queue = (LogQueue*)arg;
+  __atomic_store_n(&queue->closing, 1, __ATOMIC_RELEASE);
+}
+
+static void Logger_createKey(void) {
+  pthread_key_create(&queue_key, Logger_releaseQueue);
+}
+
+static LogQueue* Logger_getQueue(void) {
+  if (local_queue || local_queue_exhausted) return local_queue;
+  pthread_once(&queue_key_once, Logger_createKey);
+  for (int i = 0; i < LOG_MAX_THREADS; i++) {
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&claimed[i], &expected, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      continue;
+    LogQueue* queue = __atomic_load_n(&queues[i], __ATOMIC_ACQUIRE);
+    if (queue == NULL) {
+      queue = (LogQueue*)calloc(1, sizeof(LogQueue));
+      if (queue == NULL) {
+        __atomic_store_n(&claimed[i], 0, __ATOMIC_RELEASE);
+        break;
+      }
+      __atomic_store_n(&queues[i], queue, __ATOMIC_RELEASE);
+    }
+    pthread_setspecific(queue_key, queue);
+    local_queue = queue;
+    return queue;
+  }
+  local_queue_exhausted = 1;
+  return NULL;
+}
+
+static void Logger_write(FILE* out, const LogRecord* record) {
+  struct tm tm;
+  time_t seconds = record->time.tv_sec;
+  localtime_r(&seconds, &tm);
+  fprintf(out, "[%02d:%02d:%02d.%03ld] [%s] %s\n", tm.tm_hour, tm.tm_min,
+          tm.tm_sec, (long)record->time.tv_usec / 1000,
+          level_names[record->level], record->text);
+}
+
+static void Logger_format(LogRecord* record, LogLevel level,
+                          unsigned long suppressed, const char* fmt,
+                          va_list args) {
+  gettimeofday(&record->time, NULL);
+  record->level = level;
+  int len = vsnprintf(record->text, LOG_LINE_LEN, fmt, args);
+  if (len >= LOG_LINE_LEN) len = LOG_LINE_LEN - 1;
+  // the old debug_print messages carry their own newline
+  while (len > 0 &&
+         (record->text[len - 1] == '\n' || record->text[len - 1] == ' '))
+    record->text[--len] = '\0';
+  if (suppressed > 0 && len < LOG_LINE_LEN - 1)
+    snprintf(record->text + len, LOG_LINE_LEN - len, " (%lu suppressed)",
+             suppressed);
+}
+
+static void Logger_vlog(LogLevel level, unsigned long suppressed,
+                        const char* fmt, va_list args) {
+  LogQueue* queue = __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)
+                        ? Logger_getQueue()
+                        : NULL;
+  if (queue == NULL) {
+    LogRecord record;
+    Logger_format(&record, level, suppressed, fmt, args);
+    pthread_mutex_lock(&sync_mutex);
+    Logger_write(log_out ? log_out : stderr, &record);
+    pthread_mutex_unlock(&sync_mutex);
+    return;
+  }
+  unsigned long head = queue->head;
+  unsigned long tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= LOG_QUEUE_SIZE) {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  Logger_format(&queue->records[head % LOG_QUEUE_SIZE], level, suppressed, fmt,
+                args);
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void Logger_log(LogLevel level, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  Logger_vlog(level, 0, fmt, args);
+  va_end(args);
+}
+
+void Logger_logSuppressed(LogLevel level, unsigned long suppressed,
+                          const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  Logger_vlog(level, suppressed, fmt, args);
+  va_end(args);
+}
+
+long Logger_rateLimit(LogRateLimit* limit, long interval_us) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  long now = ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+  long last = __atomic_load_n(&limit->last, __ATOMIC_RELAXED);
+  if ((last != 0 && now - last < interval_us) ||
+      !__atomic_compare_exchange_n(&limit->last, &last, now, 0,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  return (long)__atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+}
+
+// writes the pending records of every queue, returns how many were written
+static int Logger_drain(FILE* out) {
+  int written = 0;
+  for (int i = 0; i < LOG_MAX_THREADS; i++) {
+    LogQueue* queue = __atomic_load_n(&queues[i], __ATOMIC_ACQUIRE);
+    if (queue == NULL) continue;
+    char closing = __atomic_load_n(&queue->closing, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = queue->tail;
+    for (; tail < head; tail++, written++)
+      Logger_write(out, &queue->records[tail % LOG_QUEUE_SIZE]);
+    __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+    if (closing) {
+      // the owner is gone, nothing else can be pushed
+      queue->closing = 0;
+      __atomic_store_n(&claimed[i], 0, __ATOMIC_RELEASE);
+    }
+  }
+  return written;
+}
+
+static void* Logger_writerLoop(void* args) {
+  FILE* out = (FILE*)args;
+  while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+    if (Logger_drain(out) > 0)
+      fflush(out);
+    else
+      usleep(LOG_FLUSH_INTERVAL * 1000);
+  }
+  Logger_drain(out);
+  fflush(out);
+  return NULL;
+}
+
+static int Logger_parseLevel(const char* name) {
+  for (int i = LogDebug; i <= LogOff; i++)
+    if (strcasecmp(name, level_names[i]) == 0) return i;
+  return -1;
+}
+
+void Logger_init(FILE* out) {
+  if (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) return;
+  const char* env_level = getenv("PROTOGAME_LOG_LEVEL");
+  if (env_level != NULL) {
+    int level = Logger_parseLevel(env_level);
+    if (level != -1) Logger_setLevel(level);
+  }
+  log_out = out;
+  __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+  if (pthread_create(&writer, NULL, Logger_writerLoop, out) != 0)
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+}
+
+void Logger_shutdown(void) {
+  if (!__atomic_exchange_n(&writer_running, 0, __ATOMIC_ACQ_REL)) return;
+  pthread_join(writer, NULL);
+}
+
+void Logger_setLevel(LogLevel level) {
+  __atomic_store_n(&runtime_level, level, __ATOMIC_RELAXED);
+}
+
+LogLevel Logger_getLevel(void) {
+  return __atomic_load_n(&runtime_level, __ATOMIC_RELAXED);
+}
+
+int Logger_enabled(LogLevel level) {
+  return level >= __atomic_load_n(&runtime_level, __ATOMIC_RELAXED);
+}
+
+unsigned long Logger_dropped(void) {
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdio.h>
+#include "../common/common.h"
+
+// Levels, a message is kept only if its level is at least LOG_LEVEL (compile
+// time) and the runtime level set with Logger_setLevel
+typedef enum {
+  LogDebug = 0x0,
+  LogInfo = 0x1,
+  LogWarning = 0x2,
+  LogError = 0x3,
+  LogOff = 0x4
+} LogLevel;
+
+// State of a rate-limited call site, see LOG_EVERY
+typedef struct LogRateLimit {
+  long last;  // usec, CLOCK_MONOTONIC
+  unsigned long suppressed;
+} LogRateLimit;
+
+// Starts the writer thread draining the per-thread queues into out. Before
+// Logger_init and after Logger_shutdown messages are written synchronously.
+// The runtime level is read from the PROTOGAME_LOG_LEVEL environment variable
+// (debug, info, warning, error, off) if set.
+void Logger_init(FILE* out);
+// flushes every queue and joins the writer thread
+void Logger_shutdown(void);
+
+void Logger_setLevel(LogLevel level);
+LogLevel Logger_getLevel(void);
+int Logger_enabled(LogLevel level);
+
+// formats the message into the calling thread's queue, never blocks: when the
+// queue is full the message is dropped and counted
+void Logger_log(LogLevel level, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+// same as Logger_log, appends the number of messages suppressed by a rate
+// limit
+void Logger_logSuppressed(LogLevel level, unsigned long suppressed,
+                          const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// returns -1 if the call site logged less than interval_us ago, otherwise the
+// number of messages suppressed since the last one
+long Logger_rateLimit(LogRateLimit* limit, long interval_us);
+
+// messages dropped because a queue was full
+unsigned long Logger_dropped(void);
+
+#define LOG_AT(level, fmt, ...)                                 \
+  do {                                                          \
+    if ((level) >= LOG_LEVEL && Logger_enabled(level))          \
+      Logger_log((level), fmt, ##__VA_ARGS__);                  \
+  } while (0)
+
+#define LOG_DEBUG(fmt, ...) LOG_AT(LogDebug, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_AT(LogInfo, fmt, ##__VA_ARGS__)
+#define LOG_WARNING(fmt, ...) LOG_AT(LogWarning, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT(LogError, fmt, ##__VA_ARGS__)
+
+// logs at most once every interval_ms from this call site, meant for the
+// per-tick loops
+#define LOG_EVERY(level, interval_ms, fmt, ...)                          \
+  do {                                                                   \
+    static LogRateLimit _log_limit;                                      \
+    if ((level) >= LOG_LEVEL && Logger_enabled(level)) {                 \
+      long _log_suppressed =                                             \
+          Logger_rateLimit(&_log_limit, (interval_ms)*1000L);            \
+      if (_log_suppressed >= 0)                                          \
+        Logger_logSuppressed((level), _log_suppressed, fmt, ##__VA_ARGS__); \
+    }                                                                    \
+  } while (0)
@@ -0,0 +1,56 @@
+#include "map_tiles.h"
+#include <stdlib.h>
+
+int MapTiles_init(MapTiles* tiles, const Image* elevation,
+                  const Image* texture, int tile_size) {
+  if (elevation == NULL || texture == NULL || tile_size <= 0) return -1;
+  tiles->rows = elevation->rows;
+  tiles->cols = elevation->cols;
+  tiles->tile_size = tile_size;
+  tiles->tile_rows = (elevation->rows + tile_size - 1) / tile_size;
+  tiles->tile_cols = (elevation->cols + tile_size - 1) / tile_size;
+  tiles->tiles = (MapTile*)calloc(tiles->tile_rows * tiles->tile_cols,
+                                  sizeof(MapTile));
+  for (int tr = 0; tr < tiles->tile_rows; tr++) {
+    for (int tc = 0; tc < tiles->tile_cols; tc++) {
+      MapTile* tile = &tiles->tiles[tr * tiles->tile_cols + tc];
+      int r0 = tr * tile_size, c0 = tc * tile_size;
+      int r1 = r0 + tile_size, c1 = c0 + tile_size;
+      if (r1 > elevation->rows) r1 = elevation->rows;
+      if (c1 > elevation->cols) c1 = elevation->cols;
+      tile->elevation = Image_crop(elevation, r0, c0, r1 - r0, c1 - c0);
+      // same area of the texture
+      int tr0 = (long)r0 * texture->rows / elevation->rows;
+      int tr1 = (long)r1 * texture->rows / elevation->rows;
+      int tc0 = (long)c0 * texture->cols / elevation->cols;
+      int tc1 = (long)c1 * texture->cols / elevation->cols;
+      if (tr1 == tr0) tr1++;
+      if (tc1 == tc0) tc1++;
+      tile->texture = Image_crop(texture, tr0, tc0, tr1 - tr0, tc1 - tc0);
+      if (tile->elevation == NULL || tile->texture == NULL) {
+        MapTiles_destroy(tiles);
+        return -1;
+      }
+      tile->elevation_encoding = ImageCodec_choose(tile->elevation);
+      tile->texture_encoding = ImageCodec_choose(tile->texture);
+    }
+  }
+  return 0;
+}
+
+MapTile* MapTiles_get(MapTiles* tiles, int tile_row, int tile_col) {
+  if (tile_row < 0 || tile_row >= tiles->tile_rows || tile_col < 0 ||
+      tile_col >= tiles->tile_cols)
+    return NULL;
+  return &tiles->tiles[tile_row * tiles->tile_cols + tile_col];
+}
+
+void MapTiles_destroy(MapTiles* tiles) {
+  if (tiles->tiles == NULL) return;
+  for (int i = 0; i < tiles->tile_rows * tiles->tile_cols; i++) {
+    if (tiles->tiles[i].elevation) Image_free(tiles->tiles[i].elevation);
+    if (tiles->tiles[i].texture) Image_free(tiles->tiles[i].texture);
+  }
+  free(tiles->tiles);
+  tiles->tiles = NULL;
+}
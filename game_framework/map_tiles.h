@@ -0,0 +1,28 @@
+#pragma once
+#include "../av_framework/image.h"
+#include "../av_framework/image_codec.h"
+
+// A tile of the map: elevation and texture of the same area, with the
+// encoding that makes them smaller on the wire
+typedef struct MapTile {
+  Image* elevation;
+  Image* texture;
+  ImageEncoding elevation_encoding, texture_encoding;
+} MapTile;
+
+// The map cut in tile_size x tile_size tiles of elevation points, the last
+// row and column of tiles may be smaller. The texture is cut along the same
+// boundaries, scaled if its size differs from the elevation one
+typedef struct MapTiles {
+  int rows, cols;  // elevation points of the whole map
+  int tile_size;
+  int tile_rows, tile_cols;
+  MapTile* tiles;  // tile_rows x tile_cols, row major
+} MapTiles;
+
+// returns -1 if the images can't be cut
+int MapTiles_init(MapTiles* tiles, const Image* elevation,
+                  const Image* texture, int tile_size);
+// NULL if the tile is out of the map
+MapTile* MapTiles_get(MapTiles* tiles, int tile_row, int tile_col);
+void MapTiles_destroy(MapTiles* tiles);
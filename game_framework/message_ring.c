@@ -0,0 +1,73 @@
+#include "message_ring.h"
+#include <string.h>
+#include <time.h>
+
+void MessageRing_init(MessageRing* r) {
+  memset(r, 0, sizeof(MessageRing));
+  for (unsigned long i = 0; i < MESSAGE_RING_SIZE; i++)
+    r->slots[i].sequence = i;
+}
+
+int MessageRing_push(MessageRing* r, const MessageBroadcast* m) {
+  unsigned long position = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  MessageRingSlot* slot;
+  for (;;) {
+    slot = &r->slots[position % MESSAGE_RING_SIZE];
+    unsigned long sequence =
+        __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    long distance = (long)(sequence - position);
+    if (distance == 0) {
+      if (__atomic_compare_exchange_n(&r->head, &position, position + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (distance < 0) {
+      // the consumer didn't free it yet, a lap behind
+      __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+      return 0;
+    } else {
+      position = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    }
+  }
+  slot->message = *m;
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&r->pushed, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+int MessageRing_drain(MessageRing* r, MessageBroadcast* out, int max) {
+  unsigned long tail = r->tail;
+  int n = 0;
+  while (n < max) {
+    MessageRingSlot* slot = &r->slots[tail % MESSAGE_RING_SIZE];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != tail + 1)
+      break;
+    out[n++] = slot->message;
+    __atomic_store_n(&slot->sequence, tail + MESSAGE_RING_SIZE,
+                     __ATOMIC_RELEASE);
+    tail++;
+  }
+  __atomic_store_n(&r->tail, tail, __ATOMIC_RELAXED);
+  return n;
+}
+
+int MessageRing_size(const MessageRing* r) {
+  unsigned long head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  unsigned long tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+  long size = (long)(head - tail);
+  return size < 0 ? 0 : size;
+}
+
+unsigned long MessageRing_dropped(const MessageRing* r) {
+  return __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+}
+
+int MessageRing_addDisconnectMessage(MessageRing* r, ClientListItem* user) {
+  if (!user->inside_chat) return 0;
+  MessageBroadcast m = {0};
+  m.id = user->id;
+  m.type = Goodbye;
+  time(&m.time);
+  strncpy(m.sender, user->username, USERNAME_LEN);
+  user->inside_chat = 0;
+  return MessageRing_push(r, &m);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "../common/common.h"
+#include "client_list.h"
+#include "protogame_protocol.h"
+
+// Bounded multi-producer single-consumer queue of chat messages, in
+// preallocated slots. A producer claims a position with a compare and swap
+// and publishes its slot with the position's sequence, the consumer takes
+// the slots in order. Nobody blocks: a message that finds the ring full is
+// dropped and counted
+typedef struct MessageRingSlot {
+  unsigned long sequence;  // position + 1 once published, free at position
+  MessageBroadcast message;
+} MessageRingSlot;
+
+typedef struct MessageRing {
+  MessageRingSlot slots[MESSAGE_RING_SIZE];
+  unsigned long head;  // next position to claim
+  unsigned long tail;  // next position to take
+  unsigned long pushed, dropped;
+} MessageRing;
+
+void MessageRing_init(MessageRing* r);
+
+// copies m in the ring, returns 0 if the ring is full and m was dropped
+int MessageRing_push(MessageRing* r, const MessageBroadcast* m);
+
+// consumer: moves at most max messages in out, oldest first. Returns how
+// many, a slot still being written ends the batch
+int MessageRing_drain(MessageRing* r, MessageBroadcast* out, int max);
+
+// messages waiting, a snapshot while the producers push
+int MessageRing_size(const MessageRing* r);
+
+unsigned long MessageRing_dropped(const MessageRing* r);
+
+// pushes the Goodbye of a user leaving the chat
+int MessageRing_addDisconnectMessage(MessageRing* r, ClientListItem* user);
@@ -0,0 +1,244 @@
+#include "metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct MetricsSlot {
+  unsigned long counters[MetricCounters];
+  LatencyHistogram histograms[MetricHistograms];
+  int in_use;
+} MetricsSlot;
+
+static MetricsSlot slots[METRICS_MAX_THREADS];
+// totals of the threads that already exited, also used as a shared slot when
+// every per-thread slot is taken
+static MetricsSlot retired;
+static long gauges[MetricGauges];
+static __thread MetricsSlot* local_slot = NULL;
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static MetricsSnapshot last_snapshot;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* counter_names[MetricCounters] = {
+    "packets_in",    "packets_out",    "bytes_in",    "bytes_out",
+    "tcp_bytes_in",  "tcp_bytes_out",  "gc_removals", "texture_bytes_served",
+    "texture_dedup_hits", "moves_clamped", "moves_rejected",
+    "inputs_lost",   "inputs_dropped", "vehicles_deferred",
+    "vehicles_predicted", "roster_events", "roster_syncs",
+    "chat_records",  "chat_retransmits", "chat_dropped"};
+static const char* gauge_names[MetricGauges] = {
+    "clients_connecting", "clients_online", "clients_in_chat",
+    "pending_messages", "link_rtt_ms", "link_jitter_ms",
+    "link_downlink_loss_permille", "link_uplink_loss_permille",
+    "link_interval_ms", "links_congested"};
+static const char* histogram_names[MetricHistograms] = {
+    "tick_duration_us", "sender_duration_us", "lock_wait_us",
+    "rtt_sample_us"};
+
+static void Metrics_releaseSlot(void* arg) {
+  MetricsSlot* slot = (MetricsSlot*)arg;
+  for (int i = 0; i < MetricCounters; i++) {
+    unsigned long v = __atomic_exchange_n(&slot->counters[i], 0,
+                                          __ATOMIC_RELAXED);
+    __atomic_fetch_add(&retired.counters[i], v, __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < MetricHistograms; i++) {
+    LatencyHistogram_merge(&retired.histograms[i], &slot->histograms[i]);
+    LatencyHistogram_init(&slot->histograms[i]);
+  }
+  __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void Metrics_createKey(void) {
+  pthread_key_create(&slot_key, Metrics_releaseSlot);
+}
+
+static MetricsSlot* Metrics_getSlot(void) {
+  if (local_slot) return local_slot;
+  pthread_once(&slot_key_once, Metrics_createKey);
+  for (int i = 0; i < METRICS_MAX_THREADS; i++) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&slots[i].in_use, &expected, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      local_slot = &slots[i];
+      pthread_setspecific(slot_key, local_slot);
+      return local_slot;
+    }
+  }
+  local_slot = &retired;
+  return local_slot;
+}
+
+void Metrics_add(MetricCounter counter, unsigned long value) {
+  MetricsSlot* slot = Metrics_getSlot();
+  __atomic_fetch_add(&slot->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void Metrics_setGauge(MetricGauge gauge, long value) {
+  __atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+void Metrics_observe(MetricHistogram histogram, long usec) {
+  MetricsSlot* slot = Metrics_getSlot();
+  LatencyHistogram_record(&slot->histograms[histogram], usec);
+}
+
+long Metrics_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void Metrics_lock(pthread_mutex_t* mutex) {
+  if (pthread_mutex_trylock(mutex) == 0) {
+    Metrics_observe(MetricLockWait, 0);
+    return;
+  }
+  long start = Metrics_now();
+  pthread_mutex_lock(mutex);
+  Metrics_observe(MetricLockWait, Metrics_now() - start);
+}
+
+void Metrics_aggregate(MetricsSnapshot* out) {
+  MetricsSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(MetricsSnapshot));
+  gettimeofday(&snapshot.time, NULL);
+  for (int s = -1; s < METRICS_MAX_THREADS; s++) {
+    MetricsSlot* slot = s == -1 ? &retired : &slots[s];
+    for (int i = 0; i < MetricCounters; i++)
+      snapshot.counters[i] +=
+          __atomic_load_n(&slot->counters[i], __ATOMIC_RELAXED);
+    for (int i = 0; i < MetricHistograms; i++)
+      LatencyHistogram_merge(&snapshot.histograms[i], &slot->histograms[i]);
+  }
+  for (int i = 0; i < MetricGauges; i++)
+    snapshot.gauges[i] = __atomic_load_n(&gauges[i], __ATOMIC_RELAXED);
+  pthread_mutex_lock(&snapshot_mutex);
+  last_snapshot = snapshot;
+  pthread_mutex_unlock(&snapshot_mutex);
+  if (out) *out = snapshot;
+}
+
+void Metrics_getSnapshot(MetricsSnapshot* out) {
+  pthread_mutex_lock(&snapshot_mutex);
+  *out = last_snapshot;
+  pthread_mutex_unlock(&snapshot_mutex);
+}
+
+static void Metrics_writeHistogramText(FILE* out, const char* name,
+                                       const LatencyHistogram* h) {
+  fprintf(out, "%s count=%lu avg=%lu p50=%ld p99=%ld max=%lu\n", name,
+          h->count, h->count ? h->sum_us / h->count : 0,
+          LatencyHistogram_percentile(h, 0.5),
+          LatencyHistogram_percentile(h, 0.99), h->max_us);
+}
+
+static void Metrics_writeHistogramJson(FILE* out, const char* name,
+                                       const LatencyHistogram* h, char last) {
+  fprintf(out,
+          "\"%s\":{\"count\":%lu,\"avg\":%lu,\"p50\":%ld,\"p99\":%ld,"
+          "\"max\":%lu}%s",
+          name, h->count, h->count ? h->sum_us / h->count : 0,
+          LatencyHistogram_percentile(h, 0.5),
+          LatencyHistogram_percentile(h, 0.99), h->max_us, last ? "" : ",");
+}
+
+void Metrics_writeText(FILE* out, const MetricsSnapshot* snapshot) {
+  fprintf(out, "time %ld.%06ld\n", (long)snapshot->time.tv_sec,
+          (long)snapshot->time.tv_usec);
+  for (int i = 0; i < MetricCounters; i++)
+    fprintf(out, "%s %lu\n", counter_names[i], snapshot->counters[i]);
+  for (int i = 0; i < MetricGauges; i++)
+    fprintf(out, "%s %ld\n", gauge_names[i], snapshot->gauges[i]);
+  for (int i = 0; i < MetricHistograms; i++)
+    Metrics_writeHistogramText(out, histogram_names[i],
+                               &snapshot->histograms[i]);
+  for (int i = 0; i < LatHops; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "latency_%s_us", Latency_hopName(i));
+    Metrics_writeHistogramText(out, name, Latency_getHistogram(i));
+  }
+  fflush(out);
+}
+
+void Metrics_writeJson(FILE* out, const MetricsSnapshot* snapshot) {
+  fprintf(out, "{\"time\":%ld.%06ld,\"counters\":{",
+          (long)snapshot->time.tv_sec, (long)snapshot->time.tv_usec);
+  for (int i = 0; i < MetricCounters; i++)
+    fprintf(out, "\"%s\":%lu%s", counter_names[i], snapshot->counters[i],
+            i == MetricCounters - 1 ? "" : ",");
+  fprintf(out, "},\"gauges\":{");
+  for (int i = 0; i < MetricGauges; i++)
+    fprintf(out, "\"%s\":%ld%s", gauge_names[i], snapshot->gauges[i],
+            i == MetricGauges - 1 ? "" : ",");
+  fprintf(out, "},\"histograms\":{");
+  for (int i = 0; i < MetricHistograms; i++)
+    Metrics_writeHistogramJson(out, histogram_names[i],
+                               &snapshot->histograms[i],
+                               i == MetricHistograms - 1);
+  fprintf(out, "},\"latency\":{");
+  for (int i = 0; i < LatHops; i++)
+    Metrics_writeHistogramJson(out, Latency_hopName(i),
+                               Latency_getHistogram(i), i == LatHops - 1);
+  fprintf(out, "}}\n");
+  fflush(out);
+}
+
+int Metrics_dumpToFile(const char* filename, const MetricsSnapshot* snapshot) {
+  char tmp_filename[1024];
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+  FILE* out = fopen(tmp_filename, "w");
+  if (out == NULL) return -1;
+  Metrics_writeJson(out, snapshot);
+  fclose(out);
+  // rename is atomic, readers never see a partial dump
+  return rename(tmp_filename, filename);
+}
+
+int Metrics_openSocket(const char* path) {
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) return -1;
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(sock, 4) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+void Metrics_handleConnection(int fd) {
+  // don't let a silent client stall the exporter
+  struct timeval timeout = {0, 100 * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  char command[16] = {0};
+  int ret;
+  do {
+    ret = recv(fd, command, sizeof(command) - 1, 0);
+  } while (ret == -1 && errno == EINTR);
+  MetricsSnapshot snapshot;
+  Metrics_getSnapshot(&snapshot);
+  FILE* out = fdopen(dup(fd), "w");
+  if (out == NULL) return;
+  if (ret > 0 && strncmp(command, "json", 4) == 0)
+    Metrics_writeJson(out, &snapshot);
+  else
+    Metrics_writeText(out, &snapshot);
+  fclose(out);
+}
+
+void Metrics_closeSocket(int socket, const char* path) {
+  if (socket < 0) return;
+  close(socket);
+  unlink(path);
+}
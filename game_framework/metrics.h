@@ -0,0 +1,92 @@
+#pragma once
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include "../common/common.h"
+#include "latency.h"
+
+// Counters are kept in per-thread slots and only summed when a snapshot is
+// aggregated, so recording never contends with other threads
+typedef enum {
+  MetricPacketsIn = 0x0,
+  MetricPacketsOut = 0x1,
+  MetricBytesIn = 0x2,
+  MetricBytesOut = 0x3,
+  MetricTcpBytesIn = 0x4,
+  MetricTcpBytesOut = 0x5,
+  MetricGcRemovals = 0x6,
+  MetricTextureBytesServed = 0x7,
+  MetricTextureDedupHits = 0x8,
+  MetricMovesClamped = 0x9,
+  MetricMovesRejected = 0xa,
+  MetricInputsLost = 0xb,
+  MetricInputsDropped = 0xc,
+  MetricVehiclesDeferred = 0xd,  // left out of a snapshot for lack of room
+  MetricVehiclesPredicted = 0xe,  // left out, the recipient extrapolates them
+  MetricRosterEvents = 0xf,       // presence events sent to the clients
+  MetricRosterSyncs = 0x10,       // whole rosters sent
+  MetricChatRecords = 0x11,       // chat records sent to the clients
+  MetricChatRetransmits = 0x12,   // of them, sent again for lack of an ack
+  MetricChatDropped = 0x13,       // messages that found the ring full
+  MetricCounters = 0x14
+} MetricCounter;
+
+// Gauges are absolute values set by a single owner
+typedef enum {
+  MetricClientsConnecting = 0x0,
+  MetricClientsOnline = 0x1,
+  MetricClientsInChat = 0x2,
+  MetricPendingMessages = 0x3,
+  // link estimates of the online clients, see LinkStats
+  MetricLinkRtt = 0x4,           // mean smoothed round trip, ms
+  MetricLinkJitter = 0x5,        // mean, ms
+  MetricLinkDownlinkLoss = 0x6,  // worst, permille
+  MetricLinkUplinkLoss = 0x7,    // worst, permille
+  MetricLinkInterval = 0x8,      // mean time between two updates, ms
+  MetricLinksCongested = 0x9,
+  MetricGauges = 0xa
+} MetricGauge;
+
+// Durations, in microseconds
+typedef enum {
+  MetricTickDuration = 0x0,
+  MetricSenderDuration = 0x1,
+  MetricLockWait = 0x2,
+  MetricRttSample = 0x3,
+  MetricHistograms = 0x4
+} MetricHistogram;
+
+typedef struct MetricsSnapshot {
+  struct timeval time;
+  unsigned long counters[MetricCounters];
+  long gauges[MetricGauges];
+  LatencyHistogram histograms[MetricHistograms];
+} MetricsSnapshot;
+
+void Metrics_add(MetricCounter counter, unsigned long value);
+void Metrics_setGauge(MetricGauge gauge, long value);
+void Metrics_observe(MetricHistogram histogram, long usec);
+
+// monotonic clock in microseconds, used to time the instrumented sections
+long Metrics_now(void);
+
+// locks the mutex accounting the time spent waiting for it
+void Metrics_lock(pthread_mutex_t* mutex);
+
+// sums every per-thread slot into out and keeps it as the latest snapshot
+void Metrics_aggregate(MetricsSnapshot* out);
+// copies the latest aggregated snapshot
+void Metrics_getSnapshot(MetricsSnapshot* out);
+
+void Metrics_writeText(FILE* out, const MetricsSnapshot* snapshot);
+void Metrics_writeJson(FILE* out, const MetricsSnapshot* snapshot);
+
+// rewrites filename with the JSON dump of the snapshot, returns -1 on error
+int Metrics_dumpToFile(const char* filename, const MetricsSnapshot* snapshot);
+
+// creates the listening UNIX-domain socket used to query the metrics
+int Metrics_openSocket(const char* path);
+// answers a single query: the client writes "text" or "json" and receives the
+// latest snapshot in that format
+void Metrics_handleConnection(int fd);
+void Metrics_closeSocket(int socket, const char* path);
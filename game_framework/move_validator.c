@@ -0,0 +1,71 @@
+#include "move_validator.h"
+#include <math.h>
+
+int MoveBatch_add(MoveBatch* batch, float from_x, float from_y,
+                  float from_theta, float x, float y, float theta, float dt) {
+  if (batch->size == MOVE_BATCH_SIZE) return -1;
+  int i = batch->size++;
+  batch->from_x[i] = from_x;
+  batch->from_y[i] = from_y;
+  batch->from_theta[i] = from_theta;
+  batch->x[i] = x;
+  batch->y[i] = y;
+  batch->theta[i] = theta;
+  // a long silence doesn't allow a long jump
+  batch->dt[i] = dt < 0 ? 0 : dt > MOVE_MAX_DT ? MOVE_MAX_DT : dt;
+  return i;
+}
+
+// the envelope, without branches so the loop is vectorized
+static void MoveBatch_envelope(MoveBatch* batch) {
+  int n = batch->size;
+  for (int i = 0; i < n; i++) {
+    float dx = batch->x[i] - batch->from_x[i];
+    float dy = batch->y[i] - batch->from_y[i];
+    float reach = MOVE_MAX_SPEED * batch->dt[i] + MOVE_TOLERANCE;
+    float d2 = dx * dx + dy * dy;
+    // NaN fails every comparison, infinities are past any reach
+    int valid = d2 <= reach * reach * MOVE_TELEPORT_FACTOR *
+                          MOVE_TELEPORT_FACTOR &&
+                batch->theta[i] == batch->theta[i] &&
+                fabsf(batch->theta[i]) < 1e6f;
+    int outside = d2 > reach * reach;
+    float scale = outside ? reach / sqrtf(d2) : 1;
+    float dtheta = remainderf(batch->theta[i] - batch->from_theta[i],
+                              2 * (float)M_PI);
+    float turn = MOVE_MAX_TURN * batch->dt[i] + MOVE_TOLERANCE;
+    int turned = fabsf(dtheta) > turn;
+    float theta = batch->from_theta[i] + copysignf(turn, dtheta);
+    batch->x[i] = valid ? batch->from_x[i] + dx * scale : batch->from_x[i];
+    batch->y[i] = valid ? batch->from_y[i] + dy * scale : batch->from_y[i];
+    batch->theta[i] = !valid     ? batch->from_theta[i]
+                      : turned   ? theta
+                                 : batch->theta[i];
+    batch->verdict[i] =
+        !valid ? MoveRejected : outside | turned ? MoveClamped : MoveAccepted;
+  }
+}
+
+void MoveBatch_validate(MoveBatch* batch, const DistanceField* obstacles) {
+  MoveBatch_envelope(batch);
+  // the terrain, only for the moves that reach past the free space around
+  // the server pose
+  for (int i = 0; i < batch->size; i++) {
+    if (batch->verdict[i] == MoveRejected) continue;
+    float from_x = batch->from_x[i], from_y = batch->from_y[i];
+    float dx = batch->x[i] - from_x, dy = batch->y[i] - from_y;
+    float clearance = DistanceField_clearance(obstacles, from_x, from_y);
+    // already touching a wall, the slope pushes it back
+    if (clearance < MOVE_VEHICLE_RADIUS) continue;
+    if (dx * dx + dy * dy <= (clearance - MOVE_VEHICLE_RADIUS) *
+                                 (clearance - MOVE_VEHICLE_RADIUS))
+      continue;
+    float fraction;
+    if (DistanceField_sweep(obstacles, from_x, from_y, batch->x[i],
+                            batch->y[i], MOVE_VEHICLE_RADIUS, &fraction))
+      continue;
+    batch->x[i] = from_x + dx * fraction;
+    batch->y[i] = from_y + dy * fraction;
+    batch->verdict[i] = MoveClamped;
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "../common/common.h"
+#include "distance_field.h"
+
+typedef enum MoveVerdict {
+  MoveAccepted = 0x0,
+  MoveClamped = 0x1,   // moved back inside the envelope or out of a wall
+  MoveRejected = 0x2,  // not a pose, or a teleport: the server one is kept
+} MoveVerdict;
+
+// Poses reported by the clients in one tick, checked together against the
+// poses the server has for their vehicles. Structure of arrays, so the
+// envelope check runs on every input in one vectorizable loop
+typedef struct MoveBatch {
+  int size;
+  // server pose and seconds since the last accepted one
+  float from_x[MOVE_BATCH_SIZE], from_y[MOVE_BATCH_SIZE];
+  float from_theta[MOVE_BATCH_SIZE], dt[MOVE_BATCH_SIZE];
+  // reported pose, replaced by the validated one
+  float x[MOVE_BATCH_SIZE], y[MOVE_BATCH_SIZE], theta[MOVE_BATCH_SIZE];
+  unsigned char verdict[MOVE_BATCH_SIZE];
+} MoveBatch;
+
+static inline void MoveBatch_clear(MoveBatch* batch) { batch->size = 0; }
+
+// returns the index of the input, -1 if the batch is full
+int MoveBatch_add(MoveBatch* batch, float from_x, float from_y,
+                  float from_theta, float x, float y, float theta, float dt);
+
+// fills verdict and rewrites x, y, theta of every input. obstacles may be
+// an empty field, then only the envelope is checked
+void MoveBatch_validate(MoveBatch* batch, const DistanceField* obstacles);
@@ -0,0 +1,65 @@
+#include "prediction.h"
+#include <math.h>
+#include <string.h>
+#include "world.h"
+
+void Prediction_init(Prediction* p) { memset(p, 0, sizeof(Prediction)); }
+
+static void Prediction_store(PredictedState* state, Vehicle* v) {
+  Vehicle_getXYTheta(v, &state->x, &state->y, &state->theta);
+  Vehicle_getVelocities(v, &state->translational_velocity,
+                        &state->rotational_velocity);
+}
+
+static void Prediction_step(Vehicle* v, InputFrame input) {
+  World_applyInput(v->world, v,
+                   (float)input.translational_force / INPUT_FORCE_SCALE,
+                   (float)input.rotational_force / INPUT_FORCE_SCALE);
+}
+
+unsigned int Prediction_apply(Prediction* p, Vehicle* v, InputFrame input) {
+  PredictedState* state = &p->states[++p->sequence % PREDICTION_FRAMES];
+  state->sequence = p->sequence;
+  state->input = input;
+  Prediction_step(v, input);
+  Prediction_store(state, v);
+  return p->sequence;
+}
+
+int Prediction_reconcile(Prediction* p, Vehicle* v,
+                         const ClientUpdate* server_state) {
+  unsigned int acked = server_state->input_sequence;
+  // old or reordered snapshot, or an ack of a frame never sent
+  if ((int)(acked - p->acked) <= 0 || (int)(p->sequence - acked) < 0)
+    return 0;
+  p->acked = acked;
+  const PredictedState* predicted = &p->states[acked % PREDICTION_FRAMES];
+  int pending = p->sequence - acked;
+  if (pending < PREDICTION_FRAMES && predicted->sequence == acked &&
+      fabsf(predicted->x - server_state->x) < PREDICTION_TOLERANCE &&
+      fabsf(predicted->y - server_state->y) < PREDICTION_TOLERANCE &&
+      fabsf(predicted->theta - server_state->theta) < PREDICTION_TOLERANCE &&
+      fabsf(predicted->translational_velocity -
+            server_state->translational_velocity) < PREDICTION_TOLERANCE &&
+      fabsf(predicted->rotational_velocity -
+            server_state->rotational_velocity) < PREDICTION_TOLERANCE)
+    return 0;
+
+  p->corrections++;
+  float translational_update, rotational_update;
+  Vehicle_getForcesUpdate(v, &translational_update, &rotational_update);
+  Vehicle_place(v, server_state->x, server_state->y, server_state->theta);
+  Vehicle_setVelocities(v, server_state->translational_velocity,
+                        server_state->rotational_velocity);
+  // frames that fell out of the buffer can't be replayed
+  if (pending < PREDICTION_FRAMES) {
+    for (unsigned int seq = acked + 1; seq != p->sequence + 1; seq++) {
+      PredictedState* state = &p->states[seq % PREDICTION_FRAMES];
+      Prediction_step(v, state->input);
+      Prediction_store(state, v);
+    }
+  }
+  // the forces are still the ones of the controls
+  Vehicle_setForcesUpdate(v, translational_update, rotational_update);
+  return 1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "../common/common.h"
+#include "protogame_protocol.h"
+#include "vehicle.h"
+
+// pose of the own vehicle after an input frame, until the server acks it
+typedef struct PredictedState {
+  unsigned int sequence;
+  InputFrame input;
+  float x, y, theta;
+  float translational_velocity, rotational_velocity;
+} PredictedState;
+
+// Client side prediction of the own vehicle. The inputs are simulated as
+// soon as they're sent, and replayed on top of the server state when it
+// disagrees with what was predicted for the same frame
+typedef struct Prediction {
+  PredictedState states[PREDICTION_FRAMES];  // by sequence % PREDICTION_FRAMES
+  unsigned int sequence;  // last predicted frame
+  unsigned int acked;     // last frame the server simulated
+  unsigned long corrections;
+} Prediction;
+
+void Prediction_init(Prediction* p);
+
+// simulates the input frame following the last one on v (already locked)
+// and returns its sequence number
+unsigned int Prediction_apply(Prediction* p, Vehicle* v, InputFrame input);
+
+// compares the state the server sent for v (already locked) with the one
+// predicted for the same frame. If they differ v is moved to the server
+// state and the frames the server hasn't simulated yet are replayed.
+// Returns 1 if v was corrected
+int Prediction_reconcile(Prediction* p, Vehicle* v,
+                         const ClientUpdate* server_state);
@@ -0,0 +1,83 @@
+#include "priority_accumulator.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// priority of a vehicle that just showed up, before any accumulated one
+#define PRIORITY_NEW 1e9
+
+typedef struct {
+  int index;  // in the candidates
+  int id;
+  float priority;
+} Candidate;
+
+static int Candidate_compareId(const void* a, const void* b) {
+  int id_a = ((const Candidate*)a)->id, id_b = ((const Candidate*)b)->id;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+static int Candidate_comparePriority(const void* a, const void* b) {
+  float p_a = ((const Candidate*)a)->priority;
+  float p_b = ((const Candidate*)b)->priority;
+  return (p_a < p_b) - (p_a > p_b);
+}
+
+void PriorityAccumulator_init(PriorityAccumulator* a) {
+  memset(a, 0, sizeof(PriorityAccumulator));
+}
+
+float PriorityAccumulator_rate(float distance, float speed) {
+  return (1 + fabsf(speed) / PRIORITY_SPEED) /
+         (1 + fabsf(distance) / PRIORITY_DISTANCE);
+}
+
+int PriorityAccumulator_select(PriorityAccumulator* a, const int* ids,
+                               const float* rates, int n, int max_selected,
+                               int* selected, unsigned int now) {
+  if (n > PRIORITY_MAX_ENTITIES) n = PRIORITY_MAX_ENTITIES;
+  if (max_selected > n) max_selected = n;
+  if (max_selected < 0) max_selected = 0;
+  float elapsed = a->last_tick != 0 ? (int)(now - a->last_tick) / 1000.0 : 0;
+  if (elapsed < 0) elapsed = 0;
+  a->last_tick = now;
+
+  Candidate candidates[PRIORITY_MAX_ENTITIES];
+  for (int i = 0; i < n; i++) {
+    candidates[i].index = i;
+    candidates[i].id = ids[i];
+  }
+  // merges the candidates with the entries of the last tick, both by id
+  qsort(candidates, n, sizeof(Candidate), Candidate_compareId);
+  int e = 0;
+  for (int i = 0; i < n; i++) {
+    Candidate* c = &candidates[i];
+    while (e < a->count && a->entries[e].id < c->id) e++;
+    float gained = rates[c->index] * elapsed;
+    if (e < a->count && a->entries[e].id == c->id)
+      c->priority = a->entries[e].priority + gained;
+    else
+      c->priority = PRIORITY_NEW + rates[c->index];
+  }
+  for (int i = 0; i < n; i++) {
+    a->entries[i].id = candidates[i].id;
+    a->entries[i].priority = candidates[i].priority;
+  }
+  a->count = n;
+
+  // the selected entries restart from zero
+  qsort(candidates, n, sizeof(Candidate), Candidate_comparePriority);
+  for (int i = 0; i < max_selected; i++) {
+    selected[i] = candidates[i].index;
+    int lo = 0, hi = a->count - 1;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (a->entries[mid].id < candidates[i].id)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    a->entries[lo].priority = 0;
+  }
+  return max_selected;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "../common/common.h"
+
+typedef struct PriorityEntry {
+  int id;
+  float priority;  // accumulated since it was last selected
+} PriorityEntry;
+
+// Picks the vehicles that fit in the snapshot of one recipient. Each one
+// accumulates priority at its own rate while it's left out, so the ones
+// starved by closer or faster vehicles eventually get their turn
+typedef struct PriorityAccumulator {
+  PriorityEntry entries[PRIORITY_MAX_ENTITIES];  // sorted by id
+  int count;
+  unsigned int last_tick;  // ms, 0 before the first tick
+} PriorityAccumulator;
+
+void PriorityAccumulator_init(PriorityAccumulator* a);
+
+// priority gained each second by a vehicle at distance from the recipient
+// and moving at speed
+float PriorityAccumulator_rate(float distance, float speed);
+
+// one tick at now (ms): the n candidates ids gain rates[i] each second since
+// the last tick, the candidates of the previous tick that are missing are
+// forgotten and the new ones go first. Writes in selected the indices of the
+// (at most) max_selected with the highest priority, which start again from
+// zero. Returns how many were selected
+int PriorityAccumulator_select(PriorityAccumulator* a, const int* ids,
+                               const float* rates, int n, int max_selected,
+                               int* selected, unsigned int now);
@@ -3,6 +3,48 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../av_framework/audio_context.h"
+// writes img after a packet header, falling back to raw if the encoding
+// doesn't make it smaller. Returns the written bytes
+static int Packet_serializeImage(char* dest, const Image* img,
+                                 ImageEncoding* encoding, int capacity) {
+  int size = -1;
+  if (*encoding != EncodingRaw)
+    size = ImageCodec_encode(img, *encoding, dest, capacity);
+  if (size == -1) {
+    *encoding = EncodingRaw;
+    size = Image_serialize(img, dest, capacity);
+  }
+  return size;
+}
+
+// a MessageBroadcast in a ChatHistory, followed by sender_len bytes of the
+// sender and text_len bytes of the text, without the terminators
+typedef struct {
+  unsigned int sequence;
+  int id;
+  long long time;
+  unsigned char type, sender_len;
+  unsigned short text_len;
+} ChatRecord;
+
+static void ChatRecord_lengths(const MessageBroadcast* m, int* sender_len,
+                               int* text_len) {
+  *sender_len = strnlen(m->sender, USERNAME_LEN - 1);
+  *text_len = m->type == Text ? strnlen(m->text, TEXT_LEN - 1) : 0;
+}
+
+int MessageBroadcast_size(const MessageBroadcast* m) {
+  int sender_len, text_len;
+  ChatRecord_lengths(m, &sender_len, &text_len);
+  return sizeof(ChatRecord) + sender_len + text_len;
+}
+
+static Image* Packet_deserializeImage(const char* buffer, int size,
+                                      ImageEncoding encoding) {
+  if (encoding == EncodingRaw) return Image_deserialize(buffer, size);
+  return ImageCodec_decode(buffer, size);
+}
+
 // converts a packet into a (preallocated) buffer
 int Packet_serialize(char* dest, const PacketHeader* h) {
   char* dest_end = dest;
@@ -23,6 +65,43 @@ int Packet_serialize(char* dest, const PacketHeader* h) {
       dest_end += sizeof(AudioInfoPacket);
       break;
     }
+    case GetTextureHash:
+    case PostTextureHash:
+    case GetTextureByHash: {
+      const TextureHashPacket* hash_packet = (TextureHashPacket*)h;
+      memcpy(dest, hash_packet, sizeof(TextureHashPacket));
+      dest_end += sizeof(TextureHashPacket);
+      break;
+    }
+    case GetCodecs:
+    case PostCodecs: {
+      const CodecsPacket* codecs_packet = (CodecsPacket*)h;
+      memcpy(dest, codecs_packet, sizeof(CodecsPacket));
+      dest_end += sizeof(CodecsPacket);
+      break;
+    }
+    case GetMapInfo:
+    case PostMapInfo: {
+      const MapInfoPacket* info_packet = (MapInfoPacket*)h;
+      memcpy(dest, info_packet, sizeof(MapInfoPacket));
+      dest_end += sizeof(MapInfoPacket);
+      break;
+    }
+    case GetTile: {
+      const TilePacket* tile_packet = (TilePacket*)h;
+      memcpy(dest, tile_packet, sizeof(TilePacket));
+      dest_end += sizeof(TilePacket);
+      break;
+    }
+    case PostTile: {
+      const TilePacket* tile_packet = (TilePacket*)h;
+      memcpy(dest, tile_packet, sizeof(TilePacket));
+      dest_end += sizeof(TilePacket);
+      dest_end += Packet_serializeImage(dest_end, tile_packet->image,
+                                        &((TilePacket*)dest)->encoding,
+                                        BUFFERSIZE - sizeof(TilePacket));
+      break;
+    }
     case ChatAuth: {
       const MessageAuthPacket* mp = (MessageAuthPacket*)h;
       memcpy(dest, mp, sizeof(MessageAuthPacket));
@@ -39,9 +118,29 @@ int Packet_serialize(char* dest, const PacketHeader* h) {
       const MessageHistoryPacket* mh = (MessageHistoryPacket*)h;
       memcpy(dest, mh, sizeof(MessageHistoryPacket));
       dest_end += sizeof(MessageHistoryPacket);
-      memcpy(dest_end, mh->messages,
-             mh->num_messages * sizeof(MessageBroadcast));
-      dest_end += mh->num_messages * sizeof(MessageBroadcast);
+      for (int i = 0; i < mh->num_messages; i++) {
+        const MessageBroadcast* m = &mh->messages[i];
+        ChatRecord record;
+        int sender_len, text_len;
+        ChatRecord_lengths(m, &sender_len, &text_len);
+        record.sequence = m->sequence;
+        record.id = m->id;
+        record.time = m->time;
+        record.type = m->type;
+        record.sender_len = sender_len;
+        record.text_len = text_len;
+        memcpy(dest_end, &record, sizeof(ChatRecord));
+        dest_end += sizeof(ChatRecord);
+        memcpy(dest_end, m->sender, sender_len);
+        dest_end += sender_len;
+        memcpy(dest_end, m->text, text_len);
+        dest_end += text_len;
+      }
+      break;
+    }
+    case ChatAck: {
+      memcpy(dest, h, sizeof(ChatAckPacket));
+      dest_end += sizeof(ChatAckPacket);
       break;
     }
     case PostTexture:
@@ -54,7 +153,9 @@ int Packet_serialize(char* dest, const PacketHeader* h) {
       debug_print("forward address\n");
       dest_end += sizeof(ImagePacket);
       debug_print("image serialization");
-      dest_end += Image_serialize(img_packet->image, dest_end, 1024 * 1024);
+      dest_end += Packet_serializeImage(dest_end, img_packet->image,
+                                        &((ImagePacket*)dest)->encoding,
+                                        BUFFERSIZE - sizeof(ImagePacket));
       debug_print("end\n");
       break;
     }
@@ -79,6 +180,20 @@ int Packet_serialize(char* dest, const PacketHeader* h) {
       dest_end += sizeof(VehicleUpdatePacket);
       break;
     }
+    case TimeSync: {
+      memcpy(dest, h, sizeof(TimeSyncPacket));
+      dest_end += sizeof(TimeSyncPacket);
+      break;
+    }
+    case VehicleInput: {
+      // only the frames that are used
+      VehicleForces* input = (VehicleForces*)h;
+      int size = sizeof(VehicleForces) -
+                 sizeof(InputFrame) * (INPUT_REDUNDANCY - input->num_frames);
+      memcpy(dest, input, size);
+      dest_end += size;
+      break;
+    }
   }
 
   PacketHeader* dest_header = (PacketHeader*)dest;
@@ -105,6 +220,47 @@ PacketHeader* Packet_deserialize(const char* buffer, int size) {
       memcpy(audio_packet, buffer, sizeof(AudioInfoPacket));
       return (PacketHeader*)audio_packet;
     }
+    case GetTextureHash:
+    case PostTextureHash:
+    case GetTextureByHash: {
+      TextureHashPacket* hash_packet =
+          (TextureHashPacket*)malloc(sizeof(TextureHashPacket));
+      memcpy(hash_packet, buffer, sizeof(TextureHashPacket));
+      return (PacketHeader*)hash_packet;
+    }
+    case GetCodecs:
+    case PostCodecs: {
+      CodecsPacket* codecs_packet = (CodecsPacket*)malloc(sizeof(CodecsPacket));
+      memcpy(codecs_packet, buffer, sizeof(CodecsPacket));
+      return (PacketHeader*)codecs_packet;
+    }
+    case GetMapInfo:
+    case PostMapInfo: {
+      MapInfoPacket* info_packet =
+          (MapInfoPacket*)malloc(sizeof(MapInfoPacket));
+      memcpy(info_packet, buffer, sizeof(MapInfoPacket));
+      return (PacketHeader*)info_packet;
+    }
+    case GetTile: {
+      TilePacket* tile_packet = (TilePacket*)malloc(sizeof(TilePacket));
+      memcpy(tile_packet, buffer, sizeof(TilePacket));
+      tile_packet->image = NULL;
+      return (PacketHeader*)tile_packet;
+    }
+    case PostTile: {
+      if (size < (int)sizeof(TilePacket)) return 0;
+      TilePacket* tile_packet = (TilePacket*)malloc(sizeof(TilePacket));
+      memcpy(tile_packet, buffer, sizeof(TilePacket));
+      tile_packet->image =
+          Packet_deserializeImage(buffer + sizeof(TilePacket),
+                                  size - sizeof(TilePacket),
+                                  tile_packet->encoding);
+      if (!tile_packet->image) {
+        free(tile_packet);
+        return 0;
+      }
+      return (PacketHeader*)tile_packet;
+    }
     case ChatAuth: {
       MessageAuthPacket* mp =
           (MessageAuthPacket*)malloc(sizeof(MessageAuthPacket));
@@ -117,15 +273,55 @@ PacketHeader* Packet_deserialize(const char* buffer, int size) {
       return (PacketHeader*)mp;
     }
     case ChatHistory: {
+      if (size < sizeof(MessageHistoryPacket)) return 0;
       MessageHistoryPacket* mh =
           (MessageHistoryPacket*)malloc(sizeof(MessageHistoryPacket));
       memcpy(mh, buffer, sizeof(MessageHistoryPacket));
-      // we get the number of messages
-      mh->messages = (MessageBroadcast*)malloc(mh->num_messages *
-                                               sizeof(MessageBroadcast));
+      // each record takes at least its fixed part
+      int left = size - sizeof(MessageHistoryPacket);
+      if (mh->num_messages < 0 ||
+          mh->num_messages > left / (int)sizeof(ChatRecord)) {
+        free(mh);
+        return 0;
+      }
+      mh->messages = NULL;
+      if (mh->num_messages)
+        mh->messages = (MessageBroadcast*)calloc(mh->num_messages,
+                                                 sizeof(MessageBroadcast));
       buffer += sizeof(MessageHistoryPacket);
-      memcpy(mh->messages, buffer, mh->num_messages * sizeof(MessageBroadcast));
-      return (PacketHeader*)mh;
+      for (int i = 0; i < mh->num_messages; i++) {
+        MessageBroadcast* m = &mh->messages[i];
+        ChatRecord record;
+        if (left < (int)sizeof(ChatRecord)) break;
+        memcpy(&record, buffer, sizeof(ChatRecord));
+        buffer += sizeof(ChatRecord);
+        left -= sizeof(ChatRecord);
+        if (record.sender_len >= USERNAME_LEN ||
+            record.text_len >= TEXT_LEN ||
+            left < record.sender_len + record.text_len)
+          break;
+        m->sequence = record.sequence;
+        m->id = record.id;
+        m->time = record.time;
+        m->type = record.type;
+        memcpy(m->sender, buffer, record.sender_len);
+        buffer += record.sender_len;
+        memcpy(m->text, buffer, record.text_len);
+        buffer += record.text_len;
+        left -= record.sender_len + record.text_len;
+        // the last record must end the datagram
+        if (i == mh->num_messages - 1 && left == 0) return (PacketHeader*)mh;
+      }
+      if (mh->num_messages == 0 && left == 0) return (PacketHeader*)mh;
+      free(mh->messages);
+      free(mh);
+      return 0;
+    }
+    case ChatAck: {
+      if (size != sizeof(ChatAckPacket)) return 0;
+      ChatAckPacket* ack = (ChatAckPacket*)malloc(sizeof(ChatAckPacket));
+      memcpy(ack, buffer, sizeof(ChatAckPacket));
+      return (PacketHeader*)ack;
     }
     case PostTexture:
     case PostElevation: {
@@ -134,7 +330,8 @@ PacketHeader* Packet_deserialize(const char* buffer, int size) {
       // the image is invalid, we need to read it from the buffer
       size -= sizeof(ImagePacket);
       buffer += sizeof(ImagePacket);
-      img_packet->image = Image_deserialize(buffer, size);
+      img_packet->image =
+          Packet_deserializeImage(buffer, size, img_packet->encoding);
       if (!img_packet->image) {
         free(img_packet);
         return 0;
@@ -142,9 +339,25 @@ PacketHeader* Packet_deserialize(const char* buffer, int size) {
       return (PacketHeader*)img_packet;
     }
     case WorldUpdate: {
+      if (size < sizeof(WorldUpdatePacket)) return 0;
       WorldUpdatePacket* world_packet =
           (WorldUpdatePacket*)malloc(sizeof(WorldUpdatePacket));
       memcpy(world_packet, buffer, sizeof(WorldUpdatePacket));
+      // a datagram is decoded on its own, it must hold the whole slice
+      long expected = sizeof(WorldUpdatePacket) +
+                      (long)world_packet->num_update_vehicles *
+                          sizeof(ClientUpdate);
+#ifdef _USE_SERVER_SIDE_FOG_
+      expected += (long)world_packet->num_status_vehicles *
+                  sizeof(ClientStatusUpdate);
+      if (world_packet->num_status_vehicles < 0) expected = -1;
+#endif
+      if (world_packet->num_update_vehicles < 0 || expected != size ||
+          world_packet->fragment >= world_packet->num_fragments ||
+          world_packet->num_fragments > SNAPSHOT_MAX_FRAGMENTS) {
+        free(world_packet);
+        return 0;
+      }
       // we get the number of clients
       world_packet->updates = (ClientUpdate*)malloc(
           world_packet->num_update_vehicles * sizeof(ClientUpdate));
@@ -170,6 +383,27 @@ PacketHeader* Packet_deserialize(const char* buffer, int size) {
       memcpy(vehicle_packet, buffer, sizeof(VehicleUpdatePacket));
       return (PacketHeader*)vehicle_packet;
     }
+    case TimeSync: {
+      if (size != sizeof(TimeSyncPacket)) return 0;
+      TimeSyncPacket* sync = (TimeSyncPacket*)malloc(sizeof(TimeSyncPacket));
+      memcpy(sync, buffer, sizeof(TimeSyncPacket));
+      return (PacketHeader*)sync;
+    }
+    case VehicleInput: {
+      int header_size = sizeof(VehicleForces) - sizeof(InputFrame) *
+                                                    INPUT_REDUNDANCY;
+      if (size < header_size) return 0;
+      VehicleForces* input = (VehicleForces*)malloc(sizeof(VehicleForces));
+      memcpy(input, buffer, header_size);
+      if (input->num_frames < 1 || input->num_frames > INPUT_REDUNDANCY ||
+          size != header_size + sizeof(InputFrame) * input->num_frames) {
+        free(input);
+        return 0;
+      }
+      memcpy(input->frames, buffer + header_size,
+             sizeof(InputFrame) * input->num_frames);
+      return (PacketHeader*)input;
+    }
   }
   return 0;
 }
@@ -181,10 +415,20 @@ void Packet_free(PacketHeader* h) {
     case GetTexture:
     case GetElevation:
     case VehicleUpdate:
+    case VehicleInput:
+    case TimeSync:
+    case ChatAck:
     case ChatAuth:
     case ChatMessage:
     case GetAudioInfo:
-    case PostAudioInfo: {
+    case PostAudioInfo:
+    case GetTextureHash:
+    case PostTextureHash:
+    case GetTextureByHash:
+    case GetCodecs:
+    case PostCodecs:
+    case GetMapInfo:
+    case PostMapInfo: {
       free(h);
       return;
     }
@@ -210,6 +454,78 @@ void Packet_free(PacketHeader* h) {
         Image_free(img_packet->image);
       }
       free(img_packet);
+      return;
+    }
+    case GetTile:
+    case PostTile: {
+      TilePacket* tile_packet = (TilePacket*)h;
+      if (tile_packet->image) Image_free(tile_packet->image);
+      free(tile_packet);
     }
   }
 }
+
+// a fragment of one update and one status always fits, so the fragments of
+// any snapshot do
+#ifdef _USE_SERVER_SIDE_FOG_
+_Static_assert(sizeof(WorldUpdatePacket) + sizeof(ClientUpdate) +
+                       sizeof(ClientStatusUpdate) <=
+                   PACKET_MTU,
+               "PACKET_MTU is too small for a snapshot fragment");
+#else
+_Static_assert(sizeof(WorldUpdatePacket) + sizeof(ClientUpdate) <= PACKET_MTU,
+               "PACKET_MTU is too small for a snapshot fragment");
+#endif
+
+// the updates and the statuses are spread evenly on the fragments
+static int WorldUpdate_fits(const WorldUpdatePacket* wup, int fragments) {
+  int updates = (wup->num_update_vehicles + fragments - 1) / fragments;
+  int size = sizeof(WorldUpdatePacket) + updates * sizeof(ClientUpdate);
+#ifdef _USE_SERVER_SIDE_FOG_
+  int statuses = (wup->num_status_vehicles + fragments - 1) / fragments;
+  size += statuses * sizeof(ClientStatusUpdate);
+#endif
+  return size <= PACKET_MTU;
+}
+
+int WorldUpdate_fragment(WorldUpdatePacket* wup) {
+  int fragments = 1;
+  while (!WorldUpdate_fits(wup, fragments)) fragments++;
+  if (fragments > SNAPSHOT_MAX_FRAGMENTS) return -1;
+  wup->num_fragments = fragments;
+  return fragments;
+}
+
+#ifdef _USE_SERVER_SIDE_FOG_
+int WorldUpdate_room(int num_statuses, int num_candidates) {
+  int left = SNAPSHOT_BUDGET - (int)sizeof(WorldUpdatePacket) -
+             (num_statuses + num_candidates) * (int)sizeof(ClientStatusUpdate);
+  int room = left / (int)sizeof(ClientUpdate) - 1;
+  return room > 1 ? room : 1;
+}
+#endif
+
+int WorldUpdate_serializeFragment(char* dest, WorldUpdatePacket* wup,
+                                  int fragment) {
+  WorldUpdatePacket part = *wup;
+  part.fragment = fragment;
+  int per_fragment = (wup->num_update_vehicles + wup->num_fragments - 1) /
+                     wup->num_fragments;
+  int start = fragment * per_fragment;
+  if (start > wup->num_update_vehicles) start = wup->num_update_vehicles;
+  int end = start + per_fragment;
+  if (end > wup->num_update_vehicles) end = wup->num_update_vehicles;
+  part.updates = wup->updates + start;
+  part.num_update_vehicles = end - start;
+#ifdef _USE_SERVER_SIDE_FOG_
+  per_fragment = (wup->num_status_vehicles + wup->num_fragments - 1) /
+                 wup->num_fragments;
+  start = fragment * per_fragment;
+  if (start > wup->num_status_vehicles) start = wup->num_status_vehicles;
+  end = start + per_fragment;
+  if (end > wup->num_status_vehicles) end = wup->num_status_vehicles;
+  part.status_updates = wup->status_updates + start;
+  part.num_status_vehicles = end - start;
+#endif
+  return Packet_serialize(dest, &part.header);
+}
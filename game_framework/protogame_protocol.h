@@ -1,6 +1,9 @@
 #pragma once
 #include <time.h>
+#include "../av_framework/image_codec.h"
 #include "../common/common.h"
+#include "link_stats.h"
+#include "sha256.h"
 #include "vehicle.h"
 #if SERVER_SIDE_POSITION_CHECK == 1
 #define _USE_SERVER_SIDE_FOG_
@@ -19,7 +22,19 @@ typedef enum {
   PostAudioInfo = 0x10,
   ChatMessage = 0x11,
   ChatHistory = 0x12,
-  ChatAuth = 0x13
+  ChatAuth = 0x13,
+  GetTextureHash = 0x14,
+  PostTextureHash = 0x15,
+  GetTextureByHash = 0x16,
+  GetCodecs = 0x17,
+  PostCodecs = 0x18,
+  GetMapInfo = 0x19,
+  PostMapInfo = 0x1a,
+  GetTile = 0x1b,
+  PostTile = 0x1c,
+  VehicleInput = 0x1d,
+  TimeSync = 0x1e,
+  ChatAck = 0x1f
 } PacketType;
 
 #ifdef _USE_SERVER_SIDE_FOG_
@@ -27,7 +42,12 @@ typedef enum {
   Online = 0x1,
   Offline = 0x2,
   Connecting = 0x3,
-  Dropped = 0x4
+  Dropped = 0x4,
+  // online and in range, left out of this snapshot to keep it in budget
+  Deferred = 0x5,
+  // online and in range, left out since the client's extrapolation of the
+  // last state it got is still accurate (see DeadReckoning)
+  Predicted = 0x6
 } Status;
 #endif
 
@@ -40,11 +60,28 @@ typedef struct {
   int size;
 } PacketHeader;
 
-// sent from client to server to notify its intentions
+// forces of one input frame, in 1/INPUT_FORCE_SCALE units
+typedef struct {
+  short translational_force;
+  short rotational_force;
+} InputFrame;
+
+// sent from client to server (with type=VehicleInput) instead of
+// VehicleUpdatePacket when INPUT_UPLINK is set: the client sends its
+// intentions and the server simulates the pose. Every frame is a simulation
+// step of 1/INPUT_RATE seconds, frames[i] has sequence number sequence - i.
+// The last num_frames frames are repeated so a lost packet loses no input
 typedef struct {
   PacketHeader header;
-  float translational_force;
-  float rotational_force;
+  int id;
+  LinkFeedback link;
+  unsigned int roster_ack;  // last presence event applied, see Roster
+  unsigned int sequence;
+  // send time of frames[0], ms on the server timeline, 0 before the clocks
+  // are synced
+  unsigned int time;
+  int num_frames;
+  InputFrame frames[INPUT_REDUNDANCY];
 } VehicleForces;
 
 // sent from client to server to ask for an id (id=-1)
@@ -60,12 +97,67 @@ typedef struct {
 //       (with type=PostTexture and id=0) to assign the surface texture
 //       (with type=PostElevation and id=0) to assign the surface texture
 //       (with type=PostTexture and id>0) to assign the  texture to vehicle id
+// the image is sent with encoding if the receiver announced it can decode it
+// (see CodecsPacket), Packet_serialize falls back to EncodingRaw if the
+// encoding doesn't make the image smaller
 typedef struct {
   PacketHeader header;
   int id;
+  ImageEncoding encoding;
   Image* image;
 } ImagePacket;
 
+// sent from client to server (with type=GetCodecs) right after GetId with the
+// bitmask of the image encodings the client can decode
+// sent from server to client (with type=PostCodecs) with its own bitmask.
+// Images are sent raw until the peers have exchanged their codecs
+typedef struct {
+  PacketHeader header;
+  int codecs;
+} CodecsPacket;
+
+// sent from client to server (with type=GetTextureHash and hash unset) to ask
+// for the content hash of the texture of vehicle id, or of the map texture
+// and elevation with id=MAP_TEXTURE_ID and id=MAP_ELEVATION_ID
+// sent from server to client (with type=PostTextureHash) as the answer
+// sent from client to server (with type=GetTextureByHash) to download a
+// texture, the server answers with a PostTexture ImagePacket or with a
+// PostDisconnect IdPacket if the hash is unknown
+typedef struct {
+  PacketHeader header;
+  int id;
+  unsigned char hash[SHA256_DIGEST_LEN];
+} TextureHashPacket;
+
+// sent from client to server (with type=GetMapInfo) to stream the map in
+// tiles instead of downloading it whole
+// sent from server to client (with type=PostMapInfo) with the size of the
+// elevation map and of its tiles
+typedef struct {
+  PacketHeader header;
+  int rows, cols;
+  int tile_size;
+  int tile_rows, tile_cols;
+} MapInfoPacket;
+
+typedef enum { LayerElevation = 0x1, LayerTexture = 0x2 } MapLayer;
+
+// sent from client to server (with type=GetTile and image unset) to ask for
+// the layer of a tile
+// sent from server to client (with type=PostTile) with the tile image, or a
+// PostDisconnect IdPacket if the tile is out of the map. The image is
+// encoded like in ImagePacket
+typedef struct {
+  PacketHeader header;
+  MapLayer layer;
+  int tile_row, tile_col;
+  ImageEncoding encoding;
+  Image* image;
+} TilePacket;
+
+#define MAP_TEXTURE_ID -1
+#define MAP_ELEVATION_ID -2
+
 // sent from client to server, in udp to notify the updates
 typedef struct {
   PacketHeader header;
@@ -73,12 +165,28 @@ typedef struct {
   float rotational_force;
   float translational_force;
   float x, y, theta;
-  struct timeval time;
+  unsigned int time;  // ms on the server timeline, see ClockSync
+  LinkFeedback link;
+  unsigned int roster_ack;  // last presence event applied, see Roster
 } VehicleUpdatePacket;
 
+// ping of the client (client_send on its own clock), echoed by the server
+// with the time it was received and sent back on the server timeline
+typedef struct {
+  PacketHeader header;
+  unsigned int client_send;
+  unsigned int server_receive, server_send;
+} TimeSyncPacket;
+
 // block of the client updates, id of vehicle
 // x,y,theta (read from vehicle id) are position of vehicle
 // id is the id of the vehicle
+// times are ms on the server timeline: client_creation_time is the login of
+// the client and input_time the send time of the last VehicleUpdatePacket
+// or input frame applied by the server, used to measure the
+// input-to-replication latency
+// input_sequence is the last input frame simulated by the server, the pose
+// and the velocities are the ones it left (see Prediction_reconcile)
 typedef struct {
   int id;
   float x;
@@ -86,13 +194,19 @@ typedef struct {
   float theta;
   float rotational_force;
   float translational_force;
-  struct timeval client_update_time, client_creation_time;
+  float translational_velocity, rotational_velocity;
+  unsigned int input_sequence;
+  unsigned int client_creation_time;
+  unsigned int input_time;
 } ClientUpdate;
 
 #ifdef _USE_SERVER_SIDE_FOG_
+// an event of the Roster, or a vehicle left out of this snapshot (Deferred
+// or Predicted, with sequence 0)
 typedef struct {
   int id;
   Status status;
+  unsigned int sequence;
 } ClientStatusUpdate;
 #endif
 
@@ -103,12 +217,15 @@ typedef struct {
   MessageType type;
 } Message;
 
+// a record of the chat channel, see ChatLog. On the wire it takes only the
+// bytes of its sender and of its text, Hello and Goodbye have no text
 typedef struct {
   int id;
   char text[TEXT_LEN];
   char sender[USERNAME_LEN];
   time_t time;  // Used only by server to save the time the message was received
   MessageType type;
+  unsigned int sequence;
 } MessageBroadcast;
 
 typedef struct {
@@ -116,12 +233,24 @@ typedef struct {
   Message message;
 } MessagePacket;
 
+// the chat records a client didn't ack yet, send by server (UDP), oldest
+// first. The ones before first aren't kept anymore and won't come
 typedef struct {
   PacketHeader header;
+  unsigned int first;
   int num_messages;
   MessageBroadcast* messages;
 } MessageHistoryPacket;
 
+// send by client (UDP) after each ChatHistory: it has every record up to
+// ack, and ack + 2 + i too if bit i of selective is set
+typedef struct {
+  PacketHeader header;
+  int id;
+  unsigned int ack;
+  unsigned int selective;
+} ChatAckPacket;
+
 typedef struct {
   PacketHeader header;
   char username[USERNAME_LEN];
@@ -129,13 +258,22 @@ typedef struct {
 } MessageAuthPacket;
 
 // server world update, send by server (UDP)
+// a snapshot larger than PACKET_MTU is split in num_fragments datagrams with
+// the same snapshot number, each one with a slice of the updates and of the
+// statuses that can be applied on its own. The statuses carry the presence
+// events the client didn't ack yet, or the whole roster if roster_full
 typedef struct {
   PacketHeader header;
   int num_update_vehicles;
 #ifdef _USE_SERVER_SIDE_FOG_
   int num_status_vehicles;
+  unsigned int roster_sequence, roster_hash;  // of the server Roster
+  char roster_full;
 #endif
-  struct timeval time;
+  unsigned int time;  // ms on the server timeline, the poses are taken then
+  unsigned int snapshot;
+  unsigned short fragment, num_fragments;
+  LinkFeedback link;  // numbered for each datagram
   ClientUpdate* updates;
 #ifdef _USE_SERVER_SIDE_FOG_
   ClientStatusUpdate* status_updates;
@@ -158,5 +296,24 @@ int Packet_serialize(char* dest, const PacketHeader* h);
 // returns a newly allocated packet read from the buffer
 PacketHeader* Packet_deserialize(const char* buffer, int size);
 
+// sets the number of datagrams of at most PACKET_MTU bytes wup is split in
+// and returns it, -1 if they're more than SNAPSHOT_MAX_FRAGMENTS
+int WorldUpdate_fragment(WorldUpdatePacket* wup);
+
+#ifdef _USE_SERVER_SIDE_FOG_
+// vehicles besides the own one that fit in the SNAPSHOT_BUDGET bytes of a
+// snapshot carrying num_statuses presence events and a status for each of
+// the num_candidates in range. At least 1, a crowd too large for the
+// budget still moves
+int WorldUpdate_room(int num_statuses, int num_candidates);
+#endif
+
+// serializes the datagram fragment of wup, split by WorldUpdate_fragment
+int WorldUpdate_serializeFragment(char* dest, WorldUpdatePacket* wup,
+                                  int fragment);
+
+// bytes taken by the chat record m in a ChatHistory
+int MessageBroadcast_size(const MessageBroadcast* m);
+
 // deletes a packet, freeing memory
 void Packet_free(PacketHeader* h);
@@ -0,0 +1,139 @@
+#include "roster.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _USE_SERVER_SIDE_FOG_
+static int Roster_compareId(const void* a, const void* b) {
+  int id_a = ((const ClientStatusUpdate*)a)->id;
+  int id_b = ((const ClientStatusUpdate*)b)->id;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+static ClientStatusUpdate* Roster_find(const Roster* r, int id) {
+  ClientStatusUpdate key = {0};
+  key.id = id;
+  return (ClientStatusUpdate*)bsearch(&key, r->members, r->size,
+                                      sizeof(ClientStatusUpdate),
+                                      Roster_compareId);
+}
+
+static void Roster_record(Roster* r, int id, Status status) {
+  ClientStatusUpdate* event = &r->log[(r->sequence) % ROSTER_LOG];
+  event->sequence = ++r->sequence;
+  event->id = id;
+  event->status = status;
+  if (r->log_size < ROSTER_LOG) r->log_size++;
+}
+
+// the event on the sorted members, without numbering it
+static void Roster_change(Roster* r, int id, Status status) {
+  ClientStatusUpdate* member = Roster_find(r, id);
+  if (member != NULL && status != Offline) {
+    member->status = status;
+  } else if (member != NULL) {
+    int i = member - r->members;
+    memmove(member, member + 1,
+            (r->size - i - 1) * sizeof(ClientStatusUpdate));
+    r->size--;
+  } else if (status != Offline && r->size < WORLDSIZE) {
+    int i = r->size;
+    while (i > 0 && r->members[i - 1].id > id) i--;
+    memmove(&r->members[i + 1], &r->members[i],
+            (r->size - i) * sizeof(ClientStatusUpdate));
+    r->members[i].id = id;
+    r->members[i].status = status;
+    r->members[i].sequence = 0;
+    r->size++;
+  }
+}
+
+void Roster_init(Roster* r) { memset(r, 0, sizeof(Roster)); }
+
+int Roster_update(Roster* r, const ClientStatusUpdate* current, int n) {
+  if (n > WORLDSIZE) n = WORLDSIZE;
+  ClientStatusUpdate sorted[WORLDSIZE];
+  memcpy(sorted, current, n * sizeof(ClientStatusUpdate));
+  qsort(sorted, n, sizeof(ClientStatusUpdate), Roster_compareId);
+  // merges the two sorted lists
+  int events = 0, i = 0, j = 0;
+  while (i < r->size || j < n) {
+    if (j == n || (i < r->size && r->members[i].id < sorted[j].id)) {
+      Roster_record(r, r->members[i++].id, Offline);
+      events++;
+    } else if (i == r->size || sorted[j].id < r->members[i].id) {
+      Roster_record(r, sorted[j].id, sorted[j].status);
+      j++;
+      events++;
+    } else {
+      if (r->members[i].status != sorted[j].status) {
+        Roster_record(r, sorted[j].id, sorted[j].status);
+        events++;
+      }
+      i++;
+      j++;
+    }
+  }
+  if (events == 0) return 0;
+  for (j = 0; j < n; j++) {
+    r->members[j] = sorted[j];
+    r->members[j].sequence = 0;
+  }
+  r->size = n;
+  r->hash = Roster_hash(r);
+  return events;
+}
+
+int Roster_eventsSince(const Roster* r, unsigned int ack,
+                       ClientStatusUpdate* events) {
+  int missing = (int)(r->sequence - ack);
+  if (missing < 0 || missing > r->log_size) return -1;
+  for (int i = 0; i < missing; i++)
+    events[i] = r->log[(ack + i) % ROSTER_LOG];
+  return missing;
+}
+
+int Roster_members(const Roster* r, ClientStatusUpdate* members) {
+  for (int i = 0; i < r->size; i++) {
+    members[i] = r->members[i];
+    members[i].sequence = r->sequence;
+  }
+  return r->size;
+}
+
+int Roster_apply(Roster* r, const ClientStatusUpdate* event) {
+  int ahead = (int)(event->sequence - r->sequence);
+  if (ahead <= 0) return 0;
+  if (ahead > 1) return -1;
+  Roster_change(r, event->id, event->status);
+  r->sequence = event->sequence;
+  r->hash = Roster_hash(r);
+  return 1;
+}
+
+void Roster_reset(Roster* r, const ClientStatusUpdate* members, int n,
+                  unsigned int sequence) {
+  r->size = 0;
+  for (int i = 0; i < n; i++)
+    Roster_change(r, members[i].id, members[i].status);
+  r->sequence = sequence;
+  r->hash = Roster_hash(r);
+}
+
+Status Roster_status(const Roster* r, int id) {
+  ClientStatusUpdate* member = Roster_find(r, id);
+  return member != NULL ? member->status : 0;
+}
+
+unsigned int Roster_hash(const Roster* r) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < r->size; i++) {
+    int values[2] = {r->members[i].id, r->members[i].status};
+    const unsigned char* bytes = (const unsigned char*)values;
+    for (int k = 0; k < sizeof(values); k++) {
+      hash ^= bytes[k];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+#endif
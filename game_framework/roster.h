@@ -0,0 +1,52 @@
+#pragma once
+#include "../common/common.h"
+#include "protogame_protocol.h"
+
+#ifdef _USE_SERVER_SIDE_FOG_
+// Who is in the game and in which state. The server numbers every change as
+// an event (a member that leaves goes Offline) and keeps the last ROSTER_LOG
+// ones, a client applies them in order and acks the last one: the roster
+// costs a packet only when someone joins, leaves or changes state. A client
+// that falls behind the log, or whose hash differs from the server one, gets
+// the whole roster again
+typedef struct Roster {
+  ClientStatusUpdate members[WORLDSIZE];  // sorted by id, never Offline
+  int size;
+  unsigned int sequence;  // of the last event, 0 if none
+  unsigned int hash;      // of the members, see Roster_hash
+  // server side, ring of the last events
+  ClientStatusUpdate log[ROSTER_LOG];
+  int log_size;
+} Roster;
+
+void Roster_init(Roster* r);
+
+// server: the members are now the n in current (in any order, each id
+// once), records an event for each one that joined, left or changed state.
+// Returns how many
+int Roster_update(Roster* r, const ClientStatusUpdate* current, int n);
+
+// server: copies in events the ones after ack, oldest first. Returns how
+// many, -1 if some of them left the log and the whole roster is needed
+int Roster_eventsSince(const Roster* r, unsigned int ack,
+                       ClientStatusUpdate* events);
+
+// server: copies in members the whole roster as of the last event, returns
+// its size
+int Roster_members(const Roster* r, ClientStatusUpdate* members);
+
+// client: applies the event if it's the next one. Returns 1 if applied, 0
+// if already seen, -1 if some are missing before it
+int Roster_apply(Roster* r, const ClientStatusUpdate* event);
+
+// client: replaces the members with the n of a whole roster, as of event
+// sequence
+void Roster_reset(Roster* r, const ClientStatusUpdate* members, int n,
+                  unsigned int sequence);
+
+// status of id, 0 if it isn't a member
+Status Roster_status(const Roster* r, int id);
+
+// FNV-1a of the ids and the statuses of the members, in order
+unsigned int Roster_hash(const Roster* r);
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+
+typedef struct Sha256Context {
+  uint32_t state[8];
+  uint64_t length;  // bytes hashed so far
+  unsigned char block[64];
+  int block_len;
+} Sha256Context;
+
+void Sha256_init(Sha256Context* ctx);
+void Sha256_update(Sha256Context* ctx, const void* data, size_t len);
+void Sha256_final(Sha256Context* ctx, unsigned char digest[SHA256_DIGEST_LEN]);
+
+// one-shot helper
+void Sha256_hash(const void* data, size_t len,
+                 unsigned char digest[SHA256_DIGEST_LEN]);
@@ -0,0 +1,67 @@
+#include "snapshot_buffer.h"
+#include <math.h>
+#include <string.h>
+
+static const Snapshot* SnapshotBuffer_at(const SnapshotBuffer* b, int i) {
+  return &b->snapshots[(b->first + i) % SNAPSHOT_BUFFER_SIZE];
+}
+
+// shortest turn from a to b
+static float SnapshotBuffer_turn(float a, float b) {
+  float d = fmodf(b - a, 2 * M_PI);
+  if (d > M_PI) d -= 2 * M_PI;
+  if (d < -M_PI) d += 2 * M_PI;
+  return d;
+}
+
+void SnapshotBuffer_init(SnapshotBuffer* b) {
+  memset(b, 0, sizeof(SnapshotBuffer));
+}
+
+int SnapshotBuffer_push(SnapshotBuffer* b, const ClientUpdate* update,
+                        unsigned int time) {
+  if (b->size > 0 &&
+      (int)(time - SnapshotBuffer_at(b, b->size - 1)->time) <= 0)
+    return 0;
+  if (b->size == SNAPSHOT_BUFFER_SIZE) {
+    b->first = (b->first + 1) % SNAPSHOT_BUFFER_SIZE;
+    b->size--;
+  }
+  Snapshot* s = &b->snapshots[(b->first + b->size) % SNAPSHOT_BUFFER_SIZE];
+  s->time = time;
+  s->x = update->x;
+  s->y = update->y;
+  s->theta = update->theta;
+  b->size++;
+  return 1;
+}
+
+int SnapshotBuffer_sample(const SnapshotBuffer* b, unsigned int now, float* x,
+                          float* y, float* theta) {
+  if (b->size == 0) return 0;
+  unsigned int time = now - (unsigned int)(INTERPOLATION_DELAY * 1000);
+  int i = b->size - 1;
+  while (i > 0 && (int)(SnapshotBuffer_at(b, i)->time - time) > 0) i--;
+  const Snapshot* from = SnapshotBuffer_at(b, i);
+  const Snapshot* to;
+  float t;
+  if ((int)(time - from->time) <= 0 || b->size == 1) {
+    // older than the whole buffer, or nothing to move towards
+    to = from;
+    t = 0;
+  } else if (i < b->size - 1) {
+    to = SnapshotBuffer_at(b, i + 1);
+    t = (float)(int)(time - from->time) / (int)(to->time - from->time);
+  } else {
+    // past the last snapshot, goes on from the previous one
+    to = from;
+    from = SnapshotBuffer_at(b, i - 1);
+    int ahead = (int)(time - to->time);
+    if (ahead > MAX_EXTRAPOLATION * 1000) ahead = MAX_EXTRAPOLATION * 1000;
+    t = 1 + (float)ahead / (int)(to->time - from->time);
+  }
+  *x = from->x + (to->x - from->x) * t;
+  *y = from->y + (to->y - from->y) * t;
+  *theta = from->theta + SnapshotBuffer_turn(from->theta, to->theta) * t;
+  return 1;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "../common/common.h"
+#include "protogame_protocol.h"
+
+typedef struct Snapshot {
+  unsigned int time;  // ms on the server timeline
+  float x, y, theta;
+} Snapshot;
+
+// Jitter buffer of the poses the server sent for a vehicle. The vehicle is
+// drawn INTERPOLATION_DELAY seconds in the past of the server clock, between
+// the two snapshots around that time, so it moves smoothly at any snapshot
+// rate. After the last one it keeps its speed for MAX_EXTRAPOLATION seconds
+typedef struct SnapshotBuffer {
+  Snapshot snapshots[SNAPSHOT_BUFFER_SIZE];  // ring, oldest first
+  int first, size;
+} SnapshotBuffer;
+
+void SnapshotBuffer_init(SnapshotBuffer* b);
+
+// adds the pose in update, taken at time on the server timeline. Returns 0
+// if it's not newer than the last one
+int SnapshotBuffer_push(SnapshotBuffer* b, const ClientUpdate* update,
+                        unsigned int time);
+
+// pose to draw at now (server timeline), returns 0 if there are no snapshots
+int SnapshotBuffer_sample(const SnapshotBuffer* b, unsigned int now, float* x,
+                          float* y, float* theta);
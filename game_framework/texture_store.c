@@ -0,0 +1,140 @@
+#include "texture_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void TextureHash_compute(const Image* img, TextureHash* hash) {
+  Sha256Context ctx;
+  Sha256_init(&ctx);
+  int header[3] = {img->type, img->rows, img->cols};
+  Sha256_update(&ctx, header, sizeof(header));
+  Sha256_update(&ctx, img->data, Image_dataSize(img));
+  Sha256_final(&ctx, hash->bytes);
+}
+
+int TextureHash_equals(const TextureHash* a, const TextureHash* b) {
+  return memcmp(a->bytes, b->bytes, SHA256_DIGEST_LEN) == 0;
+}
+
+void TextureHash_toString(const TextureHash* hash, char* dest, int size) {
+  int written = 0;
+  for (int i = 0; i < SHA256_DIGEST_LEN && written + 2 < size; i++)
+    written += snprintf(dest + written, size - written, "%02x",
+                        hash->bytes[i]);
+}
+
+static int TextureStore_bucket(const TextureHash* hash) {
+  // the hash is already uniform, its first bytes are enough
+  unsigned int index;
+  memcpy(&index, hash->bytes, sizeof(index));
+  return index % TEXTURE_STORE_BUCKETS;
+}
+
+static TextureStoreItem* TextureStore_lookup(TextureStore* store,
+                                             const TextureHash* hash) {
+  TextureStoreItem* item = store->buckets[TextureStore_bucket(hash)];
+  while (item != NULL && !TextureHash_equals(&item->hash, hash))
+    item = item->next;
+  return item;
+}
+
+void TextureStore_init(TextureStore* store, char build_blobs) {
+  memset(store->buckets, 0, sizeof(store->buckets));
+  store->size = 0;
+  store->build_blobs = build_blobs;
+  pthread_mutex_init(&store->mutex, NULL);
+}
+
+TextureStoreItem* TextureStore_insert(TextureStore* store, Image* img,
+                                      char* duplicate) {
+  TextureHash hash;
+  // hashing and serializing are done outside the lock
+  TextureHash_compute(img, &hash);
+  pthread_mutex_lock(&store->mutex);
+  TextureStoreItem* item = TextureStore_lookup(store, &hash);
+  if (item != NULL) {
+    item->refcount++;
+    pthread_mutex_unlock(&store->mutex);
+    Image_free(img);
+    if (duplicate) *duplicate = 1;
+    return item;
+  }
+  pthread_mutex_unlock(&store->mutex);
+  AssetBlob* blob = NULL;
+  AssetBlob* compressed_blob = NULL;
+  if (store->build_blobs) {
+    blob = AssetBlob_create(img, PostTexture, EncodingRaw);
+    compressed_blob = AssetBlob_createCompressed(img, PostTexture);
+  }
+  pthread_mutex_lock(&store->mutex);
+  // someone may have stored the same texture in the meantime
+  item = TextureStore_lookup(store, &hash);
+  if (item != NULL) {
+    item->refcount++;
+    pthread_mutex_unlock(&store->mutex);
+    AssetBlob_release(blob);
+    AssetBlob_release(compressed_blob);
+    Image_free(img);
+    if (duplicate) *duplicate = 1;
+    return item;
+  }
+  item = (TextureStoreItem*)malloc(sizeof(TextureStoreItem));
+  item->hash = hash;
+  item->image = img;
+  item->blob = blob;
+  item->compressed_blob = compressed_blob;
+  item->refcount = 1;
+  int bucket = TextureStore_bucket(&hash);
+  item->next = store->buckets[bucket];
+  store->buckets[bucket] = item;
+  store->size++;
+  pthread_mutex_unlock(&store->mutex);
+  if (duplicate) *duplicate = 0;
+  return item;
+}
+
+TextureStoreItem* TextureStore_find(TextureStore* store,
+                                    const TextureHash* hash) {
+  pthread_mutex_lock(&store->mutex);
+  TextureStoreItem* item = TextureStore_lookup(store, hash);
+  if (item != NULL) item->refcount++;
+  pthread_mutex_unlock(&store->mutex);
+  return item;
+}
+
+static void TextureStore_freeItem(TextureStoreItem* item) {
+  Image_free(item->image);
+  // a sender may still hold the blob
+  AssetBlob_release(item->blob);
+  AssetBlob_release(item->compressed_blob);
+  free(item);
+}
+
+void TextureStore_release(TextureStore* store, TextureStoreItem* item) {
+  if (item == NULL) return;
+  pthread_mutex_lock(&store->mutex);
+  if (--item->refcount > 0) {
+    pthread_mutex_unlock(&store->mutex);
+    return;
+  }
+  TextureStoreItem** prev = &store->buckets[TextureStore_bucket(&item->hash)];
+  while (*prev != item) prev = &(*prev)->next;
+  *prev = item->next;
+  store->size--;
+  pthread_mutex_unlock(&store->mutex);
+  TextureStore_freeItem(item);
+}
+
+void TextureStore_destroy(TextureStore* store) {
+  for (int i = 0; i < TEXTURE_STORE_BUCKETS; i++) {
+    TextureStoreItem* item = store->buckets[i];
+    while (item != NULL) {
+      TextureStoreItem* next = item->next;
+      TextureStore_freeItem(item);
+      item = next;
+    }
+    store->buckets[i] = NULL;
+  }
+  store->size = 0;
+  pthread_mutex_destroy(&store->mutex);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <pthread.h>
+#include "../av_framework/image.h"
+#include "../common/common.h"
+#include "asset_blob.h"
+#include "sha256.h"
+
+// Content address of a texture: SHA-256 of its type, size and pixels
+typedef struct TextureHash {
+  unsigned char bytes[SHA256_DIGEST_LEN];
+} TextureHash;
+
+// A texture shared by every vehicle using the same image
+typedef struct TextureStoreItem {
+  struct TextureStoreItem* next;
+  TextureHash hash;
+  Image* image;
+  AssetBlob* blob;  // serialized image, only built by the server
+  AssetBlob* compressed_blob;  // NULL if compression doesn't pay off
+  int refcount;
+} TextureStoreItem;
+
+typedef struct TextureStore {
+  TextureStoreItem* buckets[TEXTURE_STORE_BUCKETS];
+  int size;
+  char build_blobs;
+  pthread_mutex_t mutex;
+} TextureStore;
+
+void TextureHash_compute(const Image* img, TextureHash* hash);
+int TextureHash_equals(const TextureHash* a, const TextureHash* b);
+// writes the first bytes of the hash in hex, for logging
+void TextureHash_toString(const TextureHash* hash, char* dest, int size);
+
+// build_blobs: serialize every new texture in an AssetBlob to serve it, raw
+// and compressed
+void TextureStore_init(TextureStore* store, char build_blobs);
+// takes the ownership of img. If an identical texture is already stored img
+// is freed and the stored one is returned, duplicate is set accordingly.
+// The caller owns a reference to the returned item.
+TextureStoreItem* TextureStore_insert(TextureStore* store, Image* img,
+                                      char* duplicate);
+// returns a new reference to the texture with the given hash or NULL
+TextureStoreItem* TextureStore_find(TextureStore* store,
+                                    const TextureHash* hash);
+// drops a reference, the texture is freed with the last one
+void TextureStore_release(TextureStore* store, TextureStoreItem* item);
+// frees every texture regardless of the references
+void TextureStore_destroy(TextureStore* store);
@@ -0,0 +1,201 @@
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "metrics.h"
+
+#define TRACE_MAX_HELD 8
+
+// Single-producer ring: only the owner thread writes events and head, the
+// dumper only reads them. head keeps growing when the ring changes owner,
+// so the dumper can tell the events that were overwritten while it read them
+typedef struct TraceRing {
+  TraceEvent events[TRACE_BUFFER_SIZE];
+  unsigned long head;   // number of events ever written
+  unsigned long first;  // head when the owner claimed the ring
+  int tid;
+  const char* thread_name;
+  // mutexes held by the owner, used to close the hold spans
+  pthread_mutex_t* held[TRACE_MAX_HELD];
+  long held_since[TRACE_MAX_HELD];
+  int n_held;
+} TraceRing;
+
+static TraceRing* rings[TRACE_MAX_THREADS];
+static int claimed[TRACE_MAX_THREADS];
+static __thread TraceRing* local_ring = NULL;
+static __thread char local_ring_exhausted = 0;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+// the ring is not freed, its events stay available to the dump until another
+// thread claims it and starts over
+static void Trace_releaseRing(void* arg) {
+  TraceRing* ring = (TraceRing*)arg;
+  for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+    if (rings[i] == ring) __atomic_store_n(&claimed[i], 0, __ATOMIC_RELEASE);
+  }
+}
+
+static void Trace_createKey(void) {
+  pthread_key_create(&ring_key, Trace_releaseRing);
+}
+
+static TraceRing* Trace_getRing(void) {
+  if (local_ring || local_ring_exhausted) return local_ring;
+  pthread_once(&ring_key_once, Trace_createKey);
+  for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&claimed[i], &expected, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      continue;
+    TraceRing* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+    if (ring == NULL) {
+      ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+      if (ring == NULL) {
+        __atomic_store_n(&claimed[i], 0, __ATOMIC_RELEASE);
+        break;
+      }
+    }
+    // a ring that changes owner may be read by a dump meanwhile
+    __atomic_store_n(&ring->tid, (int)syscall(SYS_gettid), __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->thread_name, NULL, __ATOMIC_RELAXED);
+    ring->n_held = 0;
+    // the events of the previous owner aren't dumped anymore
+    __atomic_store_n(&ring->first, ring->head, __ATOMIC_RELEASE);
+    __atomic_store_n(&rings[i], ring, __ATOMIC_RELEASE);
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    return ring;
+  }
+  local_ring_exhausted = 1;
+  return NULL;
+}
+
+void Trace_span(const char* name, const char* category, long start,
+                long dur) {
+  TraceRing* ring = Trace_getRing();
+  if (ring == NULL) return;
+  unsigned long head = ring->head;
+  TraceEvent* ev = &ring->events[head % TRACE_BUFFER_SIZE];
+  // a dumper that sees any of these stores sees the head published before
+  // them too, and knows the slot is being overwritten
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&ev->name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&ev->category, category, __ATOMIC_RELAXED);
+  __atomic_store_n(&ev->ts, start, __ATOMIC_RELAXED);
+  __atomic_store_n(&ev->dur, dur, __ATOMIC_RELAXED);
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+TraceScope Trace_beginScope(const char* name) {
+  TraceScope scope;
+  scope.name = name;
+  scope.start = Metrics_now();
+  return scope;
+}
+
+void Trace_endScope(TraceScope* scope) {
+  Trace_span(scope->name, "scope", scope->start,
+             Metrics_now() - scope->start);
+}
+
+void Trace_setThreadName(const char* name) {
+#if TRACING == 1
+  TraceRing* ring = Trace_getRing();
+  if (ring != NULL)
+    __atomic_store_n(&ring->thread_name, name, __ATOMIC_RELAXED);
+#endif
+}
+
+void Trace_lock(pthread_mutex_t* mutex, const char* name) {
+#if TRACING == 1
+  long start = Metrics_now();
+  if (pthread_mutex_trylock(mutex) != 0) pthread_mutex_lock(mutex);
+  long acquired = Metrics_now();
+  Metrics_observe(MetricLockWait, acquired - start);
+  if (acquired > start) Trace_span(name, "lock_wait", start, acquired - start);
+  TraceRing* ring = Trace_getRing();
+  if (ring == NULL || ring->n_held == TRACE_MAX_HELD) return;
+  ring->held[ring->n_held] = mutex;
+  ring->held_since[ring->n_held] = acquired;
+  ring->n_held++;
+#else
+  Metrics_lock(mutex);
+#endif
+}
+
+void Trace_unlock(pthread_mutex_t* mutex, const char* name) {
+#if TRACING == 1
+  TraceRing* ring = Trace_getRing();
+  if (ring != NULL) {
+    // locks are not always released in LIFO order
+    for (int i = ring->n_held - 1; i >= 0; i--) {
+      if (ring->held[i] != mutex) continue;
+      long since = ring->held_since[i];
+      ring->n_held--;
+      ring->held[i] = ring->held[ring->n_held];
+      ring->held_since[i] = ring->held_since[ring->n_held];
+      Trace_span(name, "lock_hold", since, Metrics_now() - since);
+      break;
+    }
+  }
+#endif
+  pthread_mutex_unlock(mutex);
+}
+
+int Trace_dump(const char* filename) {
+  FILE* out = fopen(filename, "w");
+  if (out == NULL) return -1;
+  int pid = (int)getpid();
+  char first = 1;
+  fprintf(out, "{\"traceEvents\":[\n");
+  for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+    TraceRing* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+    if (ring == NULL) continue;
+    int tid = __atomic_load_n(&ring->tid, __ATOMIC_RELAXED);
+    const char* thread_name =
+        __atomic_load_n(&ring->thread_name, __ATOMIC_RELAXED);
+    if (thread_name != NULL) {
+      fprintf(out,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+              "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",\n", pid, tid, thread_name);
+      first = 0;
+    }
+    // events are read while the owner keeps writing: of the ones published
+    // the oldest may be being overwritten, the last TRACE_BUFFER_SIZE - 1
+    // are in the ring
+    unsigned long owned = __atomic_load_n(&ring->first, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long begin = head - owned >= TRACE_BUFFER_SIZE
+                              ? head - TRACE_BUFFER_SIZE + 1
+                              : owned;
+    for (unsigned long k = begin; k < head; k++) {
+      TraceEvent* slot = &ring->events[k % TRACE_BUFFER_SIZE];
+      TraceEvent ev;
+      ev.name = __atomic_load_n(&slot->name, __ATOMIC_RELAXED);
+      ev.category = __atomic_load_n(&slot->category, __ATOMIC_RELAXED);
+      ev.ts = __atomic_load_n(&slot->ts, __ATOMIC_RELAXED);
+      ev.dur = __atomic_load_n(&slot->dur, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      // the owner got to event k + TRACE_BUFFER_SIZE, which overwrites it
+      if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - k >=
+          TRACE_BUFFER_SIZE)
+        continue;
+      if (ev.name == NULL) continue;
+      fprintf(out,
+              "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%ld,"
+              "\"dur\":%ld,\"pid\":%d,\"tid\":%d}",
+              first ? "" : ",\n", ev.name, ev.category, ev.ts, ev.dur, pid,
+              tid);
+      first = 0;
+    }
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(out);
+  return 0;
+}
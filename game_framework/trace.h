@@ -0,0 +1,55 @@
+#pragma once
+#include <pthread.h>
+#include "../common/common.h"
+#include "metrics.h"
+
+// A single trace event, timestamps come from CLOCK_MONOTONIC (usec).
+// name and category must point to string literals, they are not copied.
+typedef struct TraceEvent {
+  const char* name;
+  const char* category;
+  long ts;
+  long dur;
+} TraceEvent;
+
+// Used by TRACE_SCOPE to close the span when the scope is left
+typedef struct TraceScope {
+  const char* name;
+  long start;
+} TraceScope;
+
+TraceScope Trace_beginScope(const char* name);
+void Trace_endScope(TraceScope* scope);
+
+// records a complete span, the caller provides start and duration
+void Trace_span(const char* name, const char* category, long start, long dur);
+
+// names the calling thread in the dump
+void Trace_setThreadName(const char* name);
+
+// lock/unlock a mutex recording the wait and the hold spans, the lock wait
+// time is also accounted in the metrics
+void Trace_lock(pthread_mutex_t* mutex, const char* name);
+void Trace_unlock(pthread_mutex_t* mutex, const char* name);
+
+// writes the content of every ring buffer, up to the last
+// TRACE_BUFFER_SIZE - 1 events of each thread, as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev), returns -1 on error
+int Trace_dump(const char* filename);
+
+#if TRACING == 1
+#define TRACE_SCOPE(name)                                        \
+  TraceScope _trace_scope __attribute__((cleanup(Trace_endScope))) = \
+      Trace_beginScope(name)
+// span from start (Metrics_now) to now, for the work of a loop that
+// sleeps at the end of each round
+#define TRACE_SINCE(name, start) \
+  Trace_span(name, "scope", (start), Metrics_now() - (start))
+#else
+#define TRACE_SCOPE(name) \
+  do {                    \
+  } while (0)
+#define TRACE_SINCE(name, start) \
+  do {                           \
+  } while (0)
+#endif
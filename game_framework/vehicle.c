@@ -69,6 +69,8 @@ void Vehicle_init(Vehicle* v, World* w, int id, Image* texture) {
   v->world = w;
   v->id = id;
   v->self_vehicle = 0;
+  v->input_driven = 0;
+  v->snapshots = NULL;
   v->texture = texture;
   v->theta = 0;
   v->list.next = v->list.prev = 0;
@@ -124,6 +126,29 @@ void Vehicle_setXYTheta(Vehicle* v, float x, float y, float theta) {
   v->theta = theta;
 }
 
+int Vehicle_place(Vehicle* v, float x, float y, float theta) {
+  Vehicle_setXYTheta(v, x, y, theta);
+  if (!Surface_getTransform(v->camera_to_world, &v->world->ground, x, y, 0,
+                            theta, 0))
+    return 0;
+  v->z = v->camera_to_world[14];
+  Surface_getTransform(v->world_to_camera, &v->world->ground, x, y, 0, theta,
+                       1);
+  return 1;
+}
+
+void Vehicle_getVelocities(Vehicle* v, float* translational_velocity,
+                           float* rotational_velocity) {
+  *translational_velocity = v->translational_velocity;
+  *rotational_velocity = v->rotational_velocity;
+}
+
+void Vehicle_setVelocities(Vehicle* v, float translational_velocity,
+                           float rotational_velocity) {
+  v->translational_velocity = translational_velocity;
+  v->rotational_velocity = rotational_velocity;
+}
+
 void Vehicle_getForcesUpdate(Vehicle* v, float* translational_update,
                              float* rotational_update) {
   *translational_update = v->translational_force_update;
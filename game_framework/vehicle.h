@@ -6,6 +6,7 @@
 
 struct World;
 struct Vehicle;
+struct SnapshotBuffer;
 typedef void (*VehicleDtor)(struct Vehicle* v);
 
 typedef struct Vehicle {
@@ -23,6 +24,8 @@ typedef struct Vehicle {
 
   // dont' touch these
   char is_new, manual_updated, self_vehicle;
+  char input_driven;  // moved only by World_applyInput
+  struct SnapshotBuffer* snapshots;  // if set, World_update draws v from them
   float temp_x, temp_y, temp_z;
   float prev_x, prev_y, prev_z,
       prev_theta;  // orientation of the vehicle, on the surface
@@ -55,6 +58,15 @@ void Vehicle_setForcesUpdate(Vehicle* v, float translational_update,
 
 void Vehicle_setXYTheta(Vehicle* v, float x, float y, float theta);
 
+// moves v to the pose along with its transforms, returns 0 outside the ground
+int Vehicle_place(Vehicle* v, float x, float y, float theta);
+
+void Vehicle_getVelocities(Vehicle* v, float* translational_velocity,
+                           float* rotational_velocity);
+
+void Vehicle_setVelocities(Vehicle* v, float translational_velocity,
+                           float rotational_velocity);
+
 void Vehicle_getTime(Vehicle* v, struct timeval* time);
 
 void Vehicle_setTime(Vehicle* v, struct timeval time);
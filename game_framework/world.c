@@ -1,6 +1,7 @@
 #include "world.h"
 #include <GL/glut.h>
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -10,12 +11,15 @@
 #include "../av_framework/image.h"
 #include "../av_framework/surface.h"
 #include "../common/common.h"
+#include "snapshot_buffer.h"
+#include "trace.h"
 #include "vehicle.h"
 
 void World_destroy(World* w) {
   int ret = pthread_mutex_destroy(&(w->update_mutex));
   if (ret == -1) debug_print("World's mutex wasn't successfully destroyed");
   Surface_destroy(&w->ground);
+  DistanceField_destroy(&w->obstacles);
   sem_t sem = w->vehicles.sem;
   sem_wait(&(sem));
   ListItem* item = w->vehicles.first;
@@ -35,25 +39,112 @@ void World_disableDecay(World* w) { w->disable_collisions = 1; }
 
 int World_init(World* w, Image* surface_elevation, Image* surface_texture,
                float x_step, float y_step, float z_step) {
+  return World_initCached(w, surface_elevation, surface_texture, x_step,
+                          y_step, z_step, NULL, NULL);
+}
+
+// the cached ground of an elevation map, also depends on how it's built
+static void World_surfaceKey(const TextureHash* elevation_hash,
+                             unsigned char key[SURFACE_KEY_LEN]) {
+  static const char* layout = "surface v1 .5 .5 5";
+  Sha256Context ctx;
+  Sha256_init(&ctx);
+  Sha256_update(&ctx, layout, strlen(layout));
+  Sha256_update(&ctx, elevation_hash->bytes, SHA256_DIGEST_LEN);
+  Sha256_final(&ctx, key);
+}
+
+int World_initCached(World* w, Image* surface_elevation,
+                     Image* surface_texture, float x_step, float y_step,
+                     float z_step, const char* cache_dir,
+                     const TextureHash* elevation_hash) {
   int ret = pthread_mutex_init(&(w->update_mutex), NULL);
   if (ret == -1) debug_print("Mutex init for world was not successful");
   List_init(&w->vehicles);
   w->disable_collisions = 0;
   w->disable_decay = 0;
-  Image* float_image = Image_convert(surface_elevation, FLOATMONO);
+  w->clock = NULL;
 
-  if (!float_image) return 0;
+  unsigned char key[SURFACE_KEY_LEN];
+  char filename[PATH_MAX] = "";
+  if (cache_dir != NULL) {
+    TextureHash hash;
+    if (elevation_hash == NULL) {
+      TextureHash_compute(surface_elevation, &hash);
+      elevation_hash = &hash;
+    }
+    World_surfaceKey(elevation_hash, key);
+    int len = snprintf(filename, sizeof(filename), "%s/", cache_dir);
+    for (int i = 0; i < SURFACE_KEY_LEN && len < sizeof(filename) - 3; i++)
+      len += sprintf(filename + len, "%02x", key[i]);
+    snprintf(filename + len, sizeof(filename) - len, ".surface");
+  }
+  if (cache_dir == NULL || Surface_load(&w->ground, filename, key) == -1) {
+    Image* float_image = Image_convert(surface_elevation, FLOATMONO);
+
+    if (!float_image) return 0;
 
-  Surface_fromMatrix(&w->ground, (float**)float_image->row_data,
-                     float_image->rows, float_image->cols, .5, .5, 5);
+    Surface_fromMatrix(&w->ground, (float**)float_image->row_data,
+                       float_image->rows, float_image->cols, .5, .5, 5);
+    Image_free(float_image);
+    if (cache_dir != NULL && Surface_save(&w->ground, filename, key) == -1)
+      LOG_WARNING("[World] Can't write the ground cache %s", filename);
+  }
   w->ground.texture = surface_texture;
-  Image_free(float_image);
+  // only the server checks the moves, see World_buildObstacles
+  DistanceField_initEmpty(&w->obstacles);
+  w->dt = 1;
+  w->time_scale = WORLD_TIME_SCALE;
+  gettimeofday(&w->last_update, 0);
+  return 1;
+}
+
+int World_initTiled(World* w, int rows, int cols, int tile_size) {
+  int ret = pthread_mutex_init(&(w->update_mutex), NULL);
+  if (ret == -1) debug_print("Mutex init for world was not successful");
+  List_init(&w->vehicles);
+  w->disable_collisions = 0;
+  w->disable_decay = 0;
+  w->clock = NULL;
+  // same scales used by World_init
+  Surface_initTiled(&w->ground, rows, cols, .5, .5, tile_size);
+  // a streamed map belongs to a client, it doesn't check the moves
+  DistanceField_initEmpty(&w->obstacles);
   w->dt = 1;
-  w->time_scale = 10;
+  w->time_scale = WORLD_TIME_SCALE;
   gettimeofday(&w->last_update, 0);
   return 1;
 }
 
+int World_buildObstacles(World* w, Image* surface_elevation) {
+  DistanceField_destroy(&w->obstacles);
+  if (DistanceField_init(&w->obstacles, surface_elevation, WALL_THRESHOLD,
+                         w->ground.row_scale, w->ground.col_scale) == 0)
+    return 1;
+  DistanceField_initEmpty(&w->obstacles);
+  return 0;
+}
+
+int World_setTile(World* w, int tile_row, int tile_col, Image* elevation,
+                  Image* texture) {
+  int ret = 0;
+  if (elevation != NULL) {
+    Image* float_image = Image_convert(elevation, FLOATMONO);
+    if (!float_image) return 0;
+    pthread_mutex_lock(&w->update_mutex);
+    ret = Surface_setTile(&w->ground, tile_row, tile_col,
+                          (float**)float_image->row_data, float_image->rows,
+                          float_image->cols, 5);
+    pthread_mutex_unlock(&w->update_mutex);
+    Image_free(float_image);
+  }
+  if (texture != NULL) {
+    Surface_setTileTexture(&w->ground, tile_row, tile_col, texture);
+    ret = 1;
+  }
+  return ret;
+}
+
 void World_fixCollisions(World* w, Vehicle* v) {
   // v mutex is already locked
   if (w->disable_collisions) return;
@@ -62,9 +153,9 @@ void World_fixCollisions(World* w, Vehicle* v) {
   for (; item2 != NULL; item2 = item2->next) {
     Vehicle* v2 = (Vehicle*)item2;
     if (v2 == v || v2->id == v->id) continue;
-    pthread_mutex_lock(&v2->mutex);
+    Trace_lock(&v2->mutex, "vehicle_mutex");
     flag = Vehicle_fixCollisions(v, v2);
-    pthread_mutex_unlock(&v2->mutex);
+    Trace_unlock(&v2->mutex, "vehicle_mutex");
   }
   if (!flag) {
     v->is_new = 0;
@@ -74,6 +165,7 @@ void World_fixCollisions(World* w, Vehicle* v) {
 }
 
 void World_update(World* w) {
+  TRACE_SCOPE("World_update");
   struct timeval current_time;
   gettimeofday(&current_time, 0);
   struct timeval dt;
@@ -82,14 +174,22 @@ void World_update(World* w) {
   float exp = delta / (30000 * 1e-6);
   float tr_decay = powf(1 - 0.001, exp);
   float rt_decay = powf(1 - 0.15, exp);
+  unsigned int server_time = w->clock ? ClockSync_now(w->clock) : 0;
   sem_t sem = w->vehicles.sem;
   sem_wait(&sem);
   ListItem* item = w->vehicles.first;
   while (item) {
     Vehicle* v = (Vehicle*)item;
     World_fixCollisions(w, v);
-    pthread_mutex_lock(&v->mutex);
-    if (!Vehicle_update(v, delta * w->time_scale)) {
+    Trace_lock(&v->mutex, "vehicle_mutex");
+    if (v->snapshots) {
+      float x, y, theta;
+      if (SnapshotBuffer_sample(v->snapshots, server_time, &x, &y, &theta))
+        Vehicle_place(v, x, y, theta);
+    } else if (v->input_driven) {
+      if (v->self_vehicle && !w->disable_collisions)
+        Vehicle_decayForcesUpdate(v, tr_decay, rt_decay);
+    } else if (!Vehicle_update(v, delta * w->time_scale)) {
       Vehicle_reset(v);
     } else {
       if (v->manual_updated) {
@@ -106,20 +206,18 @@ void World_update(World* w) {
       }
     }
     Vehicle_setTime(v, current_time);
-    pthread_mutex_unlock(&v->mutex);
+    Trace_unlock(&v->mutex, "vehicle_mutex");
     item = item->next;
   }
   sem_post(&sem);
   w->last_update = current_time;
 }
 
-void World_manualUpdate(World* w, Vehicle* v, struct timeval update_time) {
+void World_manualUpdate(World* w, Vehicle* v, float elapsed) {
   pthread_mutex_lock(&w->update_mutex);
   struct timeval current_time;
   gettimeofday(&current_time, 0);
-  struct timeval dt;
-  timersub(&current_time, &update_time, &dt);
-  float delta = dt.tv_sec + 1e-6 * dt.tv_usec;
+  float delta = elapsed > 0 ? elapsed : 0;
   float exp = delta / (30000 * 1e-6);
   float tr_decay = powf(1 - 0.001, exp);
   float rt_decay = powf(1 - 0.15, exp);
@@ -130,6 +228,19 @@ void World_manualUpdate(World* w, Vehicle* v, struct timeval update_time) {
   pthread_mutex_unlock(&w->update_mutex);
 }
 
+void World_applyInput(World* w, Vehicle* v, float translational_force,
+                      float rotational_force) {
+  // v mutex is already locked
+  pthread_mutex_lock(&w->update_mutex);
+  struct timeval current_time;
+  gettimeofday(&current_time, 0);
+  Vehicle_setForcesUpdate(v, translational_force, rotational_force);
+  if (!Vehicle_update(v, w->time_scale / INPUT_RATE)) Vehicle_reset(v);
+  Vehicle_setTime(v, current_time);
+  v->input_driven = 1;
+  pthread_mutex_unlock(&w->update_mutex);
+}
+
 Vehicle* World_getVehicle(World* w, int vehicle_id) {
   sem_t sem = w->vehicles.sem;
   sem_wait(&sem);
@@ -2,12 +2,18 @@
 #include <sys/time.h>
 #include "../av_framework/image.h"
 #include "../av_framework/surface.h"
+#include "clock_sync.h"
+#include "distance_field.h"
 #include "linked_list.h"
+#include "texture_store.h"
 #include "vehicle.h"
 
 typedef struct World {
   ListHead vehicles;  // list of vehicles
   Surface ground;     // surface
+  // walls of the ground, for the clearance queries. Empty unless
+  // World_buildObstacles is called
+  DistanceField obstacles;
 
   // stuff
   float dt;
@@ -15,12 +21,34 @@ typedef struct World {
   float time_scale;
   char disable_collisions;
   char disable_decay; 
+  ClockSync* clock;  // server timeline of the vehicle snapshots, if any
   pthread_mutex_t update_mutex;
 } World;
 
 int World_init(World* w, Image* surface_elevation, Image* surface_texture,
                float x_step, float y_step, float z_step);
 
+// like World_init, but the ground is mapped from cache_dir if it was already
+// built out of the same elevation, and stored there otherwise. elevation_hash
+// is the TextureHash of surface_elevation, computed here if NULL
+int World_initCached(World* w, Image* surface_elevation,
+                     Image* surface_texture, float x_step, float y_step,
+                     float z_step, const char* cache_dir,
+                     const TextureHash* elevation_hash);
+
+// world whose ground is streamed in tiles, see World_setTile
+int World_initTiled(World* w, int rows, int cols, int tile_size);
+
+// builds the walls of the ground out of the elevation it was made of, for
+// the world that checks the moves. Returns 0 on error, the world is left
+// without walls
+int World_buildObstacles(World* w, Image* surface_elevation);
+
+// adds a tile of the ground, elevation is not retained while the surface
+// takes the ownership of texture (if not NULL). Returns 0 on error
+int World_setTile(World* w, int tile_row, int tile_col, Image* elevation,
+                  Image* texture);
+
 void World_destroy(World* w);
 
 void World_update(World* w);
@@ -33,7 +61,13 @@ Vehicle* World_addVehicle(World* w, Vehicle* v);
 
 Vehicle* World_detachVehicle(World* w, Vehicle* v);
 
-void World_manualUpdate(World* w, Vehicle* v, struct timeval update_time);
+// advances v by the seconds elapsed since its pose was taken
+void World_manualUpdate(World* w, Vehicle* v, float elapsed);
+
+// advances v by one input frame (1/INPUT_RATE seconds) with the given forces,
+// from now on World_update leaves v where the inputs bring it
+void World_applyInput(World* w, Vehicle* v, float translational_force,
+                      float rotational_force);
 
 void World_disableVehicleCollisions(World* w);
 
@@ -1,6 +1,7 @@
 #include <arpa/inet.h>  // htons() and inet_addr()
 #include <math.h>
 #include <netinet/in.h>  // struct sockaddr_in
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -13,14 +14,29 @@
 #include "../av_framework/world_viewer.h"
 #include "../client/client_op.h"
 #include "../common/common.h"
+#include "../game_framework/asset_blob.h"
+#include "../game_framework/asset_cache.h"
+#include "../game_framework/chat_channel.h"
 #include "../game_framework/client_list.h"
-#include "../game_framework/message_list.h"
+#include "../game_framework/clock_sync.h"
+#include "../game_framework/latency.h"
+#include "../game_framework/link_stats.h"
+#include "../game_framework/logger.h"
+#include "../game_framework/map_tiles.h"
+#include "../game_framework/message_ring.h"
+#include "../game_framework/metrics.h"
+#include "../game_framework/move_validator.h"
+#include "../game_framework/priority_accumulator.h"
 #include "../game_framework/protogame_protocol.h"
+#include "../game_framework/roster.h"
+#include "../game_framework/texture_store.h"
+#include "../game_framework/trace.h"
 #include "../game_framework/vehicle.h"
 #include "../game_framework/world.h"
 #define RECEIVER_SLEEP 50 * 100
 #define WORLD_LOOP_SLEEP 70 * 1000
-#define SENDER_SLEEP 300 * 1000
+// each client is served when its interval (see LinkStats_adapt) expires
+#define SENDER_SLEEP LINK_MIN_INTERVAL * 1000
 #if SERVER_SIDE_POSITION_CHECK == 1
 #define _USE_SERVER_SIDE_FOG_
 #endif
@@ -30,21 +46,52 @@ World server_world;
 struct timeval world_update_time;
 Image* surface_elevation;
 Image* surface_texture;
+// serialized map images, served to every joining client. The compressed
+// blobs are NULL if compression doesn't pay off
+AssetBlob* texture_blob = NULL;
+AssetBlob* elevation_blob = NULL;
+AssetBlob* texture_compressed_blob = NULL;
+AssetBlob* elevation_compressed_blob = NULL;
+// advertised to the clients so they can use their disk cache
+TextureHash texture_hash, elevation_hash;
+// vehicle textures, deduplicated by content
+TextureStore texture_store;
+// the map cut in tiles for the clients that stream it
+MapTiles map_tiles;
 // flags
 int connectivity = 1;
 int exchange_update = 1;
 int clean_garbage = 1;
 int has_users = 0;
+volatile sig_atomic_t dump_latency = 0;
+volatile sig_atomic_t dump_trace = 0;
 // lists
 ClientListHead* users;
-MessageListHead* messages;
+MessageRing messages;  // pushed by any thread, drained by sendMessages
+ChatLog chat_log;      // the drained messages, numbered
+#ifdef _USE_SERVER_SIDE_FOG_
+Roster roster;  // of the users, replicated to the clients
+#endif
 // networking
 uint16_t port_number_no;
 int server_tcp = -1;
 int server_udp;
+int server_metrics = -1;
 // syncronization
 pthread_mutex_t users_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t messages_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t blobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+// vehicle updates queued by the UDP receiver, validated in one batch
+typedef struct PendingUpdate {
+  VehicleUpdatePacket* vup;
+  struct sockaddr_in addr;
+  struct timeval ingest_time;
+  unsigned int ingest_clock;  // ingest_time on the shared timeline
+  ClientListItem* client;  // NULL if the update is dropped
+  int move;                // index in move_batch
+} PendingUpdate;
+PendingUpdate pending_updates[MOVE_BATCH_SIZE];
+int num_pending_updates = 0;
+MoveBatch move_batch;
 
 typedef struct {
   int client_desc;
@@ -58,6 +105,12 @@ void handleSignal(int signal) {
   switch (signal) {
     case SIGHUP:
       break;
+    case SIGUSR1:
+      dump_latency = 1;
+      break;
+    case SIGUSR2:
+      dump_trace = 1;
+      break;
     case SIGINT:
       connectivity = 0;
       exchange_update = 0;
@@ -83,6 +136,10 @@ void sendDisconnect(int socket_udp, struct sockaddr_in client_addr) {
   int ret =
       sendto(socket_udp, buf_send, size, 0, (struct sockaddr*)&client_addr,
              (socklen_t)sizeof(client_addr));
+  if (ret > 0) {
+    Metrics_add(MetricPacketsOut, 1);
+    Metrics_add(MetricBytesOut, ret);
+  }
   Packet_free(&(ip->header));
   debug_print(
       "[UDP_Receiver] Sent PostDisconnect packet of %d bytes to unrecognized "
@@ -90,95 +147,339 @@ void sendDisconnect(int socket_udp, struct sockaddr_in client_addr) {
       ret);
 }
 
+// the first UDP packet of a client tells where to send its updates, it must
+// come from the same host of the TCP connection. Returns 0 otherwise
+int bindUdpAddress(ClientListItem* client, struct sockaddr_in addr) {
+  if (client->is_udp_addr_ready) return 1;
+  int sockaddr_len = sizeof(struct sockaddr_in);
+  char addr_udp[sockaddr_len];
+  char addr_tcp[sockaddr_len];
+  const char* pt_addr_udp =
+      inet_ntop(addr.sin_family, &(addr.sin_addr), addr_udp, sockaddr_len);
+  const char* pt_addr_tcp = inet_ntop(
+      addr.sin_family, &(client->user_addr_tcp.sin_addr), addr_tcp,
+      sockaddr_len);
+  if (pt_addr_udp != NULL && pt_addr_tcp != NULL &&
+      strcmp(addr_udp, addr_tcp) != 0)
+    return 0;
+  client->user_addr_udp = addr;
+  client->is_udp_addr_ready = 1;
+  return 1;
+}
+
+// accounts the link feedback of a packet of client, users_mutex is held
+// roster_ack is taken only from a packet newer than the others received
+void receiveLinkFeedback(ClientListItem* client, const LinkFeedback* link,
+                         unsigned int roster_ack) {
+  int samples = client->link.rtt_samples;
+  unsigned int lost = client->link.lost;
+  if (LinkStats_receive(&client->link, link, Clock_now()))
+    client->roster_ack = roster_ack;
+  if (client->link.rtt_samples != samples)
+    Metrics_observe(MetricRttSample, client->link.last_rtt * 1000);
+  // the replicas are set when a snapshot is sent: a lost one may have
+  // carried states the client never got, so they are all sent again
+  if (client->link.lost != lost)
+    for (int i = 0; i < WORLDSIZE; i++) client->replicas[i].valid = 0;
+}
+
+// the vehicle of a user that left isn't extrapolated by anyone anymore,
+// a new user taking its id is sent in full. users_mutex is held
+void forgetReplicas(ClientListItem* user) {
+  for (ClientListItem* c = users->first; c != NULL; c = c->next)
+    DeadReckoning_init(&c->replicas[user->id % WORLDSIZE]);
+}
+
+// says goodbye in the chat for a user that is leaving, users_mutex is held
+void leaveChat(ClientListItem* user) {
+  if (user->inside_chat && !MessageRing_addDisconnectMessage(&messages, user))
+    Metrics_add(MetricChatDropped, 1);
+}
+
+// simulates the input frames of a client that weren't applied yet, oldest
+// first. A client can't apply more than INPUT_RATE frames per second (with
+// INPUT_MAX_BURST of slack), so it can't speed up its vehicle
+int applyVehicleInput(int socket_udp, VehicleForces* input,
+                      struct sockaddr_in addr) {
+  struct timeval ingest_time;
+  gettimeofday(&ingest_time, NULL);
+  Trace_lock(&users_mutex, "users_mutex");
+  ClientListItem* client = ClientList_findByID(users, input->id);
+  if (client == NULL) {
+    Trace_unlock(&users_mutex, "users_mutex");
+    sendDisconnect(socket_udp, addr);
+    return 0;
+  }
+  if (!client->inside_world || !bindUdpAddress(client, addr)) {
+    Trace_unlock(&users_mutex, "users_mutex");
+    return 0;
+  }
+  receiveLinkFeedback(client, &input->link, input->roster_ack);
+  int fresh = input->num_frames;
+  if (client->input_time.tv_sec == -1) {
+    client->input_budget = INPUT_MAX_BURST;
+  } else {
+    fresh = (int)(input->sequence - client->input_sequence);
+    if (fresh <= 0) {
+      Trace_unlock(&users_mutex, "users_mutex");
+      return 0;
+    }
+    struct timeval elapsed;
+    timersub(&ingest_time, &client->input_time, &elapsed);
+    client->input_budget +=
+        (elapsed.tv_sec + 1e-6 * elapsed.tv_usec) * INPUT_RATE;
+    if (client->input_budget > INPUT_MAX_BURST)
+      client->input_budget = INPUT_MAX_BURST;
+  }
+  if (fresh > input->num_frames) {
+    Metrics_add(MetricInputsLost, fresh - input->num_frames);
+    fresh = input->num_frames;
+  }
+  int applied = fresh;
+  if (applied > (int)client->input_budget) {
+    applied = (int)client->input_budget;
+    Metrics_add(MetricInputsDropped, fresh - applied);
+    LOG_EVERY(LogWarning, 100,
+              "[UDPHandler] Vehicle %d sends inputs too fast", input->id);
+  }
+  client->input_budget -= applied;
+  client->input_sequence = input->sequence;
+  client->input_time = ingest_time;
+  client->ingest_time = ingest_time;
+
+  Trace_lock(&client->vehicle->mutex, "vehicle_mutex");
+  for (int i = applied - 1; i >= 0; i--)
+    World_applyInput(&server_world, client->vehicle,
+                     (float)input->frames[i].translational_force /
+                         INPUT_FORCE_SCALE,
+                     (float)input->frames[i].rotational_force /
+                         INPUT_FORCE_SCALE);
+  gettimeofday(&client->apply_time, NULL);
+  Latency_record(LatApply, &client->ingest_time, &client->apply_time);
+  client->snapshot_pending = 1;
+  if (client->prev_x != -1 && client->prev_y != -1) {
+    client->x_shift += abs(client->x - client->prev_x);
+    client->y_shift += abs(client->y - client->prev_y);
+  }
+  client->prev_x = client->x;
+  client->prev_y = client->y;
+  Trace_unlock(&client->vehicle->mutex, "vehicle_mutex");
+  client->last_update_time = ingest_time;
+  // frames[0] is the newest frame applied, the pose is the one it left. A
+  // time in the future would stop the dead reckoning of the vehicle, it's
+  // kept between the last pose and now
+  if (applied > 0) {
+    unsigned int now = Clock_now();
+    unsigned int pose_time = input->time;
+    if (pose_time == 0 || (int)(pose_time - now) > 0) pose_time = now;
+    if (client->input_clock != 0 &&
+        (int)(pose_time - client->input_clock) < 0)
+      pose_time = client->input_clock;
+    client->input_clock = pose_time;
+  }
+  Trace_unlock(&users_mutex, "users_mutex");
+  return applied;
+}
+
+// checks the pose reported by a client before it's applied
+void applyVehicleUpdate(int socket_udp, PendingUpdate* pending) {
+  VehicleUpdatePacket* vup = pending->vup;
+  ClientListItem* client = pending->client;
+  MoveVerdict verdict = move_batch.verdict[pending->move];
+  if (verdict == MoveClamped) Metrics_add(MetricMovesClamped, 1);
+  if (verdict == MoveRejected) {
+    Metrics_add(MetricMovesRejected, 1);
+    LOG_EVERY(LogWarning, 100, "[UDPHandler] Rejected the pose of vehicle %d",
+              vup->id);
+  }
+  Latency_recordMs(LatUplink, vup->time, pending->ingest_clock);
+  client->ingest_time = pending->ingest_time;
+  Trace_lock(&client->vehicle->mutex, "vehicle_mutex");
+  Vehicle_setForcesUpdate(client->vehicle, vup->translational_force,
+                          vup->rotational_force);
+  Vehicle_setXYTheta(client->vehicle, move_batch.x[pending->move],
+                     move_batch.y[pending->move],
+                     move_batch.theta[pending->move]);
+  // the pose was validated for at most MOVE_MAX_DT
+  float elapsed = (int)(Clock_now() - vup->time) / 1000.0;
+  World_manualUpdate(&server_world, client->vehicle,
+                     elapsed < MOVE_MAX_DT ? elapsed : MOVE_MAX_DT);
+  gettimeofday(&client->apply_time, NULL);
+  Latency_record(LatApply, &client->ingest_time, &client->apply_time);
+  client->snapshot_pending = 1;
+  if (client->prev_x != -1 && client->prev_y != -1) {
+    client->x_shift += abs(client->x - client->prev_x);
+    client->y_shift += abs(client->y - client->prev_y);
+  }
+  client->prev_x = client->x;
+  client->prev_y = client->y;
+  Trace_unlock(&client->vehicle->mutex, "vehicle_mutex");
+  client->last_update_time = pending->ingest_time;
+  client->input_clock = vup->time;
+  debug_print(
+      "[UDP_Receiver] Applied VehicleUpdatePacket with "
+      "force_translational_update: %f force_rotation_update: %f.. \n",
+      vup->translational_force, vup->rotational_force);
+}
+
+// applies the vehicle updates received since the last call, their poses
+// are validated in one batch
+int applyVehicleUpdates(int socket_udp) {
+  if (num_pending_updates == 0) return 0;
+  TRACE_SCOPE("applyVehicleUpdates");
+  int applied = 0;
+  Trace_lock(&users_mutex, "users_mutex");
+  MoveBatch_clear(&move_batch);
+  for (int i = 0; i < num_pending_updates; i++) {
+    PendingUpdate* pending = &pending_updates[i];
+    VehicleUpdatePacket* vup = pending->vup;
+    ClientListItem* client = ClientList_findByID(users, vup->id);
+    pending->client = NULL;
+    if (client == NULL) {
+      debug_print(
+          "[UDPHandler] Can't find the user with id %d to apply the update "
+          "\n",
+          vup->id);
+      sendDisconnect(socket_udp, pending->addr);
+      continue;
+    }
+    if (!client->inside_world) {
+      debug_print(
+          "[Info] Skipping update of a vehicle that isn't inside the world "
+          "simulation \n");
+      continue;
+    }
+    if (!(client->input_clock == 0 ||
+          (int)(vup->time - client->input_clock) > 0))
+      continue;
+
+    if (!bindUdpAddress(client, pending->addr)) continue;
+    // the first update is checked against the spawn pose
+    struct timeval elapsed;
+    timersub(&pending->ingest_time, &client->ingest_time, &elapsed);
+    float dt = client->ingest_time.tv_sec == -1
+                   ? MOVE_MAX_DT
+                   : elapsed.tv_sec + 1e-6 * elapsed.tv_usec;
+    float x, y, theta;
+    Trace_lock(&client->vehicle->mutex, "vehicle_mutex");
+    Vehicle_getXYTheta(client->vehicle, &x, &y, &theta);
+    Trace_unlock(&client->vehicle->mutex, "vehicle_mutex");
+    pending->move = MoveBatch_add(&move_batch, x, y, theta, vup->x, vup->y,
+                                  vup->theta, dt);
+    pending->client = client;
+  }
+  MoveBatch_validate(&move_batch, &server_world.obstacles);
+  for (int i = 0; i < num_pending_updates; i++) {
+    if (pending_updates[i].client) {
+      applyVehicleUpdate(socket_udp, &pending_updates[i]);
+      applied++;
+    }
+    Packet_free(&pending_updates[i].vup->header);
+  }
+  Trace_unlock(&users_mutex, "users_mutex");
+  num_pending_updates = 0;
+  return applied;
+}
+
 int UDPHandler(int socket_udp, char* buf_rcv, struct sockaddr_in client_addr) {
   PacketHeader* ph = (PacketHeader*)buf_rcv;
   switch (ph->type) {
     case (VehicleUpdate): {
+      struct timeval ingest_time;
+      gettimeofday(&ingest_time, NULL);
       VehicleUpdatePacket* vup =
           (VehicleUpdatePacket*)Packet_deserialize(buf_rcv, ph->size);
-      pthread_mutex_lock(&users_mutex);
+      if (vup == NULL) return -1;
+      // accounted now, a queued update can be replaced before it's applied
+      Trace_lock(&users_mutex, "users_mutex");
       ClientListItem* client = ClientList_findByID(users, vup->id);
-      if (client == NULL) {
-        debug_print(
-            "[UDPHandler] Can't find the user with id %d to apply the update "
-            "\n",
-            vup->id);
-        Packet_free(&vup->header);
-        sendDisconnect(socket_udp, client_addr);
-        pthread_mutex_unlock(&users_mutex);
-        return -1;
-      }
-
-      if (!client->inside_world) {
-        debug_print(
-            "[Info] Skipping update of a vehicle that isn't inside the world "
-            "simulation \n");
-        pthread_mutex_unlock(&users_mutex);
+      if (client != NULL && client->inside_world)
+        receiveLinkFeedback(client, &vup->link, vup->roster_ack);
+      Trace_unlock(&users_mutex, "users_mutex");
+      // a newer update of the same vehicle replaces the queued one
+      for (int i = 0; i < num_pending_updates; i++) {
+        PendingUpdate* pending = &pending_updates[i];
+        if (pending->vup->id != vup->id) continue;
+        if ((int)(vup->time - pending->vup->time) > 0) {
+          Packet_free(&pending->vup->header);
+          pending->vup = vup;
+          pending->addr = client_addr;
+          pending->ingest_time = ingest_time;
+          pending->ingest_clock = Clock_now();
+        } else {
+          Packet_free(&vup->header);
+        }
         return 0;
       }
-      if (!(client->last_update_time.tv_sec == -1 ||
-            timercmp(&vup->time, &client->last_update_time, >)))
-        goto END;
-
-      if (!client->is_udp_addr_ready) {
-        int sockaddr_len = sizeof(struct sockaddr_in);
-        char addr_udp[sockaddr_len];
-        char addr_tcp[sockaddr_len];
-        const char* pt_addr_udp =
-            inet_ntop(client_addr.sin_family, &(client_addr.sin_addr), addr_udp,
-                      sockaddr_len);
-        const char* pt_addr_tcp =
-            inet_ntop(client_addr.sin_family, &(client->user_addr_tcp.sin_addr),
-                      addr_tcp, sockaddr_len);
-        if (pt_addr_udp != NULL && pt_addr_tcp != NULL &&
-            strcmp(addr_udp, addr_tcp) != 0)
-          goto END;
-        client->user_addr_udp = client_addr;
-        client->is_udp_addr_ready = 1;
-      }
-
-      pthread_mutex_lock(&client->vehicle->mutex);
-      Vehicle_setForcesUpdate(client->vehicle, vup->translational_force,
-                              vup->rotational_force);
-      Vehicle_setXYTheta(client->vehicle, vup->x, vup->y, vup->theta);
-      World_manualUpdate(&server_world, client->vehicle, vup->time);
-      if (client->prev_x != -1 && client->prev_y != -1) {
-        client->x_shift += abs(client->x - client->prev_x);
-        client->y_shift += abs(client->y - client->prev_y);
-      }
-      client->prev_x = client->x;
-      client->prev_y = client->y;
-      pthread_mutex_unlock(&client->vehicle->mutex);
-      client->last_update_time = vup->time;
-    END:
-      pthread_mutex_unlock(&users_mutex);
-      debug_print(
-          "[UDP_Receiver] Applied VehicleUpdatePacket with "
-          "force_translational_update: %f force_rotation_update: %f.. \n",
-          vup->translational_force, vup->rotational_force);
-      Packet_free(&vup->header);
+      // the receiver applies the queue before it's full
+      PendingUpdate* pending = &pending_updates[num_pending_updates++];
+      pending->vup = vup;
+      pending->addr = client_addr;
+      pending->ingest_time = ingest_time;
+      pending->ingest_clock = Clock_now();
+      return 0;
+    }
+    case (TimeSync): {
+      // answered right away, the client measures the round trip
+      unsigned int receive = Clock_now();
+      TimeSyncPacket* sync =
+          (TimeSyncPacket*)Packet_deserialize(buf_rcv, ph->size);
+      if (sync == NULL) return -1;
+      sync->server_receive = receive;
+      sync->server_send = Clock_now();
+      char buf_send[sizeof(TimeSyncPacket)];
+      int size = Packet_serialize(buf_send, &sync->header);
+      Packet_free(&sync->header);
+      if (sendto(socket_udp, buf_send, size, 0,
+                 (struct sockaddr*)&client_addr, sizeof(client_addr)) != size)
+        return -1;
+      Metrics_add(MetricPacketsOut, 1);
+      Metrics_add(MetricBytesOut, size);
+      return 0;
+    }
+    case (VehicleInput): {
+      VehicleForces* input =
+          (VehicleForces*)Packet_deserialize(buf_rcv, ph->size);
+      if (input == NULL) return -1;
+      applyVehicleInput(socket_udp, input, client_addr);
+      Packet_free(&input->header);
+      return 0;
+    }
+    case (ChatAck): {
+      ChatAckPacket* ack =
+          (ChatAckPacket*)Packet_deserialize(buf_rcv, ph->size);
+      if (ack == NULL) return -1;
+      Trace_lock(&users_mutex, "users_mutex");
+      ClientListItem* client = ClientList_findByID(users, ack->id);
+      // only from the address the client plays from
+      struct sockaddr_in* addr = client ? &client->user_addr_udp : NULL;
+      if (client != NULL && client->inside_chat && client->is_udp_addr_ready &&
+          addr->sin_addr.s_addr == client_addr.sin_addr.s_addr &&
+          addr->sin_port == client_addr.sin_port)
+        ChatSender_ack(&client->chat, ack->ack, ack->selective);
+      Trace_unlock(&users_mutex, "users_mutex");
+      Packet_free(&ack->header);
       return 0;
     }
     case (ChatMessage): {
       MessagePacket* mp = (MessagePacket*)Packet_deserialize(buf_rcv, ph->size);
-      MessageListItem* mli = (MessageListItem*)malloc(sizeof(MessageListItem));
-      pthread_mutex_lock(&users_mutex);
+      if (mp == NULL) return -1;
+      MessageBroadcast m = {0};
+      Trace_lock(&users_mutex, "users_mutex");
       ClientListItem* user = ClientList_findByID(users, mp->message.id);
       if (user == NULL || !user->inside_chat || !user->inside_world) {
-        free(mli);
-        pthread_mutex_unlock(&users_mutex);
+        Trace_unlock(&users_mutex, "users_mutex");
+        Packet_free(&mp->header);
         return 0;
       }
-      strncpy(mli->sender, user->username, USERNAME_LEN);
-      pthread_mutex_unlock(&users_mutex);
-      strncpy(mli->text, mp->message.text, TEXT_LEN);
-      mli->id = mp->message.id;
-      mli->type = mp->message.type;
-      time(&mli->time);
-      pthread_mutex_lock(&messages_mutex);
-      MessageList_insert(messages, mli);
+      strncpy(m.sender, user->username, USERNAME_LEN);
+      Trace_unlock(&users_mutex, "users_mutex");
+      strncpy(m.text, mp->message.text, TEXT_LEN);
+      m.id = mp->message.id;
+      m.type = mp->message.type;
+      time(&m.time);
       Packet_free(&mp->header);
-      pthread_mutex_unlock(&messages_mutex);
+      if (!MessageRing_push(&messages, &m)) Metrics_add(MetricChatDropped, 1);
       return 0;
     }
     default:
@@ -186,8 +487,81 @@ int UDPHandler(int socket_udp, char* buf_rcv, struct sockaddr_in client_addr) {
   }
 }
 
+// serializes the map images once, a map change only needs to call this again
+// while clients still being served keep their reference to the old blobs
+int updateMapBlobs(Image* texture, Image* elevation) {
+  AssetBlob* new_texture = AssetBlob_create(texture, PostTexture, EncodingRaw);
+  AssetBlob* new_elevation =
+      AssetBlob_create(elevation, PostElevation, EncodingRaw);
+  AssetBlob* new_texture_compressed =
+      AssetBlob_createCompressed(texture, PostTexture);
+  AssetBlob* new_elevation_compressed =
+      AssetBlob_createCompressed(elevation, PostElevation);
+  if (new_texture == NULL || new_elevation == NULL) {
+    AssetBlob_release(new_texture_compressed);
+    AssetBlob_release(new_elevation_compressed);
+    AssetBlob_release(new_texture);
+    AssetBlob_release(new_elevation);
+    return -1;
+  }
+  TextureHash new_texture_hash, new_elevation_hash;
+  TextureHash_compute(texture, &new_texture_hash);
+  TextureHash_compute(elevation, &new_elevation_hash);
+  pthread_mutex_lock(&blobs_mutex);
+  AssetBlob* old_texture = texture_blob;
+  AssetBlob* old_elevation = elevation_blob;
+  AssetBlob* old_texture_compressed = texture_compressed_blob;
+  AssetBlob* old_elevation_compressed = elevation_compressed_blob;
+  texture_blob = new_texture;
+  elevation_blob = new_elevation;
+  texture_compressed_blob = new_texture_compressed;
+  elevation_compressed_blob = new_elevation_compressed;
+  texture_hash = new_texture_hash;
+  elevation_hash = new_elevation_hash;
+  pthread_mutex_unlock(&blobs_mutex);
+  AssetBlob_release(old_texture);
+  AssetBlob_release(old_elevation);
+  AssetBlob_release(old_texture_compressed);
+  AssetBlob_release(old_elevation_compressed);
+  LOG_INFO("[Map] Texture %d bytes (%d compressed), elevation %d bytes (%d "
+           "compressed)",
+           new_texture->size,
+           new_texture_compressed ? new_texture_compressed->size : -1,
+           new_elevation->size,
+           new_elevation_compressed ? new_elevation_compressed->size : -1);
+  return 0;
+}
+
+// codecs: the encodings the client can decode
+AssetBlob* getMapBlob(PacketType type, int codecs) {
+  pthread_mutex_lock(&blobs_mutex);
+  AssetBlob* blob =
+      type == PostTexture
+          ? AssetBlob_pick(texture_blob, texture_compressed_blob, codecs)
+          : AssetBlob_pick(elevation_blob, elevation_compressed_blob, codecs);
+  pthread_mutex_unlock(&blobs_mutex);
+  return blob;
+}
+
+// answers a texture request that can't be satisfied
+void sendTextureNotFound(int socket_desc) {
+  IdPacket packet;
+  packet.header.type = PostDisconnect;
+  packet.id = -1;
+  char buf_send[sizeof(IdPacket)];
+  int msg_len = Packet_serialize(buf_send, &packet.header);
+  int bytes_sent = 0;
+  while (bytes_sent < msg_len) {
+    int ret = send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
+    if (ret == -1 && errno == EINTR) continue;
+    ERROR_HELPER(ret, "Can't send map texture over TCP");
+    bytes_sent += ret;
+  }
+}
+
+// codecs: image encodings announced by the client, raw until GetCodecs
 int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
-               Image* elevation_map, int id, int* isActive) {
+               Image* elevation_map, int id, int* isActive, int* codecs) {
   PacketHeader* header = (PacketHeader*)buf_rcv;
   switch (header->type) {
     case (GetId): {
@@ -209,20 +583,100 @@ int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
         bytes_sent += ret;
       }
       Packet_free(&(response->header));
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
       debug_print("[Send ID] Sent %d bytes \n", bytes_sent);
       return 0;
     }
+    case (GetCodecs): {
+      CodecsPacket* request = (CodecsPacket*)buf_rcv;
+      // raw is always understood
+      *codecs = (request->codecs & IMAGE_CODECS) | (1 << EncodingRaw);
+      CodecsPacket response;
+      response.header.type = PostCodecs;
+      response.codecs = IMAGE_CODECS;
+      char buf_send[sizeof(CodecsPacket)];
+      int msg_len = Packet_serialize(buf_send, &response.header);
+      int bytes_sent = 0;
+      while (bytes_sent < msg_len) {
+        int ret =
+            send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
+        if (ret == -1 && errno == EINTR) continue;
+        ERROR_HELPER(ret, "Can't send codecs over TCP");
+        bytes_sent += ret;
+      }
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      LOG_DEBUG("[Codecs] Client %d decodes 0x%x", id, *codecs);
+      return 0;
+    }
+    case (GetMapInfo): {
+      MapInfoPacket response;
+      response.header.type = PostMapInfo;
+      response.rows = map_tiles.rows;
+      response.cols = map_tiles.cols;
+      response.tile_size = map_tiles.tile_size;
+      response.tile_rows = map_tiles.tile_rows;
+      response.tile_cols = map_tiles.tile_cols;
+      char buf_send[sizeof(MapInfoPacket)];
+      int msg_len = Packet_serialize(buf_send, &response.header);
+      int bytes_sent = 0;
+      while (bytes_sent < msg_len) {
+        int ret =
+            send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
+        if (ret == -1 && errno == EINTR) continue;
+        ERROR_HELPER(ret, "Can't send map info over TCP");
+        bytes_sent += ret;
+      }
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      return 0;
+    }
+    case (GetTile): {
+      TRACE_SCOPE("TCPFlow tile send");
+      TilePacket* request = (TilePacket*)buf_rcv;
+      // the tiles are immutable, no lock needed
+      MapTile* tile =
+          MapTiles_get(&map_tiles, request->tile_row, request->tile_col);
+      if (tile == NULL || (request->layer != LayerElevation &&
+                           request->layer != LayerTexture)) {
+        sendTextureNotFound(socket_desc);
+        return -1;
+      }
+      TilePacket response;
+      response.header.type = PostTile;
+      response.layer = request->layer;
+      response.tile_row = request->tile_row;
+      response.tile_col = request->tile_col;
+      char elevation = request->layer == LayerElevation;
+      response.image = elevation ? tile->elevation : tile->texture;
+      response.encoding =
+          elevation ? tile->elevation_encoding : tile->texture_encoding;
+      if (!(*codecs & (1 << response.encoding)))
+        response.encoding = EncodingRaw;
+      char* buf_send = (char*)malloc(BUFFERSIZE);
+      int msg_len = Packet_serialize(buf_send, &response.header);
+      int bytes_sent = 0;
+      while (bytes_sent < msg_len) {
+        int ret =
+            send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
+        if (ret == -1 && errno == EINTR) continue;
+        ERROR_HELPER(ret, "Can't send map tile over TCP");
+        bytes_sent += ret;
+      }
+      free(buf_send);
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      Metrics_add(MetricTextureBytesServed, bytes_sent);
+      return 0;
+    }
     case (ChatAuth): {
       char buf_send[BUFFERSIZE];
       MessageAuthPacket* deserialized_packet =
           (MessageAuthPacket*)Packet_deserialize(buf_rcv, header->size);
       char result = 0;
-      pthread_mutex_lock(&users_mutex);
+      Trace_lock(&users_mutex, "users_mutex");
       ClientListItem* client =
           ClientList_findByID(users, deserialized_packet->id);
       if (client == NULL) {
         Packet_free(&deserialized_packet->header);
-        pthread_mutex_unlock(&users_mutex);
+        Trace_unlock(&users_mutex, "users_mutex");
         return -1;
       }
       if (client->inside_chat)
@@ -231,8 +685,9 @@ int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
         strncpy(client->username, deserialized_packet->username, USERNAME_LEN);
         result = deserialized_packet->id;
         client->inside_chat = 1;
+        ChatSender_init(&client->chat);
       }
-      pthread_mutex_unlock(&users_mutex);
+      Trace_unlock(&users_mutex, "users_mutex");
       IdPacket* response = (IdPacket*)malloc(sizeof(IdPacket));
       PacketHeader ph;
       ph.type = GetId;
@@ -249,122 +704,125 @@ int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
         if (ret == 0) break;
         bytes_sent += ret;
       }
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
       if (result != -1) {
-        pthread_mutex_lock(&messages_mutex);
-        MessageListItem* mli =
-            (MessageListItem*)malloc(sizeof(MessageListItem));
-        mli->id = deserialized_packet->id;
-        strncpy(mli->sender, deserialized_packet->username, USERNAME_LEN);
-        mli->type = Hello;
-        time(&mli->time);
-        MessageList_insert(messages, mli);
-        pthread_mutex_unlock(&messages_mutex);
+        MessageBroadcast m = {0};
+        m.id = deserialized_packet->id;
+        strncpy(m.sender, deserialized_packet->username, USERNAME_LEN);
+        m.type = Hello;
+        time(&m.time);
+        if (!MessageRing_push(&messages, &m))
+          Metrics_add(MetricChatDropped, 1);
       }
       Packet_free(&(response->header));
       Packet_free(&(deserialized_packet->header));
       return 0;
     }
+    case (GetTextureHash): {
+      TextureHashPacket* hash_request = (TextureHashPacket*)buf_rcv;
+      TextureHashPacket response = {0};
+      if (hash_request->id == MAP_TEXTURE_ID ||
+          hash_request->id == MAP_ELEVATION_ID) {
+        pthread_mutex_lock(&blobs_mutex);
+        TextureHash* hash = hash_request->id == MAP_TEXTURE_ID
+                                ? &texture_hash
+                                : &elevation_hash;
+        memcpy(response.hash, hash->bytes, SHA256_DIGEST_LEN);
+        pthread_mutex_unlock(&blobs_mutex);
+        goto SEND_HASH;
+      }
+      Trace_lock(&users_mutex, "users_mutex");
+      ClientListItem* el = ClientList_findByID(users, hash_request->id);
+      if (el == NULL || el->v_texture_item == NULL) {
+        Trace_unlock(&users_mutex, "users_mutex");
+        sendTextureNotFound(socket_desc);
+        return -1;
+      }
+      memcpy(response.hash, el->v_texture_item->hash.bytes, SHA256_DIGEST_LEN);
+      Trace_unlock(&users_mutex, "users_mutex");
+    SEND_HASH:
+      response.header.type = PostTextureHash;
+      response.id = hash_request->id;
+      char buf_send[sizeof(TextureHashPacket)];
+      int msg_len = Packet_serialize(buf_send, &response.header);
+      int bytes_sent = 0;
+      while (bytes_sent < msg_len) {
+        int ret =
+            send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
+        if (ret == -1 && errno == EINTR) continue;
+        ERROR_HELPER(ret, "Can't send texture hash over TCP");
+        bytes_sent += ret;
+      }
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      return 0;
+    }
+    case (GetTextureByHash): {
+      TRACE_SCOPE("TCPFlow texture send");
+      TextureHashPacket* hash_request = (TextureHashPacket*)buf_rcv;
+      TextureHash hash;
+      memcpy(hash.bytes, hash_request->hash, SHA256_DIGEST_LEN);
+      TextureStoreItem* item = TextureStore_find(&texture_store, &hash);
+      if (item == NULL) {
+        sendTextureNotFound(socket_desc);
+        return -1;
+      }
+      AssetBlob* blob =
+          AssetBlob_pick(item->blob, item->compressed_blob, *codecs);
+      TextureStore_release(&texture_store, item);
+      int bytes_sent = AssetBlob_send(blob, socket_desc, hash_request->id);
+      AssetBlob_release(blob);
+      ERROR_HELPER(bytes_sent, "Can't send vehicle texture over TCP");
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      Metrics_add(MetricTextureBytesServed, bytes_sent);
+      return 0;
+    }
     case (GetTexture): {
-      char buf_send[BUFFERSIZE];
+      TRACE_SCOPE("TCPFlow texture send");
       ImagePacket* image_request = (ImagePacket*)buf_rcv;
       if (image_request->id >= 0) {
         if (image_request->id == 0)
           debug_print(
               "[WARNING] Received GetTexture with id 0 which is highly "
               "unlikeable \n");
-        char buf_send[BUFFERSIZE];
-        ImagePacket* image_packet = (ImagePacket*)malloc(sizeof(ImagePacket));
-        PacketHeader im_head;
-        im_head.type = PostTexture;
-        pthread_mutex_lock(&users_mutex);
+        Trace_lock(&users_mutex, "users_mutex");
         ClientListItem* el = ClientList_findByID(users, image_request->id);
 
-        if (el == NULL) {
-          PacketHeader pheader;
-          pheader.type = PostDisconnect;
-          IdPacket* id_pckt = (IdPacket*)malloc(sizeof(IdPacket));
-          id_pckt->header = pheader;
-            id_pckt->id = -1;
-          int msg_len = Packet_serialize(buf_send, &id_pckt->header);
-          int bytes_sent = 0;
-          int ret = 0;
-          while (bytes_sent < msg_len) {
-            ret = send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent,
-                       0);
-            if (ret == -1 && errno == EINTR) continue;
-            ERROR_HELPER(ret, "Can't send map texture over TCP");
-            bytes_sent += ret;
-          }
-          free(id_pckt);
-          free(image_packet);
-          pthread_mutex_unlock(&users_mutex);
+        if (el == NULL || el->v_texture_item == NULL) {
+          Trace_unlock(&users_mutex, "users_mutex");
+          sendTextureNotFound(socket_desc);
           return -1;
         }
-        pthread_mutex_unlock(&users_mutex);
-        image_packet->id = image_request->id;
-        image_packet->image = el->v_texture;
-        image_packet->header = im_head;
-        int msg_len = Packet_serialize(buf_send, &image_packet->header);
-        debug_print("[Send Vehicle Texture] bytes written in the buffer: %d\n",
-                    msg_len);
-        int bytes_sent = 0;
-        int ret = 0;
-        while (bytes_sent < msg_len) {
-          ret =
-              send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
-          if (ret == -1 && errno == EINTR) continue;
-          ERROR_HELPER(ret, "Can't send map texture over TCP");
-          bytes_sent += ret;
-        }
-
-        free(image_packet);
+        // the user may leave while its texture is being sent
+        AssetBlob* blob = AssetBlob_pick(el->v_texture_item->blob,
+                                         el->v_texture_item->compressed_blob,
+                                         *codecs);
+        Trace_unlock(&users_mutex, "users_mutex");
+        int bytes_sent = AssetBlob_send(blob, socket_desc, image_request->id);
+        AssetBlob_release(blob);
+        ERROR_HELPER(bytes_sent, "Can't send vehicle texture over TCP");
+        Metrics_add(MetricTcpBytesOut, bytes_sent);
+        Metrics_add(MetricTextureBytesServed, bytes_sent);
         debug_print("[Send Vehicle Texture] Sent %d bytes \n", bytes_sent);
         return 0;
       }
-      ImagePacket* image_packet = (ImagePacket*)malloc(sizeof(ImagePacket));
-      PacketHeader im_head;
-      im_head.type = PostTexture;
-      image_packet->image = texture_map;
-      image_packet->header = im_head;
-      image_packet->id = id;
-      int msg_len = Packet_serialize(buf_send, &image_packet->header);
-      debug_print("[Send Map Texture] bytes written in the buffer: %d\n",
-                  msg_len);
-      int bytes_sent = 0;
-      int ret = 0;
-      while (bytes_sent < msg_len) {
-        ret = send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
-        if (ret == -1 && errno == EINTR) continue;
-        ERROR_HELPER(ret, "Can't send map texture over TCP");
-        if (ret == 0) break;
-        bytes_sent += ret;
-      }
-      free(image_packet);
+      AssetBlob* blob = getMapBlob(PostTexture, *codecs);
+      int bytes_sent = AssetBlob_send(blob, socket_desc, id);
+      AssetBlob_release(blob);
+      ERROR_HELPER(bytes_sent, "Can't send map texture over TCP");
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      Metrics_add(MetricTextureBytesServed, bytes_sent);
       debug_print("[Send Map Texture] Sent %d bytes \n", bytes_sent);
       return 0;
     }
 
     case (GetElevation): {
-      char buf_send[BUFFERSIZE];
-      ImagePacket* image_packet = (ImagePacket*)malloc(sizeof(ImagePacket));
-      PacketHeader im_head;
-      im_head.type = PostElevation;
-      image_packet->image = elevation_map;
-      image_packet->header = im_head;
-      image_packet->id = id;
-      int msg_len = Packet_serialize(buf_send, &image_packet->header);
-      printf("[Send Map Elevation] bytes written in the buffer: %d\n", msg_len);
-      int bytes_sent = 0;
-      int ret = 0;
-      while (bytes_sent < msg_len) {
-        ret = send(socket_desc, buf_send + bytes_sent, msg_len - bytes_sent, 0);
-        if (ret == -1 && errno == EINTR) continue;
-        ERROR_HELPER(ret, "Can't send map elevation over TCP");
-        if (ret == 0) break;
-        bytes_sent += ret;
-      }
-
-      free(image_packet);
+      TRACE_SCOPE("TCPFlow elevation send");
+      AssetBlob* blob = getMapBlob(PostElevation, *codecs);
+      int bytes_sent = AssetBlob_send(blob, socket_desc, id);
+      AssetBlob_release(blob);
+      ERROR_HELPER(bytes_sent, "Can't send map elevation over TCP");
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
+      Metrics_add(MetricTextureBytesServed, bytes_sent);
       debug_print("[Send Map Elevation] Sent %d bytes \n", bytes_sent);
       return 0;
     }
@@ -390,37 +848,45 @@ int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
         bytes_sent += ret;
       }
       Packet_free(&(response->header));
+      Metrics_add(MetricTcpBytesOut, bytes_sent);
       debug_print("[Send ID] Sent %d bytes \n", bytes_sent);
       return 0;
     }
     case (PostTexture): {
+      TRACE_SCOPE("TCPFlow texture receive");
       ImagePacket* deserialized_packet =
           (ImagePacket*)Packet_deserialize(buf_rcv, header->size);
-      Image* user_texture = deserialized_packet->image;
-      pthread_mutex_lock(&users_mutex);
+      // identical skins share a single image and a single serialized blob
+      char duplicate;
+      TextureStoreItem* item = TextureStore_insert(
+          &texture_store, deserialized_packet->image, &duplicate);
+      if (duplicate) Metrics_add(MetricTextureDedupHits, 1);
+      Trace_lock(&users_mutex, "users_mutex");
       ClientListItem* user =
           ClientList_findByID(users, deserialized_packet->id);
-      ClientList_print(users);
-      fflush(stdout);
-
+      LOG_DEBUG("[Set Texture] Texture received from user %d, %d users online",
+                deserialized_packet->id, users->size);
       if (user == NULL) {
         debug_print("[Set Texture] User not found \n");
-        pthread_mutex_unlock(&users_mutex);
-        Packet_free(&(deserialized_packet->header));
+        Trace_unlock(&users_mutex, "users_mutex");
+        TextureStore_release(&texture_store, item);
+        free(deserialized_packet);
         return -1;
       }
       if (user->inside_world) {
-        pthread_mutex_unlock(&users_mutex);
-        Packet_free(&(deserialized_packet->header));
+        Trace_unlock(&users_mutex, "users_mutex");
+        TextureStore_release(&texture_store, item);
+        free(deserialized_packet);
         return 0;
       }
-      user->v_texture = user_texture;
+      user->v_texture_item = item;
+      user->v_texture = item->image;
       Vehicle* vehicle = (Vehicle*)malloc(sizeof(Vehicle));
       Vehicle_init(vehicle, &server_world, id, user->v_texture);
       user->vehicle = vehicle;
       user->inside_world = 1;
       World_addVehicle(&server_world, vehicle);
-      pthread_mutex_unlock(&users_mutex);
+      Trace_unlock(&users_mutex, "users_mutex");
       debug_print("[Set Texture] Vehicle texture applied to user with id %d \n",
                   id);
       free(deserialized_packet);
@@ -433,7 +899,7 @@ int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
     }
     default: {
       *isActive = 0;
-      printf("[TCP Handler] Unknown packet. Cleaning resources...\n");
+      LOG_WARNING("[TCP Handler] Unknown packet. Cleaning resources...");
       return -1;
     }
   }
@@ -443,16 +909,19 @@ int TCPHandler(int socket_desc, char* buf_rcv, Image* texture_map,
 void* TCPFlow(void* args) {
   tcpArgs* tcp_args = (tcpArgs*)args;
   int sock_fd = tcp_args->client_desc;
-  pthread_mutex_lock(&users_mutex);
+  Trace_setThreadName("TCPFlow");
+  Trace_lock(&users_mutex, "users_mutex");
   ClientListItem* user = malloc(sizeof(ClientListItem));
   user->v_texture = NULL;
   gettimeofday(&user->creation_time, NULL);
+  user->creation_clock = Clock_now();
   user->id = sock_fd;
   user->user_addr_tcp = tcp_args->client_addr;
   user->is_udp_addr_ready = 0;
   user->inside_world = 0;
   user->inside_chat = 0;
   user->v_texture = NULL;
+  user->v_texture_item = NULL;
   user->vehicle = NULL;
   user->afk_counter = 0;
   user->x_shift = 0;
@@ -460,13 +929,27 @@ void* TCPFlow(void* args) {
   user->prev_x = -1;
   user->prev_y = -1;
   user->last_update_time.tv_sec = -1;
-  printf("[New user] Adding client with id %d \n", sock_fd);
+  user->ingest_time.tv_sec = -1;
+  user->apply_time.tv_sec = -1;
+  user->snapshot_pending = 0;
+  user->input_sequence = 0;
+  user->input_budget = 0;
+  user->input_time.tv_sec = -1;
+  user->input_clock = 0;
+  LinkStats_init(&user->link);
+  PriorityAccumulator_init(&user->priorities);
+  for (int i = 0; i < WORLDSIZE; i++) DeadReckoning_init(&user->replicas[i]);
+  user->next_send = 0;
+  user->roster_ack = 0;
+  user->roster_sync_time = 0;
   ClientList_insert(users, user);
-  ClientList_print(users);
+  LOG_INFO("[New user] Adding client with id %d, %d users online", sock_fd,
+           users->size);
   has_users = 1;
-  pthread_mutex_unlock(&users_mutex);
+  Trace_unlock(&users_mutex, "users_mutex");
   int ph_len = sizeof(PacketHeader);
   int isActive = 1;
+  int codecs = 1 << EncodingRaw;
   while (connectivity && isActive) {
     int msg_len = 0;
     char buf_rcv[BUFFERSIZE];
@@ -490,32 +973,31 @@ void* TCPFlow(void* args) {
         goto EXIT;
       msg_len += ret;
     }
+    Metrics_add(MetricTcpBytesIn, header->size);
     int ret = TCPHandler(sock_fd, buf_rcv, tcp_args->surface_texture,
                          tcp_args->elevation_texture, tcp_args->client_desc,
-                         &isActive);
-    if (ret == -1) ClientList_print(users);
+                         &isActive, &codecs);
+    if (ret == -1)
+      LOG_WARNING("[TCP Handler] Request of client %d failed", sock_fd);
   }
 EXIT:
-  printf("Freeing resources...");
-  pthread_mutex_lock(&users_mutex);
+  LOG_INFO("[TCPFlow] Freeing resources of client %d", sock_fd);
+  Trace_lock(&users_mutex, "users_mutex");
   ClientListItem* el = ClientList_findByID(users, sock_fd);
   if (el == NULL) goto END;
   ClientListItem* del = ClientList_detach(users, el);
   if (del == NULL) goto END;
-  pthread_mutex_lock(&messages_mutex);
-  MessageList_addDisconnectMessage(messages, del);
-  pthread_mutex_unlock(&messages_mutex);
+  leaveChat(del);
+  forgetReplicas(del);
   if (!del->inside_world) goto END;
   World_detachVehicle(&server_world, del->vehicle);
   Vehicle_destroy(del->vehicle);
   free(del->vehicle);
-  Image* user_texture = del->v_texture;
-  if (user_texture != NULL) Image_free(user_texture);
+  TextureStore_release(&texture_store, del->v_texture_item);
   free(del);
-  ClientList_print(users);
 END:
   if (users->size == 0) has_users = 0;
-  pthread_mutex_unlock(&users_mutex);
+  Trace_unlock(&users_mutex, "users_mutex");
   close(sock_fd);
   pthread_exit(NULL);
 }
@@ -523,6 +1005,7 @@ END:
 // Receive and apply VehicleUpdatePacket from clients
 void* UDPReceiver(void* args) {
   int socket_udp = *(int*)args;
+  Trace_setThreadName("UDPReceiver");
   while (connectivity && exchange_update) {
     if (!has_users) {
       usleep(RECEIVER_SLEEP);
@@ -530,200 +1013,333 @@ void* UDPReceiver(void* args) {
     }
 
     char buf_recv[BUFFERSIZE];
-    struct sockaddr_in client_addr = {0};
-    socklen_t addrlen = sizeof(struct sockaddr_in);
-    int bytes_read = recvfrom(socket_udp, buf_recv, BUFFERSIZE, 0,
-                              (struct sockaddr*)&client_addr, &addrlen);
-    if (bytes_read == -1) goto END;
-    if (bytes_read == 0) goto END;
-    PacketHeader* ph = (PacketHeader*)buf_recv;
-    if (ph->size != bytes_read) {
-      debug_print("[WARNING] Skipping partial UDP packet \n");
-      continue;
+    // waits for a packet, then drains the ones already queued so that the
+    // vehicle updates are validated together
+    int flags = 0;
+    while (num_pending_updates < MOVE_BATCH_SIZE) {
+      struct sockaddr_in client_addr = {0};
+      socklen_t addrlen = sizeof(struct sockaddr_in);
+      int bytes_read = recvfrom(socket_udp, buf_recv, BUFFERSIZE, flags,
+                                (struct sockaddr*)&client_addr, &addrlen);
+      if (bytes_read <= 0) break;
+      flags = MSG_DONTWAIT;
+      Metrics_add(MetricPacketsIn, 1);
+      Metrics_add(MetricBytesIn, bytes_read);
+      PacketHeader* ph = (PacketHeader*)buf_recv;
+      if (ph->size != bytes_read) {
+        debug_print("[WARNING] Skipping partial UDP packet \n");
+        continue;
+      }
+      int ret = UDPHandler(socket_udp, buf_recv, client_addr);
+      if (ret == -1)
+        debug_print(
+            "[UDP_Receiver] UDP Handler couldn't manage to apply the "
+            "VehicleUpdate \n");
     }
-    int ret = UDPHandler(socket_udp, buf_recv, client_addr);
-    if (ret == -1)
-      debug_print(
-          "[UDP_Receiver] UDP Handler couldn't manage to apply the "
-          "VehicleUpdate \n");
-  END:
+    applyVehicleUpdates(socket_udp);
     usleep(RECEIVER_SLEEP);
   }
   pthread_exit(NULL);
 }
 
+// ms before a chat record is sent again to client, users_mutex is held
+unsigned int chatTimeout(const ClientListItem* client) {
+  unsigned int rto = client->link.srtt + 4 * client->link.rttvar;
+  return rto > CHAT_MIN_RTO ? rto : CHAT_MIN_RTO;
+}
+
+// numbers the pending messages in the chat log, a batch at a time, then
+// sends each client in the chat the records it didn't ack yet. Returns the
+// bytes sent
 int sendMessages(int socket_udp) {
-  char buf_send[BUFFERSIZE];
-  pthread_mutex_lock(&messages_mutex);
+  TRACE_SCOPE("sendMessages");
+  char buf_send[PACKET_MTU];
+  MessageBroadcast records[CHAT_WINDOW];
   int size = 0;
-  if (messages->size == 0) goto END;
+  // more than the log in a tick would be dropped from it before being sent
+  for (int drained = 0; drained < CHAT_LOG;) {
+    int n = MessageRing_drain(&messages, records, CHAT_WINDOW);
+    for (int i = 0; i < n; i++) ChatLog_append(&chat_log, &records[i]);
+    drained += n;
+    if (n < CHAT_WINDOW) break;
+  }
   PacketHeader ph;
   ph.type = ChatHistory;
-  MessageHistoryPacket* mh =
-      (MessageHistoryPacket*)malloc(sizeof(MessageHistoryPacket));
-  mh->header = ph;
-  mh->num_messages = messages->size;
-  mh->messages =
-      (MessageBroadcast*)malloc(sizeof(MessageBroadcast) * mh->num_messages);
-  MessageListItem* mli = messages->first;
-  for (int i = 0; i < mh->num_messages; i++) {
-    if (mli->type == Text) {
-      strncpy(mh->messages[i].text, mli->text, TEXT_LEN);
-    }
-    strncpy(mh->messages[i].sender, mli->sender, USERNAME_LEN);
-    mh->messages[i].id = mli->id;
-    mh->messages[i].time = mli->time;
-    mh->messages[i].type = mli->type;
-    mli = mli->next;
-  }
-  size = Packet_serialize(buf_send, &mh->header);
-  if (size == 0 || size == -1) goto END;
-  pthread_mutex_lock(&users_mutex);
+  MessageHistoryPacket mh;
+  mh.header = ph;
+  mh.first = ChatLog_first(&chat_log);
+  mh.messages = records;
+  unsigned int now = Clock_now();
+  Trace_lock(&users_mutex, "users_mutex");
   ClientListItem* client = users->first;
   for (; client != NULL; client = client->next) {
     if (!client->is_udp_addr_ready || !client->inside_chat || !client->inside_world) continue;
-    int ret = sendto(socket_udp, buf_send, size, 0,
+    unsigned int retransmits = client->chat.retransmits;
+    mh.num_messages = ChatSender_collect(
+        &client->chat, &chat_log, now, chatTimeout(client),
+        PACKET_MTU - sizeof(MessageHistoryPacket), records);
+    if (mh.num_messages == 0) continue;
+    int packet_size = Packet_serialize(buf_send, &mh.header);
+    int ret = sendto(socket_udp, buf_send, packet_size, 0,
                      (struct sockaddr*)&client->user_addr_udp,
                      (socklen_t)sizeof(client->user_addr_udp));
-    if (ret < size)
+    if (ret > 0) {
+      Metrics_add(MetricPacketsOut, 1);
+      Metrics_add(MetricBytesOut, ret);
+      size += ret;
+    }
+    Metrics_add(MetricChatRecords, mh.num_messages);
+    Metrics_add(MetricChatRetransmits, client->chat.retransmits - retransmits);
+    if (ret < packet_size)
       debug_print(
           "[MessageSender] Something went wrong when sending the packet over "
           "UDP \n ");
   }
-  pthread_mutex_unlock(&users_mutex);
-  Packet_free(&mh->header);
-  MessageList_removeAll(messages);
-END:
-  pthread_mutex_unlock(&messages_mutex);
+  Trace_unlock(&users_mutex, "users_mutex");
   return size;
 }
 
+// Sends wup to client in as many datagrams as it takes to stay within
+// PACKET_MTU, each one numbered on its own for the link statistics.
+// Returns the bytes sent, -1 if a fragment couldn't be serialized
+int sendSnapshot(int socket_udp, WorldUpdatePacket* wup,
+                 ClientListItem* client, unsigned int now) {
+  char buf_send[PACKET_MTU];
+  int sent = 0;
+  int fragments = WorldUpdate_fragment(wup);
+  if (fragments == -1) return -1;
+  for (int f = 0; f < fragments; f++) {
+    LinkStats_stamp(&client->link, &wup->link, now);
+    int size = WorldUpdate_serializeFragment(buf_send, wup, f);
+    if (size == 0 || size == -1) return -1;
+    int ret = sendto(socket_udp, buf_send, size, 0,
+                     (struct sockaddr*)&client->user_addr_udp,
+                     (socklen_t)sizeof(client->user_addr_udp));
+    if (ret > 0) {
+      Metrics_add(MetricPacketsOut, 1);
+      Metrics_add(MetricBytesOut, ret);
+      sent += ret;
+    }
+  }
+  return sent;
+}
+
 // Send WorldUpdatePacket to every client that sent al least one
-// VehicleUpdatePacket
+// VehicleUpdatePacket, each one at the rate its link can take
 #ifdef _USE_SERVER_SIDE_FOG_
+// the state of the vehicle of tmp, as sent in a snapshot
+void describeVehicle(ClientUpdate* cup, ClientListItem* tmp) {
+  cup->y = tmp->y;
+  cup->x = tmp->x;
+  cup->theta = tmp->theta;
+  cup->id = tmp->id;
+  cup->translational_force = tmp->translational_force;
+  cup->rotational_force = tmp->rotational_force;
+  cup->translational_velocity = tmp->translational_velocity;
+  cup->rotational_velocity = tmp->rotational_velocity;
+  cup->input_sequence = tmp->input_sequence;
+  cup->client_creation_time = tmp->creation_clock;
+  cup->input_time = tmp->input_clock;
+}
+
+// ms on the server timeline the pose of tmp was taken: the send time of
+// the last input or pose applied, now until one is. The server
+// extrapolates on it since the poses come at the pace of the inputs, the
+// client on the snapshot times: its error grows by the age of the pose, a
+// frame or so, like for the snapshots it interpolates
+unsigned int poseTime(const ClientListItem* tmp, unsigned int now) {
+  return tmp->input_clock != 0 ? tmp->input_clock : now;
+}
+
 void* UDPSender(void* args) {
   int socket_udp = *(int*)args;
+  // vehicles in range of the client being served, in the order of the list
+  ClientListItem* candidates[PRIORITY_MAX_ENTITIES];
+  Status left_out[PRIORITY_MAX_ENTITIES];  // 0 if sent
+  // the ones the client can't extrapolate, competing for the snapshot
+  int competing[PRIORITY_MAX_ENTITIES];
+  int competing_ids[PRIORITY_MAX_ENTITIES];
+  float competing_rates[PRIORITY_MAX_ENTITIES];
+  int selected[PRIORITY_MAX_ENTITIES];
+  ClientStatusUpdate members[WORLDSIZE];
+  unsigned int snapshot = 0;
+  Trace_setThreadName("UDPSender");
   while (connectivity && exchange_update) {
     if (!has_users) {
       usleep(SENDER_SLEEP);
       continue;
     }
+    long start = Metrics_now();
     int bytes_sent = sendMessages(socket_udp);
     debug_print("Messages sent - %d bytes", bytes_sent);
-    pthread_mutex_lock(&users_mutex);
+    Trace_lock(&users_mutex, "users_mutex");
     ClientListItem* client = users->first;
     debug_print("I'm going to create a WorldUpdatePacket \n");
+    unsigned int time = Clock_now();
+    // numbers the joins, leaves and state changes since the last tick
+    int num_members = 0;
+    for (; client != NULL && num_members < WORLDSIZE; client = client->next) {
+      members[num_members].id = client->id;
+      members[num_members].status =
+          client->is_udp_addr_ready && client->inside_world ? Online
+                                                            : Connecting;
+      num_members++;
+    }
+    Roster_update(&roster, members, num_members);
     client = users->first;
-    struct timeval time;
-    gettimeofday(&time, NULL);
     while (client != NULL) {
-      char buf_send[BUFFERSIZE];
-      if (client->is_udp_addr_ready != 1 || !client->inside_world) {
+      if (client->is_udp_addr_ready != 1 || !client->inside_world ||
+          (int)(time - client->next_send) < 0) {
         client = client->next;
         continue;
       }
+      struct timeval build_time;
+      gettimeofday(&build_time, NULL);
       PacketHeader ph;
       ph.type = WorldUpdate;
       WorldUpdatePacket* wup =
           (WorldUpdatePacket*)malloc(sizeof(WorldUpdatePacket));
       wup->header = ph;
-      int n = 0;
+      int n;
 
       // refresh list x,y,theta before proceding
       ClientListItem* check = users->first;
       while (check != NULL) {
         if (check->inside_world && check->is_udp_addr_ready) {
-          pthread_mutex_lock(&check->vehicle->mutex);
+          Trace_lock(&check->vehicle->mutex, "vehicle_mutex");
           Vehicle_getXYTheta(check->vehicle, &check->x, &check->y,
                              &check->theta);
           Vehicle_getForcesUpdate(check->vehicle, &check->translational_force,
                                   &check->rotational_force);
-          Vehicle_getTime(check->vehicle, &check->world_update_time);
-          pthread_mutex_unlock(&check->vehicle->mutex);
+          Vehicle_getVelocities(check->vehicle, &check->translational_velocity,
+                                &check->rotational_velocity);
+          Trace_unlock(&check->vehicle->mutex, "vehicle_mutex");
         }
         check = check->next;
       }
-      // find num of eligible clients to receive the worldUpdatePacket
+      // the other vehicles in range that strayed from what the client
+      // extrapolates compete for the room left in the snapshot by the own one
+      int num_candidates = 0, num_competing = 0;
       ClientListItem* tmp = users->first;
-      while (tmp != NULL) {
-        if (tmp->is_udp_addr_ready && tmp->inside_world &&
-            tmp->id == client->id)
-          n++;
-        else if (tmp->is_udp_addr_ready && tmp->inside_world &&
-                 (abs(tmp->x - client->x) <= HIDE_RANGE &&
-                  abs(tmp->y - client->y) <= HIDE_RANGE)) {
-          n++;
+      for (; tmp != NULL; tmp = tmp->next) {
+        if (tmp == client) continue;
+        DeadReckoning* replica = &client->replicas[tmp->id % WORLDSIZE];
+        if (!tmp->is_udp_addr_ready || !tmp->inside_world ||
+            abs(tmp->x - client->x) > HIDE_RANGE ||
+            abs(tmp->y - client->y) > HIDE_RANGE) {
+          // out of range the client hides it, it must be sent again
+          if (replica->state.id == tmp->id) replica->valid = 0;
+          continue;
+        }
+        if (num_candidates == PRIORITY_MAX_ENTITIES) continue;
+        candidates[num_candidates] = tmp;
+        left_out[num_candidates] = Deferred;
+        num_candidates++;
+#if DEAD_RECKONING == 1
+        ClientUpdate state;
+        describeVehicle(&state, tmp);
+        if (replica->state.id == tmp->id &&
+            !DeadReckoning_diverged(replica, &state, poseTime(tmp, time))) {
+          left_out[num_candidates - 1] = Predicted;
+          continue;
         }
-        tmp = tmp->next;
+#endif
+        competing[num_competing] = num_candidates - 1;
+        competing_ids[num_competing] = tmp->id;
+        competing_rates[num_competing] = PriorityAccumulator_rate(
+            hypotf(tmp->x - client->x, tmp->y - client->y),
+            tmp->translational_velocity);
+        num_competing++;
       }
-      if (n == 0) {
-        client = client->next;
-        free(wup);
-        continue;
+      // the presence events the client didn't ack, or the whole roster if
+      // it fell behind the log, then the vehicles in range left out
+      int max_statuses =
+          (roster.size > ROSTER_LOG ? roster.size : ROSTER_LOG) +
+          num_candidates;
+      wup->status_updates = (ClientStatusUpdate*)malloc(
+          sizeof(ClientStatusUpdate) * max_statuses);
+      int num_statuses =
+          Roster_eventsSince(&roster, client->roster_ack, wup->status_updates);
+      wup->roster_full = 0;
+      if (num_statuses != -1) {
+        Metrics_add(MetricRosterEvents, num_statuses);
+      } else if (client->roster_sync_time == 0 ||
+                 (int)(time - client->roster_sync_time) >=
+                     ROSTER_SYNC_INTERVAL) {
+        num_statuses = Roster_members(&roster, wup->status_updates);
+        wup->roster_full = 1;
+        client->roster_sync_time = time;
+        Metrics_add(MetricRosterSyncs, 1);
+      } else {
+        num_statuses = 0;
       }
+      wup->roster_sequence = roster.sequence;
+      wup->roster_hash = roster.hash;
+      // the vehicles get what the statuses leave of the budget, a status
+      // is kept for each candidate in case it's left out
+      int room = WorldUpdate_room(num_statuses, num_candidates);
+      int num_selected = PriorityAccumulator_select(
+          &client->priorities, competing_ids, competing_rates, num_competing,
+          room, selected, time);
+      for (int i = 0; i < num_selected; i++) {
+        selected[i] = competing[selected[i]];
+        left_out[selected[i]] = 0;
+      }
+      if (num_selected < num_competing)
+        Metrics_add(MetricVehiclesDeferred, num_competing - num_selected);
+      if (num_competing < num_candidates)
+        Metrics_add(MetricVehiclesPredicted, num_candidates - num_competing);
+      n = num_selected + 1;
       wup->num_update_vehicles = n;
       wup->updates = (ClientUpdate*)malloc(sizeof(ClientUpdate) * n);
       wup->time = time;
-      tmp = users->first;
-      ClientList_print(users);
-      int k = 0;
+      wup->snapshot = ++snapshot;
+      client->next_send =
+          time + LinkStats_adapt(&client->link,
+                                 LinkStats_need(client->translational_velocity,
+                                                num_candidates));
+      LOG_EVERY(LogDebug, 1000,
+                "[UDP_Sender] %d vehicles visible to client %d, %d sent",
+                num_candidates + 1, client->id, n);
       // Place data in the WorldUpdatePacket
-      while (tmp != NULL) {
-        if (!(tmp->is_udp_addr_ready && tmp->inside_world &&
-              (abs(tmp->x - client->x) <= HIDE_RANGE &&
-               abs(tmp->y - client->y) <= HIDE_RANGE))) {
-          tmp = tmp->next;
-          continue;
-        }
+      for (int k = 0; k < n; k++) {
+        tmp = k == 0 ? client : candidates[selected[k - 1]];
         ClientUpdate* cup = &(wup->updates[k]);
-        cup->y = tmp->y;
-        cup->x = tmp->x;
-        cup->theta = tmp->theta;
-        cup->id = tmp->id;
-        cup->translational_force = tmp->translational_force;
-        cup->rotational_force = tmp->rotational_force;
-        if (timercmp(&tmp->last_update_time, &tmp->world_update_time, >))
-          cup->client_update_time = tmp->last_update_time;
-        else
-          cup->client_update_time = tmp->world_update_time;
-        cup->client_creation_time = tmp->creation_time;
-        printf("--- Vehicle with id: %d x: %f y:%f z:%f tf:%f rf:%f --- \n",
-               cup->id, cup->x, cup->y, cup->theta, cup->translational_force,
-               cup->rotational_force);
-        tmp = tmp->next;
-        k++;
+        describeVehicle(cup, tmp);
+        if (k > 0)
+          DeadReckoning_set(&client->replicas[tmp->id % WORLDSIZE], cup,
+                            poseTime(tmp, time));
+        if (tmp->snapshot_pending) {
+          Latency_record(LatSnapshot, &tmp->apply_time, &build_time);
+          tmp->snapshot_pending = 0;
+        }
+        LOG_EVERY(LogDebug, 1000,
+                  "--- Vehicle with id: %d x: %f y:%f z:%f tf:%f rf:%f ---",
+                  cup->id, cup->x, cup->y, cup->theta,
+                  cup->translational_force, cup->rotational_force);
       }
-      wup->status_updates =
-          (ClientStatusUpdate*)malloc(sizeof(ClientStatusUpdate) * users->size);
-      tmp = users->first;
-      k = 0;
-      while (tmp != NULL) {
-        ClientStatusUpdate* csu = &wup->status_updates[k];
-        csu->id = tmp->id;
-        if (tmp->is_udp_addr_ready && tmp->inside_world)
-          csu->status = Online;
-        else
-          csu->status = Connecting;
-        tmp = tmp->next;
-        k++;
+      for (int c = 0; c < num_candidates; c++) {
+        if (!left_out[c]) continue;
+        ClientStatusUpdate* csu = &wup->status_updates[num_statuses++];
+        csu->id = candidates[c]->id;
+        csu->status = left_out[c];
+        csu->sequence = 0;
       }
-      wup->num_status_vehicles = users->size;
-      int size = Packet_serialize(buf_send, &wup->header);
-      if (size == 0 || size == -1) goto END;
-      int ret = sendto(socket_udp, buf_send, size, 0,
-                       (struct sockaddr*)&client->user_addr_udp,
-                       (socklen_t)sizeof(client->user_addr_udp));
+      wup->num_status_vehicles = num_statuses;
+      int ret = sendSnapshot(socket_udp, wup, client, time);
+      Latency_recordSince(LatSend, &build_time);
       debug_print(
-          "[UDP_Send] Sent WorldUpdate of %d bytes to client with id %d \n",
-          ret, client->id);
-      debug_print("Difference lenght check - wup: %d client found:%d \n",
-                  wup->num_update_vehicles, n);
-    END:
+          "[UDP_Send] Sent WorldUpdate of %d bytes in %d datagrams to client "
+          "with id %d \n",
+          ret, wup->num_fragments, client->id);
       Packet_free(&(wup->header));
       client = client->next;
     }
-    fprintf(stdout, "[UDP_Sender] WorldUpdatePacket sent to each client \n");
-    pthread_mutex_unlock(&users_mutex);
+    LOG_EVERY(LogInfo, 5000,
+              "[UDP_Sender] WorldUpdatePacket sent to each client");
+    Trace_unlock(&users_mutex, "users_mutex");
+    Metrics_observe(MetricSenderDuration, Metrics_now() - start);
+    TRACE_SINCE("UDPSender", start);
     usleep(SENDER_SLEEP);
   }
   pthread_exit(NULL);
@@ -731,41 +1347,59 @@ void* UDPSender(void* args) {
 #endif
 
 #ifndef _USE_SERVER_SIDE_FOG_
+// vehicles within HIDE_RANGE of the one of client
+int countNeighbours(ClientListItem* client) {
+  int n = 0;
+  ClientListItem* tmp = users->first;
+  for (; tmp != NULL; tmp = tmp->next) {
+    if (tmp != client && tmp->is_udp_addr_ready && tmp->inside_world &&
+        abs(tmp->x - client->x) <= HIDE_RANGE &&
+        abs(tmp->y - client->y) <= HIDE_RANGE)
+      n++;
+  }
+  return n;
+}
+
 void* UDPSender(void* args) {
   int socket_udp = *(int*)args;
+  unsigned int snapshot = 0;
+  Trace_setThreadName("UDPSender");
   while (connectivity && exchange_update) {
     if (!has_users) {
       usleep(SENDER_SLEEP);
       continue;
     }
+    long start = Metrics_now();
     int bytes_sent = sendMessages(socket_udp);
     debug_print("Messages sent - %d bytes", bytes_sent);
-    char buf_send[BUFFERSIZE];
     PacketHeader ph;
     ph.type = WorldUpdate;
     WorldUpdatePacket* wup =
         (WorldUpdatePacket*)malloc(sizeof(WorldUpdatePacket));
     wup->header = ph;
-    pthread_mutex_lock(&users_mutex);
+    Trace_lock(&users_mutex, "users_mutex");
     int n;
     ClientListItem* client = users->first;
     for (n = 0; client != NULL; client = client->next) {
       if (client->is_udp_addr_ready && client->inside_world) n++;
     }
     wup->num_update_vehicles = n;
-    fprintf(stdout,
-            "[UDPSender] Creating WorldUpdatePacket containing info about %d "
-            "users \n",
-            n);
+    LOG_EVERY(LogDebug, 1000,
+              "[UDPSender] Creating WorldUpdatePacket containing info about "
+              "%d users",
+              n);
     if (n == 0) {
-      pthread_mutex_unlock(&users_mutex);
+      Trace_unlock(&users_mutex, "users_mutex");
       usleep(SENDER_SLEEP);
       continue;
     }
     World_update(&server_world);
     wup->updates = (ClientUpdate*)malloc(sizeof(ClientUpdate) * n);
     client = users->first;
-    gettimeofday(&wup->time, NULL);
+    struct timeval build_time;
+    gettimeofday(&build_time, NULL);
+    wup->time = Clock_now();
+    wup->snapshot = ++snapshot;
     int k = 0;
     while (client != NULL) {
       if (!(client->is_udp_addr_ready && client->inside_world)) {
@@ -773,51 +1407,68 @@ void* UDPSender(void* args) {
         continue;
       }
       ClientUpdate* cup = &(wup->updates[k]);
-      pthread_mutex_lock(&client->vehicle->mutex);
+      Trace_lock(&client->vehicle->mutex, "vehicle_mutex");
       Vehicle_getXYTheta(client->vehicle, &(client->x), &(client->y),
                          &(cup->theta));
       Vehicle_getForcesUpdate(client->vehicle, &(client->translational_force),
                               &(client->rotational_force));
-      Vehicle_getTime(client->vehicle, &client->world_update_time);
-      pthread_mutex_unlock(&client->vehicle->mutex);
+      Vehicle_getVelocities(client->vehicle, &(client->translational_velocity),
+                            &(client->rotational_velocity));
+      Trace_unlock(&client->vehicle->mutex, "vehicle_mutex");
       cup->id = client->id;
+      cup->translational_velocity = client->translational_velocity;
+      cup->rotational_velocity = client->rotational_velocity;
       cup->x = client->x;
       cup->y = client->y;
       cup->translational_force = client->translational_force;
       cup->rotational_force = client->rotational_force;
-      if (timercmp(&client->last_update_time, &client->world_update_time, >))
-        cup->client_update_time = client->last_update_time;
-      else
-        cup->client_update_time = client->world_update_time;
-      cup->client_creation_time = client->creation_time;
-      printf("--- Vehicle with id: %d x: %f y:%f z:%f tf:%f rf:%f --- \n",
-             cup->id, cup->x, cup->y, cup->theta, cup->translational_force,
-             cup->rotational_force);
+      cup->input_sequence = client->input_sequence;
+      cup->client_creation_time = client->creation_clock;
+      cup->input_time = client->input_clock;
+      if (client->snapshot_pending) {
+        Latency_record(LatSnapshot, &client->apply_time, &build_time);
+        client->snapshot_pending = 0;
+      }
+      LOG_EVERY(LogDebug, 1000,
+                "--- Vehicle with id: %d x: %f y:%f z:%f tf:%f rf:%f ---",
+                cup->id, cup->x, cup->y, cup->theta, cup->translational_force,
+                cup->rotational_force);
       client = client->next;
       k++;
     }
 
-    int size = Packet_serialize(buf_send, &wup->header);
-    if (size == 0 || size == -1) {
-      pthread_mutex_unlock(&users_mutex);
-      usleep(SENDER_SLEEP);
-      continue;
-    }
+    // the datagrams are numbered for each client
+    unsigned int now = Clock_now();
     client = users->first;
     while (client != NULL) {
-      if (client->is_udp_addr_ready == 1 && client->inside_world) {
-        int ret = sendto(socket_udp, buf_send, size, 0,
-                         (struct sockaddr*)&client->user_addr_udp,
-                         (socklen_t)sizeof(client->user_addr_udp));
-        debug_print(
-            "[UDP_Send] Sent WorldUpdate of %d bytes to client with id %d \n",
-            ret, client->id);
+      if (client->is_udp_addr_ready == 1 && client->inside_world &&
+          (int)(now - client->next_send) >= 0) {
+        client->next_send =
+            now + LinkStats_adapt(
+                      &client->link,
+                      LinkStats_need(client->translational_velocity,
+                                     countNeighbours(client)));
+        int ret = sendSnapshot(socket_udp, wup, client, now);
+        Latency_recordSince(LatSend, &build_time);
+        // the other clients are still served
+        if (ret == -1)
+          LOG_EVERY(LogWarning, 100,
+                    "[UDP_Send] Can't send the WorldUpdate to client %d",
+                    client->id);
+        else
+          debug_print(
+              "[UDP_Send] Sent WorldUpdate of %d bytes to client with id "
+              "%d \n",
+              ret, client->id);
       }
       client = client->next;
     }
     Packet_free(&(wup->header));
-    fprintf(stdout, "[UDP_Send] WorldUpdatePacket sent to each client \n");
-    pthread_mutex_unlock(&users_mutex);
+    LOG_EVERY(LogInfo, 5000,
+              "[UDP_Send] WorldUpdatePacket sent to each client");
+    Trace_unlock(&users_mutex, "users_mutex");
+    Metrics_observe(MetricSenderDuration, Metrics_now() - start);
+    TRACE_SINCE("UDPSender", start);
     usleep(SENDER_SLEEP);
   }
   pthread_exit(NULL);
@@ -829,9 +1480,11 @@ void* UDPSender(void* args) {
 void* garbageCollector(void* args) {
   debug_print("[GC] Garbage collector initialized \n");
   int socket_udp = *(int*)args;
+  Trace_setThreadName("garbageCollector");
   while (clean_garbage) {
+    TRACE_SCOPE("garbageCollector");
     if (has_users == 0) goto END;
-    pthread_mutex_lock(&users_mutex);
+    Trace_lock(&users_mutex, "users_mutex");
     ClientListItem* client = users->first;
     long current_time = (long)time(NULL);
     int count = 0;
@@ -848,15 +1501,13 @@ void* garbageCollector(void* args) {
         sendDisconnect(socket_udp, tmp->user_addr_udp);
         ClientListItem* del = ClientList_detach(users, tmp);
         if (del == NULL) continue;
-        pthread_mutex_lock(&messages_mutex);
-        MessageList_addDisconnectMessage(messages, del);
-        pthread_mutex_unlock(&messages_mutex);
+        leaveChat(del);
+        forgetReplicas(del);
         if (!del->inside_world) goto SKIP;
         World_detachVehicle(&server_world, del->vehicle);
         Vehicle_destroy(del->vehicle);
         free(del->vehicle);
-        Image* user_texture = del->v_texture;
-        if (user_texture != NULL) Image_free(user_texture);
+        TextureStore_release(&texture_store, del->v_texture_item);
         count++;
       SKIP:
         if (users->size == 0) has_users = 0;
@@ -873,15 +1524,13 @@ void* garbageCollector(void* args) {
           sendDisconnect(socket_udp, tmp->user_addr_udp);
           ClientListItem* del = ClientList_detach(users, tmp);
           if (del == NULL) continue;
-          pthread_mutex_lock(&messages_mutex);
-          MessageList_addDisconnectMessage(messages, del);
-          pthread_mutex_unlock(&messages_mutex);
+          leaveChat(del);
+          forgetReplicas(del);
           if (!del->inside_world) goto SKIP2;
           World_detachVehicle(&server_world, del->vehicle);
           Vehicle_destroy(del->vehicle);
           free(del->vehicle);
-          Image* user_texture = del->v_texture;
-          if (user_texture != NULL) Image_free(user_texture);
+          TextureStore_release(&texture_store, del->v_texture_item);
           count++;
         SKIP2:
           if (users->size == 0) has_users = 0;
@@ -901,9 +1550,10 @@ void* garbageCollector(void* args) {
       }
     }
     if (count > 0)
-      fprintf(stdout, "[GC] Removed %d users from the client list \n", count);
+      LOG_INFO("[GC] Removed %d users from the client list", count);
+    Metrics_add(MetricGcRemovals, count);
   END:
-    pthread_mutex_unlock(&users_mutex);
+    Trace_unlock(&users_mutex, "users_mutex");
     sleep(10);
   }
   pthread_exit(NULL);
@@ -912,6 +1562,7 @@ void* garbageCollector(void* args) {
 void* TCPAuth(void* args) {
   tcpArgs* tcp_args = (tcpArgs*)args;
   int sockaddr_len = sizeof(struct sockaddr_in);
+  Trace_setThreadName("TCPAuth");
   while (connectivity) {
     struct sockaddr_in client_addr = {0};
     // Setup to accept client connection
@@ -936,10 +1587,93 @@ void* TCPAuth(void* args) {
   pthread_exit(NULL);
 }
 
+// Aggregate the metrics periodically and answer the queries coming from the
+// local UNIX-domain socket
+void* metricsExporter(void* args) {
+  debug_print("[Metrics] Exporter initialized \n");
+  Trace_setThreadName("metricsExporter");
+  struct pollfd pfd;
+  pfd.fd = server_metrics;
+  pfd.events = POLLIN;
+  long next_aggregation = 0;
+  while (connectivity) {
+    long now = Metrics_now();
+    if (now >= next_aggregation) {
+      next_aggregation = now + METRICS_INTERVAL * 1000000L;
+      long connecting = 0, online = 0, in_chat = 0;
+      long measured = 0, congested = 0;
+      float rtt = 0, jitter = 0, interval = 0;
+      float downlink_loss = 0, uplink_loss = 0;
+      Trace_lock(&users_mutex, "users_mutex");
+      ClientListItem* client = users->first;
+      for (; client != NULL; client = client->next) {
+        if (client->is_udp_addr_ready && client->inside_world)
+          online++;
+        else
+          connecting++;
+        if (client->inside_chat) in_chat++;
+        const LinkStats* link = &client->link;
+        if (link->rtt_samples == 0) continue;
+        measured++;
+        rtt += link->srtt;
+        jitter += link->jitter;
+        interval += link->interval;
+        downlink_loss = fmaxf(downlink_loss, link->send_loss);
+        uplink_loss = fmaxf(uplink_loss, link->receive_loss);
+        if (LinkStats_congested(link)) congested++;
+      }
+      Trace_unlock(&users_mutex, "users_mutex");
+      if (measured > 0) {
+        rtt /= measured;
+        jitter /= measured;
+        interval /= measured;
+      }
+      Metrics_setGauge(MetricLinkRtt, lrintf(rtt));
+      Metrics_setGauge(MetricLinkJitter, lrintf(jitter));
+      Metrics_setGauge(MetricLinkDownlinkLoss, lrintf(downlink_loss * 1000));
+      Metrics_setGauge(MetricLinkUplinkLoss, lrintf(uplink_loss * 1000));
+      Metrics_setGauge(MetricLinkInterval, lrintf(interval));
+      Metrics_setGauge(MetricLinksCongested, congested);
+      Metrics_setGauge(MetricClientsConnecting, connecting);
+      Metrics_setGauge(MetricClientsOnline, online);
+      Metrics_setGauge(MetricClientsInChat, in_chat);
+      Metrics_setGauge(MetricPendingMessages, MessageRing_size(&messages));
+      MetricsSnapshot snapshot;
+      Metrics_aggregate(&snapshot);
+      if (METRICS_DUMP_FILE[0] != '\0' &&
+          Metrics_dumpToFile(METRICS_DUMP_FILE, &snapshot) == -1)
+        debug_print("[Metrics] Can't write %s \n", METRICS_DUMP_FILE);
+    }
+    // poll doubles as the aggregation timer when the socket is not available
+    int ret = poll(&pfd, server_metrics >= 0 ? 1 : 0,
+                   (int)((next_aggregation - now) / 1000) + 1);
+    if (ret <= 0 || !(pfd.revents & POLLIN)) continue;
+    int fd = accept(server_metrics, NULL, NULL);
+    if (fd < 0) continue;
+    Metrics_handleConnection(fd);
+    close(fd);
+  }
+  pthread_exit(NULL);
+}
+
 void* worldLoop(void* args) {
   debug_print("[WorldLoop] World Update loop initialized \n");
+  Trace_setThreadName("worldLoop");
   while (connectivity) {
+    long start = Metrics_now();
     World_update(&server_world);
+    Metrics_observe(MetricTickDuration, Metrics_now() - start);
+    if (dump_latency) {
+      dump_latency = 0;
+      Latency_print(stderr);
+    }
+    if (dump_trace) {
+      dump_trace = 0;
+      if (Trace_dump(TRACE_FILE) == 0)
+        LOG_INFO("[Trace] Dumped trace to %s", TRACE_FILE);
+      else
+        LOG_ERROR("[Trace] Can't write %s", TRACE_FILE);
+    }
     usleep(WORLD_LOOP_SLEEP);
   }
   pthread_exit(NULL);
@@ -980,6 +1714,16 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  if (updateMapBlobs(surface_texture, surface_elevation) == -1) {
+    fprintf(stderr, "[Main] Can't serialize the map images \n");
+    return -1;
+  }
+  if (MapTiles_init(&map_tiles, surface_elevation, surface_texture,
+                    MAP_TILE_SIZE) == -1) {
+    fprintf(stderr, "[Main] Can't cut the map in tiles \n");
+    return -1;
+  }
+
 #ifdef _USE_SERVER_SIDE_FOG_
   debug_print("[Main] Server-side position check option is enabled \n");
 #endif
@@ -1015,12 +1759,17 @@ int main(int argc, char** argv) {
 
   debug_print("[Main] TCP socket successfully created \n");
 
+  TextureStore_init(&texture_store, 1);
   // init List structure
   users = malloc(sizeof(ClientListHead));
   ClientList_init(users);
-  messages = malloc(sizeof(MessageListHead));
-  MessageList_init(messages);
+#ifdef _USE_SERVER_SIDE_FOG_
+  Roster_init(&roster);
+#endif
+  MessageRing_init(&messages);
+  ChatLog_init(&chat_log);
   fprintf(stdout, "[Main] Initialized users list \n");
+  Logger_init(stdout);
 
   // seting signal handlers
   struct sigaction sa;
@@ -1033,6 +1782,10 @@ int main(int argc, char** argv) {
   ERROR_HELPER(ret, "Error: cannot handle SIGHUP");
   ret = sigaction(SIGINT, &sa, NULL);
   ERROR_HELPER(ret, "Error: cannot handle SIGINT");
+  ret = sigaction(SIGUSR1, &sa, NULL);
+  ERROR_HELPER(ret, "Error: cannot handle SIGUSR1");
+  ret = sigaction(SIGUSR2, &sa, NULL);
+  ERROR_HELPER(ret, "Error: cannot handle SIGUSR2");
 
   debug_print("[Main] Custom signal handlers are now enabled \n");
 
@@ -1060,9 +1813,22 @@ int main(int argc, char** argv) {
   tcpArgs tcp_args;
   tcp_args.surface_texture = surface_texture;
   tcp_args.elevation_texture = surface_elevation;
-  World_init(&server_world, surface_elevation, surface_texture, 0.5, 0.5, 0.5);
+  // the ground of a map is built once and then mapped from the disk cache
+  AssetCache surface_cache = {.enabled = 0};
+  if (SURFACE_CACHE && AssetCache_init(&surface_cache) == -1)
+    LOG_WARNING("[Main] Can't use the disk cache, building the ground");
+  World_initCached(&server_world, surface_elevation, surface_texture, 0.5, 0.5,
+                   0.5, surface_cache.enabled ? surface_cache.path : NULL,
+                   &elevation_hash);
+  if (!World_buildObstacles(&server_world, surface_elevation))
+    LOG_WARNING("[Main] Can't find the walls, the moves are checked "
+                "without them");
 
-  pthread_t UDP_receiver, UDP_sender, GC_thread, TCP_thread, world_thread;
+  server_metrics = Metrics_openSocket(METRICS_SOCKET_PATH);
+  if (server_metrics < 0)
+    LOG_ERROR("[Main] Can't open metrics socket %s", METRICS_SOCKET_PATH);
+  pthread_t UDP_receiver, UDP_sender, GC_thread, TCP_thread, world_thread,
+      metrics_thread;
   ret = pthread_create(&UDP_receiver, NULL, UDPReceiver, &server_udp);
   PTHREAD_ERROR_HELPER(ret, "pthread_create on thread tcp failed");
   ret = pthread_create(&UDP_sender, NULL, UDPSender, &server_udp);
@@ -1075,34 +1841,38 @@ int main(int argc, char** argv) {
                        "pthread_create on garbace collector thread failed");
   ret = pthread_create(&world_thread, NULL, worldLoop, NULL);
   PTHREAD_ERROR_HELPER(ret, "pthread_create on world_loop thread failed");
-  fprintf(stdout,
-          "[Main] World created. Now waiting for clients to connect... \n");
-  fflush(stdout);
+  ret = pthread_create(&metrics_thread, NULL, metricsExporter, NULL);
+  PTHREAD_ERROR_HELPER(ret, "pthread_create on metrics thread failed");
+  LOG_INFO("[Main] World created. Now waiting for clients to connect...");
 
   // Wait for threads to finish
 
   ret = pthread_join(world_thread, NULL);
   ERROR_HELPER(ret, "Join on world_loop thread failed");
-  fprintf(stdout, "[Main] World_loop ended... \n");
+  LOG_INFO("[Main] World_loop ended...");
   ret = pthread_join(UDP_receiver, NULL);
   ERROR_HELPER(ret, "Join on UDP_receiver thread failed");
-  fprintf(stdout, "[Main] UDP_receiver ended... \n");
+  LOG_INFO("[Main] UDP_receiver ended...");
   ret = pthread_join(TCP_thread, NULL);
   ERROR_HELPER(ret, "Join on tcp_auth thread failed");
-  fprintf(stdout, "[Main] TCP_receiver/sender ended... \n");
+  LOG_INFO("[Main] TCP_receiver/sender ended...");
   ret = pthread_join(UDP_sender, NULL);
   ERROR_HELPER(ret, "Join on UDP_sender thread failed");
-  fprintf(stdout, "[Main] UDP_sender ended... \n");
+  LOG_INFO("[Main] UDP_sender ended...");
   ret = pthread_join(GC_thread, NULL);
   ERROR_HELPER(ret, "Join on garbage collector thread failed");
-  fprintf(stdout, "[Main] GC ended... \n");
+  LOG_INFO("[Main] GC ended...");
+  ret = pthread_join(metrics_thread, NULL);
+  ERROR_HELPER(ret, "Join on metrics thread failed");
+  Metrics_closeSocket(server_metrics, METRICS_SOCKET_PATH);
+  LOG_INFO("[Main] Metrics exporter ended...");
+  Logger_shutdown();
+  Latency_print(stdout);
   fprintf(stdout, "[Main] Freeing resources... \n");
 
   // Delete list
   ClientList_destroy(users);
-  MessageList_destroy(messages);
   pthread_mutex_destroy(&users_mutex);
-  pthread_mutex_destroy(&messages_mutex);
   // Close descriptors
   ret = close(server_tcp);
   ERROR_HELPER(ret, "Failed close() on server_tcp socket");
@@ -1111,5 +1881,12 @@ int main(int argc, char** argv) {
   World_destroy(&server_world);
   Image_free(surface_elevation);
   Image_free(surface_texture);
+  AssetBlob_release(texture_blob);
+  AssetBlob_release(elevation_blob);
+  AssetBlob_release(texture_compressed_blob);
+  AssetBlob_release(elevation_compressed_blob);
+  MapTiles_destroy(&map_tiles);
+  TextureStore_destroy(&texture_store);
+  pthread_mutex_destroy(&blobs_mutex);
   exit(EXIT_SUCCESS);
 }
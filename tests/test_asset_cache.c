@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../game_framework/asset_cache.h"
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  char base[] = "/tmp/protogame_cacheXXXXXX";
+  if (mkdtemp(base) == NULL) return -1;
+  setenv("XDG_CACHE_HOME", base, 1);
+  printf("Opening the cache in %s...", base);
+  AssetCache cache;
+  if (AssetCache_init(&cache) == -1) {
+    printf("ERROR: can't create the cache\n");
+    return -1;
+  }
+  printf("Done.\n");
+
+  Image* img = Image_load("./resources/images/maze.ppm");
+  if (img == NULL) return -1;
+  TextureHash hash;
+  TextureHash_compute(img, &hash);
+  printf("Missing texture...");
+  if (AssetCache_load(&cache, &hash) != NULL) flag = -1;
+  printf("Done.\n");
+
+  printf("Storing and loading it back...");
+  if (AssetCache_store(&cache, &hash, img) == -1) flag = -1;
+  Image* loaded = AssetCache_load(&cache, &hash);
+  if (loaded == NULL || loaded->rows != img->rows ||
+      loaded->cols != img->cols ||
+      memcmp(loaded->data, img->data, Image_dataSize(img))) {
+    printf("ERROR: cached texture is different\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  printf("Corrupting the entry...");
+  char filename[PATH_MAX], hex[SHA256_DIGEST_LEN * 2 + 1];
+  TextureHash_toString(&hash, hex, sizeof(hex));
+  snprintf(filename, sizeof(filename), "%s/%s.pnm", cache.path, hex);
+  truncate(filename, 1000);
+  if (AssetCache_load(&cache, &hash) != NULL ||
+      access(filename, F_OK) == 0) {
+    printf("ERROR: corrupted entry was loaded\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  if (loaded) Image_free(loaded);
+  Image_free(img);
+  rmdir(cache.path);
+  rmdir(base);
+  return flag;
+}
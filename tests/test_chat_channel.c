@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/chat_channel.h"
+
+#define TICKS 4000
+#define TICK 50    // ms between two sends of the server
+#define LOSS 30    // percent of the datagrams lost, each way
+#define DELAY 5    // ticks a datagram can take, they arrive out of order
+#define RTO (2 * DELAY * TICK)  // above the longest round trip
+#define OUTAGE 1500  // tick the link goes down for longer than the log
+#define QUEUE 64
+#define MAX_RECORDS (TICKS / 2)
+
+typedef struct {
+  int arrival;  // tick, -1 if free
+  int size;
+  char buffer[PACKET_MTU];
+} Datagram;
+
+static Datagram down[QUEUE], up[QUEUE];
+
+static void transmit(Datagram* queue, const PacketHeader* h, int t) {
+  if (rand() % 100 < LOSS || (t >= OUTAGE && t < OUTAGE + 4 * CHAT_LOG))
+    return;
+  for (int i = 0; i < QUEUE; i++) {
+    if (queue[i].arrival != -1) continue;
+    queue[i].size = Packet_serialize(queue[i].buffer, h);
+    queue[i].arrival = t + 1 + rand() % DELAY;
+    return;
+  }
+}
+
+// the next datagram of queue arrived at t, NULL if none
+static PacketHeader* arrive(Datagram* queue, int t) {
+  for (int i = 0; i < QUEUE; i++) {
+    if (queue[i].arrival != t) continue;
+    queue[i].arrival = -1;
+    return Packet_deserialize(queue[i].buffer, queue[i].size);
+  }
+  return NULL;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  srand(5);
+  static MessageBroadcast appended[MAX_RECORDS + 1];
+  ChatLog log;
+  ChatSender sender;
+  ChatReceiver receiver;
+  ChatLog_init(&log);
+  ChatSender_init(&sender);
+  ChatReceiver_init(&receiver);
+  for (int i = 0; i < QUEUE; i++) down[i].arrival = up[i].arrival = -1;
+
+  printf("Delivering the chat over a lossy link...");
+  unsigned int expected = 1;
+  int delivered = 0, skipped = 0, duplicates = 0, disordered = 0;
+  long records_sent = 0, bytes_sent = 0;
+  MessageBroadcast records[CHAT_WINDOW];
+  for (int t = 0; t < TICKS; t++) {
+    unsigned int now = 0xffff0000u + t * TICK;
+    // the last ticks drain the log
+    if (t < TICKS - 200 && log.sequence < MAX_RECORDS && rand() % 3 == 0) {
+      MessageBroadcast m = {0};
+      m.id = t;
+      m.type = 1 + rand() % 3;
+      snprintf(m.sender, USERNAME_LEN, "user%d", rand() % 100);
+      int len = rand() % (TEXT_LEN - 1);
+      for (int i = 0; i < len; i++) m.text[i] = 'a' + (t + i) % 26;
+      ChatLog_append(&log, &m);
+      appended[log.sequence] = log.records[log.sequence % CHAT_LOG];
+    }
+    MessageHistoryPacket mh;
+    mh.header.type = ChatHistory;
+    mh.first = ChatLog_first(&log);
+    mh.messages = records;
+    mh.num_messages = ChatSender_collect(
+        &sender, &log, now, RTO, PACKET_MTU - sizeof(MessageHistoryPacket),
+        records);
+    if (mh.num_messages) {
+      char buffer[PACKET_MTU];
+      records_sent += mh.num_messages;
+      bytes_sent += Packet_serialize(buffer, &mh.header);
+      transmit(down, &mh.header, t);
+    }
+    PacketHeader* h;
+    while ((h = arrive(down, t)) != NULL) {
+      MessageHistoryPacket* received = (MessageHistoryPacket*)h;
+      ChatReceiver_skipTo(&receiver, received->first);
+      for (int i = 0; i < received->num_messages; i++)
+        ChatReceiver_receive(&receiver, &received->messages[i]);
+      Packet_free(h);
+      MessageBroadcast m;
+      while (ChatReceiver_pop(&receiver, &m)) {
+        if ((int)(m.sequence - expected) < 0) duplicates++;
+        // only the records that left the log can be missed
+        if (m.sequence != expected && expected >= ChatLog_first(&log))
+          disordered++;
+        if (m.sequence > expected) skipped += m.sequence - expected;
+        expected = m.sequence + 1;
+        MessageBroadcast* original = &appended[m.sequence];
+        if (m.id != original->id || m.type != original->type ||
+            strcmp(m.sender, original->sender) ||
+            strcmp(m.text, m.type == Text ? original->text : ""))
+          disordered++;
+        delivered++;
+      }
+      ChatAckPacket ack;
+      ack.header.type = ChatAck;
+      ack.id = 0;
+      ChatReceiver_ack(&receiver, &ack.ack, &ack.selective);
+      transmit(up, &ack.header, t);
+    }
+    while ((h = arrive(up, t)) != NULL) {
+      ChatAckPacket* ack = (ChatAckPacket*)h;
+      ChatSender_ack(&sender, ack->ack, ack->selective);
+      Packet_free(h);
+    }
+  }
+  printf("Done, %d records delivered, %d skipped in the outage, %u "
+         "retransmits.\n",
+         delivered, skipped, sender.retransmits);
+  // a record is sent again only when it or its ack is lost, or while the
+  // link is down
+  if (delivered + skipped != log.sequence || duplicates || disordered ||
+      skipped == 0 || sender.ack != log.sequence ||
+      records_sent > 3 * log.sequence)
+    flag = -1;
+
+  printf("Sizing the records...");
+  printf("Done, %ld bytes for %ld records, %ld with the fixed ones.\n",
+         bytes_sent, records_sent, records_sent * sizeof(MessageBroadcast));
+  if (bytes_sent * 2 > records_sent * sizeof(MessageBroadcast)) flag = -1;
+
+  printf("Holding the records out of the window...");
+  ChatReceiver_init(&receiver);
+  ChatReceiver_skipTo(&receiver, 10);
+  MessageBroadcast m = {0};
+  m.sequence = 10 + CHAT_WINDOW;
+  int far = ChatReceiver_receive(&receiver, &m);
+  m.sequence = 12;
+  int ahead = ChatReceiver_receive(&receiver, &m);
+  int again = ChatReceiver_receive(&receiver, &m);
+  unsigned int ack, selective;
+  ChatReceiver_ack(&receiver, &ack, &selective);
+  int early = ChatReceiver_pop(&receiver, &m);
+  printf("Done.\n");
+  if (far || !ahead || again || ack != 9 || selective != 2 || early)
+    flag = -1;
+  return flag;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../game_framework/clock_sync.h"
+#include "../game_framework/protogame_protocol.h"
+
+// the server clock is behind and wraps during the test
+#define SERVER_OFFSET (-123456789)
+#define LOCAL_START 0x75bcd000u
+
+static int sample(ClockSync* sync, unsigned int local, int uplink,
+                  int downlink, int busy) {
+  unsigned int server_receive = local + uplink + SERVER_OFFSET;
+  return ClockSync_update(sync, local, server_receive, server_receive + busy,
+                          local + uplink + busy + downlink);
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  srand(3);
+
+  printf("Pinging through a congested link...");
+  ClockSync sync;
+  ClockSync_init(&sync);
+  if (ClockSync_ready(&sync)) flag = -1;
+  unsigned int local = LOCAL_START;
+  for (int i = 0; i < 20; i++) {
+    local += 100;
+    // queues on the way out or back, one ping is lucky
+    int uplink = i == 13 ? 4 : 4 + rand() % 80;
+    int downlink = i == 13 ? 4 : 4 + rand() % 80;
+    if (!sample(&sync, local, uplink, downlink, rand() % 3)) flag = -1;
+  }
+  int error = (int)(ClockSync_toServer(&sync, local) - (local + SERVER_OFFSET));
+  printf("Done, error %dms with rtt %dms.\n", error, sync.rtt);
+  if (!ClockSync_ready(&sync) || abs(error) > 1 || sync.rtt != 8) flag = -1;
+
+  printf("Discarding inconsistent replies...");
+  if (ClockSync_update(&sync, local, local + 10, local + 5, local + 20) ||
+      ClockSync_update(&sync, local, local + 10, local + 41, local + 20))
+    flag = -1;
+  printf("Done.\n");
+
+  printf("Pacing the pings...");
+  ClockSync_init(&sync);
+  local = LOCAL_START;
+  int pings = 0;
+  for (int ms = 0; ms < 10 * CLOCK_SYNC_INTERVAL; ms += 10) {
+    if (!ClockSync_shouldPing(&sync, local + ms)) continue;
+    pings++;
+    sample(&sync, local + ms, 10, 10, 0);
+  }
+  // a burst to get the first samples, then one each interval
+  int expected = CLOCK_SYNC_SAMPLES +
+                 (10 * CLOCK_SYNC_INTERVAL - CLOCK_SYNC_SAMPLES *
+                                                 CLOCK_SYNC_INTERVAL / 10) /
+                     CLOCK_SYNC_INTERVAL;
+  printf("Done, %d pings.\n", pings);
+  if (abs(pings - expected) > 1) flag = -1;
+
+  printf("Keeping the timeline monotonic...");
+  ClockSync_init(&sync);
+  unsigned int now = Clock_now();
+  ClockSync_update(&sync, now, now + 1000, now + 1000, now + 100);
+  unsigned int before = ClockSync_now(&sync);
+  // a better sample moves the clock 40ms back
+  now = Clock_now();
+  ClockSync_update(&sync, now, now + 1000 - 40 + 5, now + 1000 - 40 + 5,
+                   now + 10);
+  unsigned int after = ClockSync_now(&sync);
+  if ((int)(after - before) < 0) {
+    printf("ERROR: went back by %dms\n", (int)(before - after));
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  printf("Serializing a TimeSyncPacket...");
+  TimeSyncPacket ping = {0};
+  ping.header.type = TimeSync;
+  ping.client_send = 1;
+  ping.server_receive = 2;
+  ping.server_send = 0xffffffffu;
+  char buffer[BUFFERSIZE];
+  int size = Packet_serialize(buffer, &ping.header);
+  TimeSyncPacket* pong = (TimeSyncPacket*)Packet_deserialize(buffer, size);
+  if (pong == NULL || pong->client_send != 1 || pong->server_receive != 2 ||
+      pong->server_send != 0xffffffffu)
+    flag = -1;
+  if (pong) Packet_free(&pong->header);
+  if (Packet_deserialize(buffer, size - 1) != NULL) flag = -1;
+  printf("Done, %d bytes.\n", size);
+  return flag;
+}
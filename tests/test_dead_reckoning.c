@@ -0,0 +1,135 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/dead_reckoning.h"
+#include "../game_framework/world.h"
+
+#define TICK 50       // ms between two snapshots
+#define DURATION 10000
+#define WARMUP 60     // frames to reach the cruising speed
+#define SIDE 640      // pixels of the flat ground
+// the timeline wraps during the test
+#define START 0xfffff000u
+
+typedef struct {
+  float translational_force, rotational_force;
+} Forces;
+
+// the inputs of a maneuver at ms
+typedef Forces (*Maneuver)(int ms);
+
+static World world;
+
+// ms on the timeline of the input frame
+static unsigned int frameTime(int frame) {
+  return START + (frame * 1000 + INPUT_RATE / 2) / INPUT_RATE;
+}
+
+static void takeState(Vehicle* v, ClientUpdate* state) {
+  memset(state, 0, sizeof(ClientUpdate));
+  Vehicle_getXYTheta(v, &state->x, &state->y, &state->theta);
+  Vehicle_getVelocities(v, &state->translational_velocity,
+                        &state->rotational_velocity);
+}
+
+// drives a vehicle of the world with the inputs of maneuver, INPUT_RATE
+// frames per second, and sends its state each tick when it strays from
+// what the peer extrapolates. Returns the updates sent and stores in worst
+// the largest error of the peer, checked at every frame
+static int replicate(Maneuver maneuver, float* worst) {
+  Vehicle v;
+  Vehicle_init(&v, &world, 1, NULL);
+  Forces forces = maneuver(0);
+  for (int i = 0; i < WARMUP; i++)
+    World_applyInput(&world, &v, forces.translational_force,
+                     forces.rotational_force);
+  DeadReckoning sender, peer;
+  DeadReckoning_init(&sender);
+  DeadReckoning_init(&peer);
+  int sent = 0, frame = 0;
+  ClientUpdate state;
+  *worst = 0;
+  for (int ms = 0; ms <= DURATION; ms += TICK) {
+    for (; (int)(frameTime(frame) - START) <= ms; frame++) {
+      forces = maneuver((int)(frameTime(frame) - START));
+      World_applyInput(&world, &v, forces.translational_force,
+                       forces.rotational_force);
+      takeState(&v, &state);
+      if (!peer.valid) continue;
+      ClientUpdate drawn;
+      DeadReckoning_predict(&peer, frameTime(frame), &drawn);
+      float error = hypotf(drawn.x - state.x, drawn.y - state.y);
+      if (error > *worst) *worst = error;
+    }
+    // the latest pose, stamped with its frame
+    unsigned int pose_time = frameTime(frame - 1);
+    if (DeadReckoning_diverged(&sender, &state, pose_time)) {
+      DeadReckoning_set(&sender, &state, pose_time);
+      DeadReckoning_set(&peer, &state, pose_time);
+      sent++;
+    }
+  }
+  Vehicle_destroy(&v);
+  return sent;
+}
+
+static Forces parked(int ms) { return (Forces){0, 0}; }
+
+static Forces cruising(int ms) { return (Forces){3, 0}; }
+
+static Forces circles(int ms) { return (Forces){3, 0.3}; }
+
+// turns left for 0.7s every 2.1s, braking in between
+static Forces slalom(int ms) {
+  return (Forces){(ms / 700) % 2 ? 4.5 : 3, (ms / 700) % 3 == 0 ? 0.3 : 0};
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  Image* elevation = Image_alloc(SIDE, SIDE, MONO8);
+  for (int r = 0; r < SIDE; r++) memset(elevation->row_data[r], 0, SIDE);
+  World_init(&world, elevation, NULL, 0.5, 0.5, 0.5);
+  int keepalives = DURATION / DR_KEEPALIVE + 1;
+  float worst;
+
+  printf("Replicating a parked vehicle...");
+  int sent = replicate(parked, &worst);
+  printf("Done, %d updates.\n", sent);
+  if (sent > keepalives || worst > 0) flag = -1;
+
+  printf("Replicating a cruising vehicle...");
+  sent = replicate(cruising, &worst);
+  printf("Done, %d updates, worst error %.3f.\n", sent, worst);
+  if (sent > keepalives || worst > DR_POSITION_ERROR) flag = -1;
+
+  printf("Replicating a vehicle driving in circles...");
+  sent = replicate(circles, &worst);
+  printf("Done, %d updates, worst error %.3f.\n", sent, worst);
+  if (sent > keepalives || worst > DR_POSITION_ERROR) flag = -1;
+
+  printf("Replicating a slalom...");
+  sent = replicate(slalom, &worst);
+  printf("Done, %d updates in %d ticks, worst error %.3f.\n", sent,
+         DURATION / TICK, worst);
+  // the error is found one tick late at most, at 1.5 units per second
+  if (sent <= keepalives || sent > DURATION / TICK / 4 ||
+      worst > DR_POSITION_ERROR + 1.5 * WORLD_TIME_SCALE * TICK / 1000.0)
+    flag = -1;
+
+  printf("Crossing -pi, turning back...");
+  DeadReckoning d;
+  DeadReckoning_init(&d);
+  ClientUpdate turn = {0};
+  turn.theta = M_PI - 0.01;
+  DeadReckoning_set(&d, &turn, START);
+  turn.theta = -M_PI + 0.01;
+  int crossed = DeadReckoning_diverged(&d, &turn, START + TICK);
+  turn.theta = M_PI - 0.01 - 2 * DR_HEADING_ERROR;
+  int turned = DeadReckoning_diverged(&d, &turn, START + TICK);
+  printf("Done.\n");
+  if (crossed || !turned) flag = -1;
+  World_destroy(&world);
+  Image_free(elevation);
+  return flag;
+}
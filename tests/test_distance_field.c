@@ -0,0 +1,138 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../game_framework/distance_field.h"
+
+#define SCALE 0.5
+#define CHECKED_POINTS 2000
+#define QUERIES 10000000
+#define SWEEPS 1000000
+#define LARGE_SIZE 2048
+
+static double elapsed(struct timeval* start) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+// distance between x, y and the nearest wall point or edge, checking every
+// point of the map
+static float bruteForce(Image* img, float x, float y) {
+  float best = x + SCALE;
+  if (SCALE * img->rows - x < best) best = SCALE * img->rows - x;
+  if (y + SCALE < best) best = y + SCALE;
+  if (SCALE * img->cols - y < best) best = SCALE * img->cols - y;
+  for (int i = 0; i < img->rows; i++) {
+    for (int j = 0; j < img->cols; j++) {
+      if (img->row_data[i][j] < 128) continue;
+      float d = hypotf(i * SCALE - x, j * SCALE - y);
+      if (d < best) best = d;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  Image* maze = Image_load("./resources/images/maze.pgm");
+  if (maze == NULL || maze->type != MONO8) return -1;
+
+  printf("Building the field of the maze...");
+  DistanceField field;
+  if (DistanceField_init(&field, maze, 0.5, SCALE, SCALE) == -1) {
+    printf("ERROR: can't build the field\n");
+    return -1;
+  }
+  printf("Done.\n");
+
+  printf("Comparing with the brute force distance...");
+  srand(0);
+  for (int i = 0; i < CHECKED_POINTS; i++) {
+    int r = rand() % maze->rows, c = rand() % maze->cols;
+    float expected = bruteForce(maze, r * SCALE, c * SCALE);
+    float d = field.distances[r * field.cols + c];
+    if (fabsf(d - expected) > 1e-4) {
+      printf("ERROR: %d,%d is %f away, not %f\n", r, c, d, expected);
+      flag = -1;
+      break;
+    }
+    // the lookup between the points is never larger than the distance
+    float x = (r + (rand() % 100) / 100. - .5) * SCALE;
+    float y = (c + (rand() % 100) / 100. - .5) * SCALE;
+    if (x < 0 || y < 0) continue;
+    if (DistanceField_clearance(&field, x, y) > bruteForce(maze, x, y) + 1e-4) {
+      printf("ERROR: clearance at %f,%f is too large\n", x, y);
+      flag = -1;
+      break;
+    }
+  }
+  printf("Done.\n");
+
+  printf("Sweeping circles...");
+  // find a wall and a free point on the same row
+  int wall_r = -1, wall_c = -1;
+  for (int r = 10; r < maze->rows - 10 && wall_r < 0; r++)
+    for (int c = 20; c < maze->cols - 10 && wall_r < 0; c++)
+      if (maze->row_data[r][c] >= 128 && maze->row_data[r][c - 10] < 128 &&
+          field.distances[r * field.cols + c - 10] > 2) {
+        wall_r = r;
+        wall_c = c;
+      }
+  if (wall_r < 0) {
+    printf("ERROR: no wall in the maze\n");
+    return -1;
+  }
+  float fraction;
+  float x0 = wall_r * SCALE, y0 = (wall_c - 10) * SCALE;
+  float y1 = (wall_c + 2) * SCALE;
+  if (DistanceField_sweep(&field, x0, y0, x0, y1, 0.25, &fraction) ||
+      y0 + fraction * (y1 - y0) > wall_c * SCALE - 0.25) {
+    printf("ERROR: the circle went through the wall\n");
+    flag = -1;
+  }
+  float free_fraction;
+  if (!DistanceField_sweep(&field, x0, y0, x0, y0 + fraction * (y1 - y0),
+                           0.25, &free_fraction)) {
+    printf("ERROR: the safe part of the sweep isn't free\n");
+    flag = -1;
+  }
+  if (DistanceField_sweep(&field, x0, y0, -10, y0, 0.25, &fraction)) {
+    printf("ERROR: the circle left the map\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  float sum = 0;
+  for (int i = 0; i < QUERIES; i++)
+    sum += DistanceField_clearance(&field, (i & 255) * SCALE,
+                                   ((i >> 8) & 255) * SCALE);
+  double seconds = elapsed(&start);
+  printf("clearance: %.1fns per query (%f)\n", seconds / QUERIES * 1e9, sum);
+  gettimeofday(&start, NULL);
+  int hits = 0;
+  for (int i = 0; i < SWEEPS; i++) {
+    float x = (rand() % 256) * SCALE, y = (rand() % 256) * SCALE;
+    hits += !DistanceField_sweep(&field, x, y, x + 0.3, y + 0.2, 0.25,
+                                 &fraction);
+  }
+  seconds = elapsed(&start);
+  printf("sweep: %.1fns per vehicle step (%d hits)\n", seconds / SWEEPS * 1e9,
+         hits);
+  DistanceField_destroy(&field);
+  Image_free(maze);
+
+  Image* large = Image_alloc(LARGE_SIZE, LARGE_SIZE, MONO8);
+  for (int r = 0; r < LARGE_SIZE; r++)
+    for (int c = 0; c < LARGE_SIZE; c++)
+      large->row_data[r][c] = (r % 64 < 4 && c % 256 > 32) ? 255 : 0;
+  gettimeofday(&start, NULL);
+  DistanceField_init(&field, large, 0.5, SCALE, SCALE);
+  printf("%dx%d field built in %.2fms\n", LARGE_SIZE, LARGE_SIZE,
+         elapsed(&start) * 1e3);
+  DistanceField_destroy(&field);
+  Image_free(large);
+  return flag;
+}
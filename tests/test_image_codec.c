@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../av_framework/image_codec.h"
+#include "../game_framework/protogame_protocol.h"
+
+#define DECODE_ROUNDS 20
+
+static const char* images[] = {
+    "./resources/images/maze.pgm",        "./resources/images/maze.ppm",
+    "./resources/images/depth1.pgm",      "./resources/images/depth1.ppm",
+    "./resources/images/test.pgm",        "./resources/images/test.ppm",
+    "./resources/images/arrow-right.ppm", "./resources/images/circle.ppm",
+    "./resources/images/square.ppm",      "./resources/images/triangle.ppm"};
+
+static const char* encoding_names[] = {"raw", "rle+delta", "lz"};
+
+static double elapsed(struct timeval* start) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+static int equals(const Image* a, const Image* b) {
+  return a != NULL && b != NULL && a->rows == b->rows && a->cols == b->cols &&
+         a->type == b->type && !memcmp(a->data, b->data, Image_dataSize(a));
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  int num_images = sizeof(images) / sizeof(images[0]);
+  printf("%-36s %-10s %8s %8s %7s %10s\n", "image", "codec", "raw", "encoded",
+         "ratio", "decode");
+  for (int i = 0; i < num_images; i++) {
+    Image* img = Image_load(images[i]);
+    if (img == NULL) {
+      printf("ERROR: can't load %s\n", images[i]);
+      return -1;
+    }
+    int capacity = ImageCodec_maxEncodedSize(img);
+    char* buffer = (char*)malloc(capacity);
+    for (int encoding = EncodingRleDelta; encoding < ImageEncodings;
+         encoding++) {
+      int size = ImageCodec_encode(img, encoding, buffer, capacity);
+      int raw = Image_dataSize(img);
+      if (size == -1) {
+        printf("%-36s %-10s %8d %8s\n", images[i], encoding_names[encoding],
+               raw, "-");
+        continue;
+      }
+      struct timeval start;
+      gettimeofday(&start, NULL);
+      for (int k = 0; k < DECODE_ROUNDS; k++) {
+        Image* decoded = ImageCodec_decode(buffer, size);
+        if (!equals(img, decoded)) {
+          printf("ERROR: %s decoded with %s is different\n", images[i],
+                 encoding_names[encoding]);
+          flag = -1;
+        }
+        if (decoded) Image_free(decoded);
+      }
+      double seconds = elapsed(&start);
+      printf("%-36s %-10s %8d %8d %6.2fx %6.0fMB/s\n", images[i],
+             encoding_names[encoding], raw, size, (double)raw / size,
+             (double)raw * DECODE_ROUNDS / seconds / 1e6);
+      // a truncated buffer must be rejected, not read past its end
+      if (ImageCodec_decode(buffer, size - 1) != NULL) {
+        printf("ERROR: truncated buffer was decoded\n");
+        flag = -1;
+      }
+      // so must a forged size, before anything is allocated: larger than
+      // allowed, overflowing, or more than the payload can expand to
+      int forged[][2] = {{IMAGE_MAX_SIDE + 1, 1},
+                         {IMAGE_MAX_SIDE, IMAGE_MAX_SIDE},
+                         {0x10000, 0x10000}};
+      for (int k = 0; k < 3; k++) {
+        int header[2];
+        memcpy(header, buffer, sizeof(header));
+        memcpy(buffer, forged[k], sizeof(header));
+        Image* decoded = ImageCodec_decode(buffer, size);
+        memcpy(buffer, header, sizeof(header));
+        if (decoded != NULL) {
+          printf("ERROR: a forged %dx%d image was decoded\n", forged[k][0],
+                 forged[k][1]);
+          Image_free(decoded);
+          flag = -1;
+        }
+      }
+    }
+    free(buffer);
+
+    // the packet carries the encoding chosen for the image type
+    ImagePacket packet;
+    packet.header.type = PostTexture;
+    packet.id = i;
+    packet.encoding = ImageCodec_choose(img);
+    packet.image = img;
+    char* packet_buffer = (char*)malloc(BUFFERSIZE);
+    int packet_size = Packet_serialize(packet_buffer, &packet.header);
+    ImagePacket* deserialized =
+        (ImagePacket*)Packet_deserialize(packet_buffer, packet_size);
+    if (deserialized == NULL || !equals(img, deserialized->image)) {
+      printf("ERROR: %s is different after a packet round trip\n", images[i]);
+      flag = -1;
+    }
+    if (deserialized) Packet_free(&deserialized->header);
+    free(packet_buffer);
+    Image_free(img);
+  }
+  return flag;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "../game_framework/latency.h"
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  printf("Creating latency histogram...");
+  LatencyHistogram h;
+  LatencyHistogram_init(&h);
+  printf("Done.\n");
+  printf("Recording samples...");
+  for (int i = 0; i < 99; i++) LatencyHistogram_record(&h, 100);
+  LatencyHistogram_record(&h, 50000);
+  LatencyHistogram_record(&h, -10);
+  printf("Done.\n");
+  if (h.count != 101 || h.max_us != 50000) {
+    printf("ERROR IN RECORD\n");
+    flag = -1;
+  }
+  long p50 = LatencyHistogram_percentile(&h, 0.5);
+  long p99 = LatencyHistogram_percentile(&h, 0.995);
+  printf("p50: %ld p99.5: %ld\n", p50, p99);
+  if (p50 < 100 || p50 > 256 || p99 < 50000) {
+    printf("ERROR IN PERCENTILE\n");
+    flag = -1;
+  }
+  printf("Recording hops...");
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  usleep(1000);
+  gettimeofday(&end, NULL);
+  Latency_record(LatUplink, &start, &end);
+  Latency_recordSince(LatEndToEnd, &start);
+  printf("Done.\n");
+  if (Latency_getHistogram(LatUplink)->count != 1 ||
+      Latency_getHistogram(LatEndToEnd)->sum_us < 1000) {
+    printf("ERROR IN HOPS\n");
+    flag = -1;
+  }
+  Latency_print(stdout);
+  Latency_reset();
+  if (Latency_getHistogram(LatUplink)->count != 0) {
+    printf("ERROR IN RESET\n");
+    flag = -1;
+  }
+  return flag;
+}
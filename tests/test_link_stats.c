@@ -0,0 +1,163 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../game_framework/link_stats.h"
+
+#define MAX_FLIGHTS 1024
+// the clocks wrap during the test
+#define START 0xfffff000u
+
+typedef struct {
+  LinkFeedback f;
+  unsigned int arrival;
+  char to_client;
+} Flight;
+
+typedef struct {
+  LinkStats server, client;
+  Flight flights[MAX_FLIGHTS];
+  int num_flights;
+  unsigned int next_server, next_client;
+} Simulation;
+
+// one way delay in [delay, delay + spread), loss in percent
+typedef struct {
+  int delay, spread, loss;
+} Path;
+
+static void transmit(Simulation* sim, LinkStats* from, char to_client,
+                     unsigned int now, Path path) {
+  Flight* flight = &sim->flights[sim->num_flights];
+  LinkStats_stamp(from, &flight->f, now);
+  if (rand() % 100 < path.loss || sim->num_flights == MAX_FLIGHTS) return;
+  flight->arrival = now + path.delay + rand() % (path.spread + 1);
+  flight->to_client = to_client;
+  sim->num_flights++;
+}
+
+// the server sends at the rate asked by need, the client every
+// client_interval ms
+static void run(Simulation* sim, unsigned int* now, int duration, float need,
+                int client_interval, Path downlink, Path uplink) {
+  for (unsigned int end = *now + duration; *now != end; (*now)++) {
+    for (int i = 0; i < sim->num_flights;) {
+      Flight* flight = &sim->flights[i];
+      if ((int)(*now - flight->arrival) < 0) {
+        i++;
+        continue;
+      }
+      LinkStats_receive(flight->to_client ? &sim->client : &sim->server,
+                        &flight->f, *now);
+      *flight = sim->flights[--sim->num_flights];
+    }
+    if ((int)(*now - sim->next_server) >= 0) {
+      transmit(sim, &sim->server, 1, *now, downlink);
+      sim->next_server = *now + LinkStats_adapt(&sim->server, need);
+    }
+    if ((int)(*now - sim->next_client) >= 0) {
+      transmit(sim, &sim->client, 0, *now, uplink);
+      sim->next_client = *now + client_interval;
+    }
+  }
+}
+
+static void reset(Simulation* sim, unsigned int now) {
+  LinkStats_init(&sim->server);
+  LinkStats_init(&sim->client);
+  sim->num_flights = 0;
+  sim->next_server = now;
+  sim->next_client = now;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  srand(5);
+  Simulation sim;
+  unsigned int now = START;
+  Path clean = {40, 0, 0};
+
+  printf("Measuring a clean link...");
+  reset(&sim, now);
+  run(&sim, &now, 5000, 1, 33, clean, clean);
+  printf("Done, rtt %.1fms jitter %.1fms loss %.2f interval %ums.\n",
+         sim.server.srtt, sim.server.jitter, sim.server.send_loss,
+         sim.server.interval);
+  if (fabsf(sim.server.srtt - 80) > 1 || sim.server.jitter > 1 ||
+      sim.server.send_loss > 0.01 || sim.server.receive_loss > 0.01 ||
+      LinkStats_congested(&sim.server) ||
+      sim.server.interval != LINK_MIN_INTERVAL)
+    flag = -1;
+
+  printf("Subtracting the ack delay of a slow peer...");
+  reset(&sim, now);
+  run(&sim, &now, 5000, 1, 200, clean, clean);
+  printf("Done, rtt %.1fms.\n", sim.server.srtt);
+  if (fabsf(sim.server.srtt - 80) > 1 || sim.server.send_loss > 0.01)
+    flag = -1;
+
+  printf("Measuring the loss and the jitter...");
+  reset(&sim, now);
+  Path lossy = {40, 30, 20};
+  run(&sim, &now, 60000, 0, 33, lossy, (Path){40, 30, 10});
+  printf("Done, down %.2f up %.2f jitter %.1fms.\n", sim.server.send_loss,
+         sim.server.receive_loss, sim.server.jitter);
+  if (fabsf(sim.server.send_loss - 0.2) > 0.1 ||
+      fabsf(sim.server.receive_loss - 0.1) > 0.06 || sim.server.jitter < 5 ||
+      sim.server.jitter > 30)
+    flag = -1;
+
+  printf("Backing off a lossy link...");
+  reset(&sim, now);
+  run(&sim, &now, 5000, 1, 33, lossy, clean);
+  // the rate probes again when the loss average drops for a while
+  unsigned int interval = 0;
+  for (int i = 0; i < 20; i++) {
+    run(&sim, &now, 1000, 1, 33, lossy, clean);
+    interval += sim.server.interval;
+  }
+  printf("Done, interval %ums.\n", interval / 20);
+  if (interval / 20 < LINK_MAX_INTERVAL / 2) flag = -1;
+
+  printf("Backing off a queueing link, recovering after...");
+  reset(&sim, now);
+  run(&sim, &now, 5000, 1, 33, clean, clean);
+  unsigned int healthy = sim.server.interval;
+  run(&sim, &now, 5000, 1, 33, (Path){300, 0, 0}, clean);
+  unsigned int queueing = sim.server.interval;
+  run(&sim, &now, 20000, 1, 33, clean, clean);
+  printf("Done, %ums then %ums then %ums.\n", healthy, queueing,
+         sim.server.interval);
+  if (healthy != LINK_MIN_INTERVAL || queueing < LINK_MAX_INTERVAL / 2 ||
+      sim.server.interval != LINK_MIN_INTERVAL)
+    flag = -1;
+
+  printf("Ignoring the stale and duplicate packets...");
+  reset(&sim, now);
+  LinkFeedback sent[5], feedback;
+  for (int i = 0; i < 2; i++) LinkStats_stamp(&sim.server, &sent[i], now);
+  LinkStats_receive(&sim.client, &sent[0], now);
+  LinkStats_stamp(&sim.client, &feedback, now);
+  LinkStats_receive(&sim.server, &feedback, now);
+  for (int i = 2; i < 5; i++) LinkStats_stamp(&sim.server, &sent[i], now);
+  // the fifth overtakes the third, then comes again
+  int accepted = LinkStats_receive(&sim.client, &sent[4], now);
+  int stale = LinkStats_receive(&sim.client, &sent[2], now);
+  int duplicate = LinkStats_receive(&sim.client, &sent[4], now);
+  LinkStats_stamp(&sim.client, &feedback, now);
+  LinkStats_receive(&sim.server, &feedback, now);
+  printf("Done, %u received, %u lost.\n", sim.client.received,
+         sim.server.lost);
+  if (!accepted || stale || duplicate || sim.client.received != 2 ||
+      sim.server.lost != 3)
+    flag = -1;
+
+  printf("Estimating the need of updates...");
+  float idle = LinkStats_need(0, 0);
+  float racing = LinkStats_need(-2 * LINK_FAST_SPEED, 2 * LINK_CROWD);
+  float alone = LinkStats_need(LINK_FAST_SPEED / 2, 0);
+  printf("Done, %.2f %.2f %.2f.\n", idle, racing, alone);
+  if (idle != 0 || racing != 1 || alone <= 0 || alone >= 1) flag = -1;
+  reset(&sim, now);
+  if (LinkStats_adapt(&sim.server, 0) != LINK_MAX_INTERVAL) flag = -1;
+  return flag;
+}
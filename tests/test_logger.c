@@ -0,0 +1,58 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/logger.h"
+
+#define THREADS 8
+#define MESSAGES 1000
+
+void* worker(void* args) {
+  long id = (long)args;
+  for (int i = 0; i < MESSAGES; i++) {
+    Logger_log(LogInfo, "thread %ld message %d \n", id, i);
+    LOG_DEBUG("filtered at runtime %d", i);
+  }
+  return NULL;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  FILE* out = tmpfile();
+  Logger_setLevel(LogInfo);
+  Logger_init(out);
+  printf("Logging from %d threads...", THREADS);
+  pthread_t threads[THREADS];
+  for (long i = 0; i < THREADS; i++)
+    pthread_create(&threads[i], NULL, worker, (void*)i);
+  for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+  printf("Done.\n");
+  printf("Logging with a rate limit...");
+  for (int i = 0; i < 100; i++) LOG_EVERY(LogWarning, 60000, "limited %d", i);
+  printf("Done.\n");
+  Logger_shutdown();
+
+  rewind(out);
+  char line[LOG_LINE_LEN + 64];
+  unsigned long lines = 0, limited = 0, debug = 0;
+  while (fgets(line, sizeof(line), out) != NULL) {
+    lines++;
+    if (strstr(line, "[WARNING] limited 0") != NULL) limited++;
+    if (strstr(line, "[DEBUG]") != NULL) debug++;
+    if (strstr(line, " \n") != NULL) {
+      printf("ERROR: TRAILING SPACE NOT STRIPPED\n");
+      flag = -1;
+    }
+  }
+  fclose(out);
+  printf("%lu lines written, %lu dropped\n", lines, Logger_dropped());
+  if (lines + Logger_dropped() != THREADS * MESSAGES + 1) {
+    printf("ERROR: LOST MESSAGES\n");
+    flag = -1;
+  }
+  if (limited != 1 || debug != 0) {
+    printf("ERROR IN FILTERING\n");
+    flag = -1;
+  }
+  return flag;
+}
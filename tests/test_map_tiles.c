@@ -0,0 +1,114 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/map_tiles.h"
+#include "../game_framework/protogame_protocol.h"
+#include "../game_framework/world.h"
+
+// tiles that don't divide the map, to exercise the smaller last ones
+#define TILE_SIZE 60
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  Image* elevation = Image_load("./resources/images/maze.pgm");
+  Image* texture = Image_load("./resources/images/maze.ppm");
+  if (elevation == NULL || texture == NULL) return -1;
+
+  printf("Cutting the map in tiles...");
+  MapTiles tiles;
+  if (MapTiles_init(&tiles, elevation, texture, TILE_SIZE) == -1) {
+    printf("ERROR: can't cut the map\n");
+    return -1;
+  }
+  int n_tiles = tiles.tile_rows * tiles.tile_cols;
+  printf("Done, %dx%d tiles.\n", tiles.tile_rows, tiles.tile_cols);
+  MapTile* last =
+      MapTiles_get(&tiles, tiles.tile_rows - 1, tiles.tile_cols - 1);
+  if (last == NULL || last->elevation->rows != 256 % TILE_SIZE ||
+      MapTiles_get(&tiles, tiles.tile_rows, 0) != NULL)
+    flag = -1;
+
+  printf("Building the reference world...");
+  World reference, tiled;
+  World_init(&reference, elevation, texture, 0.5, 0.5, 0.5);
+  World_initTiled(&tiled, tiles.rows, tiles.cols, tiles.tile_size);
+  printf("Done.\n");
+
+  // the spawn point is in the middle of the map
+  float x = tiled.ground.rows / 2 * tiled.ground.row_scale;
+  float y = tiled.ground.cols / 2 * tiled.ground.col_scale;
+  float transform[16], expected[16];
+  printf("Nothing resident...");
+  if (Surface_getTransform(transform, &tiled.ground, x, y, 0, 0, 0)) {
+    printf("ERROR: transform on a missing tile\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  printf("Streaming the tiles through packets...");
+  int bytes = 0;
+  char* buffer = (char*)malloc(BUFFERSIZE);
+  for (int i = 0; i < n_tiles; i++) {
+    MapTile* tile =
+        MapTiles_get(&tiles, i / tiles.tile_cols, i % tiles.tile_cols);
+    Image* images[2] = {NULL, NULL};
+    for (int layer = 0; layer < 2; layer++) {
+      TilePacket packet;
+      packet.header.type = PostTile;
+      packet.layer = layer ? LayerTexture : LayerElevation;
+      packet.tile_row = i / tiles.tile_cols;
+      packet.tile_col = i % tiles.tile_cols;
+      packet.encoding =
+          layer ? tile->texture_encoding : tile->elevation_encoding;
+      packet.image = layer ? tile->texture : tile->elevation;
+      int size = Packet_serialize(buffer, &packet.header);
+      bytes += size;
+      TilePacket* received = (TilePacket*)Packet_deserialize(buffer, size);
+      if (received == NULL) {
+        printf("ERROR: tile %d can't be deserialized\n", i);
+        return -1;
+      }
+      images[layer] = received->image;
+      received->image = NULL;
+      Packet_free(&received->header);
+    }
+    if (!World_setTile(&tiled, i / tiles.tile_cols, i % tiles.tile_cols,
+                       images[0], images[1])) {
+      printf("ERROR: tile %d rejected\n", i);
+      flag = -1;
+    }
+    Image_free(images[0]);
+  }
+  free(buffer);
+  printf("Done, %d bytes.\n", bytes);
+
+  printf("Comparing with the whole map...");
+  Surface* a = &reference.ground;
+  Surface* b = &tiled.ground;
+  for (int i = 0; i < a->n_points; i++) {
+    for (int k = 0; k < 3; k++) {
+      if (fabs(a->points[i].values[k] - b->points[i].values[k]) > 1e-6 ||
+          fabs(a->normals[i].values[k] - b->normals[i].values[k]) > 1e-6) {
+        printf("ERROR: point %d differs\n", i);
+        flag = -1;
+        i = a->n_points;
+        break;
+      }
+    }
+  }
+  if (!Surface_getTransform(transform, b, x, y, 0, 0, 0) ||
+      !Surface_getTransform(expected, a, x, y, 0, 0, 0) ||
+      memcmp(transform, expected, sizeof(transform))) {
+    printf("ERROR: different transform at the spawn point\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  World_destroy(&reference);
+  World_destroy(&tiled);
+  MapTiles_destroy(&tiles);
+  Image_free(elevation);
+  Image_free(texture);
+  return flag;
+}
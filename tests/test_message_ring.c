@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/message_ring.h"
+
+#define PRODUCERS 4
+#define MESSAGES 100000  // pushed by each producer
+#define BATCH 32
+
+MessageRing ring;
+unsigned long dropped[PRODUCERS];  // pushes that found the ring full
+int producing = PRODUCERS;
+
+void* produce(void* arg) {
+  int producer = *(int*)arg;
+  MessageBroadcast m = {0};
+  m.id = producer;
+  m.type = Text;
+  for (int i = 1; i <= MESSAGES; i++) {
+    m.sequence = i;
+    snprintf(m.text, TEXT_LEN, "%d from %d", i, producer);
+    // the test pushes again until there's room, to deliver them all
+    while (!MessageRing_push(&ring, &m)) {
+      dropped[producer]++;
+      sched_yield();
+    }
+  }
+  __atomic_sub_fetch(&producing, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  MessageBroadcast batch[BATCH];
+
+  printf("Filling the ring...");
+  MessageRing_init(&ring);
+  MessageBroadcast m = {0};
+  int pushed = 0;
+  for (int i = 0; i <= MESSAGE_RING_SIZE; i++) {
+    m.id = i;
+    pushed += MessageRing_push(&ring, &m);
+  }
+  int size = MessageRing_size(&ring);
+  int in_order = 1, drained = 0, n;
+  while ((n = MessageRing_drain(&ring, batch, BATCH)) > 0) {
+    for (int i = 0; i < n; i++)
+      if (batch[i].id != drained + i) in_order = 0;
+    drained += n;
+  }
+  int refilled = MessageRing_push(&ring, &m);
+  printf("Done, %d pushed, %lu dropped.\n", pushed,
+         MessageRing_dropped(&ring));
+  if (pushed != MESSAGE_RING_SIZE || size != MESSAGE_RING_SIZE ||
+      MessageRing_dropped(&ring) != 1 || drained != MESSAGE_RING_SIZE ||
+      !in_order || !refilled)
+    flag = -1;
+
+  printf("Draining %d producers...", PRODUCERS);
+  MessageRing_init(&ring);
+  pthread_t threads[PRODUCERS];
+  int ids[PRODUCERS];
+  for (int i = 0; i < PRODUCERS; i++) {
+    ids[i] = i;
+    pthread_create(&threads[i], NULL, produce, &ids[i]);
+  }
+  unsigned int last[PRODUCERS] = {0};
+  unsigned long received = 0, batches = 0;
+  int corrupted = 0;
+  for (;;) {
+    int done = __atomic_load_n(&producing, __ATOMIC_ACQUIRE) == 0;
+    n = MessageRing_drain(&ring, batch, BATCH);
+    for (int i = 0; i < n; i++) {
+      MessageBroadcast* r = &batch[i];
+      char text[TEXT_LEN];
+      snprintf(text, TEXT_LEN, "%u from %d", r->sequence, r->id);
+      // each producer's messages come in its order, and whole
+      if (r->id < 0 || r->id >= PRODUCERS || r->sequence <= last[r->id] ||
+          strcmp(text, r->text)) {
+        corrupted++;
+        continue;
+      }
+      last[r->id] = r->sequence;
+    }
+    received += n;
+    if (n) batches++;
+    if (done && n == 0) break;
+  }
+  unsigned long lost = 0;
+  for (int i = 0; i < PRODUCERS; i++) {
+    pthread_join(threads[i], NULL);
+    lost += dropped[i];
+  }
+  printf("Done, %lu received in %lu batches, %lu pushes on a full ring.\n",
+         received, batches, lost);
+  if (corrupted || received != (unsigned long)PRODUCERS * MESSAGES ||
+      lost != MessageRing_dropped(&ring) || received != ring.pushed ||
+      MessageRing_size(&ring) != 0)
+    flag = -1;
+  return flag;
+}
@@ -0,0 +1,53 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../game_framework/metrics.h"
+
+#define THREADS 8
+#define ITERATIONS 10000
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void* worker(void* args) {
+  for (int i = 0; i < ITERATIONS; i++) {
+    Metrics_add(MetricPacketsIn, 1);
+    Metrics_add(MetricBytesIn, 10);
+    Metrics_lock(&mutex);
+    pthread_mutex_unlock(&mutex);
+  }
+  Metrics_observe(MetricTickDuration, 100);
+  return NULL;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  printf("Recording from %d threads...", THREADS);
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++)
+    pthread_create(&threads[i], NULL, worker, NULL);
+  for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+  printf("Done.\n");
+  printf("Aggregating...");
+  Metrics_setGauge(MetricClientsOnline, 3);
+  MetricsSnapshot snapshot;
+  Metrics_aggregate(&snapshot);
+  printf("Done.\n");
+  if (snapshot.counters[MetricPacketsIn] != THREADS * ITERATIONS ||
+      snapshot.counters[MetricBytesIn] != THREADS * ITERATIONS * 10) {
+    printf("ERROR IN COUNTERS\n");
+    flag = -1;
+  }
+  if (snapshot.histograms[MetricTickDuration].count != THREADS ||
+      snapshot.histograms[MetricLockWait].count != THREADS * ITERATIONS) {
+    printf("ERROR IN HISTOGRAMS\n");
+    flag = -1;
+  }
+  if (snapshot.gauges[MetricClientsOnline] != 3) {
+    printf("ERROR IN GAUGES\n");
+    flag = -1;
+  }
+  Metrics_writeText(stdout, &snapshot);
+  Metrics_writeJson(stdout, &snapshot);
+  return flag;
+}
@@ -0,0 +1,118 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../game_framework/move_validator.h"
+
+#define SCALE 0.5
+#define ROUNDS 20000
+
+static double elapsed(struct timeval* start) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+static const char* verdict_names[] = {"accepted", "clamped", "rejected"};
+
+static int check(MoveBatch* batch, int i, MoveVerdict expected,
+                 const char* what) {
+  if (batch->verdict[i] == expected) return 0;
+  printf("ERROR: %s was %s\n", what, verdict_names[batch->verdict[i]]);
+  return -1;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  Image* maze = Image_load("./resources/images/maze.pgm");
+  if (maze == NULL) return -1;
+  DistanceField obstacles, open;
+  DistanceField_init(&obstacles, maze, WALL_THRESHOLD, SCALE, SCALE);
+  DistanceField_initEmpty(&open);
+
+  printf("Checking the envelope...");
+  MoveBatch batch;
+  MoveBatch_clear(&batch);
+  float reach = MOVE_MAX_SPEED * 0.1 + MOVE_TOLERANCE;
+  int slow = MoveBatch_add(&batch, 10, 10, 0, 10 + reach / 2, 10, 0.1, 0.1);
+  int fast = MoveBatch_add(&batch, 10, 10, 0, 10 + reach * 2, 10, 0, 0.1);
+  int jump = MoveBatch_add(&batch, 10, 10, 0, 10 + reach * 10, 10, 0, 0.1);
+  int nan = MoveBatch_add(&batch, 10, 10, 0, NAN, 10, 0, 0.1);
+  int spin = MoveBatch_add(&batch, 10, 10, 0, 10, 10, 3, 0.1);
+  // a full turn is the same orientation
+  int wrap = MoveBatch_add(&batch, 10, 10, 3.1, 10, 10, 3.1 - 2 * M_PI, 0.1);
+  int late = MoveBatch_add(&batch, 10, 10, 0, 10 + reach * 2, 10, 0, 60);
+  MoveBatch_validate(&batch, &open);
+  flag |= check(&batch, slow, MoveAccepted, "a slow move");
+  flag |= check(&batch, fast, MoveClamped, "a fast move");
+  flag |= check(&batch, jump, MoveRejected, "a teleport");
+  flag |= check(&batch, nan, MoveRejected, "a NaN");
+  flag |= check(&batch, spin, MoveClamped, "a fast turn");
+  flag |= check(&batch, wrap, MoveAccepted, "a full turn");
+  flag |= check(&batch, late, MoveAccepted, "a move after a silence");
+  if (fabsf(batch.x[fast] - (10 + reach)) > 1e-3 || batch.x[jump] != 10 ||
+      batch.x[nan] != 10) {
+    printf("ERROR: wrong clamped poses\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  printf("Checking the walls...");
+  // a free point of the maze with a wall on its row
+  int wall_r = -1, wall_c = -1;
+  for (int r = 10; r < maze->rows - 10 && wall_r < 0; r++)
+    for (int c = 20; c < maze->cols - 10 && wall_r < 0; c++)
+      if (maze->row_data[r][c] >= 128 && maze->row_data[r][c - 6] < 128 &&
+          obstacles.distances[r * obstacles.cols + c - 6] > 2) {
+        wall_r = r;
+        wall_c = c;
+      }
+  if (wall_r < 0) return -1;
+  MoveBatch_clear(&batch);
+  float x = wall_r * SCALE, y = (wall_c - 6) * SCALE;
+  int through = MoveBatch_add(&batch, x, y, 0, x, y + 5, 0, 0.1);
+  int before = MoveBatch_add(&batch, x, y, 0, x, y + 0.5, 0, 0.1);
+  MoveBatch_validate(&batch, &obstacles);
+  flag |= check(&batch, through, MoveClamped, "a move through a wall");
+  flag |= check(&batch, before, MoveAccepted, "a move in front of a wall");
+  if (batch.y[through] > wall_c * SCALE - MOVE_VEHICLE_RADIUS) {
+    printf("ERROR: the vehicle is in the wall\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  // a full batch of plausible moves all over the maze
+  srand(0);
+  float from[MOVE_BATCH_SIZE][3], to[MOVE_BATCH_SIZE][3];
+  for (int i = 0; i < MOVE_BATCH_SIZE; i++) {
+    from[i][0] = (rand() % 250 + 3) * SCALE;
+    from[i][1] = (rand() % 250 + 3) * SCALE;
+    from[i][2] = (rand() % 628) / 100.;
+    to[i][0] = from[i][0] + (rand() % 100) / 100. - .5;
+    to[i][1] = from[i][1] + (rand() % 100) / 100. - .5;
+    to[i][2] = from[i][2] + (rand() % 100) / 200.;
+  }
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  int clamped = 0;
+  for (int k = 0; k < ROUNDS; k++) {
+    MoveBatch_clear(&batch);
+    for (int i = 0; i < MOVE_BATCH_SIZE; i++)
+      MoveBatch_add(&batch, from[i][0], from[i][1], from[i][2], to[i][0],
+                    to[i][1], to[i][2], 0.07);
+    MoveBatch_validate(&batch, &obstacles);
+    for (int i = 0; i < MOVE_BATCH_SIZE; i++)
+      clamped += batch.verdict[i] != MoveAccepted;
+  }
+  double per_update = elapsed(&start) / ROUNDS / MOVE_BATCH_SIZE * 1e9;
+  printf("%.1fns per update in batches of %d (%d clamped)\n", per_update,
+         MOVE_BATCH_SIZE, clamped / ROUNDS);
+  if (per_update > 1000) {
+    printf("ERROR: validation is slower than a microsecond\n");
+    flag = -1;
+  }
+
+  DistanceField_destroy(&obstacles);
+  Image_free(maze);
+  return flag;
+}
@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include "../game_framework/asset_blob.h"
 #include "../game_framework/protogame_protocol.h"
 #if SERVER_SIDE_POSITION_CHECK == 1
 #define _USE_SERVER_SIDE_FOG_
@@ -60,6 +63,7 @@ int main(int argc, char const* argv[]) {
   printf("loaded\n");
 
   image_packet->header = im_head;
+  image_packet->encoding = EncodingRaw;
   image_packet->image = im;
 
   Image_save(image_packet->image, "in.pgm");
@@ -74,6 +78,38 @@ int main(int argc, char const* argv[]) {
       Packet_serialize(image_packet_buffer, &image_packet->header);
   printf("bytes written in the buffer: %d\n", image_packet_buffer_size);
 
+  printf("send the same image as a cached blob\n");
+  AssetBlob* blob = AssetBlob_create(im, PostTexture, EncodingRaw);
+  int sockets[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+  pid_t sender = fork();
+  if (sender == 0) {
+    close(sockets[0]);
+    int sent = AssetBlob_send(blob, sockets[1], 0);
+    _exit(sent == image_packet_buffer_size ? 0 : 1);
+  }
+  close(sockets[1]);
+  char* blob_buffer = (char*)malloc(image_packet_buffer_size + 1);
+  int blob_read = 0, bytes;
+  while ((bytes = recv(sockets[0], blob_buffer + blob_read,
+                       image_packet_buffer_size + 1 - blob_read, 0)) > 0)
+    blob_read += bytes;
+  int status;
+  waitpid(sender, &status, 0);
+  close(sockets[0]);
+  printf("blob bytes received: %d\n", blob_read);
+  // the image pointer is not part of the payload
+  if (status != 0 || blob_read != image_packet_buffer_size ||
+      ((PacketHeader*)blob_buffer)->size != image_packet_buffer_size ||
+      memcmp(blob_buffer + sizeof(ImagePacket),
+             image_packet_buffer + sizeof(ImagePacket),
+             image_packet_buffer_size - sizeof(ImagePacket))) {
+    printf("Cached blob is different!\n");
+    ret = -1;
+  }
+  free(blob_buffer);
+  AssetBlob_release(blob);
+
   printf("deserialize\n");
   ImagePacket* deserialized_image_packet = (ImagePacket*)Packet_deserialize(
       image_packet_buffer, image_packet_buffer_size);
@@ -107,6 +143,8 @@ int main(int argc, char const* argv[]) {
   w_head.type = WorldUpdate;
   world_packet->header = w_head;
   world_packet->num_update_vehicles = 1;
+  world_packet->fragment = 0;
+  world_packet->num_fragments = 1;
 #ifdef _USE_SERVER_SIDE_FOG_
   world_packet->num_status_vehicles = 1;
   world_packet->status_updates = status_update_block;
@@ -304,14 +342,23 @@ int main(int argc, char const* argv[]) {
   MessageHistoryPacket* history_pckt =
       (MessageHistoryPacket*)malloc(sizeof(MessageHistoryPacket));
   history_pckt->header = history_header;
-  history_pckt->num_messages = 1;
-  MessageBroadcast* messages = (MessageBroadcast*)malloc(
-      sizeof(MessageBroadcast) * history_pckt->num_messages);
+  history_pckt->first = 6;
+  history_pckt->num_messages = 2;
+  MessageBroadcast* messages = (MessageBroadcast*)calloc(
+      history_pckt->num_messages, sizeof(MessageBroadcast));
   strncpy(messages->sender, username, USERNAME_LEN);
   strncpy(messages->text, text, TEXT_LEN);
   messages->id = 10;
   messages->type = Text;
+  messages->sequence = 7;
   time(&messages->time);
+  // a Hello carries no text
+  strncpy(messages[1].sender, username, USERNAME_LEN);
+  strncpy(messages[1].text, text, TEXT_LEN);
+  messages[1].id = 11;
+  messages[1].type = Hello;
+  messages[1].sequence = 9;
+  messages[1].time = messages->time;
   info = localtime(&messages->time);
   history_pckt->messages = messages;
 
@@ -348,6 +395,18 @@ int main(int argc, char const* argv[]) {
     printf("HistoryPacket is differnt!!\n");
     ret = -1;
   }
+  MessageBroadcast* hello = &deserialized_history_packet->messages[1];
+  printf("records of %d bytes in %d\n", history_size,
+         (int)(2 * sizeof(MessageBroadcast)));
+  if (deserialized_history_packet->first != 6 ||
+      deserialized_history_packet->messages->sequence != 7 ||
+      hello->sequence != 9 || hello->id != 11 || hello->type != Hello ||
+      hello->time != messages->time || strcmp(hello->sender, username) ||
+      hello->text[0] != 0 || history_size >= 2 * sizeof(MessageBroadcast) ||
+      Packet_deserialize(message_buffer, history_size - 1) != NULL) {
+    printf("ChatHistory records are different!!\n");
+    ret = -1;
+  }
   Packet_free(&deserialized_history_packet->header);
   Packet_free(&history_pckt->header);
 
@@ -384,5 +443,130 @@ int main(int argc, char const* argv[]) {
   }
   Packet_free(&deserialized_audio_packet->header);
   Packet_free(&audio_packet->header);
+
+  // Inputs
+  printf("\n\nallocate a VehicleForces packet with 2 frames\n");
+  VehicleForces input = {0};
+  input.header.type = VehicleInput;
+  input.id = 7;
+  input.sequence = 41;
+  input.time = 0xfffffff0u;
+  input.link.sequence = 12;
+  input.link.ack = 9;
+  input.num_frames = 2;
+  input.frames[0].translational_force = 1500;
+  input.frames[0].rotational_force = -250;
+  input.frames[1].translational_force = -10000;
+  input.frames[1].rotational_force = 500;
+  char input_buffer[BUFFERSIZE];
+  int input_size = Packet_serialize(input_buffer, &input.header);
+  printf("serialized in %d bytes, a VehicleUpdatePacket takes %d\n",
+         input_size, (int)sizeof(VehicleUpdatePacket));
+  VehicleForces* deserialized_input =
+      (VehicleForces*)Packet_deserialize(input_buffer, input_size);
+  if (deserialized_input == NULL || deserialized_input->id != input.id ||
+      deserialized_input->sequence != input.sequence ||
+      deserialized_input->time != input.time ||
+      memcmp(&deserialized_input->link, &input.link, sizeof(LinkFeedback)) ||
+      deserialized_input->num_frames != input.num_frames ||
+      memcmp(deserialized_input->frames, input.frames,
+             sizeof(InputFrame) * input.num_frames) != 0) {
+    printf("VehicleForces is different!!\n");
+    ret = -1;
+  }
+  if (deserialized_input) Packet_free(&deserialized_input->header);
+  // a truncated packet or a bogus number of frames is refused
+  ((PacketHeader*)input_buffer)->size = input_size - 1;
+  if (Packet_deserialize(input_buffer, input_size - 1) != NULL) {
+    printf("Truncated VehicleForces was accepted!!\n");
+    ret = -1;
+  }
+  input.num_frames = INPUT_REDUNDANCY + 1;
+  memcpy(input_buffer, &input, sizeof(VehicleForces));
+  if (Packet_deserialize(input_buffer, sizeof(VehicleForces)) != NULL) {
+    printf("VehicleForces with too many frames was accepted!!\n");
+    ret = -1;
+  }
+
+  // Snapshots split in datagrams
+  printf("\n\nsplit a WorldUpdatePacket of 60 vehicles\n");
+  WorldUpdatePacket snapshot = {0};
+  snapshot.header.type = WorldUpdate;
+  snapshot.num_update_vehicles = 60;
+  snapshot.updates = (ClientUpdate*)calloc(60, sizeof(ClientUpdate));
+  for (int i = 0; i < 60; i++) snapshot.updates[i].id = i;
+#ifdef _USE_SERVER_SIDE_FOG_
+  snapshot.num_status_vehicles = 60;
+  snapshot.status_updates =
+      (ClientStatusUpdate*)calloc(60, sizeof(ClientStatusUpdate));
+  for (int i = 0; i < 60; i++) snapshot.status_updates[i].id = 100 + i;
+#endif
+  int fragments = WorldUpdate_fragment(&snapshot);
+  char seen[160] = {0};
+  char fragment_buffer[BUFFERSIZE];
+  for (int f = 0; f < fragments; f++) {
+    int size = WorldUpdate_serializeFragment(fragment_buffer, &snapshot, f);
+    printf("fragment %d of %d bytes\n", f, size);
+    WorldUpdatePacket* part =
+        (WorldUpdatePacket*)Packet_deserialize(fragment_buffer, size);
+    if (size > PACKET_MTU || part == NULL || part->fragment != f ||
+        part->num_fragments != fragments) {
+      printf("Fragment %d is wrong!!\n", f);
+      ret = -1;
+      if (part) Packet_free(&part->header);
+      continue;
+    }
+    for (int i = 0; i < part->num_update_vehicles; i++)
+      seen[part->updates[i].id]++;
+#ifdef _USE_SERVER_SIDE_FOG_
+    for (int i = 0; i < part->num_status_vehicles; i++)
+      seen[part->status_updates[i].id]++;
+#endif
+    Packet_free(&part->header);
+    // a truncated datagram is refused
+    if (Packet_deserialize(fragment_buffer, size - 4) != NULL) {
+      printf("Truncated fragment was accepted!!\n");
+      ret = -1;
+    }
+    // and so is one of more fragments than the client can track
+    ((WorldUpdatePacket*)fragment_buffer)->num_fragments =
+        SNAPSHOT_MAX_FRAGMENTS + 1;
+    if (Packet_deserialize(fragment_buffer, size) != NULL) {
+      printf("Fragment of too many was accepted!!\n");
+      ret = -1;
+    }
+  }
+  for (int i = 0; i < 60; i++) {
+    if (seen[i] != 1) ret = -1;
+#ifdef _USE_SERVER_SIDE_FOG_
+    if (seen[100 + i] != 1) ret = -1;
+#endif
+  }
+  printf("%d fragments, every vehicle in one of them\n", fragments);
+  if (fragments < 2) ret = -1;
+  free(snapshot.updates);
+#ifdef _USE_SERVER_SIDE_FOG_
+  free(snapshot.status_updates);
+
+  // a crowd in range and a full log of presence events: the vehicles that
+  // fit are sent, the others are left out with a status
+  int candidates = 150;
+  int room = WorldUpdate_room(ROSTER_LOG, candidates);
+  printf("\n\nbuild a snapshot of %d vehicles in range, %d sent\n",
+         candidates, room);
+  WorldUpdatePacket crowded = {0};
+  crowded.header.type = WorldUpdate;
+  crowded.num_update_vehicles = room + 1;
+  crowded.updates = (ClientUpdate*)calloc(room + 1, sizeof(ClientUpdate));
+  crowded.num_status_vehicles = ROSTER_LOG + candidates - room;
+  crowded.status_updates = (ClientStatusUpdate*)calloc(
+      crowded.num_status_vehicles, sizeof(ClientStatusUpdate));
+  int crowded_size = Packet_serialize(fragment_buffer, &crowded.header);
+  printf("snapshot of %d bytes, budget of %d\n", crowded_size,
+         SNAPSHOT_BUDGET);
+  if (room < 1 || crowded_size > SNAPSHOT_BUDGET) ret = -1;
+  free(crowded.updates);
+  free(crowded.status_updates);
+#endif
   return ret;
 }
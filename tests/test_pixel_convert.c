@@ -0,0 +1,130 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../av_framework/image.h"
+#include "../av_framework/pixel_convert.h"
+
+#define IMAGE_SIZE 2048
+#define ROUNDS 10
+
+static const PixelType types[] = {MONO8, MONO16, RGB8, RGB16};
+static const PixelType float_types[] = {FLOATMONO, FLOATMONO, FLOATRGB,
+                                        FLOATRGB};
+static const char* type_names[] = {"MONO8", "MONO16", "RGB8", "RGB16"};
+
+static double elapsed(struct timeval* start) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+static int equals(const Image* a, const Image* b) {
+  return a != NULL && b != NULL && a->rows == b->rows && a->cols == b->cols &&
+         a->type == b->type && !memcmp(a->data, b->data, Image_dataSize(a));
+}
+
+// samples per second of a kernel pair, to float and back
+static void benchmark(const PixelConverter* converter, int t, Image* src,
+                      Image* floats, Image* back, float scale) {
+  int n = src->rows * src->cols * src->channels;
+  int wide = src->type == MONO16 || src->type == RGB16;
+  float inverse = 1. / scale;
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  for (int k = 0; k < ROUNDS; k++) {
+    if (wide)
+      converter->u16ToFloat(src->data, (float*)floats->data, n, inverse);
+    else
+      converter->u8ToFloat(src->data, (float*)floats->data, n, inverse);
+  }
+  double to_float = elapsed(&start);
+  gettimeofday(&start, NULL);
+  for (int k = 0; k < ROUNDS; k++) {
+    if (wide)
+      converter->floatToU16((float*)floats->data, back->data, n, scale);
+    else
+      converter->floatToU8((float*)floats->data, back->data, n, scale);
+  }
+  double from_float = elapsed(&start);
+  printf("%-7s %-7s %8.0f %8.0f Msamples/s\n", type_names[t], converter->name,
+         n * (double)ROUNDS / to_float / 1e6,
+         n * (double)ROUNDS / from_float / 1e6);
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  const PixelConverter* avx2 = PixelConvert_avx2();
+  printf("Using the %s kernels\n", PixelConvert_best()->name);
+  printf("%-7s %-7s %8s %8s\n", "type", "kernels", "to float", "back");
+  for (int t = 0; t < 4; t++) {
+    // odd width, to exercise the scalar tails of the vector kernels
+    Image* src = Image_alloc(IMAGE_SIZE, IMAGE_SIZE + 3, types[t]);
+    int size = Image_dataSize(src);
+    srand(t);
+    for (int k = 0; k < size; k++) src->data[k] = rand();
+    float scale = types[t] == MONO16 ? 6000 : types[t] == RGB16 ? 65535 : 255;
+    if (types[t] == MONO16) {
+      // elevations don't exceed the full scale, or they'd be clamped back
+      for (int k = 0; k < size; k += 2) src->data[k] %= 6000 >> 8;
+    }
+
+    Image* floats = Image_convert(src, float_types[t]);
+    Image* back = Image_convert(floats, types[t]);
+    if (!equals(src, back)) {
+      printf("ERROR: %s isn't the same after a round trip\n", type_names[t]);
+      flag = -1;
+    }
+    // the kernels must agree with the original per-sample formula
+    float* f = (float*)floats->data;
+    int wide = types[t] == MONO16 || types[t] == RGB16;
+    int n = size >> wide;
+    for (int k = 0; k < n; k++) {
+      int v = wide ? src->data[2 * k] << 8 | src->data[2 * k + 1]
+                   : src->data[k];
+      if (f[k] != (float)(1. / scale) * v) {
+        printf("ERROR: %s sample %d is %f\n", type_names[t], k, f[k]);
+        flag = -1;
+        break;
+      }
+    }
+
+    benchmark(&PixelConvert_scalar, t, src, floats, back, scale);
+    if (avx2) {
+      Image* vector_floats = Image_alloc(src->rows, src->cols, float_types[t]);
+      Image* vector_back = Image_alloc(src->rows, src->cols, types[t]);
+      benchmark(avx2, t, src, vector_floats, vector_back, scale);
+      if (!equals(floats, vector_floats) || !equals(back, vector_back)) {
+        printf("ERROR: the %s kernels differ from the scalar ones\n",
+               avx2->name);
+        flag = -1;
+      }
+      Image_free(vector_floats);
+      Image_free(vector_back);
+    }
+    Image_free(src);
+    Image_free(floats);
+    Image_free(back);
+  }
+
+  printf("Clamping out of range samples...");
+  float samples[16] = {-1, 2, 0.5, NAN, 1e10, -1e10, 0, 1,
+                       0.25, 0.75, 1.5, -0.5, 0.1, 0.9, 0.01, 0.99};
+  unsigned char scalar_out[32], vector_out[32];
+  PixelConvert_scalar.floatToU16(samples, scalar_out, 16, 65535);
+  if (scalar_out[0] || scalar_out[1] || scalar_out[2] != 0xff ||
+      scalar_out[3] != 0xff || scalar_out[6] || scalar_out[7]) {
+    printf("ERROR: wrong clamping\n");
+    flag = -1;
+  }
+  if (avx2) {
+    avx2->floatToU16(samples, vector_out, 16, 65535);
+    if (memcmp(scalar_out, vector_out, 32)) flag = -1;
+    PixelConvert_scalar.floatToU8(samples, scalar_out, 16, 255);
+    avx2->floatToU8(samples, vector_out, 16, 255);
+    if (memcmp(scalar_out, vector_out, 16)) flag = -1;
+  }
+  printf("Done.\n");
+  return flag;
+}
@@ -0,0 +1,125 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../game_framework/prediction.h"
+#include "../game_framework/world.h"
+
+#define FRAMES 30
+#define ROUNDS 1000
+
+static double elapsed(struct timeval* start) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+static InputFrame inputs[FRAMES + 8];
+
+static void step(Vehicle* v, InputFrame input) {
+  World_applyInput(v->world, v,
+                   (float)input.translational_force / INPUT_FORCE_SCALE,
+                   (float)input.rotational_force / INPUT_FORCE_SCALE);
+}
+
+// what the server sends after simulating the frames up to sequence
+static void snapshot(Vehicle* v, unsigned int sequence, ClientUpdate* state) {
+  Vehicle_getXYTheta(v, &state->x, &state->y, &state->theta);
+  Vehicle_getVelocities(v, &state->translational_velocity,
+                        &state->rotational_velocity);
+  state->input_sequence = sequence;
+}
+
+static int samePose(Vehicle* a, Vehicle* b) {
+  return fabsf(a->x - b->x) < 1e-4 && fabsf(a->y - b->y) < 1e-4 &&
+         fabsf(a->theta - b->theta) < 1e-4;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  Image* elevation = Image_load("./resources/images/maze.pgm");
+  Image* texture = Image_load("./resources/images/maze.ppm");
+  if (elevation == NULL || texture == NULL) return -1;
+  World client_world, server_world;
+  World_init(&client_world, elevation, texture, 0.5, 0.5, 0.5);
+  World_init(&server_world, elevation, texture, 0.5, 0.5, 0.5);
+  Vehicle client, server;
+  Vehicle_init(&client, &client_world, 1, NULL);
+  Vehicle_init(&server, &server_world, 1, NULL);
+  for (int i = 0; i < FRAMES + 8; i++) {
+    inputs[i].translational_force = i < 12 ? 3000 : -1000;
+    inputs[i].rotational_force = i % 10 < 5 ? 200 : -300;
+  }
+
+  printf("Predicting %d frames...", FRAMES);
+  Prediction prediction;
+  Prediction_init(&prediction);
+  for (int i = 0; i < FRAMES; i++) {
+    if (Prediction_apply(&prediction, &client, inputs[i]) != i + 1) {
+      printf("ERROR: wrong sequence number\n");
+      flag = -1;
+    }
+  }
+  printf("Done.\n");
+
+  printf("Server missed frame 8, acking 20...");
+  // the server simulated the first 20 frames, one of them went lost
+  InputFrame lost = {0, 0};
+  for (int i = 0; i < 20; i++) step(&server, i == 7 ? lost : inputs[i]);
+  ClientUpdate state;
+  snapshot(&server, 20, &state);
+  if (Prediction_reconcile(&prediction, &client, &state) != 1) {
+    printf("ERROR: the misprediction wasn't corrected\n");
+    flag = -1;
+  }
+  // the replay brings the client where the server will be after frame 30
+  for (int i = 20; i < FRAMES; i++) step(&server, inputs[i]);
+  if (!samePose(&client, &server)) {
+    printf("ERROR: replayed to %f %f %f, the server is at %f %f %f\n",
+           client.x, client.y, client.theta, server.x, server.y,
+           server.theta);
+    flag = -1;
+  }
+  printf("Done, at %f %f.\n", client.x, client.y);
+
+  printf("Matching and stale acks...");
+  for (int i = FRAMES; i < FRAMES + 5; i++)
+    Prediction_apply(&prediction, &client, inputs[i]);
+  for (int i = FRAMES; i < FRAMES + 3; i++) step(&server, inputs[i]);
+  snapshot(&server, FRAMES + 3, &state);
+  float x = client.x, y = client.y;
+  if (Prediction_reconcile(&prediction, &client, &state) != 0 ||
+      client.x != x || client.y != y) {
+    printf("ERROR: a correct prediction was corrected\n");
+    flag = -1;
+  }
+  state.input_sequence = 20;
+  state.x += 10;
+  if (Prediction_reconcile(&prediction, &client, &state) != 0) {
+    printf("ERROR: an old snapshot was applied\n");
+    flag = -1;
+  }
+  if (prediction.corrections != 1) flag = -1;
+  printf("Done.\n");
+
+  printf("Replaying %d frames...", PREDICTION_FRAMES - 1);
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < PREDICTION_FRAMES - 1; i++)
+      Prediction_apply(&prediction, &client, inputs[i % FRAMES]);
+    // always off, so the whole buffer is replayed
+    snapshot(&server, prediction.sequence - (PREDICTION_FRAMES - 1), &state);
+    state.x += 1;
+    Prediction_reconcile(&prediction, &client, &state);
+  }
+  printf("Done, %.1fus per reconciliation.\n", elapsed(&start) / ROUNDS * 1e6);
+
+  Vehicle_destroy(&client);
+  Vehicle_destroy(&server);
+  World_destroy(&client_world);
+  World_destroy(&server_world);
+  Image_free(elevation);
+  Image_free(texture);
+  return flag;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../game_framework/priority_accumulator.h"
+
+#define VEHICLES 12
+#define ROOM 3
+#define TICKS 400
+#define TICK 100  // ms
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+
+  printf("Ranking the vehicles...");
+  float near = PriorityAccumulator_rate(0.5, 0);
+  float far = PriorityAccumulator_rate(2.5, 0);
+  float far_fast = PriorityAccumulator_rate(2.5, 2 * PRIORITY_SPEED);
+  printf("Done, %.2f %.2f %.2f.\n", near, far, far_fast);
+  if (!(near > far && far_fast > far)) flag = -1;
+
+  printf("Sharing the room of the snapshots...");
+  PriorityAccumulator acc;
+  PriorityAccumulator_init(&acc);
+  int ids[VEHICLES];
+  float rates[VEHICLES];
+  int selected[VEHICLES];
+  int sent[VEHICLES] = {0}, last_sent[VEHICLES] = {0}, max_wait[VEHICLES] = {0};
+  for (int i = 0; i < VEHICLES; i++) {
+    // the ids don't come sorted
+    ids[i] = (i * 7) % VEHICLES + 4;
+    rates[i] = PriorityAccumulator_rate(i * 0.25, 0);
+  }
+  // the clock wraps during the test
+  unsigned int now = 0xffffff00u;
+  for (int t = 1; t <= TICKS; t++) {
+    now += TICK;
+    int n = PriorityAccumulator_select(&acc, ids, rates, VEHICLES, ROOM,
+                                       selected, now);
+    if (n != ROOM) flag = -1;
+    for (int i = 0; i < n; i++) {
+      int v = selected[i];
+      if (t - last_sent[v] > max_wait[v]) max_wait[v] = t - last_sent[v];
+      last_sent[v] = t;
+      sent[v]++;
+    }
+  }
+  printf("Done, sent %d times the nearest and %d the farthest.\n", sent[0],
+         sent[VEHICLES - 1]);
+  for (int i = 0; i < VEHICLES; i++) {
+    // everyone gets a turn, the nearer more often
+    if (sent[i] == 0 || max_wait[i] > TICKS / 10) flag = -1;
+    if (i > 0 && sent[i] > sent[i - 1] + 1) flag = -1;
+  }
+
+  printf("Sending the new vehicles first...");
+  ids[VEHICLES - 1] = 1000;
+  now += TICK;
+  int n = PriorityAccumulator_select(&acc, ids, rates, VEHICLES, 1, selected,
+                                     now);
+  printf("Done.\n");
+  if (n != 1 || selected[0] != VEHICLES - 1) flag = -1;
+
+  printf("Forgetting the vehicles out of range...");
+  now += TICK;
+  PriorityAccumulator_select(&acc, ids, rates, VEHICLES / 2, 0, selected,
+                             now);
+  if (acc.count != VEHICLES / 2) flag = -1;
+  // back in range, they are new again
+  now += TICK;
+  n = PriorityAccumulator_select(&acc, ids, rates, VEHICLES, VEHICLES / 2,
+                                 selected, now);
+  for (int i = 0; i < n; i++)
+    if (selected[i] < VEHICLES / 2) flag = -1;
+  printf("Done.\n");
+
+  printf("Fitting everyone when there's room...");
+  now += TICK;
+  n = PriorityAccumulator_select(&acc, ids, rates, VEHICLES, 2 * VEHICLES,
+                                 selected, now);
+  char seen[VEHICLES] = {0};
+  for (int i = 0; i < n; i++) seen[selected[i]] = 1;
+  for (int i = 0; i < VEHICLES; i++)
+    if (!seen[i]) flag = -1;
+  printf("Done.\n");
+  if (n != VEHICLES) flag = -1;
+  return flag;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/roster.h"
+
+#define POPULATION 200
+#define TICKS 2000
+#define LOSS 20  // percent of the snapshots lost
+
+#ifdef _USE_SERVER_SIDE_FOG_
+static int sameRoster(const Roster* a, const Roster* b) {
+  return a->size == b->size && a->hash == b->hash &&
+         !memcmp(a->members, b->members, a->size * sizeof(ClientStatusUpdate));
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  srand(3);
+  Roster server, client;
+  Roster_init(&server);
+  Roster_init(&client);
+  ClientStatusUpdate current[WORLDSIZE], events[WORLDSIZE];
+
+  printf("Numbering the changes...");
+  for (int i = 0; i < 3; i++) {
+    current[i].id = 10 - i;
+    current[i].status = Connecting;
+  }
+  int joined = Roster_update(&server, current, 3);
+  int none = Roster_update(&server, current, 3);
+  current[1].status = Online;
+  int changed = Roster_update(&server, current, 3);
+  int left = Roster_update(&server, current, 2);
+  printf("Done, %d %d %d %d.\n", joined, none, changed, left);
+  if (joined != 3 || none != 0 || changed != 1 || left != 1 ||
+      server.sequence != 5 || server.size != 2 ||
+      Roster_status(&server, 9) != Online || Roster_status(&server, 8) != 0)
+    flag = -1;
+
+  printf("Applying the events in order...");
+  int n = Roster_eventsSince(&server, 0, events);
+  if (n != 5 || Roster_apply(&client, &events[1]) != -1) flag = -1;
+  for (int i = 0; i < n; i++) Roster_apply(&client, &events[i]);
+  if (Roster_apply(&client, &events[2]) != 0) flag = -1;
+  printf("Done.\n");
+  if (!sameRoster(&client, &server) || client.sequence != server.sequence)
+    flag = -1;
+
+  printf("Replicating the churn on a lossy link...");
+  // the members of the server, in the order of the users list
+  int population = 0;
+  unsigned int ack = 0;
+  long sent = 0, syncs = 0, roster_sizes = 0;
+  Roster_init(&server);
+  Roster_init(&client);
+  for (int t = 0; t < TICKS; t++) {
+    // a few joins, leaves and state changes
+    if (population < POPULATION && rand() % 2 == 0) {
+      current[population].id = 1000 + t;
+      current[population].status = Connecting;
+      population++;
+    }
+    if (population > 0 && rand() % 4 == 0) {
+      int i = rand() % population;
+      current[i].status = Online;
+    }
+    if (population > POPULATION / 2 && rand() % 3 == 0) {
+      population--;
+      current[rand() % (population + 1)] = current[population];
+    }
+    Roster_update(&server, current, population);
+    roster_sizes += server.size;
+    int n = Roster_eventsSince(&server, ack, events);
+    char full = n == -1;
+    if (full) {
+      n = Roster_members(&server, events);
+      syncs++;
+    }
+    sent += n;
+    // with an outage longer than the log
+    if (rand() % 100 < LOSS || (t > TICKS / 2 && t < TICKS / 2 + 200))
+      continue;
+    if (full) {
+      Roster_reset(&client, events, n, server.sequence);
+    } else {
+      for (int i = 0; i < n; i++) Roster_apply(&client, &events[i]);
+    }
+    if (client.sequence == server.sequence && client.hash != server.hash)
+      Roster_init(&client);
+    // the ack is lost as well
+    if (rand() % 100 >= LOSS) ack = client.sequence;
+  }
+  printf("Done, %ld entries sent in %d ticks (%ld for the whole rosters, "
+         "%ld syncs).\n",
+         sent, TICKS, roster_sizes, syncs);
+  if (!sameRoster(&client, &server) || syncs == 0 ||
+      sent * 4 > roster_sizes)
+    flag = -1;
+
+  printf("Recovering with the hash...");
+  client.members[0].status =
+      client.members[0].status == Online ? Connecting : Online;
+  client.hash = Roster_hash(&client);
+  int noticed = client.hash != server.hash;
+  Roster_init(&client);
+  n = Roster_eventsSince(&server, client.sequence, events);
+  if (n == -1) n = Roster_members(&server, events);
+  Roster_reset(&client, events, n, server.sequence);
+  printf("Done.\n");
+  if (!noticed || !sameRoster(&client, &server)) flag = -1;
+  return flag;
+}
+#else
+int main(int argc, char const* argv[]) {
+  printf("The roster is replicated only with SERVER_SIDE_POSITION_CHECK\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,75 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../game_framework/snapshot_buffer.h"
+
+#define INTERVAL 300  // ms between two snapshots of the server
+#define SPEED 2.0     // of the vehicle along x, units per second
+// the timeline wraps during the test
+#define START 0xfffff000u
+
+static ClientUpdate poseAt(int ms) {
+  ClientUpdate update = {0};
+  update.x = 10 + SPEED * ms / 1000;
+  update.y = 20;
+  update.theta = 0.1;
+  return update;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  SnapshotBuffer buffer;
+  SnapshotBuffer_init(&buffer);
+  float x, y, theta;
+  if (SnapshotBuffer_sample(&buffer, START, &x, &y, &theta)) flag = -1;
+
+  printf("Interpolating between snapshots...");
+  int delay = INTERPOLATION_DELAY * 1000;
+  double worst = 0;
+  int samples = 0;
+  for (int k = 1; k <= 40; k++) {
+    int sent = k * INTERVAL;
+    ClientUpdate update = poseAt(sent);
+    SnapshotBuffer_push(&buffer, &update, START + sent);
+    if (sent < delay + INTERVAL) continue;
+    // draws until the next snapshot is due, every 10ms
+    for (int now = sent; now < sent + INTERVAL; now += 10) {
+      SnapshotBuffer_sample(&buffer, START + now, &x, &y, &theta);
+      double error = fabs(x - poseAt(now - delay).x);
+      if (error > worst) worst = error;
+      samples++;
+    }
+  }
+  printf("Done, worst error %.5f in %d samples.\n", worst, samples);
+  if (worst > 1e-3 || y != 20 || fabsf(theta - 0.1) > 1e-6) flag = -1;
+
+  printf("Out of order snapshots...");
+  ClientUpdate old = poseAt(0);
+  if (SnapshotBuffer_push(&buffer, &old, START + INTERVAL)) flag = -1;
+  printf("Done.\n");
+
+  printf("Extrapolating after a loss...");
+  int last = 40 * INTERVAL;
+  SnapshotBuffer_sample(&buffer, START + last + 10000, &x, &y, &theta);
+  float bound = poseAt(last).x + SPEED * MAX_EXTRAPOLATION;
+  if (fabsf(x - bound) > 1e-3) {
+    printf("ERROR: at %f, expected to stop at %f\n", x, bound);
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  printf("Turning across -pi...");
+  SnapshotBuffer_init(&buffer);
+  ClientUpdate turn = poseAt(0);
+  turn.theta = M_PI - 0.1;
+  SnapshotBuffer_push(&buffer, &turn, 1000);
+  turn.theta = -M_PI + 0.1;
+  SnapshotBuffer_push(&buffer, &turn, 2000);
+  SnapshotBuffer_sample(&buffer, 1500 + delay, &x, &y, &theta);
+  if (fabsf(fabsf(theta) - M_PI) > 1e-3) {
+    printf("ERROR: turned the long way, at %f\n", theta);
+    flag = -1;
+  }
+  printf("Done.\n");
+  return flag;
+}
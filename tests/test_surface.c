@@ -0,0 +1,139 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "../av_framework/surface.h"
+#include "../game_framework/world.h"
+
+#define MAP_SIZE 2048
+
+static double elapsed(struct timeval* start) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) * 1e3 +
+         (end.tv_usec - start->tv_usec) / 1e3;
+}
+
+static int sameSurface(const Surface* a, const Surface* b) {
+  return a->rows == b->rows && a->cols == b->cols &&
+         a->row_scale == b->row_scale && a->col_scale == b->col_scale &&
+         !memcmp(a->points, b->points, sizeof(Vec3) * a->n_points) &&
+         !memcmp(a->normals, b->normals, sizeof(Vec3) * a->n_points);
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  char dir[] = "/tmp/test_surface.XXXXXX";
+  if (mkdtemp(dir) == NULL) return -1;
+  char filename[64];
+  snprintf(filename, sizeof(filename), "%s/ground.surface", dir);
+
+  // rolling hills
+  Image* elevation = Image_alloc(MAP_SIZE, MAP_SIZE, MONO16);
+  for (int r = 0; r < MAP_SIZE; r++) {
+    for (int c = 0; c < MAP_SIZE; c++) {
+      int v = 3000 + 2000 * sin(r * 0.01) * cos(c * 0.013);
+      elevation->row_data[r][2 * c] = v >> 8;
+      elevation->row_data[r][2 * c + 1] = v & 0xff;
+    }
+  }
+  Image* float_image = Image_convert(elevation, FLOATMONO);
+  float** m = (float**)float_image->row_data;
+
+  printf("Building a %dx%d surface...", MAP_SIZE, MAP_SIZE);
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  Surface built;
+  Surface_fromMatrix(&built, m, MAP_SIZE, MAP_SIZE, .5, .5, 5);
+  printf("Done in %.2fms.\n", elapsed(&start));
+
+  printf("Comparing with the serial construction...");
+  Surface reference;
+  Surface_init(&reference, MAP_SIZE, MAP_SIZE, .5, .5);
+  for (int r = 0; r < MAP_SIZE; r++) {
+    for (int c = 0; c < MAP_SIZE; c++) {
+      Vec3* p = &reference.point_rows[r][c];
+      p->values[0] = .5 * r;
+      p->values[1] = .5 * c;
+      p->values[2] = 5 * m[r][c];
+    }
+  }
+  for (int r = 1; r < MAP_SIZE - 1; r++) {
+    for (int c = 1; c < MAP_SIZE - 1; c++) {
+      Vec3 delta_px, delta_py;
+      Vec3** p = reference.point_rows;
+      v3compose(&delta_px, &p[r + 1][c], &p[r - 1][c], 1, -1);
+      v3compose(&delta_py, &p[r][c + 1], &p[r][c - 1], 1, -1);
+      v3cross(&reference.normal_rows[r][c], &delta_px, &delta_py);
+      v3normalize(&reference.normal_rows[r][c]);
+    }
+  }
+  if (!sameSurface(&built, &reference)) {
+    printf("ERROR: the surfaces are different\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  unsigned char key[SURFACE_KEY_LEN], other_key[SURFACE_KEY_LEN];
+  memset(key, 1, sizeof(key));
+  memset(other_key, 2, sizeof(other_key));
+  printf("Saving...");
+  gettimeofday(&start, NULL);
+  if (Surface_save(&built, filename, key) == -1) {
+    printf("ERROR: can't save\n");
+    return -1;
+  }
+  printf("Done in %.2fms.\n", elapsed(&start));
+
+  printf("Loading...");
+  Surface loaded;
+  gettimeofday(&start, NULL);
+  if (Surface_load(&loaded, filename, key) == -1) {
+    printf("ERROR: can't load\n");
+    return -1;
+  }
+  printf("Done in %.2fms.\n", elapsed(&start));
+  if (!sameSurface(&built, &loaded)) {
+    printf("ERROR: the loaded surface is different\n");
+    flag = -1;
+  }
+  Surface_destroy(&loaded);
+
+  printf("Rejecting stale and broken files...");
+  Surface rejected;
+  if (Surface_load(&rejected, filename, other_key) != -1) flag = -1;
+  if (truncate(filename, 1000) == -1 ||
+      Surface_load(&rejected, filename, key) != -1)
+    flag = -1;
+  printf(flag ? "ERROR\n" : "Done.\n");
+  unlink(filename);
+
+  printf("Starting worlds on the cache...");
+  World first, second;
+  TextureHash elevation_hash;
+  TextureHash_compute(elevation, &elevation_hash);
+  World_initCached(&first, elevation, NULL, .5, .5, .5, dir, NULL);
+  gettimeofday(&start, NULL);
+  World_initCached(&second, elevation, NULL, .5, .5, .5, dir, &elevation_hash);
+  double cached = elapsed(&start);
+  if (second.ground.mapping == NULL ||
+      !sameSurface(&first.ground, &second.ground) ||
+      !sameSurface(&first.ground, &built)) {
+    printf("ERROR: the cached world is different\n");
+    flag = -1;
+  }
+  printf("Done, second start in %.2fms.\n", cached);
+  World_destroy(&first);
+  World_destroy(&second);
+
+  char command[64];
+  snprintf(command, sizeof(command), "rm -rf %s", dir);
+  if (system(command)) return -1;
+  Surface_destroy(&built);
+  Surface_destroy(&reference);
+  Image_free(float_image);
+  Image_free(elevation);
+  return flag;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_framework/texture_store.h"
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  printf("Hashing test vectors...");
+  unsigned char digest[SHA256_DIGEST_LEN];
+  const unsigned char abc[SHA256_DIGEST_LEN] = {
+      0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40,
+      0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17,
+      0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+  Sha256_hash("abc", 3, digest);
+  if (memcmp(digest, abc, SHA256_DIGEST_LEN)) {
+    printf("ERROR IN SHA256(abc)\n");
+    flag = -1;
+  }
+  // two blocks of padding, fed in odd-sized chunks
+  const char* text = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  const unsigned char two_blocks[SHA256_DIGEST_LEN] = {
+      0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26,
+      0x93, 0x0c, 0x3e, 0x60, 0x39, 0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff,
+      0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1};
+  Sha256Context ctx;
+  Sha256_init(&ctx);
+  for (int i = 0; i < strlen(text); i += 5)
+    Sha256_update(&ctx, text + i, strlen(text) - i < 5 ? strlen(text) - i : 5);
+  Sha256_final(&ctx, digest);
+  if (memcmp(digest, two_blocks, SHA256_DIGEST_LEN)) {
+    printf("ERROR IN SHA256 OF TWO BLOCKS\n");
+    flag = -1;
+  }
+  printf("Done.\n");
+
+  printf("Storing the same texture twice...");
+  TextureStore store;
+  TextureStore_init(&store, 1);
+  Image* first = Image_load("./resources/images/square.ppm");
+  Image* second = Image_load("./resources/images/square.ppm");
+  Image* other = Image_load("./resources/images/circle.ppm");
+  if (first == NULL || second == NULL || other == NULL) {
+    printf("ERROR: can't load the test images\n");
+    return -1;
+  }
+  char duplicate;
+  TextureStoreItem* a = TextureStore_insert(&store, first, &duplicate);
+  if (duplicate) flag = -1;
+  TextureStoreItem* b = TextureStore_insert(&store, second, &duplicate);
+  if (!duplicate || a != b || a->refcount != 2) flag = -1;
+  TextureStoreItem* c = TextureStore_insert(&store, other, &duplicate);
+  if (duplicate || c == a || store.size != 2 || a->blob == NULL) flag = -1;
+  printf("Done.\n");
+  if (flag) printf("ERROR IN DEDUPLICATION\n");
+
+  printf("Looking up by hash...");
+  TextureHash hash = a->hash;
+  TextureStoreItem* found = TextureStore_find(&store, &hash);
+  if (found != a || a->refcount != 3) flag = -1;
+  char hex[SHA256_DIGEST_LEN * 2 + 1];
+  TextureHash_toString(&hash, hex, sizeof(hex));
+  printf("Done (%s).\n", hex);
+
+  printf("Releasing...");
+  TextureStore_release(&store, found);
+  TextureStore_release(&store, b);
+  TextureStore_release(&store, a);
+  if (TextureStore_find(&store, &hash) != NULL || store.size != 1) {
+    printf("ERROR IN RELEASE\n");
+    flag = -1;
+  }
+  TextureStore_release(&store, c);
+  if (store.size != 0) flag = -1;
+  TextureStore_destroy(&store);
+  printf("Done.\n");
+  return flag;
+}
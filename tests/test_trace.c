@@ -0,0 +1,113 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../game_framework/trace.h"
+
+#define DUMPS 20
+
+typedef struct {
+  int events;  // spans of the test in the dump
+  int torn;    // whose fields come from different spans
+} DumpCount;
+
+static char filename[] = "/tmp/test_trace.XXXXXX";
+static int writing = 1;
+
+// counts the spans of the test in a dump: span i is named and categorized
+// "even" or "odd" after i, starts at i and lasts 2 * i + i % 2
+static int countDump(DumpCount* count) {
+  memset(count, 0, sizeof(DumpCount));
+  if (Trace_dump(filename) == -1) return -1;
+  FILE* in = fopen(filename, "r");
+  if (in == NULL) return -1;
+  char line[512], event_name[64], category[64];
+  long ts, dur;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (sscanf(line,
+               "{\"name\":\"%63[^\"]\",\"cat\":\"%63[^\"]\",\"ph\":\"X\","
+               "\"ts\":%ld,\"dur\":%ld",
+               event_name, category, &ts, &dur) != 4)
+      continue;
+    int odd = !strcmp(event_name, "odd");
+    if (!odd && strcmp(event_name, "even")) continue;
+    count->events++;
+    if (strcmp(category, odd ? "odd" : "even") || dur != 2 * ts + odd ||
+        (ts & 1) != odd)
+      count->torn++;
+  }
+  fclose(in);
+  return 0;
+}
+
+static void* writeSpans(void* arg) {
+  int spans = *(int*)arg;
+  for (long i = 0; i < spans; i++) {
+    const char* name = i & 1 ? "odd" : "even";
+    Trace_span(name, name, i, 2 * i + (i & 1));
+  }
+  return NULL;
+}
+
+// keeps overwriting the ring, the dumps read it meanwhile
+static void* writeUntilStopped(void* arg) {
+  Trace_setThreadName("writer");
+  for (long i = 0; __atomic_load_n(&writing, __ATOMIC_ACQUIRE); i++) {
+    const char* name = i & 1 ? "odd" : "even";
+    Trace_span(name, name, i, 2 * i + (i & 1));
+  }
+  return NULL;
+}
+
+int main(int argc, char const* argv[]) {
+  char flag = 0;
+  int fd = mkstemp(filename);
+  if (fd == -1) return -1;
+  close(fd);
+  DumpCount count;
+
+  printf("Dumping the spans of a thread...");
+  pthread_t thread;
+  int spans = 100;
+  pthread_create(&thread, NULL, writeSpans, &spans);
+  pthread_join(thread, NULL);
+  if (countDump(&count) == -1) flag = -1;
+  printf("Done, %d events.\n", count.events);
+  if (count.events != spans || count.torn) flag = -1;
+
+  printf("Reclaiming the ring of a thread that exited...");
+  // the next thread claims the same ring and starts it over
+  spans = TRACE_BUFFER_SIZE / 2;
+  pthread_create(&thread, NULL, writeSpans, &spans);
+  pthread_join(thread, NULL);
+  if (countDump(&count) == -1) flag = -1;
+  printf("Done, %d events.\n", count.events);
+  if (count.events != spans || count.torn) flag = -1;
+
+  printf("Wrapping the ring...");
+  spans = 3 * TRACE_BUFFER_SIZE + 7;
+  pthread_create(&thread, NULL, writeSpans, &spans);
+  pthread_join(thread, NULL);
+  if (countDump(&count) == -1) flag = -1;
+  printf("Done, %d events.\n", count.events);
+  // the oldest slot could be being overwritten, it's left out
+  if (count.events != TRACE_BUFFER_SIZE - 1 || count.torn) flag = -1;
+
+  printf("Dumping while a thread writes...");
+  pthread_create(&thread, NULL, writeUntilStopped, NULL);
+  int events = 0, torn = 0;
+  for (int i = 0; i < DUMPS; i++) {
+    if (countDump(&count) == -1) flag = -1;
+    events += count.events;
+    torn += count.torn;
+    if (count.events >= TRACE_BUFFER_SIZE) flag = -1;
+  }
+  __atomic_store_n(&writing, 0, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+  printf("Done, %d events in %d dumps, %d torn.\n", events, DUMPS, torn);
+  if (events == 0 || torn) flag = -1;
+
+  unlink(filename);
+  return flag;
+}